@@ -180,6 +180,7 @@ static void rb_player_gst_xfade_set_time (RBPlayer *player, gint64 time);
 static gint64 rb_player_gst_xfade_get_time (RBPlayer *player);
 static void rb_player_gst_xfade_set_volume (RBPlayer *player, float volume);
 static float rb_player_gst_xfade_get_volume (RBPlayer *player);
+static void rb_player_gst_xfade_tick_interval_changed (RBPlayer *player);
 static gboolean rb_player_gst_xfade_add_tee (RBPlayerGstTee *player, GstElement *element);
 static gboolean rb_player_gst_xfade_add_filter (RBPlayerGstFilter *player, GstElement *element);
 static gboolean rb_player_gst_xfade_remove_tee (RBPlayerGstTee *player, GstElement *element);
@@ -205,7 +206,6 @@ G_DEFINE_TYPE_WITH_CODE(RBPlayerGstXFade, rb_player_gst_xfade, G_TYPE_OBJECT,
 
 #define GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RB_TYPE_PLAYER_GST_XFADE, RBPlayerGstXFadePrivate))
 
-#define RB_PLAYER_GST_XFADE_TICK_HZ 5
 
 #define EPSILON			(0.001)
 #define STREAM_PLAYING_MESSAGE	"rb-stream-playing"
@@ -220,7 +220,10 @@ G_DEFINE_TYPE_WITH_CODE(RBPlayerGstXFade, rb_player_gst_xfade, G_TYPE_OBJECT,
 enum
 {
 	PROP_0,
-	PROP_BUS
+	PROP_BUS,
+	PROP_PREROLL_LATENCY,
+	PROP_PREROLL_LATENCY_AVERAGE,
+	PROP_PREROLL_LATENCY_MAX
 };
 
 enum
@@ -285,6 +288,13 @@ struct _RBPlayerGstXFadePrivate
 
 	char silence_buffer[1024];
 	guint silence_idle_id;
+
+	/* time taken from opening a stream to having it prerolled (in ns) */
+	GMutex preroll_stats_lock;
+	gint64 preroll_latency;
+	gint64 preroll_latency_max;
+	gint64 preroll_latency_total;
+	guint preroll_count;
 };
 
 
@@ -363,6 +373,7 @@ typedef struct
 	gboolean fading;
 	gboolean starting_eos;
 	gboolean use_buffering;
+	gint64 preroll_start;		/* protected by the player's preroll_stats_lock */
 
 	gulong adjust_probe_id;
 	gulong block_probe_id;
@@ -385,6 +396,7 @@ typedef struct
 
 static void adjust_stream_base_time (RBXFadeStream *stream);
 static gboolean actually_start_stream (RBXFadeStream *stream, GError **error);
+static void record_preroll_latency (RBXFadeStream *stream);
 
 static void rb_xfade_stream_class_init (RBXFadeStreamClass *klass);
 
@@ -643,6 +655,24 @@ rb_player_gst_xfade_get_property (GObject *object,
 			gst_object_unref (bus);
 		}
 		break;
+	case PROP_PREROLL_LATENCY:
+		g_mutex_lock (&player->priv->preroll_stats_lock);
+		g_value_set_int64 (value, player->priv->preroll_latency);
+		g_mutex_unlock (&player->priv->preroll_stats_lock);
+		break;
+	case PROP_PREROLL_LATENCY_AVERAGE:
+		g_mutex_lock (&player->priv->preroll_stats_lock);
+		if (player->priv->preroll_count > 0)
+			g_value_set_int64 (value, player->priv->preroll_latency_total / player->priv->preroll_count);
+		else
+			g_value_set_int64 (value, 0);
+		g_mutex_unlock (&player->priv->preroll_stats_lock);
+		break;
+	case PROP_PREROLL_LATENCY_MAX:
+		g_mutex_lock (&player->priv->preroll_stats_lock);
+		g_value_set_int64 (value, player->priv->preroll_latency_max);
+		g_mutex_unlock (&player->priv->preroll_stats_lock);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -681,6 +711,44 @@ rb_player_gst_xfade_class_init (RBPlayerGstXFadeClass *klass)
 							      "GStreamer message bus",
 							      GST_TYPE_BUS,
 							      G_PARAM_READABLE));
+	/**
+	 * RBPlayerGstXFade:preroll-latency:
+	 *
+	 * Time taken (in nanoseconds) to open and preroll the most recent stream.
+	 * For network streams, this includes the initial buffering.  A notification
+	 * is emitted for this property each time a stream finishes prerolling.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_PREROLL_LATENCY,
+					 g_param_spec_int64 ("preroll-latency",
+							     "preroll latency",
+							     "Time taken to preroll the most recent stream",
+							     0, G_MAXINT64, 0,
+							     G_PARAM_READABLE));
+	/**
+	 * RBPlayerGstXFade:preroll-latency-average:
+	 *
+	 * Average time taken (in nanoseconds) to open and preroll a stream.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_PREROLL_LATENCY_AVERAGE,
+					 g_param_spec_int64 ("preroll-latency-average",
+							     "average preroll latency",
+							     "Average time taken to preroll a stream",
+							     0, G_MAXINT64, 0,
+							     G_PARAM_READABLE));
+	/**
+	 * RBPlayerGstXFade:preroll-latency-max:
+	 *
+	 * Longest time taken (in nanoseconds) to open and preroll a stream.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_PREROLL_LATENCY_MAX,
+					 g_param_spec_int64 ("preroll-latency-max",
+							     "maximum preroll latency",
+							     "Longest time taken to preroll a stream",
+							     0, G_MAXINT64, 0,
+							     G_PARAM_READABLE));
 
 	signals[PREPARE_SOURCE] =
 		g_signal_new ("prepare-source",
@@ -753,6 +821,7 @@ rb_player_init (RBPlayerIface *iface)
 	iface->set_time = rb_player_gst_xfade_set_time;
 	iface->get_time = rb_player_gst_xfade_get_time;
 	iface->multiple_open = (RBPlayerFeatureFunc) rb_true_function;
+	iface->tick_interval_changed = rb_player_gst_xfade_tick_interval_changed;
 }
 
 static void
@@ -777,6 +846,7 @@ rb_player_gst_xfade_init (RBPlayerGstXFade *player)
 
 	g_rec_mutex_init (&player->priv->stream_list_lock);
 	g_rec_mutex_init (&player->priv->sink_lock);
+	g_mutex_init (&player->priv->preroll_stats_lock);
 	player->priv->cur_volume = 1.0f;
 }
 
@@ -1906,6 +1976,7 @@ rb_player_gst_xfade_bus_cb (GstBus *bus, GstMessage *message, RBPlayerGstXFade *
 			switch (stream->state) {
 			case PREROLLING:
 				rb_debug ("stream %s is buffered, now waiting", stream->uri);
+				record_preroll_latency (stream);
 				stream->state = WAITING;
 				break;
 
@@ -1915,6 +1986,7 @@ rb_player_gst_xfade_bus_cb (GstBus *bus, GstMessage *message, RBPlayerGstXFade *
 
 			case PREROLL_PLAY:
 				rb_debug ("stream %s is buffered, now playing", stream->uri);
+				record_preroll_latency (stream);
 				if (actually_start_stream (stream, &error) == FALSE) {
 					emit_stream_error (stream, error);
 				}
@@ -2592,6 +2664,46 @@ actually_start_stream (RBXFadeStream *stream, GError **error)
 	return ret;
 }
 
+static gboolean
+notify_preroll_latency_idle (RBPlayerGstXFade *player)
+{
+	g_object_notify (G_OBJECT (player), "preroll-latency");
+	g_object_unref (player);
+	return FALSE;
+}
+
+/* called when a stream finishes prerolling (or buffering, for network
+ * streams), from any thread.  updates the preroll latency statistics.
+ */
+static void
+record_preroll_latency (RBXFadeStream *stream)
+{
+	RBPlayerGstXFade *player = stream->player;
+	gint64 latency;
+
+	/* the stream can finish prerolling on the streaming thread and the
+	 * bus at once, so only one of them gets to record it.
+	 */
+	g_mutex_lock (&player->priv->preroll_stats_lock);
+	if (stream->preroll_start == 0) {
+		g_mutex_unlock (&player->priv->preroll_stats_lock);
+		return;
+	}
+
+	latency = (g_get_monotonic_time () - stream->preroll_start) * GST_USECOND;
+	stream->preroll_start = 0;
+
+	player->priv->preroll_latency = latency;
+	player->priv->preroll_latency_total += latency;
+	player->priv->preroll_count++;
+	if (latency > player->priv->preroll_latency_max)
+		player->priv->preroll_latency_max = latency;
+	g_mutex_unlock (&player->priv->preroll_stats_lock);
+
+	rb_debug ("stream %s took %" G_GINT64_FORMAT " ms to preroll", stream->uri, latency / GST_MSECOND);
+	g_idle_add ((GSourceFunc) notify_preroll_latency_idle, g_object_ref (player));
+}
+
 /* called on a streaming thread when the stream src pad is blocked
  * (that is, when prerolling is complete).  in some situations we
  * start playback immediately, otherwise we wait for something else
@@ -2651,10 +2763,12 @@ stream_src_blocked_cb (GstPad *pad, GstPadProbeInfo *info, RBXFadeStream *stream
 	switch (stream->state) {
 	case PREROLLING:
 		rb_debug ("stream %s is prerolled, not starting yet -> WAITING", stream->uri);
+		record_preroll_latency (stream);
 		stream->state = WAITING;
 		break;
 	case PREROLL_PLAY:
 		rb_debug ("stream %s is prerolled, need to start it", stream->uri);
+		record_preroll_latency (stream);
 		start_stream = TRUE;
 		break;
 	default:
@@ -2833,6 +2947,33 @@ tick_timeout (RBPlayerGstXFade *player)
 	return TRUE;
 }
 
+static void
+start_tick_timeout_locked (RBPlayerGstXFade *player)
+{
+	if (player->priv->tick_timeout_id == 0) {
+		player->priv->tick_timeout_id =
+			_rb_player_add_tick_timeout (RB_PLAYER (player),
+						     (GSourceFunc) tick_timeout,
+						     player);
+	}
+}
+
+static void
+rb_player_gst_xfade_tick_interval_changed (RBPlayer *iplayer)
+{
+	RBPlayerGstXFade *player = RB_PLAYER_GST_XFADE (iplayer);
+
+	g_rec_mutex_lock (&player->priv->sink_lock);
+	if (player->priv->tick_timeout_id != 0) {
+		g_source_remove (player->priv->tick_timeout_id);
+		player->priv->tick_timeout_id = 0;
+	}
+
+	if (player->priv->sink_state == SINK_PLAYING)
+		start_tick_timeout_locked (player);
+	g_rec_mutex_unlock (&player->priv->sink_lock);
+}
+
 static gboolean
 emit_volume_changed_idle (RBPlayerGstXFade *player)
 {
@@ -3080,19 +3221,12 @@ start_sink_locked (RBPlayerGstXFade *player, GList **messages, GError **error)
 	/* set the pipeline to PLAYING so it selects a clock */
 	gst_element_set_state (player->priv->pipeline, GST_STATE_PLAYING);
 
-	/* now that the sink is running, start polling for playing position.
-	 * might want to replace this with a complicated set of pad probes
-	 * to avoid polling, but duration queries on the sink are better
-	 * as they account for internal buffering etc.  maybe there's a way
-	 * to account for that in a pad probe callback on the sink's sink pad?
+	/* now that the sink is running, start reporting the playing position
+	 * as often as our tick subscribers want it.  position queries on the
+	 * sink are better than pad probes as they account for internal
+	 * buffering etc.
 	 */
-	if (player->priv->tick_timeout_id == 0) {
-		gint ms_period = 1000 / RB_PLAYER_GST_XFADE_TICK_HZ;
-		player->priv->tick_timeout_id =
-			g_timeout_add (ms_period,
-				      (GSourceFunc) tick_timeout,
-				      player);
-	}
+	start_tick_timeout_locked (player);
 	return TRUE;
 }
 
@@ -3471,6 +3605,7 @@ rb_player_gst_xfade_open (RBPlayer *iplayer,
 	RBXFadeStream *stream;
 	RBPlayerGstXFade *player = RB_PLAYER_GST_XFADE (iplayer);
 	gboolean reused = FALSE;
+	gint64 open_time;
 	GList *t;
 
 	/* create sink if we don't already have one */
@@ -3527,6 +3662,7 @@ rb_player_gst_xfade_open (RBPlayer *iplayer,
 	}
 
 	/* construct new stream */
+	open_time = g_get_monotonic_time ();
 	stream = create_stream (player, uri, stream_data, stream_data_destroy);
 	if (stream == NULL) {
 		rb_debug ("unable to create pipeline to play %s", uri);
@@ -3538,6 +3674,10 @@ rb_player_gst_xfade_open (RBPlayer *iplayer,
 		return FALSE;
 	}
 
+	g_mutex_lock (&player->priv->preroll_stats_lock);
+	stream->preroll_start = open_time;
+	g_mutex_unlock (&player->priv->preroll_stats_lock);
+
 	g_rec_mutex_lock (&player->priv->stream_list_lock);
 	player->priv->streams = g_list_prepend (player->priv->streams, stream);
 	dump_stream_list (player);
@@ -61,7 +61,6 @@ G_DEFINE_TYPE_WITH_CODE(RBPlayerGst, rb_player_gst, G_TYPE_OBJECT,
 			G_IMPLEMENT_INTERFACE(RB_TYPE_PLAYER_GST_TEE, rb_player_gst_tee_init)
 			)
 
-#define RB_PLAYER_GST_TICK_HZ 5
 #define STATE_CHANGE_MESSAGE_TIMEOUT 5
 
 enum
@@ -333,6 +332,17 @@ tick_timeout (RBPlayerGst *mp)
 	return TRUE;
 }
 
+static void
+start_tick_timeout (RBPlayerGst *mp)
+{
+	if (mp->priv->tick_timeout_id == 0) {
+		mp->priv->tick_timeout_id =
+			_rb_player_add_tick_timeout (RB_PLAYER (mp),
+						     (GSourceFunc) tick_timeout,
+						     mp);
+	}
+}
+
 static void
 set_playbin_volume (RBPlayerGst *player, float volume)
 {
@@ -369,12 +379,7 @@ track_change_done (RBPlayerGst *mp, GError *error)
 		emit_playing_stream_and_tags (mp, mp->priv->track_change);
 	}
 
-	if (mp->priv->tick_timeout_id == 0) {
-		mp->priv->tick_timeout_id =
-			g_timeout_add (1000 / RB_PLAYER_GST_TICK_HZ,
-				       (GSourceFunc) tick_timeout,
-				       mp);
-	}
+	start_tick_timeout (mp);
 
 	if (mp->priv->volume_applied == 0) {
 		GstElement *e;
@@ -1192,6 +1197,20 @@ impl_dispose (GObject *object)
 	G_OBJECT_CLASS (rb_player_gst_parent_class)->dispose (object);
 }
 
+static void
+impl_tick_interval_changed (RBPlayer *player)
+{
+	RBPlayerGst *mp = RB_PLAYER_GST (player);
+
+	if (mp->priv->tick_timeout_id != 0) {
+		g_source_remove (mp->priv->tick_timeout_id);
+		mp->priv->tick_timeout_id = 0;
+	}
+
+	if (mp->priv->playing)
+		start_tick_timeout (mp);
+}
+
 static void
 rb_player_init (RBPlayerIface *iface)
 {
@@ -1207,6 +1226,7 @@ rb_player_init (RBPlayerIface *iface)
 	iface->set_time = impl_set_time;
 	iface->get_time = impl_get_time;
 	iface->multiple_open = (RBPlayerFeatureFunc) rb_false_function;
+	iface->tick_interval_changed = impl_tick_interval_changed;
 }
 
 static void
@@ -32,6 +32,7 @@
 #include "rb-player-gst-xfade.h"
 #include "rb-marshal.h"
 #include "rb-util.h"
+#include "rb-debug.h"
 
 /**
  * RBPlayerPlayType:
@@ -65,6 +66,14 @@ enum {
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+typedef struct {
+	GHashTable *intervals;		/* subscription id -> interval */
+	guint next_id;
+	guint interval;
+} RBPlayerTickSubscriptions;
+
+static GQuark tick_subscriptions_quark = 0;
+
 /**
  * SECTION:rb-player
  * @short_description: playback backend interface
@@ -85,11 +94,15 @@ static guint signals[LAST_SIGNAL] = { 0 };
  * The player implementation should emit signals for metadata extracted from the
  * stream using the 'info' signal
  *
- * While playing, the player implementation should emit 'tick' signals frequently
- * enough to update an elapsed/remaining time display consistently.  The duration
- * value included in tick signal emissions is used to prepare the next stream before
- * the current stream reaches EOS, so it should be updated for each emission to account
- * for variable bitrate streams that produce inaccurate duration estimates early on.
+ * While playing, the player implementation emits 'tick' signals as often as its
+ * consumers have asked for.  Each consumer registers the interval it needs using
+ * #rb_player_add_tick_subscription, and the player ticks at the shortest interval
+ * currently subscribed, or not at all if there are no subscriptions.  Consumers that
+ * only need the playback position occasionally should call #rb_player_get_time instead,
+ * which queries the pipeline directly.  The duration value included in tick signal
+ * emissions is used to prepare the next stream before the current stream reaches EOS,
+ * so it should be updated for each emission to account for variable bitrate streams
+ * that produce inaccurate duration estimates early on.
  *
  * When playing a stream from the network, the player can report buffering status
  * using the 'buffering' signal.  The value included in the signal indicates the
@@ -173,8 +186,10 @@ rb_player_interface_init (RBPlayerIface *iface)
 	 *  (in nanoseconds)
 	 *
 	 * The 'tick' signal is emitted repeatedly while the stream is
-	 * playing. Signal handlers can use this to update UI and to
-	 * prepare new streams for crossfade or gapless playback.
+	 * playing, at the shortest interval requested using
+	 * #rb_player_add_tick_subscription. Signal handlers can use this
+	 * to update UI and to prepare new streams for crossfade or gapless
+	 * playback.
 	 **/
 	signals[TICK] =
 		g_signal_new ("tick",
@@ -568,6 +583,109 @@ rb_player_multiple_open (RBPlayer *player)
 		return FALSE;
 }
 
+static RBPlayerTickSubscriptions *
+get_tick_subscriptions (RBPlayer *player)
+{
+	RBPlayerTickSubscriptions *subs;
+
+	if (tick_subscriptions_quark == 0)
+		tick_subscriptions_quark = g_quark_from_static_string ("rb-player-tick-subscriptions");
+
+	subs = g_object_get_qdata (G_OBJECT (player), tick_subscriptions_quark);
+	return subs;
+}
+
+static void
+free_tick_subscriptions (RBPlayerTickSubscriptions *subs)
+{
+	g_hash_table_destroy (subs->intervals);
+	g_free (subs);
+}
+
+static void
+update_tick_interval (RBPlayer *player, RBPlayerTickSubscriptions *subs)
+{
+	RBPlayerIface *iface = RB_PLAYER_GET_IFACE (player);
+	GHashTableIter iter;
+	gpointer value;
+	guint interval = 0;
+
+	g_hash_table_iter_init (&iter, subs->intervals);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		guint i = GPOINTER_TO_UINT (value);
+		if (interval == 0 || i < interval)
+			interval = i;
+	}
+
+	if (interval == subs->interval)
+		return;
+
+	rb_debug ("tick interval changed from %u to %u ms", subs->interval, interval);
+	subs->interval = interval;
+	if (iface->tick_interval_changed)
+		iface->tick_interval_changed (player);
+}
+
+/**
+ * rb_player_add_tick_subscription:
+ * @player:	a #RBPlayer
+ * @interval:	the longest acceptable time between 'tick' signals, in milliseconds
+ *
+ * Requests 'tick' signal emissions at least every @interval milliseconds
+ * while the player is playing.  The player ticks at the shortest interval
+ * requested by any current subscription, so consumers should ask for the
+ * coarsest precision they can live with.  Intervals that are a whole number
+ * of seconds allow the player to use timers that can be coalesced with
+ * other wakeups.
+ *
+ * Return value: subscription ID, to be passed to #rb_player_remove_tick_subscription
+ */
+guint
+rb_player_add_tick_subscription (RBPlayer *player, guint interval)
+{
+	RBPlayerTickSubscriptions *subs;
+	guint id;
+
+	g_return_val_if_fail (interval > 0, 0);
+
+	subs = get_tick_subscriptions (player);
+	if (subs == NULL) {
+		subs = g_new0 (RBPlayerTickSubscriptions, 1);
+		subs->intervals = g_hash_table_new (g_direct_hash, g_direct_equal);
+		subs->next_id = 1;
+		g_object_set_qdata_full (G_OBJECT (player),
+					 tick_subscriptions_quark,
+					 subs,
+					 (GDestroyNotify) free_tick_subscriptions);
+	}
+
+	id = subs->next_id++;
+	g_hash_table_insert (subs->intervals, GUINT_TO_POINTER (id), GUINT_TO_POINTER (interval));
+	update_tick_interval (player, subs);
+	return id;
+}
+
+/**
+ * rb_player_remove_tick_subscription:
+ * @player:	a #RBPlayer
+ * @id:		a subscription ID returned by #rb_player_add_tick_subscription
+ *
+ * Removes a tick subscription.  If no subscriptions remain, the player
+ * stops emitting 'tick' signals.
+ */
+void
+rb_player_remove_tick_subscription (RBPlayer *player, guint id)
+{
+	RBPlayerTickSubscriptions *subs;
+
+	subs = get_tick_subscriptions (player);
+	if (subs == NULL || g_hash_table_remove (subs->intervals, GUINT_TO_POINTER (id)) == FALSE) {
+		g_warning ("tick subscription %u not found", id);
+		return;
+	}
+	update_tick_interval (player, subs);
+}
+
 /**
  * rb_player_new:
  * @want_crossfade: if TRUE, try to use a backend that supports
@@ -751,6 +869,51 @@ _rb_player_emit_redirect (RBPlayer *player, gpointer stream_data, const char *ur
 	g_signal_emit (player, signals[REDIRECT], 0, stream_data, uri);
 }
 
+/**
+ * _rb_player_get_tick_interval:
+ * @player: a #RBPlayer implementation
+ *
+ * Returns the interval at which the player should emit 'tick' signals,
+ * which is the shortest interval of any current tick subscription.
+ * To be used by implementations only.
+ *
+ * Return value: tick interval in milliseconds, or 0 if there are no subscriptions
+ */
+guint
+_rb_player_get_tick_interval (RBPlayer *player)
+{
+	RBPlayerTickSubscriptions *subs;
+
+	subs = get_tick_subscriptions (player);
+	return subs ? subs->interval : 0;
+}
+
+/**
+ * _rb_player_add_tick_timeout:
+ * @player: a #RBPlayer implementation
+ * @callback: function to call to emit a 'tick' signal
+ * @data: data to pass to @callback
+ *
+ * Adds a timeout that calls @callback at the current tick interval.
+ * Whole-second intervals use #g_timeout_add_seconds so the wakeups can
+ * be coalesced with others.  To be used by implementations only.
+ *
+ * Return value: the source ID, or 0 if there are no tick subscriptions
+ */
+guint
+_rb_player_add_tick_timeout (RBPlayer *player, GSourceFunc callback, gpointer data)
+{
+	guint interval;
+
+	interval = _rb_player_get_tick_interval (player);
+	if (interval == 0)
+		return 0;
+	else if (interval % 1000 == 0)
+		return g_timeout_add_seconds (interval / 1000, callback, data);
+	else
+		return g_timeout_add (interval, callback, data);
+}
+
 GQuark
 rb_player_error_quark (void)
 {
@@ -134,6 +134,8 @@ struct _RBPlayerIface
 	void		(*redirect)		(RBPlayer *player,
 						 gpointer stream_data,
 						 const gchar *uri);
+
+	void		(*tick_interval_changed) (RBPlayer *player);
 };
 
 GType		rb_player_get_type   (void);
@@ -166,6 +168,9 @@ gint64		rb_player_get_time   (RBPlayer *player);
 
 gboolean	rb_player_multiple_open (RBPlayer *player);
 
+guint		rb_player_add_tick_subscription (RBPlayer *player, guint interval);
+void		rb_player_remove_tick_subscription (RBPlayer *player, guint id);
+
 /* only to be used by subclasses */
 void	_rb_player_emit_eos (RBPlayer *player, gpointer stream_data, gboolean early);
 void	_rb_player_emit_info (RBPlayer *player, gpointer stream_data, RBMetaDataField field, GValue *value);
@@ -178,6 +183,9 @@ void	_rb_player_emit_volume_changed (RBPlayer *player, float volume);
 void	_rb_player_emit_image (RBPlayer *player, gpointer stream_data, GdkPixbuf *image);
 void	_rb_player_emit_redirect (RBPlayer *player, gpointer stream_data, const char *uri);
 
+guint	_rb_player_get_tick_interval (RBPlayer *player);
+guint	_rb_player_add_tick_timeout (RBPlayer *player, GSourceFunc callback, gpointer data);
+
 G_END_DECLS
 
 #endif /* __RB_PLAYER_H */
@@ -45,8 +45,9 @@
  * SECTION:rb-debug
  * @short_description: debugging support functions
  *
- * In addition to a simple debug output system, we have two distinct
- * profiling mechanisms for timing sections of code.
+ * In addition to a simple debug output system, there are two ways of
+ * timing sections of code, both of which record spans in the trace
+ * described in #rb-trace.
  */
 
 static void log_handler (const char *domain,
@@ -303,7 +304,8 @@ log_handler (const char *domain,
 struct RBProfiler
 {
 	GTimer *timer;
-	char *name;
+	/* interned, since trace events keep the name */
+	const char *name;
 };
 
 /**
@@ -311,7 +313,9 @@ struct RBProfiler
  * @name: profiler name
  *
  * Creates a new profiler instance.  This can be used to
- * time certain sections of code.
+ * time certain sections of code.  The time between creating
+ * (or resetting) the profiler and freeing (or resetting) it
+ * is recorded as a span in the trace.
  *
  * Return value: profiler instance
  */
@@ -319,15 +323,13 @@ RBProfiler *
 rb_profiler_new (const char *name)
 {
 	RBProfiler *profiler;
-	
-	if (debug_match == NULL)
-		return NULL;
 
 	profiler = g_new0 (RBProfiler, 1);
 	profiler->timer = g_timer_new ();
-	profiler->name  = g_strdup (name);
+	profiler->name  = g_intern_string (name);
 
 	g_timer_start (profiler->timer);
+	rb_trace_begin ("profiler", profiler->name);
 
 	return profiler;
 }
@@ -337,7 +339,8 @@ rb_profiler_new (const char *name)
  * @profiler: profiler instance
  *
  * Produces debug output for the profiler instance,
- * showing the elapsed time.
+ * showing the elapsed time, and records an instant event
+ * in the trace.
  */
 void
 rb_profiler_dump (RBProfiler *profiler)
@@ -345,11 +348,13 @@ rb_profiler_dump (RBProfiler *profiler)
 	gulong elapsed;
 	double seconds;
 
-	if (debug_match == NULL)
-		return;
 	if (profiler == NULL)
 		return;
 
+	rb_trace_instant ("profiler", profiler->name);
+	if (debug_match == NULL)
+		return;
+
 	seconds = g_timer_elapsed (profiler->timer, &elapsed);
 
 	rb_debug ("PROFILER %s %ld ms (%f s) elapsed", profiler->name, 
@@ -360,17 +365,18 @@ rb_profiler_dump (RBProfiler *profiler)
  * rb_profiler_reset: (skip)
  * @profiler: profiler instance
  *
- * Resets the elapsed time for the profiler
+ * Resets the elapsed time for the profiler, ending its current
+ * span in the trace and starting a new one.
  */
 void
 rb_profiler_reset (RBProfiler *profiler)
 {
-	if (debug_match == NULL)
-		return;
 	if (profiler == NULL)
 		return;
 
+	rb_trace_end ("profiler", profiler->name);
 	g_timer_start (profiler->timer);
+	rb_trace_begin ("profiler", profiler->name);
 }
 
 /**
@@ -382,84 +388,26 @@ rb_profiler_reset (RBProfiler *profiler)
 void
 rb_profiler_free (RBProfiler *profiler)
 {
-	if (debug_match == NULL)
-		return;
 	if (profiler == NULL)
 		return;
 
+	rb_trace_end ("profiler", profiler->name);
 	g_timer_destroy (profiler->timer);
-	g_free (profiler->name);
 	g_free (profiler);
 }
 
-/* Profiling */
-
-static int profile_indent;
-
-static void
-profile_add_indent (int indent)
-{
-	profile_indent += indent;
-	if (profile_indent < 0) {
-		g_error ("You screwed up your indentation");
-	}
-}
-
 /**
  * rb_profile_start:
  * @msg: profile point message
  *
- * Records a start point for profiling.
- * This profile mechanism operates by issuing file access
- * requests with filenames indicating the profile points.
- * Use 'strace -e access' to gather this information.
+ * Records the start of a span in the trace.  Use the --trace-file
+ * command line option to write the trace out.
  */
 
 /**
  * rb_profile_end:
  * @msg: profile point message
  *
- * Records an end point for profiling.  See @rb_profile_start.
+ * Records the end of the span started by the most recent
+ * @rb_profile_start call on the same thread.
  */
-
-/**
- * _rb_profile_log:
- * @func: call site function name
- * @file: call site file name
- * @line: call site line number
- * @indent: indent level for output
- * @msg1: message part 1
- * @msg2: message part 2
- *
- * Issues a file access request with a constructed filename.
- * Run rhythmbox under 'strace -ttt -e access' to show these profile
- * points.
- */
-void
-_rb_profile_log (const char *func,
-		 const char *file,
-		 int         line,
-		 int	     indent,
-		 const char *msg1,
-		 const char *msg2)
-{
-	char *str;
-
-	if (indent < 0) {
-		profile_add_indent (indent);
-	}
-
-	if (profile_indent == 0) {
-		str = g_strdup_printf ("MARK: [%s %s %d] %s %s", file, func, line, msg1 ? msg1 : "", msg2 ? msg2 : "");
-	} else {
-		str = g_strdup_printf ("MARK: %*c [%s %s %d] %s %s", profile_indent - 1, ' ', file, func, line, msg1 ? msg1 : "", msg2 ? msg2 : "");
-	}
-
-	access (str, F_OK);
-
-	g_free (str);
-
-	if (indent > 0) {
-		profile_add_indent (indent);
-	}
-}
@@ -32,6 +32,8 @@
 #include <stdarg.h>
 #include <glib.h>
 
+#include "rb-trace.h"
+
 G_BEGIN_DECLS
 
 #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
@@ -71,29 +73,9 @@ void        rb_profiler_dump  (RBProfiler *profiler);
 void        rb_profiler_reset (RBProfiler *profiler);
 void        rb_profiler_free  (RBProfiler *profiler);
 
-void        _rb_profile_log    (const char *func,
-                                const char *file,
-                                int         line,
-                                int	    indent,
-                                const char *msg1,
-                                const char *msg2);
-#define ENABLE_PROFILING 1
-#ifdef ENABLE_PROFILING
-#define RB_PROFILE_INDENTATION 4
-#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
-#define rb_profile_start(msg) _rb_profile_log (__func__, __FILE__, __LINE__, RB_PROFILE_INDENTATION, "START", msg)
-#define rb_profile_end(msg)   _rb_profile_log (__func__, __FILE__, __LINE__, -RB_PROFILE_INDENTATION, "END", msg)
-#elif defined(__GNUC__) && __GNUC__ >= 3
-#define rb_profile_start(msg) _rb_profile_log (__FUNCTION__, __FILE__, __LINE__, RB_PROFILE_INDENTATION, "START", msg)
-#define rb_profile_end(msg)   _rb_profile_log (__FUNCTION__, __FILE__, __LINE__, -RB_PROFILE_INDENTATION, "END", msg)
-#else
-#define rb_profile_start(msg)
-#define rb_profile_end(msg)
-#endif
-#else
-#define rb_profile_start(msg)
-#define rb_profile_end(msg)
-#endif
+/* profiling points are recorded as trace spans, see rb-trace.h */
+#define rb_profile_start(msg) rb_trace_begin ("profile", msg)
+#define rb_profile_end(msg)   rb_trace_end ("profile", msg)
 
 G_END_DECLS
 
@@ -52,10 +52,10 @@
 #include "rb-util.h"
 
 typedef struct _RBUriHandleRecursivelyAsyncData RBUriHandleRecursivelyAsyncData;
+typedef struct _RBUriHandleRecursivelyDir RBUriHandleRecursivelyDir;
 
-static void _uri_handle_recursively_free (RBUriHandleRecursivelyAsyncData *data);
-static void _uri_handle_recursively_next_dir (RBUriHandleRecursivelyAsyncData *data);
-static void _uri_handle_recursively_next_files (RBUriHandleRecursivelyAsyncData *data);
+static void _uri_handle_recursively_next_dirs (RBUriHandleRecursivelyAsyncData *data);
+static void _uri_handle_recursively_next_files (RBUriHandleRecursivelyDir *dir);
 
 static GHashTable *files = NULL;
 
@@ -84,6 +84,8 @@ static const char *recurse_attributes =
 		G_FILE_ATTRIBUTE_STANDARD_TYPE ","
 		G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
 		G_FILE_ATTRIBUTE_ID_FILE ","
+		G_FILE_ATTRIBUTE_UNIX_DEVICE ","
+		G_FILE_ATTRIBUTE_UNIX_INODE ","
 		G_FILE_ATTRIBUTE_ACCESS_CAN_READ ","
 		G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK;
 
@@ -736,11 +738,90 @@ _should_process (GFileInfo *info)
 	return TRUE;
 }
 
+/* number of directories enumerated at once when walking a directory tree */
+#define RECURSE_ASYNC_DIRECTORIES	4
 
+/* number of files fetched from an enumerator at a time */
+#define RECURSE_ASYNC_BATCH_SIZE	64
+
+/*
+ * Tracks the files seen while walking a directory tree, so files reachable
+ * through more than one path (hard links, symlink loops, bind mounts) are
+ * only handled once.  Files are identified by device and inode number where
+ * available, and by their file ID otherwise.
+ */
+typedef struct {
+	GHashTable *inodes;
+	GHashTable *ids;
+} RBUriHandledFiles;
+
+typedef struct {
+	guint32 device;
+	guint64 inode;
+} RBUriFileInode;
+
+static guint
+_file_inode_hash (gconstpointer v)
+{
+	const RBUriFileInode *f = v;
+	return g_int64_hash (&f->inode) ^ f->device;
+}
+
+static gboolean
+_file_inode_equal (gconstpointer a, gconstpointer b)
+{
+	const RBUriFileInode *fa = a;
+	const RBUriFileInode *fb = b;
+	return (fa->inode == fb->inode && fa->device == fb->device);
+}
+
+static void
+_handled_files_init (RBUriHandledFiles *handled)
+{
+	handled->inodes = g_hash_table_new_full (_file_inode_hash, _file_inode_equal, g_free, NULL);
+	handled->ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+_handled_files_destroy (RBUriHandledFiles *handled)
+{
+	g_hash_table_destroy (handled->inodes);
+	g_hash_table_destroy (handled->ids);
+}
+
+/* returns FALSE if the file has already been seen */
 static gboolean
-_uri_handle_file (GFile *dir, GFileInfo *fileinfo, GHashTable *handled, RBUriRecurseFunc func, gpointer user_data, GFile **descend)
+_handled_files_add (RBUriHandledFiles *handled, GFileInfo *fileinfo)
 {
 	const char *file_id;
+
+	if (g_file_info_has_attribute (fileinfo, G_FILE_ATTRIBUTE_UNIX_INODE)) {
+		RBUriFileInode f;
+
+		f.device = g_file_info_get_attribute_uint32 (fileinfo, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+		f.inode = g_file_info_get_attribute_uint64 (fileinfo, G_FILE_ATTRIBUTE_UNIX_INODE);
+		if (g_hash_table_contains (handled->inodes, &f))
+			return FALSE;
+
+		g_hash_table_add (handled->inodes, g_memdup (&f, sizeof (f)));
+		return TRUE;
+	}
+
+	file_id = g_file_info_get_attribute_string (fileinfo, G_FILE_ATTRIBUTE_ID_FILE);
+	if (file_id == NULL) {
+		/* have to hope for the best, I guess */
+		return TRUE;
+	} else if (g_hash_table_contains (handled->ids, file_id)) {
+		return FALSE;
+	}
+
+	g_hash_table_add (handled->ids, g_strdup (file_id));
+	return TRUE;
+}
+
+static gboolean
+_uri_handle_file (GFile *dir, GFileInfo *fileinfo, RBUriHandledFiles *handled, RBUriRecurseFunc func, gpointer user_data, GFile **descend)
+{
 	gboolean is_dir;
 	gboolean ret;
 	GFileType file_type;
@@ -753,13 +834,8 @@ _uri_handle_file (GFile *dir, GFileInfo *fileinfo, GHashTable *handled, RBUriRec
 	}
 
 	/* already handled? */
-	file_id = g_file_info_get_attribute_string (fileinfo, G_FILE_ATTRIBUTE_ID_FILE);
-	if (file_id == NULL) {
-		/* have to hope for the best, I guess */
-	} else if (g_hash_table_lookup (handled, file_id) != NULL) {
+	if (_handled_files_add (handled, fileinfo) == FALSE) {
 		return TRUE;
-	} else {
-		g_hash_table_insert (handled, g_strdup (file_id), GINT_TO_POINTER (1));
 	}
 
 	/* type? */
@@ -787,7 +863,7 @@ _uri_handle_file (GFile *dir, GFileInfo *fileinfo, GHashTable *handled, RBUriRec
 static void
 _uri_handle_recurse (GFile *dir,
 		     GCancellable *cancel,
-		     GHashTable *handled,
+		     RBUriHandledFiles *handled,
 		     RBUriRecurseFunc func,
 		     gpointer user_data)
 {
@@ -858,14 +934,14 @@ rb_uri_handle_recursively (const char *uri,
 			   gpointer user_data)
 {
 	GFile *file;
-	GHashTable *handled;
+	RBUriHandledFiles handled;
 
 	file = g_file_new_for_uri (uri);
-	handled = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	_handled_files_init (&handled);
 
-	_uri_handle_recurse (file, cancel, handled, func, user_data);
+	_uri_handle_recurse (file, cancel, &handled, func, user_data);
 
-	g_hash_table_destroy (handled);
+	_handled_files_destroy (&handled);
 	g_object_unref (file);
 }
 
@@ -875,10 +951,15 @@ struct _RBUriHandleRecursivelyAsyncData {
 	gpointer user_data;
 	GDestroyNotify data_destroy;
 
-	GHashTable *handled;
+	RBUriHandledFiles handled;
 
 	GQueue *dirs_left;
-	GFile *current;
+	guint active;
+};
+
+struct _RBUriHandleRecursivelyDir {
+	RBUriHandleRecursivelyAsyncData *data;
+	GFile *dir;
 	GFileEnumerator *enumerator;
 };
 
@@ -888,14 +969,25 @@ _uri_handle_recursively_free (RBUriHandleRecursivelyAsyncData *data)
 {
 	if (data->data_destroy)
 		data->data_destroy (data->user_data);
-	g_clear_object (&data->current);
-	g_clear_object (&data->enumerator);
 	g_clear_object (&data->cancel);
-	g_hash_table_destroy (data->handled);
+	_handled_files_destroy (&data->handled);
 	g_queue_free_full (data->dirs_left, g_object_unref);
 	g_free (data);
 }
 
+static void
+_uri_handle_recursively_dir_done (RBUriHandleRecursivelyDir *dir)
+{
+	RBUriHandleRecursivelyAsyncData *data = dir->data;
+
+	g_clear_object (&dir->dir);
+	g_clear_object (&dir->enumerator);
+	g_free (dir);
+
+	data->active--;
+	_uri_handle_recursively_next_dirs (data);
+}
+
 static void
 _uri_handle_recursively_process_files (GObject *src, GAsyncResult *result, gpointer ptr)
 {
@@ -903,25 +995,26 @@ _uri_handle_recursively_process_files (GObject *src, GAsyncResult *result, gpoin
 	GList *l;
 	GFile *descend;
 	GError *error = NULL;
-	RBUriHandleRecursivelyAsyncData *data = ptr;
+	RBUriHandleRecursivelyDir *dir = ptr;
+	RBUriHandleRecursivelyAsyncData *data = dir->data;
 
 	files = g_file_enumerator_next_files_finish (G_FILE_ENUMERATOR (src), result, &error);
 	if (error != NULL) {
 		rb_debug ("error enumerating files: %s", error->message);
-		_uri_handle_recursively_next_dir (data);
+		_uri_handle_recursively_dir_done (dir);
 		g_clear_error (&error);
 		return;
 	}
 
 	if (files == NULL) {
-		_uri_handle_recursively_next_dir (data);
+		_uri_handle_recursively_dir_done (dir);
 		return;
 	}
 
 	rb_debug ("got %d file(s)", g_list_length (files));
 	for (l = files; l != NULL; l = l->next) {
 		descend = NULL;
-		if (_uri_handle_file (data->current, l->data, data->handled, data->func, data->user_data, &descend) == FALSE) {
+		if (_uri_handle_file (dir->dir, l->data, &data->handled, data->func, data->user_data, &descend) == FALSE) {
 			rb_debug ("callback returned false");
 			g_cancellable_cancel (data->cancel);
 			break;
@@ -934,27 +1027,31 @@ _uri_handle_recursively_process_files (GObject *src, GAsyncResult *result, gpoin
 	}
 
 	g_list_free_full (files, g_object_unref);
-	_uri_handle_recursively_next_files (data);
+
+	/* start on any directories we just found while this one continues */
+	_uri_handle_recursively_next_dirs (data);
+	_uri_handle_recursively_next_files (dir);
 }
 
 static void
-_uri_handle_recursively_next_files (RBUriHandleRecursivelyAsyncData *data)
+_uri_handle_recursively_next_files (RBUriHandleRecursivelyDir *dir)
 {
-	g_file_enumerator_next_files_async (data->enumerator,
-					    16,		/* or something */
+	g_file_enumerator_next_files_async (dir->enumerator,
+					    RECURSE_ASYNC_BATCH_SIZE,
 					    G_PRIORITY_DEFAULT,
-					    data->cancel,
+					    dir->data->cancel,
 					    _uri_handle_recursively_process_files,
-					    data);
+					    dir);
 }
 
 static void
 _uri_handle_recursively_enum_files (GObject *src, GAsyncResult *result, gpointer ptr)
 {
 	GError *error = NULL;
-	RBUriHandleRecursivelyAsyncData *data = ptr;
+	RBUriHandleRecursivelyDir *dir = ptr;
+	RBUriHandleRecursivelyAsyncData *data = dir->data;
 
-	data->enumerator = g_file_enumerate_children_finish (G_FILE (src), result, &error);
+	dir->enumerator = g_file_enumerate_children_finish (G_FILE (src), result, &error);
 	if (error != NULL) {
 		if (error->code == G_IO_ERROR_NOT_DIRECTORY) {
 			GFileInfo *info;
@@ -971,33 +1068,43 @@ _uri_handle_recursively_enum_files (GObject *src, GAsyncResult *result, gpointer
 			rb_debug ("error enumerating folder: %s", error->message);
 		}
 		g_clear_error (&error);
-		_uri_handle_recursively_next_dir (data);
+		_uri_handle_recursively_dir_done (dir);
 	} else {
-		_uri_handle_recursively_next_files (data);
+		_uri_handle_recursively_next_files (dir);
 	}
 }
 
 static void
-_uri_handle_recursively_next_dir (RBUriHandleRecursivelyAsyncData *data)
+_uri_handle_recursively_next_dirs (RBUriHandleRecursivelyAsyncData *data)
 {
-	g_clear_object (&data->current);
-	g_clear_object (&data->enumerator);
-	data->current = g_queue_pop_head (data->dirs_left);
-	if (data->current != NULL) {
-		g_file_enumerate_children_async (data->current,
+	if (g_cancellable_is_cancelled (data->cancel)) {
+		g_queue_free_full (data->dirs_left, g_object_unref);
+		data->dirs_left = g_queue_new ();
+	}
+
+	while (data->active < RECURSE_ASYNC_DIRECTORIES && g_queue_is_empty (data->dirs_left) == FALSE) {
+		RBUriHandleRecursivelyDir *dir;
+
+		dir = g_new0 (RBUriHandleRecursivelyDir, 1);
+		dir->data = data;
+		dir->dir = g_queue_pop_head (data->dirs_left);
+		data->active++;
+
+		g_file_enumerate_children_async (dir->dir,
 						 recurse_attributes,
 						 G_FILE_QUERY_INFO_NONE,
 						 G_PRIORITY_DEFAULT,
 						 data->cancel,
 						 _uri_handle_recursively_enum_files,
-						 data);
-	} else {
+						 dir);
+	}
+
+	if (data->active == 0) {
 		rb_debug ("nothing more to do");
 		_uri_handle_recursively_free (data);
 	}
 }
 
-
 /**
  * rb_uri_handle_recursively_async:
  * @uri: the URI to visit
@@ -1010,6 +1117,9 @@ _uri_handle_recursively_next_dir (RBUriHandleRecursivelyAsyncData *data)
  * by @uri, or if @uri identifies a file, calls it once
  * with that.
  *
+ * Several directories are enumerated at once, so files from different
+ * directories may be passed to @func in any order.
+ *
  * If non-NULL, @destroy_data will be called once all files have been
  * processed, or when the operation is cancelled.
  */
@@ -1032,11 +1142,11 @@ rb_uri_handle_recursively_async (const char *uri,
 	data->func = func;
 	data->user_data = user_data;
 	data->data_destroy = data_destroy;
-	data->handled = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	_handled_files_init (&data->handled);
 
 	data->dirs_left = g_queue_new ();
 	g_queue_push_tail (data->dirs_left, g_file_new_for_uri (uri));
-	_uri_handle_recursively_next_dir (data);
+	_uri_handle_recursively_next_dirs (data);
 }
 
 /**
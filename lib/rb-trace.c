@@ -0,0 +1,620 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+
+#include <glib.h>
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#endif
+
+#include "rb-trace.h"
+#include "rb-debug.h"
+
+/**
+ * SECTION:rb-trace
+ * @short_description: lightweight tracing spans and counters
+ *
+ * The tracing layer records named spans (pairs of begin and end events),
+ * instant events and counters from any thread.  It is always compiled in.
+ * Spans and instant events are only recorded when a trace file has been
+ * set with rb_trace_init (the --trace-file command line option), and
+ * otherwise cost a single atomic read.  Event categories and names are
+ * not copied, so they must be static or interned strings, which is why
+ * the event functions aren't available to bindings.
+ *
+ * Counters are always maintained.  Looking a counter up by name takes a
+ * lock, so code that updates a counter often should look it up once with
+ * rb_trace_counter_lookup and update it through the returned handle,
+ * which only costs an atomic operation on 64 bit platforms.
+ *
+ * Events are buffered per thread and written out in the Chrome trace event
+ * JSON format, which can be loaded into chrome://tracing or Perfetto.  The
+ * trace and a plain text dump of the counters are written when the
+ * application exits and whenever it receives SIGUSR2.
+ */
+
+/* around 32MB of events per thread */
+#define MAX_EVENTS_PER_THREAD	(1 << 20)
+
+typedef struct {
+	gint64 time;
+	const char *category;
+	const char *name;
+	gint64 value;
+	char phase;
+} RBTraceEvent;
+
+typedef struct {
+	GMutex lock;
+	guint tid;
+	GArray *events;
+	guint dropped;
+} RBTraceBuffer;
+
+static gint trace_active = 0;
+static char *trace_filename = NULL;
+static gint64 trace_start_time = 0;
+static guint trace_signal_id = 0;
+
+/* protects trace_buffers and trace_next_tid */
+static GMutex trace_lock;
+static GPtrArray *trace_buffers = NULL;
+static guint trace_next_tid = 1;
+static GPrivate trace_buffer_key = G_PRIVATE_INIT (NULL);
+
+/* glib can only update pointer-sized values atomically, so on 32 bit
+ * platforms the 64 bit counter values are protected by a lock instead.
+ */
+#if GLIB_SIZEOF_SIZE_T == 8
+#define COUNTER_VALUES_ATOMIC
+#endif
+
+struct _RBTraceCounter {
+	char *name;
+#ifdef COUNTER_VALUES_ATOMIC
+	gssize value;
+#else
+	gint64 value;
+#endif
+};
+
+/* protects trace_counters; counters are never freed */
+static GMutex counter_lock;
+static GHashTable *trace_counters = NULL;
+
+#ifndef COUNTER_VALUES_ATOMIC
+/* protects counter values */
+static GMutex counter_value_lock;
+#endif
+
+static RBTraceBuffer *
+get_thread_buffer (void)
+{
+	RBTraceBuffer *buffer;
+
+	buffer = g_private_get (&trace_buffer_key);
+	if (buffer != NULL)
+		return buffer;
+
+	/* buffers are never freed, so events from threads that have
+	 * already exited can still be written out.
+	 */
+	buffer = g_new0 (RBTraceBuffer, 1);
+	g_mutex_init (&buffer->lock);
+	buffer->events = g_array_new (FALSE, FALSE, sizeof (RBTraceEvent));
+
+	g_mutex_lock (&trace_lock);
+	buffer->tid = trace_next_tid++;
+	if (trace_buffers == NULL)
+		trace_buffers = g_ptr_array_new ();
+	g_ptr_array_add (trace_buffers, buffer);
+	g_mutex_unlock (&trace_lock);
+
+	g_private_set (&trace_buffer_key, buffer);
+	return buffer;
+}
+
+static void
+record_event (char phase, const char *category, const char *name, gint64 value)
+{
+	RBTraceBuffer *buffer;
+	RBTraceEvent event;
+
+	event.time = g_get_monotonic_time () - trace_start_time;
+	event.category = category ? category : "";
+	event.name = name ? name : "";
+	event.value = value;
+	event.phase = phase;
+
+	buffer = get_thread_buffer ();
+	g_mutex_lock (&buffer->lock);
+	if (buffer->events->len < MAX_EVENTS_PER_THREAD) {
+		g_array_append_val (buffer->events, event);
+	} else {
+		buffer->dropped++;
+	}
+	g_mutex_unlock (&buffer->lock);
+}
+
+static gboolean
+dump_signal_cb (gpointer data)
+{
+	char *counters_filename;
+	GError *error = NULL;
+
+	rb_debug ("writing trace to %s", trace_filename);
+	if (rb_trace_write (trace_filename, &error) == FALSE) {
+		g_warning ("Unable to write trace file %s: %s", trace_filename, error->message);
+		g_clear_error (&error);
+	}
+
+	counters_filename = g_strdup_printf ("%s.counters", trace_filename);
+	if (rb_trace_write_counters (counters_filename, &error) == FALSE) {
+		g_warning ("Unable to write trace counters to %s: %s", counters_filename, error->message);
+		g_clear_error (&error);
+	}
+	g_free (counters_filename);
+
+	return TRUE;
+}
+
+/**
+ * rb_trace_init:
+ * @filename: (allow-none): file to write the trace to, or NULL
+ *
+ * Starts recording trace events if @filename is not NULL.
+ * The trace is written to @filename when rb_trace_shutdown is called or
+ * the process receives SIGUSR2, and the counters are written to the same
+ * name with '.counters' appended.
+ */
+void
+rb_trace_init (const char *filename)
+{
+	if (filename == NULL || trace_filename != NULL)
+		return;
+
+	trace_filename = g_strdup (filename);
+	trace_start_time = g_get_monotonic_time ();
+#ifdef G_OS_UNIX
+	trace_signal_id = g_unix_signal_add (SIGUSR2, dump_signal_cb, NULL);
+#endif
+	g_atomic_int_set (&trace_active, 1);
+
+	rb_debug ("recording trace events to %s", trace_filename);
+}
+
+/**
+ * rb_trace_shutdown:
+ *
+ * Stops recording trace events and writes out the trace and counters
+ * if a trace file was set.
+ */
+void
+rb_trace_shutdown (void)
+{
+	guint i;
+
+	if (trace_filename == NULL)
+		return;
+
+	g_atomic_int_set (&trace_active, 0);
+	if (trace_signal_id != 0) {
+		g_source_remove (trace_signal_id);
+		trace_signal_id = 0;
+	}
+
+	dump_signal_cb (NULL);
+
+	/* other threads may still hold pointers to their buffers,
+	 * so only the events are discarded.
+	 */
+	g_mutex_lock (&trace_lock);
+	for (i = 0; trace_buffers != NULL && i < trace_buffers->len; i++) {
+		RBTraceBuffer *buffer = g_ptr_array_index (trace_buffers, i);
+		g_mutex_lock (&buffer->lock);
+		g_array_set_size (buffer->events, 0);
+		buffer->dropped = 0;
+		g_mutex_unlock (&buffer->lock);
+	}
+	g_mutex_unlock (&trace_lock);
+
+	g_free (trace_filename);
+	trace_filename = NULL;
+}
+
+/**
+ * rb_trace_enabled:
+ *
+ * Checks whether trace events are being recorded.  This can be used to
+ * avoid building expensive span names when nothing will record them.
+ *
+ * Return value: %TRUE if trace events are being recorded
+ */
+gboolean
+rb_trace_enabled (void)
+{
+	return g_atomic_int_get (&trace_active) != 0;
+}
+
+/**
+ * rb_trace_begin: (skip)
+ * @category: span category, such as "rhythmdb"
+ * @name: span name
+ *
+ * Records the start of a span on the calling thread.  Each call must be
+ * matched by a call to rb_trace_end on the same thread.  @category and
+ * @name must remain valid until the trace has been written.
+ */
+void
+rb_trace_begin (const char *category, const char *name)
+{
+	if (g_atomic_int_get (&trace_active) == 0)
+		return;
+
+	record_event ('B', category, name, 0);
+}
+
+/**
+ * rb_trace_end: (skip)
+ * @category: span category
+ * @name: span name
+ *
+ * Records the end of the innermost open span on the calling thread.
+ */
+void
+rb_trace_end (const char *category, const char *name)
+{
+	if (g_atomic_int_get (&trace_active) == 0)
+		return;
+
+	record_event ('E', category, name, 0);
+}
+
+/**
+ * rb_trace_instant: (skip)
+ * @category: event category
+ * @name: event name
+ *
+ * Records an instant event on the calling thread.  @category and @name
+ * must remain valid until the trace has been written.
+ */
+void
+rb_trace_instant (const char *category, const char *name)
+{
+	if (g_atomic_int_get (&trace_active) == 0)
+		return;
+
+	record_event ('i', category, name, 0);
+}
+
+/**
+ * rb_trace_counter_lookup:
+ * @name: counter name
+ *
+ * Finds the counter named @name, creating it if it does not exist yet.
+ * The returned handle remains valid for the lifetime of the process.
+ *
+ * Return value: (transfer none): counter handle
+ */
+RBTraceCounter *
+rb_trace_counter_lookup (const char *name)
+{
+	RBTraceCounter *counter;
+
+	g_mutex_lock (&counter_lock);
+	if (trace_counters == NULL)
+		trace_counters = g_hash_table_new (g_str_hash, g_str_equal);
+
+	counter = g_hash_table_lookup (trace_counters, name);
+	if (counter == NULL) {
+		counter = g_new0 (RBTraceCounter, 1);
+		counter->name = g_strdup (name);
+		g_hash_table_insert (trace_counters, counter->name, counter);
+	}
+	g_mutex_unlock (&counter_lock);
+
+	return counter;
+}
+
+static void
+set_counter_value (RBTraceCounter *counter, gint64 value)
+{
+#ifdef COUNTER_VALUES_ATOMIC
+	g_atomic_pointer_set (&counter->value, (gssize) value);
+#else
+	g_mutex_lock (&counter_value_lock);
+	counter->value = value;
+	g_mutex_unlock (&counter_value_lock);
+#endif
+}
+
+static gint64
+add_counter_value (RBTraceCounter *counter, gint64 delta)
+{
+#ifdef COUNTER_VALUES_ATOMIC
+	return g_atomic_pointer_add (&counter->value, (gssize) delta) + delta;
+#else
+	gint64 value;
+
+	g_mutex_lock (&counter_value_lock);
+	counter->value += delta;
+	value = counter->value;
+	g_mutex_unlock (&counter_value_lock);
+	return value;
+#endif
+}
+
+static gint64
+get_counter_value (RBTraceCounter *counter)
+{
+#ifdef COUNTER_VALUES_ATOMIC
+	return (gssize) GPOINTER_TO_SIZE (g_atomic_pointer_get (&counter->value));
+#else
+	gint64 value;
+
+	g_mutex_lock (&counter_value_lock);
+	value = counter->value;
+	g_mutex_unlock (&counter_value_lock);
+	return value;
+#endif
+}
+
+/**
+ * rb_trace_counter_set_value:
+ * @counter: counter handle
+ * @value: new value for the counter
+ *
+ * Sets the value of a counter.  If trace events are being recorded,
+ * the new value is also added to the trace.
+ */
+void
+rb_trace_counter_set_value (RBTraceCounter *counter, gint64 value)
+{
+	set_counter_value (counter, value);
+
+	if (g_atomic_int_get (&trace_active))
+		record_event ('C', "counter", counter->name, value);
+}
+
+/**
+ * rb_trace_counter_add_value:
+ * @counter: counter handle
+ * @delta: amount to add to the counter
+ *
+ * Adds @delta to a counter.  If trace events are being recorded, the
+ * new value is also added to the trace.
+ */
+void
+rb_trace_counter_add_value (RBTraceCounter *counter, gint64 delta)
+{
+	gint64 value;
+
+	value = add_counter_value (counter, delta);
+
+	if (g_atomic_int_get (&trace_active))
+		record_event ('C', "counter", counter->name, value);
+}
+
+/**
+ * rb_trace_counter_set:
+ * @name: counter name
+ * @value: new value for the counter
+ *
+ * Sets the value of a counter, creating it if it does not exist yet.
+ * See rb_trace_counter_set_value.
+ */
+void
+rb_trace_counter_set (const char *name, gint64 value)
+{
+	rb_trace_counter_set_value (rb_trace_counter_lookup (name), value);
+}
+
+/**
+ * rb_trace_counter_add:
+ * @name: counter name
+ * @delta: amount to add to the counter
+ *
+ * Adds @delta to a counter, creating it if it does not exist yet.
+ * See rb_trace_counter_add_value.
+ */
+void
+rb_trace_counter_add (const char *name, gint64 delta)
+{
+	rb_trace_counter_add_value (rb_trace_counter_lookup (name), delta);
+}
+
+/**
+ * rb_trace_counter_get:
+ * @name: counter name
+ *
+ * Returns the current value of a counter.
+ *
+ * Return value: counter value, or 0 if the counter does not exist
+ */
+gint64
+rb_trace_counter_get (const char *name)
+{
+	RBTraceCounter *counter = NULL;
+
+	g_mutex_lock (&counter_lock);
+	if (trace_counters != NULL)
+		counter = g_hash_table_lookup (trace_counters, name);
+	g_mutex_unlock (&counter_lock);
+
+	return (counter != NULL) ? get_counter_value (counter) : 0;
+}
+
+/**
+ * rb_trace_dump_counters:
+ *
+ * Formats the current value of each counter, one per line, as
+ * the counter name followed by its value, sorted by name.
+ *
+ * Return value: (transfer full): counter dump
+ */
+char *
+rb_trace_dump_counters (void)
+{
+	GString *str;
+	GList *names = NULL;
+	GList *l;
+
+	str = g_string_new (NULL);
+
+	g_mutex_lock (&counter_lock);
+	if (trace_counters != NULL)
+		names = g_list_sort (g_hash_table_get_keys (trace_counters), (GCompareFunc) strcmp);
+
+	for (l = names; l != NULL; l = l->next) {
+		RBTraceCounter *counter = g_hash_table_lookup (trace_counters, l->data);
+		g_string_append_printf (str, "%s %" G_GINT64_FORMAT "\n", counter->name, get_counter_value (counter));
+	}
+	g_mutex_unlock (&counter_lock);
+
+	g_list_free (names);
+	return g_string_free (str, FALSE);
+}
+
+/**
+ * rb_trace_write_counters:
+ * @filename: file to write to
+ * @error: returns error information
+ *
+ * Writes the output of rb_trace_dump_counters to @filename.
+ *
+ * Return value: %TRUE if successful
+ */
+gboolean
+rb_trace_write_counters (const char *filename, GError **error)
+{
+	char *dump;
+	gboolean ret;
+
+	dump = rb_trace_dump_counters ();
+	ret = g_file_set_contents (filename, dump, -1, error);
+	g_free (dump);
+	return ret;
+}
+
+static void
+append_json_string (GString *str, const char *value)
+{
+	const char *p;
+
+	g_string_append_c (str, '"');
+	for (p = value; *p != '\0'; p++) {
+		switch (*p) {
+		case '"':
+			g_string_append (str, "\\\"");
+			break;
+		case '\\':
+			g_string_append (str, "\\\\");
+			break;
+		default:
+			if ((guchar) *p < 0x20)
+				g_string_append_printf (str, "\\u%04x", (guint) *p);
+			else
+				g_string_append_c (str, *p);
+			break;
+		}
+	}
+	g_string_append_c (str, '"');
+}
+
+static void
+append_event (GString *str, int pid, guint tid, RBTraceEvent *event)
+{
+	g_string_append (str, ",\n{\"name\":");
+	append_json_string (str, event->name);
+	g_string_append (str, ",\"cat\":");
+	append_json_string (str, event->category);
+	g_string_append_printf (str, ",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u",
+				event->phase, event->time, pid, tid);
+
+	switch (event->phase) {
+	case 'i':
+		g_string_append (str, ",\"s\":\"t\"");
+		break;
+	case 'C':
+		g_string_append_printf (str, ",\"args\":{\"value\":%" G_GINT64_FORMAT "}", event->value);
+		break;
+	default:
+		break;
+	}
+	g_string_append_c (str, '}');
+}
+
+/**
+ * rb_trace_write:
+ * @filename: file to write to
+ * @error: returns error information
+ *
+ * Writes all trace events recorded so far to @filename in the Chrome
+ * trace event JSON format.
+ *
+ * Return value: %TRUE if successful
+ */
+gboolean
+rb_trace_write (const char *filename, GError **error)
+{
+	GString *str;
+	gboolean ret;
+	int pid;
+	guint i;
+	guint j;
+
+	pid = getpid ();
+	str = g_string_new ("{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\"");
+	g_string_append_printf (str, ",\"pid\":%d,\"tid\":0,\"args\":{\"name\":", pid);
+	append_json_string (str, g_get_prgname () ? g_get_prgname () : "rhythmbox");
+	g_string_append (str, "}}");
+
+	g_mutex_lock (&trace_lock);
+	for (i = 0; trace_buffers != NULL && i < trace_buffers->len; i++) {
+		RBTraceBuffer *buffer = g_ptr_array_index (trace_buffers, i);
+
+		g_mutex_lock (&buffer->lock);
+		for (j = 0; j < buffer->events->len; j++) {
+			append_event (str, pid, buffer->tid, &g_array_index (buffer->events, RBTraceEvent, j));
+		}
+		if (buffer->dropped > 0) {
+			rb_debug ("dropped %u trace events from thread %u", buffer->dropped, buffer->tid);
+		}
+		g_mutex_unlock (&buffer->lock);
+	}
+	g_mutex_unlock (&trace_lock);
+
+	g_string_append (str, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	ret = g_file_set_contents (filename, str->str, str->len, error);
+	g_string_free (str, TRUE);
+	return ret;
+}
@@ -0,0 +1,67 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#ifndef __RB_TRACE_H
+#define __RB_TRACE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _RBTraceCounter RBTraceCounter;
+
+void		rb_trace_init			(const char *filename);
+void		rb_trace_shutdown		(void);
+gboolean	rb_trace_enabled		(void);
+
+void		rb_trace_begin			(const char *category,
+						 const char *name);
+void		rb_trace_end			(const char *category,
+						 const char *name);
+void		rb_trace_instant		(const char *category,
+						 const char *name);
+
+RBTraceCounter *rb_trace_counter_lookup		(const char *name);
+void		rb_trace_counter_set_value	(RBTraceCounter *counter,
+						 gint64 value);
+void		rb_trace_counter_add_value	(RBTraceCounter *counter,
+						 gint64 delta);
+
+void		rb_trace_counter_set		(const char *name,
+						 gint64 value);
+void		rb_trace_counter_add		(const char *name,
+						 gint64 delta);
+gint64		rb_trace_counter_get		(const char *name);
+
+char *		rb_trace_dump_counters		(void);
+gboolean	rb_trace_write			(const char *filename,
+						 GError **error);
+gboolean	rb_trace_write_counters		(const char *filename,
+						 GError **error);
+
+G_END_DECLS
+
+#endif /* __RB_TRACE_H */
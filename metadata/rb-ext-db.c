@@ -34,6 +34,9 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
 #include <metadata/rb-ext-db.h>
 #include <lib/rb-file-helpers.h>
 #include <lib/rb-debug.h>
@@ -51,8 +54,19 @@
  * A metadata requestor calls rb_ext_db_request and specifies a callback,
  * or alternatively connects to a signal to receive all metadata as it is
  * stored.
+ *
+ * Requestors that only need an image up to a certain size can use
+ * rb_ext_db_request_sized.  Scaled copies of stored images are kept
+ * alongside the originals, and recently loaded items are kept in memory,
+ * so repeated requests don't have to decode the original image again.
  */
 
+/* approximate limit on the memory used by recently loaded items */
+#define LOADED_CACHE_SIZE	(32 * 1024 * 1024)
+
+/* directory under the store containing scaled copies of stored images */
+#define SIZED_DIR		"sized"
+
 enum
 {
 	PROP_0,
@@ -86,6 +100,17 @@ struct _RBExtDBPrivate
 	GList *requests;
 	GAsyncQueue *store_queue;
 	GSimpleAsyncResult *store_op;
+
+	/* recently loaded items, most recently used first */
+	GHashTable *loaded;
+	GQueue *loaded_lru;
+	gsize loaded_size;
+
+	/* bumped whenever an original is replaced or deleted; the lock
+	 * also keeps scaled copies from being written while that happens.
+	 */
+	GMutex replace_lock;
+	guint generation;
 };
 
 typedef struct {
@@ -93,12 +118,22 @@ typedef struct {
 	RBExtDBRequestCallback callback;
 	gpointer user_data;
 	GDestroyNotify destroy_notify;
+	int size;
 
 	RBExtDBKey *store_key;
 	char *filename;
+	char *sized_filename;
 	GValue *data;
+	guint generation;
 } RBExtDBRequest;
 
+typedef struct {
+	char *cache_key;
+	char *filename;
+	GValue *data;
+	gsize bytes;
+} RBExtDBLoaded;
+
 typedef struct {
 	RBExtDBKey *key;
 	RBExtDBSourceType source_type;
@@ -120,6 +155,7 @@ free_request (RBExtDBRequest *request)
 		rb_ext_db_key_free (request->store_key);
 
 	g_free (request->filename);
+	g_free (request->sized_filename);
 
 	if (request->data) {
 		g_value_unset (request->data);
@@ -132,24 +168,188 @@ free_request (RBExtDBRequest *request)
 	g_slice_free (RBExtDBRequest, request);
 }
 
+static GValue *
+scale_value (GValue *data, int size)
+{
+	GdkPixbuf *pixbuf;
+	GdkPixbuf *scaled;
+	GValue *v;
+	int pw, ph;
+	int sw, sh;
+
+	if (data == NULL || size < 1 || G_VALUE_HOLDS (data, GDK_TYPE_PIXBUF) == FALSE)
+		return NULL;
+
+	pixbuf = GDK_PIXBUF (g_value_get_object (data));
+	pw = gdk_pixbuf_get_width (pixbuf);
+	ph = gdk_pixbuf_get_height (pixbuf);
+	if (pw <= size && ph <= size)
+		return NULL;
+
+	if (pw > ph) {
+		sw = size;
+		sh = MAX (1, (int)(((double) ph * size) / pw));
+	} else {
+		sh = size;
+		sw = MAX (1, (int)(((double) pw * size) / ph));
+	}
+
+	rb_debug ("scaling %dx%d image to %dx%d", pw, ph, sw, sh);
+	scaled = gdk_pixbuf_scale_simple (pixbuf, sw, sh, GDK_INTERP_HYPER);
+	if (scaled == NULL)
+		return NULL;
+
+	v = g_new0 (GValue, 1);
+	g_value_init (v, GDK_TYPE_PIXBUF);
+	g_value_take_object (v, scaled);
+	return v;
+}
+
+static void
+free_value (GValue *v)
+{
+	g_value_unset (v);
+	g_free (v);
+}
+
+static void
+free_loaded (RBExtDBLoaded *loaded)
+{
+	g_free (loaded->cache_key);
+	g_free (loaded->filename);
+	free_value (loaded->data);
+	g_slice_free (RBExtDBLoaded, loaded);
+}
+
+static char *
+loaded_cache_key (const char *filename, int size)
+{
+	return g_strdup_printf ("%d:%s", size, filename);
+}
+
+static void
+remove_loaded (RBExtDB *store, GList *link)
+{
+	RBExtDBLoaded *loaded = link->data;
+
+	g_queue_delete_link (store->priv->loaded_lru, link);
+	g_hash_table_remove (store->priv->loaded, loaded->cache_key);
+	store->priv->loaded_size -= loaded->bytes;
+	free_loaded (loaded);
+}
+
+static void
+forget_loaded (RBExtDB *store, const char *filename)
+{
+	GList *l;
+	GList *n;
+
+	for (l = store->priv->loaded_lru->head; l != NULL; l = n) {
+		RBExtDBLoaded *loaded = l->data;
+		n = l->next;
+		if (g_strcmp0 (loaded->filename, filename) == 0) {
+			rb_debug ("forgetting loaded item %s", loaded->cache_key);
+			remove_loaded (store, l);
+		}
+	}
+}
+
 static void
-answer_request (RBExtDBRequest *request,
+remember_loaded (RBExtDB *store, const char *filename, int size, GValue *data)
+{
+	RBExtDBLoaded *loaded;
+	GList *link;
+
+	if (filename == NULL || data == NULL)
+		return;
+
+	loaded = g_slice_new0 (RBExtDBLoaded);
+	if (G_VALUE_HOLDS (data, GDK_TYPE_PIXBUF)) {
+		GdkPixbuf *pixbuf = GDK_PIXBUF (g_value_get_object (data));
+		loaded->bytes = gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+	} else {
+		loaded->bytes = sizeof (GValue);
+	}
+
+	/* don't let one huge image push everything else out */
+	if (loaded->bytes > LOADED_CACHE_SIZE / 4) {
+		g_slice_free (RBExtDBLoaded, loaded);
+		return;
+	}
+
+	loaded->cache_key = loaded_cache_key (filename, size);
+	loaded->filename = g_strdup (filename);
+	loaded->data = g_new0 (GValue, 1);
+	g_value_init (loaded->data, G_VALUE_TYPE (data));
+	g_value_copy (data, loaded->data);
+
+	link = g_hash_table_lookup (store->priv->loaded, loaded->cache_key);
+	if (link != NULL) {
+		remove_loaded (store, link);
+	}
+
+	g_queue_push_head (store->priv->loaded_lru, loaded);
+	g_hash_table_insert (store->priv->loaded, loaded->cache_key, store->priv->loaded_lru->head);
+	store->priv->loaded_size += loaded->bytes;
+
+	while (store->priv->loaded_size > LOADED_CACHE_SIZE) {
+		remove_loaded (store, store->priv->loaded_lru->tail);
+	}
+}
+
+static GValue *
+lookup_loaded (RBExtDB *store, const char *filename, int size)
+{
+	RBExtDBLoaded *loaded;
+	GList *link;
+	char *cache_key;
+
+	cache_key = loaded_cache_key (filename, size);
+	link = g_hash_table_lookup (store->priv->loaded, cache_key);
+	g_free (cache_key);
+	if (link == NULL)
+		return NULL;
+
+	g_queue_unlink (store->priv->loaded_lru, link);
+	g_queue_push_head_link (store->priv->loaded_lru, link);
+
+	loaded = link->data;
+	return loaded->data;
+}
+
+static void
+answer_request (RBExtDB *store,
+		RBExtDBRequest *request,
 		RBExtDBKey *store_key,
 		const char *filename,
 		GValue *data)
 {
+	GValue *scaled;
+
+	scaled = scale_value (data, request->size);
+	if (scaled != NULL) {
+		data = scaled;
+	}
+	remember_loaded (store, filename, request->size, data);
+
 	request->callback (request->key, store_key, filename, data, request->user_data);
 	free_request (request);
+
+	if (scaled != NULL) {
+		free_value (scaled);
+	}
 }
 
 static RBExtDBRequest *
 create_request (RBExtDBKey *key,
+		int size,
 		RBExtDBRequestCallback callback,
 		gpointer user_data,
 		GDestroyNotify destroy_notify)
 {
 	RBExtDBRequest *req = g_slice_new0 (RBExtDBRequest);
 	req->key = rb_ext_db_key_copy (key);
+	req->size = size;
 	req->callback = callback;
 	req->user_data = user_data;
 	req->destroy_notify = destroy_notify;
@@ -391,6 +591,10 @@ impl_finalize (GObject *object)
 	}
 	g_async_queue_unref (store->priv->store_queue);
 
+	g_hash_table_destroy (store->priv->loaded);
+	g_queue_free_full (store->priv->loaded_lru, (GDestroyNotify) free_loaded);
+	g_mutex_clear (&store->priv->replace_lock);
+
 	if (store->priv->tdb_context) {
 		tdb_close (store->priv->tdb_context);
 	}
@@ -406,6 +610,9 @@ rb_ext_db_init (RBExtDB *store)
 	store->priv = G_TYPE_INSTANCE_GET_PRIVATE (store, RB_TYPE_EXT_DB, RBExtDBPrivate);
 
 	store->priv->store_queue = g_async_queue_new ();
+	store->priv->loaded = g_hash_table_new (g_str_hash, g_str_equal);
+	store->priv->loaded_lru = g_queue_new ();
+	g_mutex_init (&store->priv->replace_lock);
 }
 
 static void
@@ -616,6 +823,17 @@ rb_ext_db_lookup (RBExtDB *store, RBExtDBKey *key, RBExtDBKey **store_key)
 	return path;
 }
 
+static gboolean
+original_replaced_since (RBExtDB *store, guint generation)
+{
+	gboolean replaced;
+
+	g_mutex_lock (&store->priv->replace_lock);
+	replaced = (store->priv->generation != generation);
+	g_mutex_unlock (&store->priv->replace_lock);
+	return replaced;
+}
+
 static void
 load_request_cb (RBExtDB *store, GAsyncResult *result, gpointer data)
 {
@@ -623,27 +841,84 @@ load_request_cb (RBExtDB *store, GAsyncResult *result, gpointer data)
 	req = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
 
 	rb_debug ("finished loading %s", req->filename);
+
+	/* if the original was replaced while we were loading it, what we
+	 * have may be out of date, so don't keep it around.
+	 */
+	if (original_replaced_since (store, req->generation) == FALSE)
+		remember_loaded (store, req->filename, req->size, req->data);
 	req->callback (req->key, req->store_key, req->filename, req->data, req->user_data);
 
 	g_object_unref (result);
 }
 
-static void
-do_load_request (GSimpleAsyncResult *result, GObject *object, GCancellable *cancel)
+static gboolean
+answer_loaded_request (RBExtDBRequest *req)
+{
+	rb_debug ("answering request for %s from loaded items", req->filename);
+	req->callback (req->key, req->store_key, req->filename, req->data, req->user_data);
+	free_request (req);
+	return FALSE;
+}
+
+static gboolean
+get_file_data (GValue *data, const char **file_data, gssize *file_data_size)
+{
+	*file_data = NULL;
+	*file_data_size = 0;
+	if (data == NULL) {
+		/* do nothing */
+	} else if (G_VALUE_HOLDS_STRING (data)) {
+		*file_data = g_value_get_string (data);
+		*file_data_size = strlen (*file_data);
+	} else if (G_VALUE_HOLDS (data, G_TYPE_BYTE_ARRAY)) {
+		GByteArray *bytes = g_value_get_boxed (data);
+		*file_data = (const char *)bytes->data;
+		*file_data_size = bytes->len;
+	} else if (G_VALUE_HOLDS (data, G_TYPE_GSTRING)) {
+		GString *str = g_value_get_boxed (data);
+		*file_data = (const char *)str->str;
+		*file_data_size = str->len;
+	} else {
+		/* warning? */
+		rb_debug ("don't know how to save data of type %s", G_VALUE_TYPE_NAME (data));
+	}
+
+	return (*file_data != NULL && *file_data_size > 0);
+}
+
+static char *
+get_sized_filename (RBExtDB *store, const char *filename, int size)
+{
+	char *storedir;
+	char *sizedir;
+	char *path = NULL;
+
+	/* mirror the layout of the store under the directory for this size */
+	storedir = g_build_filename (rb_user_cache_dir (), store->priv->name, NULL);
+	if (g_str_has_prefix (filename, storedir) && G_IS_DIR_SEPARATOR (filename[strlen (storedir)])) {
+		sizedir = g_strdup_printf ("%d", size);
+		path = g_build_filename (storedir, SIZED_DIR, sizedir, filename + strlen (storedir) + 1, NULL);
+		g_free (sizedir);
+	}
+	g_free (storedir);
+	return path;
+}
+
+static GValue *
+load_file (GObject *store, const char *filename)
 {
-	RBExtDBRequest *req;
 	GFile *f;
 	char *file_data;
 	gsize file_data_size;
 	GError *error = NULL;
+	GValue *value = NULL;
 
-	req = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
-
-	rb_debug ("loading data from %s", req->filename);
-	f = g_file_new_for_path (req->filename);
+	rb_debug ("loading data from %s", filename);
+	f = g_file_new_for_path (filename);
 	g_file_load_contents (f, NULL, &file_data, &file_data_size, NULL, &error);
 	if (error != NULL) {
-		rb_debug ("unable to load item %s: %s", req->filename, error->message);
+		rb_debug ("unable to load item %s: %s", filename, error->message);
 		g_clear_error (&error);
 
 		/* probably need to delete the item from the db */
@@ -659,19 +934,93 @@ do_load_request (GSimpleAsyncResult *result, GObject *object, GCancellable *canc
 		s->allocated_len = file_data_size;
 		g_value_init (&d, G_TYPE_GSTRING);
 		g_value_take_boxed (&d, s);
-		req->data = NULL;
-		g_signal_emit (object, signals[LOAD], 0, &d, &req->data);
+		g_signal_emit (store, signals[LOAD], 0, &d, &value);
 		g_value_unset (&d);
 
-		if (req->data) {
+		if (value) {
 			rb_debug ("converted data into value of type %s",
-				  G_VALUE_TYPE_NAME (req->data));
+				  G_VALUE_TYPE_NAME (value));
 		} else {
 			rb_debug ("data conversion failed");
 		}
 	}
 
 	g_object_unref (f);
+	return value;
+}
+
+static void
+save_sized_file (GObject *store, const char *sized_filename, GValue *value)
+{
+	GValue *encoded = NULL;
+	const char *file_data;
+	gssize file_data_size;
+	GError *error = NULL;
+	char *dir;
+
+	g_signal_emit (store, signals[STORE], 0, value, &encoded);
+	if (encoded == NULL)
+		return;
+
+	if (get_file_data (encoded, &file_data, &file_data_size)) {
+		dir = g_path_get_dirname (sized_filename);
+		g_mkdir_with_parents (dir, 0700);
+		g_free (dir);
+
+		g_file_set_contents (sized_filename, file_data, file_data_size, &error);
+		if (error != NULL) {
+			rb_debug ("error saving %s: %s", sized_filename, error->message);
+			g_clear_error (&error);
+		} else {
+			rb_debug ("saved scaled copy %s", sized_filename);
+		}
+	}
+
+	free_value (encoded);
+}
+
+static void
+do_load_request (GSimpleAsyncResult *result, GObject *object, GCancellable *cancel)
+{
+	RBExtDB *store = RB_EXT_DB (object);
+	RBExtDBRequest *req;
+	GValue *scaled;
+
+	req = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (result));
+
+	g_mutex_lock (&store->priv->replace_lock);
+	req->generation = store->priv->generation;
+	g_mutex_unlock (&store->priv->replace_lock);
+
+	/* scaled copies are removed whenever the original is replaced */
+	if (req->sized_filename != NULL) {
+		req->data = load_file (object, req->sized_filename);
+		if (req->data != NULL)
+			return;
+	}
+
+	req->data = load_file (object, req->filename);
+
+	/* keep a scaled copy of large images for the next request */
+	scaled = scale_value (req->data, req->size);
+	if (scaled != NULL) {
+		free_value (req->data);
+		req->data = scaled;
+
+		/* only save the scaled copy if the original hasn't been
+		 * replaced since we read it, otherwise it would never be
+		 * removed.
+		 */
+		if (req->sized_filename != NULL) {
+			g_mutex_lock (&store->priv->replace_lock);
+			if (store->priv->generation == req->generation) {
+				save_sized_file (object, req->sized_filename, req->data);
+			} else {
+				rb_debug ("%s was replaced while loading, not saving scaled copy", req->filename);
+			}
+			g_mutex_unlock (&store->priv->replace_lock);
+		}
+	}
 }
 
 
@@ -694,6 +1043,34 @@ rb_ext_db_request (RBExtDB *store,
 		   RBExtDBRequestCallback callback,
 		   gpointer user_data,
 		   GDestroyNotify destroy)
+{
+	return rb_ext_db_request_sized (store, key, 0, callback, user_data, destroy);
+}
+
+/**
+ * rb_ext_db_request_sized:
+ * @store: metadata store instance
+ * @key: metadata lookup key
+ * @size: maximum width and height of the image to return, or 0 for the original size
+ * @callback: callback to call with results
+ * @user_data: user data to pass to the callback
+ * @destroy: destroy function for @user_data
+ *
+ * Requests a metadata item, as for rb_ext_db_request.  If the item is an
+ * image larger than @size, it is scaled down before being passed to the
+ * callback.  Scaled images are kept so later requests for the same size
+ * don't need to load the original image.  The filename passed to the
+ * callback is always that of the original item.
+ *
+ * Return value: %TRUE if results may be provided after returning
+ */
+gboolean
+rb_ext_db_request_sized (RBExtDB *store,
+			 RBExtDBKey *key,
+			 int size,
+			 RBExtDBRequestCallback callback,
+			 gpointer user_data,
+			 GDestroyNotify destroy)
 {
 	RBExtDBRequest *req;
 	gboolean result;
@@ -704,6 +1081,7 @@ rb_ext_db_request (RBExtDB *store,
 	GList *l;
 	gboolean emit_request = TRUE;
 	RBExtDBKey *store_key = NULL;
+	GValue *loaded;
 
 	rb_debug ("starting metadata request");
 
@@ -729,14 +1107,28 @@ rb_ext_db_request (RBExtDB *store,
 			rb_debug ("found cached match %s under key %s", filename, str);
 			g_free (str);
 		}
+
+		req = create_request (key, size, callback, user_data, destroy);
+		req->filename = filename;
+		req->store_key = store_key;
+
+		loaded = lookup_loaded (store, filename, size);
+		if (loaded != NULL) {
+			req->data = g_new0 (GValue, 1);
+			g_value_init (req->data, G_VALUE_TYPE (loaded));
+			g_value_copy (loaded, req->data);
+			g_idle_add ((GSourceFunc) answer_loaded_request, req);
+			return FALSE;
+		}
+
+		if (size > 0) {
+			req->sized_filename = get_sized_filename (store, filename, size);
+		}
+
 		load_op = g_simple_async_result_new (G_OBJECT (store),
 						     (GAsyncReadyCallback) load_request_cb,
 						     NULL,
 						     rb_ext_db_request);
-
-		req = create_request (key, callback, user_data, destroy);
-		req->filename = filename;
-		req->store_key = store_key;
 		g_simple_async_result_set_op_res_gpointer (load_op, req, (GDestroyNotify) free_request);
 
 		g_simple_async_result_run_in_thread (load_op,
@@ -778,7 +1170,7 @@ rb_ext_db_request (RBExtDB *store,
 	g_free (tdbkey.dptr);
 
 	/* add stuff to list of outstanding requests */
-	req = create_request (key, callback, user_data, destroy);
+	req = create_request (key, size, callback, user_data, destroy);
 	store->priv->requests = g_list_append (store->priv->requests, req);
 
 	/* and let metadata providers request it */
@@ -793,6 +1185,27 @@ rb_ext_db_request (RBExtDB *store,
 	return result;
 }
 
+static void
+delete_sized_files (RBExtDB *store, const char *filename)
+{
+	char *fullname;
+	char *sizeddir;
+	const char *size;
+	GDir *dir;
+
+	sizeddir = g_build_filename (rb_user_cache_dir (), store->priv->name, SIZED_DIR, NULL);
+	dir = g_dir_open (sizeddir, 0, NULL);
+	if (dir != NULL) {
+		while ((size = g_dir_read_name (dir)) != NULL) {
+			fullname = g_build_filename (sizeddir, size, filename, NULL);
+			g_unlink (fullname);
+			g_free (fullname);
+		}
+		g_dir_close (dir);
+	}
+	g_free (sizeddir);
+}
+
 static void
 delete_file (RBExtDB *store, const char *filename)
 {
@@ -800,6 +1213,9 @@ delete_file (RBExtDB *store, const char *filename)
 	GFile *f;
 	GError *error = NULL;
 
+	/* remove any scaled copies first */
+	delete_sized_files (store, filename);
+
 	fullname = g_build_filename (rb_user_cache_dir (), store->priv->name, filename, NULL);
 	f = g_file_new_for_path (fullname);
 	g_free (fullname);
@@ -826,6 +1242,10 @@ store_request_cb (RBExtDB *store, GAsyncResult *result, gpointer data)
 	} else if (sreq->stored) {
 		GList *l;
 
+		/* anything loaded from the old contents of the file is out of date */
+		if (sreq->filename != NULL)
+			forget_loaded (store, sreq->filename);
+
 		/* answer any matching queries */
 		l = store->priv->requests;
 		while (l != NULL) {
@@ -833,7 +1253,7 @@ store_request_cb (RBExtDB *store, GAsyncResult *result, gpointer data)
 			if (rb_ext_db_key_matches (sreq->key, req->key)) {
 				GList *n = l->next;
 				rb_debug ("answering metadata request %p", req);
-				answer_request (req, sreq->key, sreq->filename, sreq->value);
+				answer_request (store, req, sreq->key, sreq->filename, sreq->value);
 				store->priv->requests = g_list_delete_link (store->priv->requests, l);
 				l = n;
 			} else {
@@ -965,27 +1385,7 @@ do_store_request (GSimpleAsyncResult *result, GObject *object, GCancellable *can
 	}
 
 	/* get data to write to file */
-	file_data = NULL;
-	file_data_size = 0;
-	if (req->data == NULL) {
-		/* do nothing */
-	} else if (G_VALUE_HOLDS_STRING (req->data)) {
-		file_data = g_value_get_string (req->data);
-		file_data_size = strlen (file_data);
-	} else if (G_VALUE_HOLDS (req->data, G_TYPE_BYTE_ARRAY)) {
-		GByteArray *bytes = g_value_get_boxed (req->data);
-		file_data = (const char *)bytes->data;
-		file_data_size = bytes->len;
-	} else if (G_VALUE_HOLDS (req->data, G_TYPE_GSTRING)) {
-		GString *str = g_value_get_boxed (req->data);
-		file_data = (const char *)str->str;
-		file_data_size = str->len;
-	} else {
-		/* warning? */
-		rb_debug ("don't know how to save data of type %s", G_VALUE_TYPE_NAME (req->data));
-	}
-
-	if (file_data != NULL && file_data_size > 0) {
+	if (get_file_data (req->data, &file_data, &file_data_size)) {
 		GFile *f;
 		GError *error = NULL;
 		char *subdir = NULL;
@@ -1025,6 +1425,7 @@ do_store_request (GSimpleAsyncResult *result, GObject *object, GCancellable *can
 
 		f = g_file_new_for_path (req->filename);
 
+		g_mutex_lock (&store->priv->replace_lock);
 		g_file_replace_contents (f,
 					 file_data,
 					 file_data_size,
@@ -1038,8 +1439,12 @@ do_store_request (GSimpleAsyncResult *result, GObject *object, GCancellable *can
 			rb_debug ("error saving %s: %s", req->filename, error->message);
 			g_clear_error (&error);
 		} else {
+			/* scaled copies of the old contents are out of date */
+			delete_sized_files (store, filename);
+			store->priv->generation++;
 			req->stored = TRUE;
 		}
+		g_mutex_unlock (&store->priv->replace_lock);
 
 		g_free (basename);
 		g_free (subdir);
@@ -1047,7 +1452,10 @@ do_store_request (GSimpleAsyncResult *result, GObject *object, GCancellable *can
 		g_object_unref (f);
 	} else if (req->source_type == RB_EXT_DB_SOURCE_USER_EXPLICIT) {
 		if (filename != NULL) {
+			g_mutex_lock (&store->priv->replace_lock);
 			delete_file (store, filename);
+			store->priv->generation++;
+			g_mutex_unlock (&store->priv->replace_lock);
 			g_free (filename);
 			filename = NULL;
 		}
@@ -1199,6 +1607,12 @@ rb_ext_db_delete (RBExtDB *store, RBExtDBKey *key)
 
 		extract_data (value, NULL, &fn, NULL);
 		if (fn != NULL) {
+			char *path;
+
+			path = g_build_filename (rb_user_cache_dir (), store->priv->name, fn, NULL);
+			forget_loaded (store, path);
+			g_free (path);
+
 			delete_file (store, fn);
 			g_free (fn);
 		}
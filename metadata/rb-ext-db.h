@@ -103,6 +103,12 @@ gboolean		rb_ext_db_request		(RBExtDB *store,
 							 RBExtDBRequestCallback callback,
 							 gpointer user_data,
 							 GDestroyNotify destroy);
+gboolean		rb_ext_db_request_sized		(RBExtDB *store,
+							 RBExtDBKey *key,
+							 int size,
+							 RBExtDBRequestCallback callback,
+							 gpointer user_data,
+							 GDestroyNotify destroy);
 
 /* for providers */
 void			rb_ext_db_store_uri		(RBExtDB *store,
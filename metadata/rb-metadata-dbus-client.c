@@ -44,6 +44,12 @@
  * child is still capable of handling messages, and it ensures the child
  * doesn't time out between when we check the child is still running and when
  * we actually send it the request.
+ *
+ * To allow several files to be read at once, there is a pool of helper
+ * processes, each handling one request at a time.  A request takes an idle
+ * helper from the pool, starting a new one if the pool isn't full yet, or
+ * waits for one to become idle.  A helper that crashes only affects the
+ * request it was handling.
  */
 
 /**
@@ -74,14 +80,25 @@ static void rb_metadata_class_init (RBMetaDataClass *klass);
 static void rb_metadata_init (RBMetaData *md);
 static void rb_metadata_finalize (GObject *object);
 
+typedef struct {
+	GDBusConnection *connection;
+	GPid child;
+	int child_stdout;
+	gboolean busy;
+} RBMetaDataHelper;
+
 static gboolean tried_env_address = FALSE;
-static GDBusConnection *dbus_connection = NULL;
-static GPid metadata_child = 0;
-static int metadata_stdout = -1;
+static gboolean using_env_address = FALSE;
+static char *env_address = NULL;
 static GMainContext *main_context = NULL;
-static GMutex conn_mutex;
 static char **saveable_types = NULL;
 
+/* protects the helper pool and saveable types */
+static GMutex pool_mutex;
+static GCond pool_cond;
+static GPtrArray *helpers = NULL;
+static guint max_helpers = 1;
+
 struct RBMetaDataPrivate
 {
 	char       *media_type;
@@ -141,47 +158,149 @@ rb_metadata_new (void)
 }
 
 static void
-kill_metadata_service (void)
+kill_metadata_service (RBMetaDataHelper *helper)
 {
-	if (dbus_connection) {
-		if (g_dbus_connection_is_closed (dbus_connection) == FALSE) {
+	if (helper->connection) {
+		if (g_dbus_connection_is_closed (helper->connection) == FALSE) {
 			rb_debug ("closing dbus connection");
-			g_dbus_connection_close_sync (dbus_connection, NULL, NULL);
+			g_dbus_connection_close_sync (helper->connection, NULL, NULL);
 		} else {
 			rb_debug ("dbus connection already closed");
 		}
-		g_object_unref (dbus_connection);
-		dbus_connection = NULL;
+		g_object_unref (helper->connection);
+		helper->connection = NULL;
 	}
 
-	if (metadata_child) {
-		rb_debug ("killing child process");
-		kill (metadata_child, SIGINT);
-		g_spawn_close_pid (metadata_child);
-		metadata_child = 0;
+	if (helper->child) {
+		rb_debug ("killing child process %d", helper->child);
+		kill (helper->child, SIGINT);
+		g_spawn_close_pid (helper->child);
+		helper->child = 0;
 	}
 
-	if (metadata_stdout != -1) {
+	if (helper->child_stdout != -1) {
 		rb_debug ("closing metadata child process stdout pipe");
-		close (metadata_stdout);
-		metadata_stdout = -1;
+		close (helper->child_stdout);
+		helper->child_stdout = -1;
+	}
+}
+
+static guint
+get_max_helpers (void)
+{
+	/* only one service can be reached at the address from the environment */
+	if (using_env_address)
+		return 1;
+	if (max_helpers == 0)
+		return g_get_num_processors ();
+	return max_helpers;
+}
+
+/* called with the pool mutex held, before any helpers are started */
+static void
+check_env_address (void)
+{
+	const char *addr;
+
+	if (tried_env_address)
+		return;
+
+	tried_env_address = TRUE;
+	addr = g_getenv ("RB_DBUS_METADATA_ADDRESS");
+	if (addr) {
+		env_address = g_strdup (addr);
+		using_env_address = TRUE;
+	}
+}
+
+/* returns an idle helper, waiting for one if they're all busy */
+static RBMetaDataHelper *
+acquire_helper (void)
+{
+	RBMetaDataHelper *helper = NULL;
+	guint i;
+
+	g_mutex_lock (&pool_mutex);
+	if (helpers == NULL)
+		helpers = g_ptr_array_new ();
+
+	/* this limits the pool to one helper, so it has to be known
+	 * before we decide whether to start another one.
+	 */
+	check_env_address ();
+
+	while (helper == NULL) {
+		/* prefer helpers that are already running */
+		for (i = 0; i < helpers->len; i++) {
+			RBMetaDataHelper *h = g_ptr_array_index (helpers, i);
+			if (h->busy == FALSE && (helper == NULL || h->connection != NULL))
+				helper = h;
+		}
+
+		if (helper == NULL && helpers->len < get_max_helpers ()) {
+			helper = g_new0 (RBMetaDataHelper, 1);
+			helper->child_stdout = -1;
+			g_ptr_array_add (helpers, helper);
+			rb_debug ("metadata helper pool now has %u helpers", helpers->len);
+		}
+
+		if (helper == NULL)
+			g_cond_wait (&pool_cond, &pool_mutex);
+	}
+
+	helper->busy = TRUE;
+	g_mutex_unlock (&pool_mutex);
+	return helper;
+}
+
+static void
+release_helper (RBMetaDataHelper *helper)
+{
+	g_mutex_lock (&pool_mutex);
+	helper->busy = FALSE;
+
+	/* shrink the pool if the limit has been lowered */
+	if (helpers->len > get_max_helpers ()) {
+		g_ptr_array_remove (helpers, helper);
+		kill_metadata_service (helper);
+		g_free (helper);
 	}
+
+	g_cond_signal (&pool_cond);
+	g_mutex_unlock (&pool_mutex);
+}
+
+/**
+ * rb_metadata_set_max_helpers:
+ * @count: maximum number of metadata helper processes, or 0
+ *
+ * Sets the maximum number of metadata helper processes to run at once,
+ * which is also the number of metadata requests that can be processed
+ * at once.  If @count is 0, one helper is used per processor.
+ */
+void
+rb_metadata_set_max_helpers (guint count)
+{
+	g_mutex_lock (&pool_mutex);
+	max_helpers = count;
+	g_cond_broadcast (&pool_cond);
+	g_mutex_unlock (&pool_mutex);
 }
 
 static gboolean
-ping_metadata_service (GError **error)
+ping_metadata_service (RBMetaDataHelper *helper, GError **error)
 {
 	GDBusMessage *message;
 	GDBusMessage *response;
 
-	if (g_dbus_connection_is_closed (dbus_connection))
+	if (g_dbus_connection_is_closed (helper->connection))
 		return FALSE;
 
 	message = g_dbus_message_new_method_call (RB_METADATA_DBUS_NAME,
 						  RB_METADATA_DBUS_OBJECT_PATH,
 						  RB_METADATA_DBUS_INTERFACE,
 						  "ping");
-	response = g_dbus_connection_send_message_with_reply_sync (dbus_connection,
+	response = g_dbus_connection_send_message_with_reply_sync (helper->connection,
 								   message,
 								   G_DBUS_MESSAGE_FLAGS_NONE,
 								   RB_METADATA_DBUS_TIMEOUT,
@@ -202,36 +321,37 @@ ping_metadata_service (GError **error)
 }
 
 static gboolean
-start_metadata_service (GError **error)
+start_metadata_service (RBMetaDataHelper *helper, GError **error)
 {
 	GIOChannel *stdout_channel;
 	GIOStatus status;
 	gchar *dbus_address = NULL;
 	char *saveable_type_list;
 	GVariant *response_body;
+	char **types;
 
-	if (dbus_connection) {
-		if (ping_metadata_service (error))
+	if (helper->connection) {
+		if (ping_metadata_service (helper, error))
 			return TRUE;
 
 		/* Metadata service is broken.  Kill it, and if we haven't run
 		 * into any errors yet, we can try to restart it.
 		 */
-		kill_metadata_service ();
+		kill_metadata_service (helper);
 
 		if (*error)
 			return FALSE;
 	}
 
-	if (!tried_env_address) {
-		const char *addr = g_getenv ("RB_DBUS_METADATA_ADDRESS");
-		tried_env_address = TRUE;
-		if (addr) {
-			rb_debug ("trying metadata service address %s (from environment)", addr);
-			dbus_address = g_strdup (addr);
-			metadata_child = 0;
-		}
+	/* the address from the environment is only tried once */
+	g_mutex_lock (&pool_mutex);
+	if (env_address != NULL) {
+		rb_debug ("trying metadata service address %s (from environment)", env_address);
+		dbus_address = env_address;
+		env_address = NULL;
+		helper->child = 0;
 	}
+	g_mutex_unlock (&pool_mutex);
 
 	if (dbus_address == NULL) {
 		GPtrArray *argv;
@@ -267,9 +387,9 @@ start_metadata_service (GError **error)
 						NULL,
 						0,
 						NULL, NULL,
-						&metadata_child,
+						&helper->child,
 						NULL,
-						&metadata_stdout,
+						&helper->child_stdout,
 						NULL,
 						&local_error);
 		g_ptr_array_free (argv, TRUE);
@@ -280,11 +400,11 @@ start_metadata_service (GError **error)
 			return FALSE;
 		}
 
-		stdout_channel = g_io_channel_unix_new (metadata_stdout);
+		stdout_channel = g_io_channel_unix_new (helper->child_stdout);
 		status = g_io_channel_read_line (stdout_channel, &dbus_address, NULL, NULL, error);
 		g_io_channel_unref (stdout_channel);
 		if (status != G_IO_STATUS_NORMAL) {
-			kill_metadata_service ();
+			kill_metadata_service (helper);
 			return FALSE;
 		}
 
@@ -292,27 +412,23 @@ start_metadata_service (GError **error)
 		rb_debug ("Got metadata helper D-BUS address %s", dbus_address);
 	}
 
-	dbus_connection = g_dbus_connection_new_for_address_sync (dbus_address,
-								  G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
-								  NULL,
-								  NULL,
-								  error);
+	helper->connection = g_dbus_connection_new_for_address_sync (dbus_address,
+								     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+								     NULL,
+								     NULL,
+								     error);
 	g_free (dbus_address);
 	if (*error != NULL) {
-		kill_metadata_service ();
+		kill_metadata_service (helper);
 		return FALSE;
 	}
 
-	g_dbus_connection_set_exit_on_close (dbus_connection, FALSE);
+	g_dbus_connection_set_exit_on_close (helper->connection, FALSE);
 
-	rb_debug ("Metadata process %d started", metadata_child);
+	rb_debug ("Metadata process %d started", helper->child);
 
 	/* now ask it what types it can re-tag */
-	if (saveable_types != NULL) {
-		g_strfreev (saveable_types);
-	}
-
-	response_body = g_dbus_connection_call_sync (dbus_connection,
+	response_body = g_dbus_connection_call_sync (helper->connection,
 						     RB_METADATA_DBUS_NAME,
 						     RB_METADATA_DBUS_OBJECT_PATH,
 						     RB_METADATA_DBUS_INTERFACE,
@@ -328,9 +444,9 @@ start_metadata_service (GError **error)
 		return FALSE;
 	}
 
-	g_variant_get (response_body, "(^as)", &saveable_types);
-	if (saveable_types != NULL) {
-		saveable_type_list = g_strjoinv (", ", saveable_types);
+	g_variant_get (response_body, "(^as)", &types);
+	if (types != NULL) {
+		saveable_type_list = g_strjoinv (", ", types);
 		rb_debug ("saveable types from metadata helper: %s", saveable_type_list);
 		g_free (saveable_type_list);
 	} else {
@@ -338,6 +454,11 @@ start_metadata_service (GError **error)
 	}
 	g_variant_unref (response_body);
 
+	g_mutex_lock (&pool_mutex);
+	g_strfreev (saveable_types);
+	saveable_types = types;
+	g_mutex_unlock (&pool_mutex);
+
 	return TRUE;
 }
 
@@ -378,6 +499,7 @@ rb_metadata_load (RBMetaData *md,
 		  const char *uri,
 		  GError **error)
 {
+	RBMetaDataHelper *helper;
 	GVariant *response;
 	GError *fake_error = NULL;
 
@@ -387,13 +509,15 @@ rb_metadata_load (RBMetaData *md,
 	rb_metadata_reset (md);
 	if (uri == NULL)
 		return;
-	g_mutex_lock (&conn_mutex);
 
-	start_metadata_service (error);
+	rb_trace_begin ("metadata", "load");
+	helper = acquire_helper ();
+
+	start_metadata_service (helper, error);
 
 	if (*error == NULL) {
 		rb_debug ("sending metadata load request: %s", uri);
-		response = g_dbus_connection_call_sync (dbus_connection,
+		response = g_dbus_connection_call_sync (helper->connection,
 							RB_METADATA_DBUS_NAME,
 							RB_METADATA_DBUS_OBJECT_PATH,
 							RB_METADATA_DBUS_INTERFACE,
@@ -466,13 +590,78 @@ rb_metadata_load (RBMetaData *md,
 		 */
 		if (*error == NULL && g_strv_length (md->priv->missing_plugins) > 0) {
 			rb_debug ("missing plugins; killing metadata service to force registry reload");
-			kill_metadata_service ();
+			kill_metadata_service (helper);
 		}
 	}
+
+	rb_trace_counter_add ("metadata.loads", 1);
+	if (*error != NULL)
+		rb_trace_counter_add ("metadata.load-errors", 1);
 	if (fake_error)
 		g_error_free (fake_error);
 
-	g_mutex_unlock (&conn_mutex);
+	release_helper (helper);
+	rb_trace_end ("metadata", "load");
+}
+
+static void
+load_thread (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	GError *error = NULL;
+
+	rb_metadata_load (RB_METADATA (source_object), task_data, &error);
+	if (error != NULL)
+		g_task_return_error (task, error);
+	else
+		g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * rb_metadata_load_async:
+ * @md: a #RBMetaData
+ * @uri: URI from which to load metadata
+ * @cancellable: optional #GCancellable
+ * @callback: (scope async): callback to call when the metadata has been loaded
+ * @user_data: data to pass to @callback
+ *
+ * Starts reading metadata information from the specified URI without
+ * blocking the caller.  Use rb_metadata_load_finish in @callback to get
+ * the result.  Several requests can be in progress at once, up to the
+ * number of metadata helper processes allowed.
+ */
+void
+rb_metadata_load_async (RBMetaData *md,
+			const char *uri,
+			GCancellable *cancellable,
+			GAsyncReadyCallback callback,
+			gpointer user_data)
+{
+	GTask *task;
+
+	task = g_task_new (md, cancellable, callback, user_data);
+	g_task_set_task_data (task, g_strdup (uri), g_free);
+	g_task_run_in_thread (task, load_thread);
+	g_object_unref (task);
+}
+
+/**
+ * rb_metadata_load_finish:
+ * @md: a #RBMetaData
+ * @result: the #GAsyncResult passed to the callback
+ * @error: returns error information
+ *
+ * Completes a request started with rb_metadata_load_async.
+ *
+ * Return value: %TRUE if the metadata was loaded successfully
+ */
+gboolean
+rb_metadata_load_finish (RBMetaData *md,
+			 GAsyncResult *result,
+			 GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, md), FALSE);
+
+	return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 /**
@@ -607,19 +796,25 @@ rb_metadata_set (RBMetaData *md, RBMetaDataField field,
 gboolean
 rb_metadata_can_save (RBMetaData *md, const char *media_type)
 {
+	RBMetaDataHelper *helper;
 	GError *error = NULL;
 	gboolean result = FALSE;
 	int i = 0;
 
-	g_mutex_lock (&conn_mutex);
-
+	g_mutex_lock (&pool_mutex);
 	if (saveable_types == NULL) {
-		if (start_metadata_service (&error) == FALSE) {
+		g_mutex_unlock (&pool_mutex);
+
+		helper = acquire_helper ();
+		if (start_metadata_service (helper, &error) == FALSE) {
 			g_warning ("unable to start metadata service: %s", error->message);
-			g_mutex_unlock (&conn_mutex);
+			release_helper (helper);
 			g_error_free (error);
 			return FALSE;
 		}
+		release_helper (helper);
+
+		g_mutex_lock (&pool_mutex);
 	}
 
 	if (saveable_types != NULL) {
@@ -631,7 +826,7 @@ rb_metadata_can_save (RBMetaData *md, const char *media_type)
 		}
 	}
 
-	g_mutex_unlock (&conn_mutex);
+	g_mutex_unlock (&pool_mutex);
 	return result;
 }
 
@@ -648,7 +843,12 @@ rb_metadata_can_save (RBMetaData *md, const char *media_type)
 char **
 rb_metadata_get_saveable_types (RBMetaData *md)
 {
-	return g_strdupv (saveable_types);
+	char **types;
+
+	g_mutex_lock (&pool_mutex);
+	types = g_strdupv (saveable_types);
+	g_mutex_unlock (&pool_mutex);
+	return types;
 }
 
 /**
@@ -663,18 +863,19 @@ rb_metadata_get_saveable_types (RBMetaData *md)
 void
 rb_metadata_save (RBMetaData *md, const char *uri, GError **error)
 {
+	RBMetaDataHelper *helper;
 	GVariant *response;
 	GError *fake_error = NULL;
 
 	if (error == NULL)
 		error = &fake_error;
 
-	g_mutex_lock (&conn_mutex);
+	helper = acquire_helper ();
 
-	start_metadata_service (error);
+	start_metadata_service (helper, error);
 
 	if (*error == NULL) {
-		response = g_dbus_connection_call_sync (dbus_connection,
+		response = g_dbus_connection_call_sync (helper->connection,
 							RB_METADATA_DBUS_NAME,
 							RB_METADATA_DBUS_OBJECT_PATH,
 							RB_METADATA_DBUS_INTERFACE,
@@ -707,7 +908,7 @@ rb_metadata_save (RBMetaData *md, const char *uri, GError **error)
 	if (fake_error)
 		g_error_free (fake_error);
 
-	g_mutex_unlock (&conn_mutex);
+	release_helper (helper);
 }
 
 gboolean
@@ -29,6 +29,7 @@
 #define __RB_METADATA_H
 
 #include <glib-object.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -136,6 +137,16 @@ void		rb_metadata_reset	(RBMetaData *md);
 void		rb_metadata_load	(RBMetaData *md,
 					 const char *uri,
 					 GError **error);
+void		rb_metadata_load_async	(RBMetaData *md,
+					 const char *uri,
+					 GCancellable *cancellable,
+					 GAsyncReadyCallback callback,
+					 gpointer user_data);
+gboolean	rb_metadata_load_finish	(RBMetaData *md,
+					 GAsyncResult *result,
+					 GError **error);
+
+void		rb_metadata_set_max_helpers (guint count);
 
 void		rb_metadata_save	(RBMetaData *md,
 					 const char *uri,
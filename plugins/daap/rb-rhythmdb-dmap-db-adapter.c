@@ -41,43 +41,111 @@
 struct RBRhythmDBDMAPDbAdapterPrivate {
 	RhythmDB *db;
 	RhythmDBEntryType *entry_type;
+
+	/* entry ID -> RBDAAPRecord, built the first time the records are needed */
+	GHashTable *records;
 };
 
-typedef struct ForeachAdapterData {
-	gpointer data;
-	GHFunc func;
-} ForeachAdapterData;
+/*
+ * Sharing the library means handing a record for every entry to
+ * libdmapsharing each time a client asks for the track listing.  Rather
+ * than creating all of these again for each request, the records are
+ * created once and then kept up to date as entries are added, changed
+ * and removed.
+ */
 
-static DMAPRecord *
-rb_rhythmdb_dmap_db_adapter_lookup_by_id (const DMAPDb *db, guint id)
+static void
+cache_entry (RBRhythmDBDMAPDbAdapter *adapter, RhythmDBEntry *entry)
 {
-	RhythmDBEntry *entry;
+	gulong id;
 
-	g_assert (RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->db != NULL);
+	id = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_ENTRY_ID);
+	g_hash_table_insert (adapter->priv->records,
+			     GUINT_TO_POINTER (id),
+			     rb_daap_record_new (entry));
+}
 
-	entry = rhythmdb_entry_lookup_by_id (
-			RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->db,
-			id);
+static void
+entry_added_cb (RhythmDB *db, RhythmDBEntry *entry, RBRhythmDBDMAPDbAdapter *adapter)
+{
+	if (rhythmdb_entry_get_entry_type (entry) == adapter->priv->entry_type) {
+		cache_entry (adapter, entry);
+	}
+}
 
-	return DMAP_RECORD (rb_daap_record_new (entry));
+static void
+entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry, GPtrArray *changes, RBRhythmDBDMAPDbAdapter *adapter)
+{
+	guint i;
+
+	for (i = 0; i < changes->len; i++) {
+		RhythmDBEntryChange *change = g_ptr_array_index (changes, i);
+
+		/* the entry may have stopped or started being one of ours */
+		if (change->prop == RHYTHMDB_PROP_TYPE) {
+			gulong id = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_ENTRY_ID);
+			g_hash_table_remove (adapter->priv->records, GUINT_TO_POINTER (id));
+			break;
+		}
+	}
+
+	/* records are immutable as far as libdmapsharing is concerned,
+	 * so replace the old one rather than updating it.
+	 */
+	entry_added_cb (db, entry, adapter);
 }
 
 static void
-foreach_adapter (RhythmDBEntry *entry, gpointer data)
+entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry, RBRhythmDBDMAPDbAdapter *adapter)
 {
 	gulong id;
-	DMAPRecord *record;
-	ForeachAdapterData *foreach_adapter_data;
-	
+
 	id = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_ENTRY_ID);
-	foreach_adapter_data = data;
-	record = DMAP_RECORD (rb_daap_record_new (entry));
+	g_hash_table_remove (adapter->priv->records, GUINT_TO_POINTER (id));
+}
 
-	foreach_adapter_data->func (GUINT_TO_POINTER (id),
-				    record,
-				    foreach_adapter_data->data);
+static void
+foreach_cache_entry (RhythmDBEntry *entry, gpointer data)
+{
+	cache_entry (RB_RHYTHMDB_DMAP_DB_ADAPTER (data), entry);
+}
 
-	g_object_unref (record);
+static GHashTable *
+get_records (RBRhythmDBDMAPDbAdapter *adapter)
+{
+	RBRhythmDBDMAPDbAdapterPrivate *priv = adapter->priv;
+
+	if (priv->records != NULL)
+		return priv->records;
+
+	priv->records = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_object_unref);
+	rhythmdb_entry_foreach_by_type (priv->db,
+					priv->entry_type,
+					foreach_cache_entry,
+					adapter);
+
+	g_signal_connect_object (priv->db, "entry-added", G_CALLBACK (entry_added_cb), adapter, 0);
+	g_signal_connect_object (priv->db, "entry-changed", G_CALLBACK (entry_changed_cb), adapter, 0);
+	g_signal_connect_object (priv->db, "entry-deleted", G_CALLBACK (entry_deleted_cb), adapter, 0);
+	return priv->records;
+}
+
+static DMAPRecord *
+rb_rhythmdb_dmap_db_adapter_lookup_by_id (const DMAPDb *db, guint id)
+{
+	RBRhythmDBDMAPDbAdapter *adapter = RB_RHYTHMDB_DMAP_DB_ADAPTER (db);
+	RhythmDBEntry *entry;
+	DMAPRecord *record;
+
+	g_assert (adapter->priv->db != NULL);
+
+	record = g_hash_table_lookup (get_records (adapter), GUINT_TO_POINTER (id));
+	if (record != NULL)
+		return g_object_ref (record);
+
+	entry = rhythmdb_entry_lookup_by_id (adapter->priv->db, id);
+
+	return DMAP_RECORD (rb_daap_record_new (entry));
 }
 
 static void
@@ -85,20 +153,9 @@ rb_rhythmdb_dmap_db_adapter_foreach	(const DMAPDb *db,
 					 GHFunc func,
 				         gpointer data)
 {
-	ForeachAdapterData *foreach_adapter_data;
-
 	g_assert (RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->db != NULL);
 
-	foreach_adapter_data = g_new (ForeachAdapterData, 1);
-	foreach_adapter_data->data = data;
-	foreach_adapter_data->func = func;
-
-	rhythmdb_entry_foreach_by_type (RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->db,
-					RB_RHYTHMDB_DMAP_DB_ADAPTER (db)->priv->entry_type,
-				        foreach_adapter,
-				        foreach_adapter_data);
-
-	g_free (foreach_adapter_data);
+	g_hash_table_foreach (get_records (RB_RHYTHMDB_DMAP_DB_ADAPTER (db)), func, data);
 }
 
 static gint64
@@ -242,9 +299,25 @@ rb_rhythmdb_dmap_db_adapter_init (RBRhythmDBDMAPDbAdapter *db)
 	db->priv = RB_RHYTHMDB_DMAP_DB_ADAPTER_GET_PRIVATE (db);
 }
 
+static void
+rb_rhythmdb_dmap_db_adapter_finalize (GObject *object)
+{
+	RBRhythmDBDMAPDbAdapter *db = RB_RHYTHMDB_DMAP_DB_ADAPTER (object);
+
+	if (db->priv->records != NULL) {
+		g_hash_table_destroy (db->priv->records);
+	}
+
+	G_OBJECT_CLASS (rb_rhythmdb_dmap_db_adapter_parent_class)->finalize (object);
+}
+
 static void
 rb_rhythmdb_dmap_db_adapter_class_init (RBRhythmDBDMAPDbAdapterClass *klass)
 {
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = rb_rhythmdb_dmap_db_adapter_finalize;
+
 	g_type_class_add_private (klass, sizeof (RBRhythmDBDMAPDbAdapterPrivate));
 }
 
@@ -82,6 +82,7 @@ typedef struct
 	guint property_emit_id;
 
 	gint64 last_elapsed;
+	gint64 last_elapsed_time;
 } RBMprisPlugin;
 
 typedef struct
@@ -1225,6 +1226,7 @@ playing_entry_changed_cb (RBShellPlayer *player, RhythmDBEntry *entry, RBMprisPl
 {
 	rb_debug ("emitting Metadata and CanSeek changed");
 	plugin->last_elapsed = 0;
+	plugin->last_elapsed_time = g_get_monotonic_time ();
 	metadata_changed (plugin, entry);
 	add_player_property_change (plugin, "CanSeek", get_can_seek (plugin));
 }
@@ -1332,14 +1334,24 @@ player_has_prev_changed_cb (GObject *object, GParamSpec *pspec, RBMprisPlugin *p
 static void
 elapsed_nano_changed_cb (RBShellPlayer *player, gint64 elapsed, RBMprisPlugin *plugin)
 {
+	gint64 now;
+	gint64 max_increase;
+
 	/* interpret any change in the elapsed time other than an
-	 * increase of less than one second as a seek.  this includes
-	 * the seek back that we do after pausing (with crossfading),
+	 * increase of no more than the real time that has passed
+	 * (plus half a second, to allow for timer jitter) as a seek.
+	 * the player may only report the position every second or so,
+	 * so we can't just look at the size of the increase.  this
+	 * includes the seek back that we do after pausing (with crossfading),
 	 * which we intentionally report as a seek to help clients get
 	 * their time displays right.
 	 */
+	now = g_get_monotonic_time ();
+	max_increase = (now - plugin->last_elapsed_time) * 1000 + (G_USEC_PER_SEC * 500);
+	plugin->last_elapsed_time = now;
+
 	if (elapsed >= plugin->last_elapsed &&
-	    (elapsed - plugin->last_elapsed < (G_USEC_PER_SEC * 1000))) {
+	    (elapsed - plugin->last_elapsed < max_increase)) {
 		plugin->last_elapsed = elapsed;
 		return;
 	}
@@ -430,6 +430,9 @@ update_current_playing_data (RBNotificationPlugin *plugin, RhythmDBEntry *entry)
 
 		/* request album art */
 		key = rhythmdb_entry_create_ext_db_key (entry, RHYTHMDB_PROP_ALBUM);
+		/* only the file name is passed to the notification daemon,
+		 * so a scaled copy wouldn't be used.
+		 */
 		rb_ext_db_request (plugin->art_store,
 				   key,
 				   (RBExtDBRequestCallback) art_cb,
@@ -116,7 +116,7 @@ request_cover_art (MxFrame *frame, RhythmDBEntry *entry)
 	art_store = rb_ext_db_new ("album-art");
 
 	key = rhythmdb_entry_create_ext_db_key (entry, RHYTHMDB_PROP_ALBUM);
-	rb_ext_db_request (art_store, key, (RBExtDBRequestCallback) art_cb, g_object_ref (frame), g_object_unref);
+	rb_ext_db_request_sized (art_store, key, MAX_IMAGE_HEIGHT, (RBExtDBRequestCallback) art_cb, g_object_ref (frame), g_object_unref);
 	rb_ext_db_key_free (key);
 
 	g_object_unref (art_store);
@@ -0,0 +1,1033 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <libsoup/soup.h>
+
+#include "rb-podcast-downloader.h"
+#include "rb-debug.h"
+#include "rb-util.h"
+
+/**
+ * SECTION:rb-podcast-downloader
+ * @short_description: schedules podcast episode downloads
+ *
+ * The podcast downloader runs a number of downloads at once, limiting
+ * both the total number of transfers and the number of transfers from
+ * any single host.  Downloads are started in the order they were added,
+ * except that a download is skipped over while its host is at its limit.
+ *
+ * Each download first finds out what it can about the remote file (its
+ * size and a suggested file name), then asks the caller where to put it.
+ * If the destination already holds part of the file, from an earlier
+ * download that was cancelled or interrupted, the downloader resumes
+ * from the end of it, using an HTTP range request for HTTP URIs and
+ * seeking the input stream for anything else.
+ *
+ * All callbacks are called on the main thread.  Progress is reported
+ * once a second, along with the aggregate download rate, which is
+ * available as the "download-rate" property.
+ */
+
+#define DEFAULT_MAX_DOWNLOADS		3
+#define DEFAULT_MAX_DOWNLOADS_PER_HOST	2
+
+#define DOWNLOAD_BUFFER_SIZE		65536
+
+#define PROBE_ATTRIBUTES		G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+					G_FILE_ATTRIBUTE_STANDARD_COPY_NAME "," \
+					G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," \
+					G_FILE_ATTRIBUTE_STANDARD_EDIT_NAME
+
+struct _RBPodcastDownload
+{
+	RBPodcastDownloader *downloader;
+
+	char *uri;
+	char *host;
+	gboolean http;
+	GFile *destination;
+	char *validator;		/* ETag or Last-Modified from the server, for If-Range */
+
+	GCancellable *cancel;
+	GError *error;
+
+	/* protected by the downloader's stats lock while transferring */
+	guint64 offset;
+	guint64 downloaded;
+	guint64 total;
+
+	guint64 reported;
+
+	GOutputStream *out_stream;
+	SoupMessage *message;
+
+	RBPodcastDownloadDestinationFunc destination_func;
+	RBPodcastDownloadProgressFunc progress_func;
+	RBPodcastDownloadDoneFunc done_func;
+	gpointer data;
+	GDestroyNotify destroy_data;
+};
+
+struct _RBPodcastDownloaderPrivate
+{
+	guint max_downloads;
+	guint max_per_host;
+
+	GQueue *queue;			/* downloads waiting to start */
+	GList *active;			/* downloads being probed or transferred */
+	GHashTable *host_downloads;	/* host -> number of active downloads */
+
+	SoupSession *session;
+
+	GMutex stats_lock;
+	guint64 total_bytes;
+	guint64 rate_bytes;
+	gint64 rate_time;
+	guint64 rate;
+	guint rate_timer_id;
+};
+
+enum
+{
+	PROP_0,
+	PROP_MAX_DOWNLOADS,
+	PROP_MAX_DOWNLOADS_PER_HOST,
+	PROP_DOWNLOAD_RATE
+};
+
+G_DEFINE_TYPE (RBPodcastDownloader, rb_podcast_downloader, G_TYPE_OBJECT);
+
+static void schedule_downloads (RBPodcastDownloader *downloader);
+
+static void
+download_free (RBPodcastDownload *download)
+{
+	if (download->destroy_data)
+		download->destroy_data (download->data);
+
+	g_clear_object (&download->destination);
+	g_clear_object (&download->cancel);
+	g_clear_error (&download->error);
+	g_free (download->validator);
+	g_free (download->host);
+	g_free (download->uri);
+	g_free (download);
+}
+
+static void
+add_bytes (RBPodcastDownload *download, guint64 bytes)
+{
+	RBPodcastDownloaderPrivate *priv = download->downloader->priv;
+
+	g_mutex_lock (&priv->stats_lock);
+	download->downloaded += bytes;
+	priv->total_bytes += bytes;
+	g_mutex_unlock (&priv->stats_lock);
+}
+
+static void
+report_progress (RBPodcastDownload *download)
+{
+	RBPodcastDownloaderPrivate *priv = download->downloader->priv;
+	guint64 downloaded;
+	guint64 total;
+
+	g_mutex_lock (&priv->stats_lock);
+	downloaded = download->downloaded;
+	total = download->total;
+	g_mutex_unlock (&priv->stats_lock);
+
+	if (downloaded == download->reported)
+		return;
+
+	download->reported = downloaded;
+	if (download->progress_func)
+		download->progress_func (download, downloaded, total, download->data);
+}
+
+static gboolean
+rate_timer_cb (RBPodcastDownloader *downloader)
+{
+	RBPodcastDownloaderPrivate *priv = downloader->priv;
+	guint64 bytes;
+	guint64 rate = 0;
+	gint64 now;
+	GList *l;
+
+	g_mutex_lock (&priv->stats_lock);
+	bytes = priv->total_bytes;
+	g_mutex_unlock (&priv->stats_lock);
+
+	now = g_get_monotonic_time ();
+	if (now > priv->rate_time)
+		rate = ((bytes - priv->rate_bytes) * G_USEC_PER_SEC) / (now - priv->rate_time);
+	priv->rate_bytes = bytes;
+	priv->rate_time = now;
+
+	if (rate != priv->rate) {
+		priv->rate = rate;
+		g_object_notify (G_OBJECT (downloader), "download-rate");
+	}
+
+	for (l = priv->active; l != NULL; l = l->next) {
+		report_progress (l->data);
+	}
+
+	return TRUE;
+}
+
+static void
+start_rate_timer (RBPodcastDownloader *downloader)
+{
+	RBPodcastDownloaderPrivate *priv = downloader->priv;
+
+	if (priv->rate_timer_id != 0)
+		return;
+
+	g_mutex_lock (&priv->stats_lock);
+	priv->rate_bytes = priv->total_bytes;
+	g_mutex_unlock (&priv->stats_lock);
+	priv->rate_time = g_get_monotonic_time ();
+
+	priv->rate_timer_id = g_timeout_add_seconds (1, (GSourceFunc) rate_timer_cb, downloader);
+}
+
+static void
+stop_rate_timer (RBPodcastDownloader *downloader)
+{
+	RBPodcastDownloaderPrivate *priv = downloader->priv;
+
+	if (priv->rate_timer_id != 0) {
+		g_source_remove (priv->rate_timer_id);
+		priv->rate_timer_id = 0;
+	}
+
+	if (priv->rate != 0) {
+		priv->rate = 0;
+		g_object_notify (G_OBJECT (downloader), "download-rate");
+	}
+}
+
+static guint
+host_download_count (RBPodcastDownloader *downloader, const char *host)
+{
+	return GPOINTER_TO_UINT (g_hash_table_lookup (downloader->priv->host_downloads, host));
+}
+
+static void
+finish_download (RBPodcastDownload *download)
+{
+	RBPodcastDownloader *downloader = download->downloader;
+	RBPodcastDownloaderPrivate *priv = downloader->priv;
+	gboolean active;
+	guint count;
+
+	g_assert (rb_is_main_thread ());
+
+	if (download->error == NULL && g_cancellable_is_cancelled (download->cancel)) {
+		g_set_error (&download->error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Download cancelled");
+	}
+
+	if (download->error != NULL) {
+		rb_debug ("download of %s failed: %s", download->uri, download->error->message);
+	} else {
+		rb_debug ("download of %s finished: %" G_GUINT64_FORMAT " bytes",
+			  download->uri, download->downloaded);
+	}
+
+	/* downloads cancelled before they started were never active */
+	active = (g_list_find (priv->active, download) != NULL);
+	if (active) {
+		priv->active = g_list_remove (priv->active, download);
+		count = host_download_count (downloader, download->host);
+		if (count > 1) {
+			g_hash_table_insert (priv->host_downloads, g_strdup (download->host), GUINT_TO_POINTER (count - 1));
+		} else {
+			g_hash_table_remove (priv->host_downloads, download->host);
+		}
+	}
+
+	report_progress (download);
+	if (download->done_func) {
+		download->done_func (download,
+				     download->downloaded,
+				     download->total,
+				     download->error,
+				     download->data);
+	}
+	download_free (download);
+
+	if (active) {
+		schedule_downloads (downloader);
+		if (priv->active == NULL)
+			stop_rate_timer (downloader);
+
+		g_object_unref (downloader);
+	}
+}
+
+static gboolean
+transfer_done_idle (RBPodcastDownload *download)
+{
+	finish_download (download);
+	return FALSE;
+}
+
+static void
+cancel_message_cb (GCancellable *cancel, RBPodcastDownload *download)
+{
+	soup_session_cancel_message (download->downloader->priv->session,
+				     download->message,
+				     SOUP_STATUS_CANCELLED);
+}
+
+static void
+send_message (RBPodcastDownload *download, SoupMessage *message)
+{
+	gulong cancel_id;
+
+	if (g_cancellable_is_cancelled (download->cancel)) {
+		soup_message_set_status (message, SOUP_STATUS_CANCELLED);
+		return;
+	}
+
+	download->message = message;
+	cancel_id = g_cancellable_connect (download->cancel, G_CALLBACK (cancel_message_cb), download, NULL);
+	soup_session_send_message (download->downloader->priv->session, message);
+	g_cancellable_disconnect (download->cancel, cancel_id);
+	download->message = NULL;
+}
+
+static void
+set_message_error (RBPodcastDownload *download, SoupMessage *message)
+{
+	if (message->status_code == SOUP_STATUS_CANCELLED) {
+		g_set_error (&download->error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Download cancelled");
+	} else {
+		g_set_error (&download->error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "%s",
+			     message->reason_phrase ? message->reason_phrase : soup_status_get_phrase (message->status_code));
+	}
+}
+
+static GFileInfo *
+probe_http (RBPodcastDownload *download)
+{
+	SoupMessage *message;
+	GFileInfo *info;
+	GHashTable *params;
+	const char *validator;
+	char *name = NULL;
+
+	message = soup_message_new (SOUP_METHOD_HEAD, download->uri);
+	if (message == NULL) {
+		g_set_error (&download->error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+			     "Invalid URI %s", download->uri);
+		return NULL;
+	}
+
+	send_message (download, message);
+	if (SOUP_STATUS_IS_TRANSPORT_ERROR (message->status_code)) {
+		set_message_error (download, message);
+		g_object_unref (message);
+		return NULL;
+	}
+
+	/* servers that don't handle HEAD properly still get a chance to
+	 * give us the file, we just don't know anything about it yet.
+	 */
+	info = g_file_info_new ();
+	if (SOUP_STATUS_IS_SUCCESSFUL (message->status_code)) {
+		if (soup_message_headers_get_encoding (message->response_headers) == SOUP_ENCODING_CONTENT_LENGTH) {
+			g_file_info_set_size (info, soup_message_headers_get_content_length (message->response_headers));
+		}
+
+		if (soup_message_headers_get_content_disposition (message->response_headers, NULL, &params)) {
+			name = g_strdup (g_hash_table_lookup (params, "filename"));
+			g_hash_table_destroy (params);
+		}
+
+		validator = soup_message_headers_get_one (message->response_headers, "ETag");
+		if (validator == NULL)
+			validator = soup_message_headers_get_one (message->response_headers, "Last-Modified");
+		download->validator = g_strdup (validator);
+	} else {
+		rb_debug ("HEAD request for %s failed: %d %s", download->uri,
+			  message->status_code, message->reason_phrase);
+	}
+
+	/* use the last path component of the URI we were redirected to */
+	if (name == NULL) {
+		SoupURI *uri = soup_message_get_uri (message);
+		if (uri->path != NULL) {
+			char *base = g_path_get_basename (uri->path);
+			if (strcmp (base, "/") != 0 && strcmp (base, ".") != 0) {
+				name = soup_uri_decode (base);
+			}
+			g_free (base);
+		}
+	}
+
+	if (name != NULL) {
+		g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_COPY_NAME, name);
+		g_free (name);
+	}
+
+	g_object_unref (message);
+	return info;
+}
+
+static void
+probe_thread (GTask *task, gpointer source_object, RBPodcastDownload *download, GCancellable *cancel)
+{
+	GFileInfo *info;
+
+	if (download->http) {
+		info = probe_http (download);
+	} else {
+		GFile *source = g_file_new_for_uri (download->uri);
+		info = g_file_query_info (source, PROBE_ATTRIBUTES, G_FILE_QUERY_INFO_NONE, cancel, &download->error);
+		g_object_unref (source);
+	}
+
+	g_task_return_pointer (task, info, info ? g_object_unref : NULL);
+}
+
+static void
+got_headers_cb (SoupMessage *message, RBPodcastDownload *download)
+{
+	RBPodcastDownloaderPrivate *priv = download->downloader->priv;
+	goffset start;
+	goffset end;
+	goffset length;
+	guint64 downloaded;
+	guint64 total;
+
+	/* ignore redirects and such */
+	if (SOUP_STATUS_IS_SUCCESSFUL (message->status_code) == FALSE)
+		return;
+	if (download->out_stream != NULL || download->error != NULL)
+		return;
+
+	downloaded = 0;
+	total = download->total;
+	if (message->status_code == SOUP_STATUS_PARTIAL_CONTENT) {
+		if (soup_message_headers_get_content_range (message->response_headers, &start, &end, &length) == FALSE ||
+		    start != download->offset) {
+			g_set_error (&download->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				     "Server returned the wrong part of the file");
+			soup_session_cancel_message (priv->session, message, SOUP_STATUS_CANCELLED);
+			return;
+		}
+
+		rb_debug ("resuming %s at offset %" G_GUINT64_FORMAT, download->uri, download->offset);
+		download->out_stream = G_OUTPUT_STREAM (g_file_append_to (download->destination,
+									  G_FILE_CREATE_NONE,
+									  download->cancel,
+									  &download->error));
+		downloaded = download->offset;
+		if (length > 0)
+			total = length;
+	} else {
+		if (download->offset > 0) {
+			rb_debug ("server ignored range request for %s; downloading the whole file", download->uri);
+		}
+		download->out_stream = G_OUTPUT_STREAM (g_file_replace (download->destination,
+									NULL,
+									FALSE,
+									G_FILE_CREATE_NONE,
+									download->cancel,
+									&download->error));
+		if (soup_message_headers_get_encoding (message->response_headers) == SOUP_ENCODING_CONTENT_LENGTH)
+			total = soup_message_headers_get_content_length (message->response_headers);
+	}
+
+	g_mutex_lock (&priv->stats_lock);
+	download->downloaded = downloaded;
+	download->total = total;
+	g_mutex_unlock (&priv->stats_lock);
+
+	if (download->error != NULL) {
+		soup_session_cancel_message (priv->session, message, SOUP_STATUS_CANCELLED);
+	}
+}
+
+static void
+got_chunk_cb (SoupMessage *message, SoupBuffer *chunk, RBPodcastDownload *download)
+{
+	gsize written = 0;
+
+	if (download->out_stream == NULL || download->error != NULL)
+		return;
+
+	if (g_output_stream_write_all (download->out_stream,
+				       chunk->data,
+				       chunk->length,
+				       &written,
+				       download->cancel,
+				       &download->error) == FALSE) {
+		soup_session_cancel_message (download->downloader->priv->session,
+					     message,
+					     SOUP_STATUS_CANCELLED);
+	}
+	add_bytes (download, written);
+}
+
+static void
+transfer_http (RBPodcastDownload *download)
+{
+	SoupMessage *message;
+
+	message = soup_message_new (SOUP_METHOD_GET, download->uri);
+	if (download->offset > 0) {
+		soup_message_headers_set_range (message->request_headers, download->offset, -1);
+		if (download->validator != NULL)
+			soup_message_headers_replace (message->request_headers, "If-Range", download->validator);
+	}
+
+	soup_message_body_set_accumulate (message->response_body, FALSE);
+	g_signal_connect (message, "got-headers", G_CALLBACK (got_headers_cb), download);
+	g_signal_connect (message, "got-chunk", G_CALLBACK (got_chunk_cb), download);
+
+	send_message (download, message);
+
+	if (download->error != NULL) {
+		/* already know what went wrong */
+	} else if (message->status_code == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE && download->offset > 0) {
+		/* we probably have the whole thing already */
+		rb_debug ("range request for %s not satisfiable; assuming the download is complete", download->uri);
+		g_mutex_lock (&download->downloader->priv->stats_lock);
+		download->downloaded = download->offset;
+		g_mutex_unlock (&download->downloader->priv->stats_lock);
+	} else if (SOUP_STATUS_IS_SUCCESSFUL (message->status_code) == FALSE) {
+		set_message_error (download, message);
+	}
+
+	g_object_unref (message);
+}
+
+static void
+transfer_gio (RBPodcastDownload *download)
+{
+	GFile *source;
+	GFileInputStream *in_stream;
+	char *buf;
+	gssize n_read;
+	gsize written;
+
+	source = g_file_new_for_uri (download->uri);
+	in_stream = g_file_read (source, download->cancel, &download->error);
+	g_object_unref (source);
+	if (in_stream == NULL)
+		return;
+
+	/* if we have an offset to download from, try the seek
+	 * before anything else.  if we can't seek, we'll have to
+	 * grab the whole thing.
+	 */
+	if (download->offset > 0) {
+		GError *error = NULL;
+		if (g_seekable_seek (G_SEEKABLE (in_stream), download->offset, G_SEEK_SET, download->cancel, &error)) {
+			rb_debug ("seek to offset %" G_GUINT64_FORMAT " successful", download->offset);
+			download->out_stream = G_OUTPUT_STREAM (g_file_append_to (download->destination,
+										  G_FILE_CREATE_NONE,
+										  download->cancel,
+										  &download->error));
+			g_mutex_lock (&download->downloader->priv->stats_lock);
+			download->downloaded = download->offset;
+			g_mutex_unlock (&download->downloader->priv->stats_lock);
+		} else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+			rb_debug ("seeking failed: %s", error->message);
+			g_error_free (error);
+		} else {
+			g_propagate_error (&download->error, error);
+		}
+	}
+
+	if (download->out_stream == NULL && download->error == NULL) {
+		download->out_stream = G_OUTPUT_STREAM (g_file_replace (download->destination,
+									NULL,
+									FALSE,
+									G_FILE_CREATE_NONE,
+									download->cancel,
+									&download->error));
+	}
+
+	buf = g_malloc (DOWNLOAD_BUFFER_SIZE);
+	while (download->error == NULL) {
+		n_read = g_input_stream_read (G_INPUT_STREAM (in_stream),
+					      buf, DOWNLOAD_BUFFER_SIZE,
+					      download->cancel,
+					      &download->error);
+		if (n_read < 1)
+			break;
+
+		g_output_stream_write_all (download->out_stream,
+					   buf, n_read,
+					   &written,
+					   download->cancel,
+					   &download->error);
+		add_bytes (download, written);
+	}
+	g_free (buf);
+
+	g_input_stream_close (G_INPUT_STREAM (in_stream), NULL, NULL);
+	g_object_unref (in_stream);
+}
+
+static gpointer
+transfer_thread (RBPodcastDownload *download)
+{
+	if (download->http) {
+		transfer_http (download);
+	} else {
+		transfer_gio (download);
+	}
+
+	/* close everything - don't allow this to be cancelled */
+	if (download->out_stream != NULL) {
+		if (download->error == NULL) {
+			g_output_stream_close (download->out_stream, NULL, &download->error);
+		} else {
+			g_output_stream_close (download->out_stream, NULL, NULL);
+		}
+		g_clear_object (&download->out_stream);
+	}
+
+	g_idle_add ((GSourceFunc) transfer_done_idle, download);
+	return NULL;
+}
+
+static void
+probe_done_cb (RBPodcastDownloader *downloader, GAsyncResult *result, RBPodcastDownload *download)
+{
+	GFileInfo *info;
+	GFileInfo *dest_info;
+	guint64 local_size;
+
+	info = g_task_propagate_pointer (G_TASK (result), NULL);
+	if (info == NULL || g_cancellable_is_cancelled (download->cancel)) {
+		g_clear_object (&info);
+		finish_download (download);
+		return;
+	}
+
+	if (g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_STANDARD_SIZE)) {
+		download->total = g_file_info_get_size (info);
+	}
+
+	download->destination = download->destination_func (download, info, download->data, &download->error);
+	g_object_unref (info);
+	if (download->destination == NULL) {
+		if (download->error == NULL) {
+			g_set_error (&download->error, G_IO_ERROR, G_IO_ERROR_FAILED, "No destination for download");
+		}
+		finish_download (download);
+		return;
+	}
+
+	/* see if we've already downloaded some or all of it */
+	dest_info = g_file_query_info (download->destination,
+				       G_FILE_ATTRIBUTE_STANDARD_SIZE,
+				       G_FILE_QUERY_INFO_NONE,
+				       NULL,
+				       NULL);
+	if (dest_info != NULL) {
+		local_size = g_file_info_get_size (dest_info);
+		g_object_unref (dest_info);
+
+		if (download->total > 0 && local_size == download->total) {
+			rb_debug ("local file is the same size as the download (%" G_GUINT64_FORMAT ")", local_size);
+			download->downloaded = local_size;
+			finish_download (download);
+			return;
+		} else if (local_size > 0 && (download->total == 0 || local_size < download->total)) {
+			rb_debug ("%s partly downloaded (%" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT ")",
+				  download->uri, local_size, download->total);
+			download->offset = local_size;
+		} else {
+			rb_debug ("replacing local file as it's larger than the download");
+		}
+	}
+
+	g_thread_unref (g_thread_new ("podcast-download", (GThreadFunc) transfer_thread, download));
+}
+
+static void
+start_download (RBPodcastDownloader *downloader, RBPodcastDownload *download)
+{
+	RBPodcastDownloaderPrivate *priv = downloader->priv;
+	GTask *task;
+
+	rb_debug ("starting download of %s", download->uri);
+
+	/* keep ourselves around until the download is finished */
+	g_object_ref (downloader);
+
+	priv->active = g_list_append (priv->active, download);
+	g_hash_table_insert (priv->host_downloads,
+			     g_strdup (download->host),
+			     GUINT_TO_POINTER (host_download_count (downloader, download->host) + 1));
+	start_rate_timer (downloader);
+
+	task = g_task_new (downloader, download->cancel, (GAsyncReadyCallback) probe_done_cb, download);
+	g_task_set_task_data (task, download, NULL);
+	g_task_run_in_thread (task, (GTaskThreadFunc) probe_thread);
+	g_object_unref (task);
+}
+
+static void
+schedule_downloads (RBPodcastDownloader *downloader)
+{
+	RBPodcastDownloaderPrivate *priv = downloader->priv;
+	GList *l;
+	GList *next;
+
+	for (l = priv->queue->head; l != NULL; l = next) {
+		RBPodcastDownload *download = l->data;
+		next = l->next;
+
+		if (g_list_length (priv->active) >= priv->max_downloads)
+			break;
+
+		if (host_download_count (downloader, download->host) >= priv->max_per_host)
+			continue;
+
+		g_queue_delete_link (priv->queue, l);
+		start_download (downloader, download);
+	}
+}
+
+/**
+ * rb_podcast_downloader_add:
+ * @downloader: the #RBPodcastDownloader
+ * @uri: URI to download
+ * @destination_func: called to choose where to save the download
+ * @progress_func: (allow-none): called periodically with download progress
+ * @done_func: called when the download finishes, fails or is cancelled
+ * @data: data to pass to the callbacks
+ * @destroy_data: (allow-none): called to free @data after the download is done
+ *
+ * Adds a download to the queue.  It will be started as soon as there is
+ * room for it under the concurrent download limits.
+ *
+ * @destination_func is given a #GFileInfo describing the remote file, which
+ * may include its size and a suggested name for it, and returns the
+ * file to save it to.  If the file already exists and is smaller than the
+ * remote file, the download resumes from the end of it.
+ *
+ * @done_func is called exactly once, on the main thread, and the download
+ * is freed immediately afterwards.
+ *
+ * Return value: (transfer none): the download, which can be passed
+ *   to #rb_podcast_downloader_cancel until it is done
+ */
+RBPodcastDownload *
+rb_podcast_downloader_add (RBPodcastDownloader *downloader,
+			   const char *uri,
+			   RBPodcastDownloadDestinationFunc destination_func,
+			   RBPodcastDownloadProgressFunc progress_func,
+			   RBPodcastDownloadDoneFunc done_func,
+			   gpointer data,
+			   GDestroyNotify destroy_data)
+{
+	RBPodcastDownload *download;
+	char *scheme;
+
+	g_assert (rb_is_main_thread ());
+
+	download = g_new0 (RBPodcastDownload, 1);
+	download->downloader = downloader;
+	download->uri = g_strdup (uri);
+	download->cancel = g_cancellable_new ();
+	download->destination_func = destination_func;
+	download->progress_func = progress_func;
+	download->done_func = done_func;
+	download->data = data;
+	download->destroy_data = destroy_data;
+
+	scheme = g_uri_parse_scheme (uri);
+	if (g_strcmp0 (scheme, "http") == 0 || g_strcmp0 (scheme, "https") == 0) {
+		SoupURI *soup_uri = soup_uri_new (uri);
+		download->http = TRUE;
+		if (soup_uri != NULL) {
+			download->host = g_strdup (soup_uri->host);
+			soup_uri_free (soup_uri);
+		}
+	}
+	g_free (scheme);
+	if (download->host == NULL)
+		download->host = g_strdup ("");
+
+	g_queue_push_tail (downloader->priv->queue, download);
+	schedule_downloads (downloader);
+	return download;
+}
+
+/**
+ * rb_podcast_downloader_cancel:
+ * @downloader: the #RBPodcastDownloader
+ * @download: the download to cancel
+ *
+ * Cancels a download.  If the download hasn't started yet, its done
+ * callback is called before this returns.  Otherwise the transfer is
+ * stopped and the done callback is called shortly afterwards.  In both
+ * cases the error passed to the callback is %G_IO_ERROR_CANCELLED.
+ * Anything already downloaded is left in place, so the download can be
+ * resumed later.
+ */
+void
+rb_podcast_downloader_cancel (RBPodcastDownloader *downloader, RBPodcastDownload *download)
+{
+	GList *l;
+
+	g_assert (rb_is_main_thread ());
+
+	rb_debug ("cancelling download of %s", download->uri);
+	g_cancellable_cancel (download->cancel);
+
+	l = g_queue_find (downloader->priv->queue, download);
+	if (l != NULL) {
+		g_queue_delete_link (downloader->priv->queue, l);
+		finish_download (download);
+	}
+}
+
+/**
+ * rb_podcast_downloader_get_rate:
+ * @downloader: the #RBPodcastDownloader
+ *
+ * Returns the combined rate of all active downloads over the last
+ * second or so.
+ *
+ * Return value: download rate in bytes per second
+ */
+guint64
+rb_podcast_downloader_get_rate (RBPodcastDownloader *downloader)
+{
+	return downloader->priv->rate;
+}
+
+/**
+ * rb_podcast_download_get_uri:
+ * @download: a #RBPodcastDownload
+ *
+ * Return value: the URI being downloaded
+ */
+const char *
+rb_podcast_download_get_uri (RBPodcastDownload *download)
+{
+	return download->uri;
+}
+
+/**
+ * rb_podcast_download_get_destination:
+ * @download: a #RBPodcastDownload
+ *
+ * Return value: (transfer none): the file the download is being saved to,
+ *   or NULL if it hasn't been chosen yet
+ */
+GFile *
+rb_podcast_download_get_destination (RBPodcastDownload *download)
+{
+	return download->destination;
+}
+
+static void
+update_session (RBPodcastDownloader *downloader)
+{
+	g_object_set (downloader->priv->session,
+		      SOUP_SESSION_MAX_CONNS, downloader->priv->max_downloads * 2,
+		      SOUP_SESSION_MAX_CONNS_PER_HOST, downloader->priv->max_per_host,
+		      NULL);
+}
+
+static void
+impl_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
+{
+	RBPodcastDownloader *downloader = RB_PODCAST_DOWNLOADER (object);
+
+	switch (prop_id) {
+	case PROP_MAX_DOWNLOADS:
+		downloader->priv->max_downloads = g_value_get_uint (value);
+		update_session (downloader);
+		schedule_downloads (downloader);
+		break;
+	case PROP_MAX_DOWNLOADS_PER_HOST:
+		downloader->priv->max_per_host = g_value_get_uint (value);
+		update_session (downloader);
+		schedule_downloads (downloader);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+impl_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+	RBPodcastDownloader *downloader = RB_PODCAST_DOWNLOADER (object);
+
+	switch (prop_id) {
+	case PROP_MAX_DOWNLOADS:
+		g_value_set_uint (value, downloader->priv->max_downloads);
+		break;
+	case PROP_MAX_DOWNLOADS_PER_HOST:
+		g_value_set_uint (value, downloader->priv->max_per_host);
+		break;
+	case PROP_DOWNLOAD_RATE:
+		g_value_set_uint64 (value, downloader->priv->rate);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+impl_dispose (GObject *object)
+{
+	RBPodcastDownloader *downloader = RB_PODCAST_DOWNLOADER (object);
+
+	/* active downloads hold a reference, so only queued downloads can be left */
+	while (g_queue_is_empty (downloader->priv->queue) == FALSE) {
+		rb_podcast_downloader_cancel (downloader, g_queue_peek_head (downloader->priv->queue));
+	}
+
+	stop_rate_timer (downloader);
+
+	if (downloader->priv->session != NULL) {
+		soup_session_abort (downloader->priv->session);
+		g_clear_object (&downloader->priv->session);
+	}
+
+	G_OBJECT_CLASS (rb_podcast_downloader_parent_class)->dispose (object);
+}
+
+static void
+impl_finalize (GObject *object)
+{
+	RBPodcastDownloader *downloader = RB_PODCAST_DOWNLOADER (object);
+
+	g_queue_free (downloader->priv->queue);
+	g_hash_table_destroy (downloader->priv->host_downloads);
+	g_mutex_clear (&downloader->priv->stats_lock);
+
+	G_OBJECT_CLASS (rb_podcast_downloader_parent_class)->finalize (object);
+}
+
+static void
+rb_podcast_downloader_init (RBPodcastDownloader *downloader)
+{
+	downloader->priv = G_TYPE_INSTANCE_GET_PRIVATE (downloader,
+							RB_TYPE_PODCAST_DOWNLOADER,
+							RBPodcastDownloaderPrivate);
+
+	downloader->priv->queue = g_queue_new ();
+	downloader->priv->host_downloads = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	g_mutex_init (&downloader->priv->stats_lock);
+
+	downloader->priv->session = soup_session_sync_new_with_options (SOUP_SESSION_ADD_FEATURE_BY_TYPE,
+									SOUP_TYPE_PROXY_RESOLVER_DEFAULT,
+									SOUP_SESSION_USER_AGENT,
+									"Rhythmbox/" VERSION " ",
+									SOUP_SESSION_SSL_USE_SYSTEM_CA_FILE,
+									TRUE,
+									NULL);
+}
+
+static void
+rb_podcast_downloader_class_init (RBPodcastDownloaderClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->set_property = impl_set_property;
+	object_class->get_property = impl_get_property;
+	object_class->dispose = impl_dispose;
+	object_class->finalize = impl_finalize;
+
+	/**
+	 * RBPodcastDownloader:max-downloads:
+	 *
+	 * Maximum number of downloads to run at once.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_MAX_DOWNLOADS,
+					 g_param_spec_uint ("max-downloads",
+							    "max downloads",
+							    "maximum number of concurrent downloads",
+							    1, G_MAXUINT,
+							    DEFAULT_MAX_DOWNLOADS,
+							    G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+	/**
+	 * RBPodcastDownloader:max-downloads-per-host:
+	 *
+	 * Maximum number of downloads to run at once from any single host.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_MAX_DOWNLOADS_PER_HOST,
+					 g_param_spec_uint ("max-downloads-per-host",
+							    "max downloads per host",
+							    "maximum number of concurrent downloads from a single host",
+							    1, G_MAXUINT,
+							    DEFAULT_MAX_DOWNLOADS_PER_HOST,
+							    G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+	/**
+	 * RBPodcastDownloader:download-rate:
+	 *
+	 * Combined rate of all active downloads, in bytes per second.
+	 * Updated once a second while anything is downloading.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_DOWNLOAD_RATE,
+					 g_param_spec_uint64 ("download-rate",
+							      "download rate",
+							      "combined download rate in bytes per second",
+							      0, G_MAXUINT64, 0,
+							      G_PARAM_READABLE));
+
+	g_type_class_add_private (klass, sizeof (RBPodcastDownloaderPrivate));
+}
+
+/**
+ * rb_podcast_downloader_new:
+ *
+ * Creates a new podcast downloader.
+ *
+ * Return value: the #RBPodcastDownloader
+ */
+RBPodcastDownloader *
+rb_podcast_downloader_new (void)
+{
+	return RB_PODCAST_DOWNLOADER (g_object_new (RB_TYPE_PODCAST_DOWNLOADER, NULL));
+}
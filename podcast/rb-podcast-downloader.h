@@ -0,0 +1,93 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#ifndef RB_PODCAST_DOWNLOADER_H
+#define RB_PODCAST_DOWNLOADER_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define RB_TYPE_PODCAST_DOWNLOADER         (rb_podcast_downloader_get_type ())
+#define RB_PODCAST_DOWNLOADER(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), RB_TYPE_PODCAST_DOWNLOADER, RBPodcastDownloader))
+#define RB_PODCAST_DOWNLOADER_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), RB_TYPE_PODCAST_DOWNLOADER, RBPodcastDownloaderClass))
+#define RB_IS_PODCAST_DOWNLOADER(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), RB_TYPE_PODCAST_DOWNLOADER))
+#define RB_IS_PODCAST_DOWNLOADER_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), RB_TYPE_PODCAST_DOWNLOADER))
+#define RB_PODCAST_DOWNLOADER_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), RB_TYPE_PODCAST_DOWNLOADER, RBPodcastDownloaderClass))
+
+typedef struct _RBPodcastDownloader RBPodcastDownloader;
+typedef struct _RBPodcastDownloaderClass RBPodcastDownloaderClass;
+typedef struct _RBPodcastDownloaderPrivate RBPodcastDownloaderPrivate;
+
+typedef struct _RBPodcastDownload RBPodcastDownload;
+
+struct _RBPodcastDownloader
+{
+	GObject parent;
+
+	RBPodcastDownloaderPrivate *priv;
+};
+
+struct _RBPodcastDownloaderClass
+{
+	GObjectClass parent_class;
+};
+
+typedef GFile *	(*RBPodcastDownloadDestinationFunc)	(RBPodcastDownload *download,
+							 GFileInfo *info,
+							 gpointer data,
+							 GError **error);
+typedef void	(*RBPodcastDownloadProgressFunc)	(RBPodcastDownload *download,
+							 guint64 downloaded,
+							 guint64 total,
+							 gpointer data);
+typedef void	(*RBPodcastDownloadDoneFunc)		(RBPodcastDownload *download,
+							 guint64 downloaded,
+							 guint64 total,
+							 const GError *error,
+							 gpointer data);
+
+GType			rb_podcast_downloader_get_type		(void);
+
+RBPodcastDownloader *	rb_podcast_downloader_new		(void);
+
+RBPodcastDownload *	rb_podcast_downloader_add		(RBPodcastDownloader *downloader,
+								 const char *uri,
+								 RBPodcastDownloadDestinationFunc destination_func,
+								 RBPodcastDownloadProgressFunc progress_func,
+								 RBPodcastDownloadDoneFunc done_func,
+								 gpointer data,
+								 GDestroyNotify destroy_data);
+void			rb_podcast_downloader_cancel		(RBPodcastDownloader *downloader,
+								 RBPodcastDownload *download);
+guint64			rb_podcast_downloader_get_rate		(RBPodcastDownloader *downloader);
+
+const char *		rb_podcast_download_get_uri		(RBPodcastDownload *download);
+GFile *			rb_podcast_download_get_destination	(RBPodcastDownload *download);
+
+G_END_DECLS
+
+#endif /* RB_PODCAST_DOWNLOADER_H */
@@ -94,6 +94,9 @@ podcast_data_destroy (RhythmDBEntryType *entry_type, RhythmDBEntry *entry)
 	rb_refstring_unref (podcast->lang);
 	rb_refstring_unref (podcast->copyright);
 	rb_refstring_unref (podcast->image);
+	rb_refstring_unref (podcast->etag);
+	rb_refstring_unref (podcast->last_modified);
+	rb_refstring_unref (podcast->checksum);
 }
 
 /**
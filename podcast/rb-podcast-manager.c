@@ -41,6 +41,7 @@
 #include "rb-podcast-manager.h"
 #include "rb-podcast-entry-types.h"
 #include "rb-podcast-search.h"
+#include "rb-podcast-downloader.h"
 #include "rb-file-helpers.h"
 #include "rb-debug.h"
 #include "rb-marshal.h"
@@ -53,10 +54,14 @@
 #include "rb-missing-plugins.h"
 #include "rb-ext-db.h"
 
+/* number of feeds to update at once */
+#define FEED_UPDATE_THREADS	4
+
 enum
 {
 	PROP_0,
-	PROP_DB
+	PROP_DB,
+	PROP_DOWNLOAD_RATE
 };
 
 enum
@@ -84,17 +89,8 @@ typedef struct
 	RhythmDBEntry *entry;
 	char *query_string;
 
-	GFile *source;
-	GFile *destination;
-	GFileInputStream *in_stream;
-	GFileOutputStream *out_stream;
-
-	guint64 download_offset;
-	guint64 download_size;
+	RBPodcastDownload *download;
 	guint progress;
-
-	GCancellable *cancel;
-	GThread *thread;
 } RBPodcastManagerInfo;
 
 typedef struct
@@ -103,15 +99,19 @@ typedef struct
 	char *url;
 	gboolean automatic;
 	gboolean existing_feed;
+
+	char *etag;
+	char *last_modified;
+	char *checksum;
 } RBPodcastThreadInfo;
 
 struct RBPodcastManagerPrivate
 {
 	RhythmDB *db;
 	GList *download_list;
-	RBPodcastManagerInfo *active_download;
+	RBPodcastDownloader *downloader;
+	GThreadPool *update_pool;
 	guint source_sync;
-	guint next_file_id;
 	gboolean shutdown;
 	RBExtDB *art_store;
 
@@ -139,35 +139,39 @@ static void rb_podcast_manager_get_property 		(GObject *object,
 							 guint prop_id,
 		                                	 GValue *value,
                 		                	 GParamSpec *pspec);
-static void read_file_cb				(GFile *source,
-							 GAsyncResult *result,
-							 RBPodcastManagerInfo *data);
-static void download_file_info_cb			(GFile *source,
-							 GAsyncResult *result,
-							 RBPodcastManagerInfo *data);
-static void download_podcast				(GFileInfo *src_info,
-							 RBPodcastManagerInfo *data);
-static void rb_podcast_manager_abort_download		(RBPodcastManagerInfo *data);
 static gboolean rb_podcast_manager_update_feeds_cb 	(gpointer data);
 static void rb_podcast_manager_save_metadata		(RBPodcastManager *pd,
 						  	 RhythmDBEntry *entry);
 static void rb_podcast_manager_db_entry_added_cb 	(RBPodcastManager *pd,
 							 RhythmDBEntry *entry);
-static gboolean rb_podcast_manager_next_file 		(RBPodcastManager * pd);
+static void rb_podcast_manager_feed_unchanged		(RBPodcastManager *pd,
+							 RBPodcastChannel *data);
 static void rb_podcast_manager_handle_feed_error	(RBPodcastManager *mgr,
 							 const char *url,
 							 GError *error,
 							 gboolean emit);
 
-static gpointer rb_podcast_manager_thread_parse_feed	(RBPodcastThreadInfo *info);
+static void rb_podcast_manager_thread_parse_feed	(RBPodcastThreadInfo *info,
+							 gpointer unused);
 static void podcast_settings_changed_cb			(GSettings *settings,
 							 const char *key,
 							 RBPodcastManager *mgr);
 
 /* internal functions */
 static void download_info_free				(RBPodcastManagerInfo *data);
-static gpointer podcast_download_thread			(RBPodcastManagerInfo *data);
-static gboolean end_job					(RBPodcastManagerInfo *data);
+static GFile *download_destination_cb			(RBPodcastDownload *download,
+							 GFileInfo *src_info,
+							 RBPodcastManagerInfo *data,
+							 GError **error);
+static void download_progress_cb			(RBPodcastDownload *download,
+							 guint64 downloaded,
+							 guint64 total,
+							 RBPodcastManagerInfo *data);
+static void download_done_cb				(RBPodcastDownload *download,
+							 guint64 downloaded,
+							 guint64 total,
+							 const GError *error,
+							 RBPodcastManagerInfo *data);
 static void cancel_job					(RBPodcastManagerInfo *pd);
 static void rb_podcast_manager_start_update_timer 	(RBPodcastManager *pd);
 
@@ -192,6 +196,18 @@ rb_podcast_manager_class_init (RBPodcastManagerClass *klass)
 							      "database",
 							      RHYTHMDB_TYPE,
 							      G_PARAM_READWRITE));
+	/**
+	 * RBPodcastManager:download-rate:
+	 *
+	 * Combined rate of all podcast episode downloads, in bytes per second.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_DOWNLOAD_RATE,
+					 g_param_spec_uint64 ("download-rate",
+							      "download rate",
+							      "combined download rate in bytes per second",
+							      0, G_MAXUINT64, 0,
+							      G_PARAM_READABLE));
 
 	rb_podcast_manager_signals[START_DOWNLOAD] =
 	       g_signal_new ("start_download",
@@ -250,6 +266,19 @@ rb_podcast_manager_init (RBPodcastManager *pd)
 	pd->priv->source_sync = 0;
 	pd->priv->db = NULL;
 
+	pd->priv->update_pool = g_thread_pool_new ((GFunc) rb_podcast_manager_thread_parse_feed,
+						   NULL,
+						   FEED_UPDATE_THREADS,
+						   FALSE,
+						   NULL);
+}
+
+static void
+download_rate_changed_cb (GObject *downloader, GParamSpec *pspec, RBPodcastManager *pd)
+{
+	rb_debug ("podcast download rate: %" G_GUINT64_FORMAT " bytes/s",
+		  rb_podcast_downloader_get_rate (pd->priv->downloader));
+	g_object_notify (G_OBJECT (pd), "download-rate");
 }
 
 static void
@@ -272,6 +301,18 @@ rb_podcast_manager_constructed (GObject *object)
 				 G_CALLBACK (podcast_settings_changed_cb),
 				 pd, 0);
 
+	pd->priv->downloader = rb_podcast_downloader_new ();
+	g_settings_bind (pd->priv->settings, PODCAST_MAX_DOWNLOADS_KEY,
+			 pd->priv->downloader, "max-downloads",
+			 G_SETTINGS_BIND_GET);
+	g_settings_bind (pd->priv->settings, PODCAST_MAX_DOWNLOADS_PER_HOST_KEY,
+			 pd->priv->downloader, "max-downloads-per-host",
+			 G_SETTINGS_BIND_GET);
+	g_signal_connect_object (pd->priv->downloader,
+				 "notify::download-rate",
+				 G_CALLBACK (download_rate_changed_cb),
+				 pd, 0);
+
 	ts_file_path = g_build_filename (rb_user_data_dir (), "podcast-timestamp", NULL);
 	pd->priv->timestamp_file = g_file_new_for_path (ts_file_path);
 	g_free (ts_file_path);
@@ -298,9 +339,9 @@ rb_podcast_manager_dispose (GObject *object)
 	pd = RB_PODCAST_MANAGER (object);
 	g_return_if_fail (pd->priv != NULL);
 
-	if (pd->priv->next_file_id != 0) {
-		g_source_remove (pd->priv->next_file_id);
-		pd->priv->next_file_id = 0;
+	if (pd->priv->downloader != NULL) {
+		g_object_unref (pd->priv->downloader);
+		pd->priv->downloader = NULL;
 	}
 
 	if (pd->priv->source_sync != 0) {
@@ -349,6 +390,9 @@ rb_podcast_manager_finalize (GObject *object)
 
 	g_array_free (pd->priv->searches, TRUE);
 
+	/* feed updates hold references, so the pool is idle by now */
+	g_thread_pool_free (pd->priv->update_pool, TRUE, FALSE);
+
 	G_OBJECT_CLASS (rb_podcast_manager_parent_class)->finalize (object);
 }
 
@@ -394,6 +438,9 @@ rb_podcast_manager_get_property (GObject *object,
 	case PROP_DB:
 		g_value_set_object (value, pd->priv->db);
 		break;
+	case PROP_DOWNLOAD_RATE:
+		g_value_set_uint64 (value, pd->priv->downloader ? rb_podcast_downloader_get_rate (pd->priv->downloader) : 0);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 	}
@@ -473,6 +520,8 @@ rb_podcast_manager_download_entry (RBPodcastManager *pd,
 		RBPodcastManagerInfo *data;
 		GValue val = { 0, };
 		GTimeVal now;
+		const char *location;
+		const char *query_string;
 
 		if (status < RHYTHMDB_PODCAST_STATUS_COMPLETE) {
 			g_value_init (&val, G_TYPE_ULONG);
@@ -495,11 +544,24 @@ rb_podcast_manager_download_entry (RBPodcastManager *pd,
 		data->pd = g_object_ref (pd);
 		data->entry = rhythmdb_entry_ref (entry);
 
-		pd->priv->download_list = g_list_append (pd->priv->download_list, data);
-		if (pd->priv->next_file_id == 0) {
-			pd->priv->next_file_id =
-				g_idle_add ((GSourceFunc) rb_podcast_manager_next_file, pd);
+		/* extract the query string so we can remove it later if it appears
+		 * in download URLs
+		 */
+		location = get_remote_location (entry);
+		query_string = strchr (location, '?');
+		if (query_string != NULL) {
+			query_string--;
+			data->query_string = g_strdup (query_string);
 		}
+
+		pd->priv->download_list = g_list_append (pd->priv->download_list, data);
+		data->download = rb_podcast_downloader_add (pd->priv->downloader,
+							    location,
+							    (RBPodcastDownloadDestinationFunc) download_destination_cb,
+							    (RBPodcastDownloadProgressFunc) download_progress_cb,
+							    (RBPodcastDownloadDoneFunc) download_done_cb,
+							    data,
+							    (GDestroyNotify) download_info_free);
 	}
 }
 
@@ -665,7 +727,7 @@ rb_podcast_manager_update_feeds_cb (gpointer data)
 }
 
 static void
-download_error (RBPodcastManagerInfo *data, GError *error)
+download_error (RBPodcastManagerInfo *data, const GError *error)
 {
 	GValue val = {0,};
 
@@ -688,158 +750,24 @@ download_error (RBPodcastManagerInfo *data, GError *error)
 	}
 
 	rhythmdb_commit (data->pd->priv->db);
-
-	if (rb_is_main_thread() == FALSE) {
-		g_idle_add ((GSourceFunc)end_job, data);
-	} else {
-		rb_podcast_manager_abort_download (data);
-	}
 }
 
-static gboolean
-rb_podcast_manager_next_file (RBPodcastManager * pd)
+static GFile *
+download_destination_cb (RBPodcastDownload *download,
+			 GFileInfo *src_info,
+			 RBPodcastManagerInfo *data,
+			 GError **error)
 {
-	const char *location;
-	RBPodcastManagerInfo *data;
-	char *query_string;
-	GList *d;
-
-	g_assert (rb_is_main_thread ());
-
-	rb_debug ("looking for something to download");
-
-	pd->priv->next_file_id = 0;
-
-	if (pd->priv->active_download != NULL) {
-		rb_debug ("already downloading something");
-		return FALSE;
-	}
-
-	d = g_list_first (pd->priv->download_list);
-	if (d == NULL) {
-		rb_debug ("download queue is empty");
-		return FALSE;
-	}
-
-	data = (RBPodcastManagerInfo *) d->data;
-	g_assert (data != NULL);
-	g_assert (data->entry != NULL);
-
-	pd->priv->active_download = data;
-
-	location = get_remote_location (data->entry);
-	rb_debug ("processing %s", location);
-
-	/* extract the query string so we can remove it later if it appears
-	 * in download URLs
-	 */
-	query_string = strchr (location, '?');
-	if (query_string != NULL) {
-		query_string--;
-		data->query_string = g_strdup (query_string);
-	}
-
-	data->source = g_file_new_for_uri (location);
-
-	g_file_read_async (data->source,
-	                   0,
-	                   data->cancel,
-	                   (GAsyncReadyCallback) read_file_cb,
-	                   data);
-	return FALSE;
-}
-
-static void
-read_file_cb (GFile *source,
-              GAsyncResult *result,
-              RBPodcastManagerInfo *data)
-{
-	GError *error = NULL;
-	GFileInfo *src_info;
-
-	g_assert (rb_is_main_thread ());
-
-	rb_debug ("started read for %s",
-		  get_remote_location (data->entry));
-
-	data->in_stream = g_file_read_finish (data->source,
-	                                      result,
-	                                      &error);
-	if (error != NULL) {
-		download_error (data, error);
-		g_error_free (error);
-		return;
-	}
-
-	src_info = g_file_input_stream_query_info (data->in_stream,
-	                                           G_FILE_ATTRIBUTE_STANDARD_SIZE ","
-	                                           G_FILE_ATTRIBUTE_STANDARD_COPY_NAME ","
-	                                           G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME ","
-	                                           G_FILE_ATTRIBUTE_STANDARD_EDIT_NAME,
-	                                           NULL,
-	                                           &error);
-
-	/* If no stream information then probably using an old version of gvfs, fall back
-	 * to getting the stream information from the GFile.
-	 */
-	if (error != NULL) {
-		rb_debug ("file info query from input failed, trying query on file: %s", error->message);
-		g_error_free (error);
-
-		g_file_query_info_async (data->source,
-		                         G_FILE_ATTRIBUTE_STANDARD_SIZE ","
-		                         G_FILE_ATTRIBUTE_STANDARD_COPY_NAME ","
-	                                 G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME ","
-		                         G_FILE_ATTRIBUTE_STANDARD_EDIT_NAME,
-		                         G_FILE_QUERY_INFO_NONE,
-		                         0,
-		                         data->cancel,
-		                         (GAsyncReadyCallback) download_file_info_cb,
-		                         data);
-		return;
-	}
-
-	rb_debug ("got file info results for %s",
-		  get_remote_location (data->entry));
-
-	download_podcast (src_info, data);
-}
-
-static void
-download_file_info_cb (GFile *source,
-                       GAsyncResult *result,
-                       RBPodcastManagerInfo *data)
-{
-	GError *error = NULL;
-	GFileInfo *src_info;
-
-	src_info = g_file_query_info_finish (source, result, &error);
-
-	if (error != NULL) {
-		download_error (data, error);
-		g_error_free (error);
-	} else {
-		rb_debug ("got file info results for %s",
-			  get_remote_location (data->entry));
-
-		download_podcast (src_info, data);
-	}
-}
-
-static void
-download_podcast (GFileInfo *src_info, RBPodcastManagerInfo *data)
-{
-	GError *error = NULL;
+	GError *local_error = NULL;
 	char *local_file_name = NULL;
 	char *feed_folder;
 	char *esc_local_file_name;
 	char *local_file_uri;
 	char *sane_local_file_uri;
 	char *conf_dir_uri;
+	GFile *destination;
 
 	if (src_info != NULL) {
-		data->download_size = g_file_info_get_attribute_uint64 (src_info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
-
 		local_file_name = g_file_info_get_attribute_as_string (src_info, G_FILE_ATTRIBUTE_STANDARD_COPY_NAME);
 		if (local_file_name == NULL) {
 			/* probably shouldn't be using this, but the gvfs http backend doesn't
@@ -847,13 +775,15 @@ download_podcast (GFileInfo *src_info, RBPodcastManagerInfo *data)
 			 */
 			local_file_name = g_strdup (g_file_info_get_edit_name (src_info));
 		}
-
-		g_object_unref (src_info);
 	}
 
 	if (local_file_name == NULL) {
+		GFile *source;
+
 		/* fall back to the basename from the original URI */
-		local_file_name = g_file_get_basename (data->source);
+		source = g_file_new_for_uri (rb_podcast_download_get_uri (download));
+		local_file_name = g_file_get_basename (source);
+		g_object_unref (source);
 		rb_debug ("didn't get a filename from the file info request; using basename %s", local_file_name);
 	}
 
@@ -882,6 +812,7 @@ download_podcast (GFileInfo *src_info, RBPodcastManagerInfo *data)
 					   esc_local_file_name,
 					   NULL);
 
+	g_free (conf_dir_uri);
 	g_free (local_file_name);
 	g_free (feed_folder);
 	g_free (esc_local_file_name);
@@ -891,105 +822,40 @@ download_podcast (GFileInfo *src_info, RBPodcastManagerInfo *data)
 
 	rb_debug ("download URI: %s", sane_local_file_uri);
 
-	if (rb_uri_create_parent_dirs (sane_local_file_uri, &error) == FALSE) {
-		rb_debug ("error creating parent dirs: %s", error->message);
+	if (rb_uri_create_parent_dirs (sane_local_file_uri, &local_error) == FALSE) {
+		rb_debug ("error creating parent dirs: %s", local_error->message);
 
 		rb_error_dialog (NULL, _("Error creating podcast download directory"),
 				 _("Unable to create the download directory for %s: %s"),
-				 sane_local_file_uri, error->message);
+				 sane_local_file_uri, local_error->message);
 
-		g_error_free (error);
-		rb_podcast_manager_abort_download (data);
-		return;
+		g_propagate_error (error, local_error);
+		g_free (sane_local_file_uri);
+		return NULL;
 	}
 
-	data->destination = g_file_new_for_uri (sane_local_file_uri);
-	if (g_file_query_exists (data->destination, NULL)) {
-		GFileInfo *dest_info;
-		guint64 local_size;
-
-		dest_info = g_file_query_info (data->destination,
-					       G_FILE_ATTRIBUTE_STANDARD_SIZE,
-					       G_FILE_QUERY_INFO_NONE,
-					       NULL,
-					       &error);
-		if (error != NULL) {
-			/* hrm */
-			g_warning ("Looking at downloaded podcast file %s: %s",
-				   sane_local_file_uri, error->message);
-			g_error_free (error);
-			rb_podcast_manager_abort_download (data);
-			return;
-		}
-
-		/* check size */
-		local_size = g_file_info_get_attribute_uint64 (dest_info,
-							       G_FILE_ATTRIBUTE_STANDARD_SIZE);
-		g_object_unref (dest_info);
-		if (local_size == data->download_size) {
-			GValue val = {0,};
-
-			rb_debug ("local file is the same size as the download (%" G_GUINT64_FORMAT ")",
-				  local_size);
-
-			g_value_init (&val, G_TYPE_ULONG);
-			g_value_set_ulong (&val, RHYTHMDB_PODCAST_STATUS_COMPLETE);
-			rhythmdb_entry_set (data->pd->priv->db, data->entry, RHYTHMDB_PROP_STATUS, &val);
-			g_value_unset (&val);
-
-			g_value_init (&val, G_TYPE_STRING);
-			g_value_take_string (&val, g_file_get_uri (data->destination));
-			set_download_location (data->pd->priv->db, data->entry, &val);
-			g_value_unset (&val);
+	/* set the downloaded location for the episode
+	 * and do it before the file is created, so that the monitor
+	 * doesn't add a normal entry for us
+	 */
+	if (g_strcmp0 (get_download_location (data->entry), sane_local_file_uri) != 0) {
+		GValue val = {0,};
 
-			rb_podcast_manager_save_metadata (data->pd, data->entry);
+		g_value_init (&val, G_TYPE_STRING);
+		g_value_set_string (&val, sane_local_file_uri);
+		set_download_location (data->pd->priv->db, data->entry, &val);
+		g_value_unset (&val);
 
-			rb_podcast_manager_abort_download (data);
-			return;
-		} else if (local_size < data->download_size) {
-			rb_debug ("podcast partly downloaded (%" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT ")",
-				  local_size, data->download_size);
-			data->download_offset = local_size;
-		} else {
-			rb_debug ("replacing local file as it's larger than the download");
-			g_file_delete (data->destination, NULL, &error);
-			if (error != NULL) {
-				g_warning ("Removing existing download: %s", error->message);
-				g_error_free (error);
-				rb_podcast_manager_abort_download (data);
-				return;
-			}
-		}
+		rhythmdb_commit (data->pd->priv->db);
 	}
 
+	destination = g_file_new_for_uri (sane_local_file_uri);
 	g_free (sane_local_file_uri);
 
 	g_signal_emit (data->pd, rb_podcast_manager_signals[START_DOWNLOAD],
 		       0, data->entry);
 
-	data->cancel = g_cancellable_new ();
-	data->thread = g_thread_new ("podcast-download",
-				     (GThreadFunc) podcast_download_thread,
-				     data);
-}
-
-static void
-rb_podcast_manager_abort_download (RBPodcastManagerInfo *data)
-{
-	RBPodcastManager *mgr = data->pd;
-
-	g_assert (rb_is_main_thread ());
-
-	mgr->priv->download_list = g_list_remove (mgr->priv->download_list, data);
-	download_info_free (data);
-
-	if (mgr->priv->active_download == data)
-		mgr->priv->active_download = NULL;
-
-	if (mgr->priv->next_file_id == 0) {
-		mgr->priv->next_file_id =
-			g_idle_add ((GSourceFunc) rb_podcast_manager_next_file, mgr);
-	}
+	return destination;
 }
 
 gboolean
@@ -1048,9 +914,16 @@ rb_podcast_manager_subscribe_feed (RBPodcastManager *pd, const char *url, gboole
 	info->automatic = automatic;
 	info->existing_feed = existing_feed;
 
-	g_thread_new ("podcast-parse",
-		      (GThreadFunc) rb_podcast_manager_thread_parse_feed,
-		      info);
+	/* periodic updates can skip feeds that haven't changed; when the user
+	 * asks for a particular feed to be updated, always fetch it again.
+	 */
+	if (existing_feed && automatic) {
+		info->etag = g_strdup (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_FEED_ETAG));
+		info->last_modified = g_strdup (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_FEED_LAST_MODIFIED));
+		info->checksum = g_strdup (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_FEED_CHECKSUM));
+	}
+
+	g_thread_pool_push (pd->priv->update_pool, info, NULL);
 
 	return TRUE;
 }
@@ -1076,24 +949,44 @@ rb_podcast_manager_parse_complete_cb (RBPodcastManagerParseResult *result)
 						      (char *)result->channel->url,
 						      result->error,
 						      (result->automatic == FALSE));
+	} else if (result->channel->unchanged) {
+		rb_podcast_manager_feed_unchanged (result->pd, result->channel);
+	} else if (result->channel->is_opml) {
+		GList *l;
+
+		rb_debug ("Loading OPML feeds from %s", result->channel->url);
+
+		for (l = result->channel->posts; l != NULL; l = l->next) {
+			RBPodcastItem *item = l->data;
+			/* assume the feeds don't already exist */
+			rb_podcast_manager_subscribe_feed (result->pd, item->url, FALSE);
+		}
 	} else {
 		rb_podcast_manager_add_parsed_feed (result->pd, result->channel);
 	}
 	return FALSE;
 }
 
+static void
+free_thread_info (RBPodcastThreadInfo *info)
+{
+	g_free (info->url);
+	g_free (info->etag);
+	g_free (info->last_modified);
+	g_free (info->checksum);
+	g_free (info);
+}
+
 static void
 confirm_bad_mime_type_response_cb (GtkDialog *dialog, int response, RBPodcastThreadInfo *info)
 {
 	if (response == GTK_RESPONSE_YES) {
 		/* set the 'existing feed' flag to avoid the mime type check */
 		info->existing_feed = TRUE;
-		g_thread_new ("podcast-parse",
-			      (GThreadFunc) rb_podcast_manager_thread_parse_feed,
-			      info);
+		g_thread_pool_push (info->pd->priv->update_pool, info, NULL);
 	} else {
-		g_free (info->url);
-		g_free (info);
+		g_object_unref (info->pd);
+		free_thread_info (info);
 	}
 
 	gtk_widget_destroy (GTK_WIDGET (dialog));
@@ -1115,51 +1008,41 @@ confirm_bad_mime_type (RBPodcastThreadInfo *info)
 	return FALSE;
 }
 
-static gpointer
-rb_podcast_manager_thread_parse_feed (RBPodcastThreadInfo *info)
+static void
+rb_podcast_manager_thread_parse_feed (RBPodcastThreadInfo *info, gpointer unused)
 {
 	RBPodcastChannel *feed = g_new0 (RBPodcastChannel, 1);
 	RBPodcastManagerParseResult *result;
+	GError *error = NULL;
 
-	result = g_new0 (RBPodcastManagerParseResult, 1);
-	result->channel = feed;
-	result->pd = info->pd;		/* adopts our reference */
-	result->automatic = info->automatic;
-
-	g_clear_error (&result->error);
+	feed->etag = g_strdup (info->etag);
+	feed->last_modified = g_strdup (info->last_modified);
+	feed->checksum = g_strdup (info->checksum);
 
 	rb_debug ("attempting to parse feed %s", info->url);
-	if (rb_podcast_parse_load_feed (feed, info->url, info->existing_feed, &result->error) == FALSE) {
-		if (g_error_matches (result->error,
+	if (rb_podcast_parse_load_feed (feed, info->url, info->existing_feed, &error) == FALSE) {
+		if (g_error_matches (error,
 				     RB_PODCAST_PARSE_ERROR,
 				     RB_PODCAST_PARSE_ERROR_MIME_TYPE)) {
+			rb_podcast_parse_channel_free (feed);
+			g_error_free (error);
 			g_idle_add ((GSourceFunc) confirm_bad_mime_type, info);
-			return NULL;
+			return;
 		}
 	}
 
-	if (feed->is_opml) {
-		GList *l;
-
-		rb_debug ("Loading OPML feeds from %s", info->url);
-
-		for (l = feed->posts; l != NULL; l = l->next) {
-			RBPodcastItem *item = l->data;
-			/* assume the feeds don't already exist */
-			rb_podcast_manager_subscribe_feed (info->pd, item->url, FALSE);
-		}
+	result = g_new0 (RBPodcastManagerParseResult, 1);
+	result->channel = feed;
+	result->error = error;
+	result->pd = info->pd;		/* adopts our reference */
+	result->automatic = info->automatic;
 
-		rb_podcast_manager_free_parse_result (result);
-	} else {
-		g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
-				 (GSourceFunc) rb_podcast_manager_parse_complete_cb,
-				 result,
-				 (GDestroyNotify) rb_podcast_manager_free_parse_result);
-	}
+	g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+			 (GSourceFunc) rb_podcast_manager_parse_complete_cb,
+			 result,
+			 (GDestroyNotify) rb_podcast_manager_free_parse_result);
 
-	g_free (info->url);
-	g_free (info);
-	return NULL;
+	free_thread_info (info);
 }
 
 RhythmDBEntry *
@@ -1326,9 +1209,10 @@ missing_plugins_retry_cleanup (MissingPluginRetryData *retry)
 
 
 static void
-rb_podcast_manager_save_metadata (RBPodcastManager *pd, RhythmDBEntry *entry)
+save_metadata_cb (RBMetaData *md, GAsyncResult *result, MissingPluginRetryData *load_data)
 {
-	RBMetaData *md = rb_metadata_new ();
+	RBPodcastManager *pd = load_data->mgr;
+	RhythmDBEntry *entry = load_data->entry;
 	GError *error = NULL;
 	GValue val = { 0, };
 	const char *media_type;
@@ -1337,8 +1221,15 @@ rb_podcast_manager_save_metadata (RBPodcastManager *pd, RhythmDBEntry *entry)
 	char **plugin_descriptions;
 
 	uri = get_download_location (entry);
-	rb_debug ("loading podcast metadata from %s", uri);
-        rb_metadata_load (md, uri, &error);
+	rb_metadata_load_finish (md, result, &error);
+
+	/* the manager may have been shut down while we were waiting */
+	if (pd->priv->db == NULL) {
+		g_clear_error (&error);
+		g_object_unref (md);
+		missing_plugins_retry_cleanup (load_data);
+		return;
+	}
 
 	if (rb_metadata_get_missing_plugins (md, &missing_plugins, &plugin_descriptions)) {
 		GClosure *closure;
@@ -1360,6 +1251,9 @@ rb_podcast_manager_save_metadata (RBPodcastManager *pd, RhythmDBEntry *entry)
 
 		if (processing) {
 			/* when processing is complete, we'll retry */
+			g_clear_error (&error);
+			g_object_unref (md);
+			missing_plugins_retry_cleanup (load_data);
 			return;
 		}
 	}
@@ -1380,7 +1274,7 @@ rb_podcast_manager_save_metadata (RBPodcastManager *pd, RhythmDBEntry *entry)
 
 		g_object_unref (md);
 		g_error_free (error);
-
+		missing_plugins_retry_cleanup (load_data);
 		return;
 	}
 
@@ -1409,6 +1303,26 @@ rb_podcast_manager_save_metadata (RBPodcastManager *pd, RhythmDBEntry *entry)
 	rhythmdb_commit (pd->priv->db);
 
 	g_object_unref (md);
+	missing_plugins_retry_cleanup (load_data);
+}
+
+static void
+rb_podcast_manager_save_metadata (RBPodcastManager *pd, RhythmDBEntry *entry)
+{
+	MissingPluginRetryData *load_data;
+	const char *uri;
+
+	uri = get_download_location (entry);
+	rb_debug ("loading podcast metadata from %s", uri);
+
+	load_data = g_new0 (MissingPluginRetryData, 1);
+	load_data->mgr = g_object_ref (pd);
+	load_data->entry = rhythmdb_entry_ref (entry);
+	rb_metadata_load_async (rb_metadata_new (),
+				uri,
+				NULL,
+				(GAsyncReadyCallback) save_metadata_cb,
+				load_data);
 }
 
 static void
@@ -1425,23 +1339,6 @@ rb_podcast_manager_db_entry_added_cb (RBPodcastManager *pd, RhythmDBEntry *entry
 static void
 download_info_free (RBPodcastManagerInfo *data)
 {
-	/* what should this do about the thread and etc.? */
-
-	if (data->cancel != NULL) {
-		g_object_unref (data->cancel);
-		data->cancel = NULL;
-	}
-
-	if (data->source) {
-		g_object_unref (data->source);
-		data->source = NULL;
-	}
-
-	if (data->destination) {
-		g_object_unref (data->destination);
-		data->destination = NULL;
-	}
-
 	if (data->query_string) {
 		g_free (data->query_string);
 		data->query_string = NULL;
@@ -1451,11 +1348,15 @@ download_info_free (RBPodcastManagerInfo *data)
 		rhythmdb_entry_unref (data->entry);
 	}
 
+	g_object_unref (data->pd);
 	g_free (data);
 }
 
 static void
-download_progress (RBPodcastManagerInfo *data, guint64 downloaded, guint64 total, gboolean complete)
+download_progress_cb (RBPodcastDownload *download,
+		      guint64 downloaded,
+		      guint64 total,
+		      RBPodcastManagerInfo *data)
 {
 	guint local_progress = 0;
 
@@ -1478,196 +1379,50 @@ download_progress (RBPodcastManagerInfo *data, guint64 downloaded, guint64 total
 
 		data->progress = local_progress;
 	}
-
-	if (complete) {
-		if (g_cancellable_is_cancelled (data->cancel) == FALSE) {
-			GValue val = {0,};
-			rb_debug ("download of %s completed",
-				  get_remote_location (data->entry));
-
-			g_value_init (&val, G_TYPE_UINT64);
-			g_value_set_uint64 (&val, downloaded);
-			rhythmdb_entry_set (data->pd->priv->db, data->entry, RHYTHMDB_PROP_FILE_SIZE, &val);
-			g_value_unset (&val);
-
-			if (total == 0 || downloaded >= total) {
-				g_value_init (&val, G_TYPE_ULONG);
-				g_value_set_ulong (&val, RHYTHMDB_PODCAST_STATUS_COMPLETE);
-				rhythmdb_entry_set (data->pd->priv->db, data->entry, RHYTHMDB_PROP_STATUS, &val);
-				g_value_unset (&val);
-			}
-
-			rb_podcast_manager_save_metadata (data->pd,
-							  data->entry);
-		}
-		g_idle_add ((GSourceFunc)end_job, data);
-	}
 }
 
-static gpointer
-podcast_download_thread (RBPodcastManagerInfo *data)
+static void
+download_done_cb (RBPodcastDownload *download,
+		  guint64 downloaded,
+		  guint64 total,
+		  const GError *error,
+		  RBPodcastManagerInfo *data)
 {
-	GError *error = NULL;
-	char buf[8192];
-	gssize n_read;
-	gssize n_written;
-	guint64 downloaded;
-
-	/* if we have an offset to download from, try the seek
-	 * before anything else.  if we can't seek, we'll have to
-	 * grab the whole thing.
-	 */
-	downloaded = 0;
-	if (data->download_offset != 0) {
-		g_seekable_seek (G_SEEKABLE (data->in_stream),
-				 data->download_offset,
-				 G_SEEK_SET,
-				 data->cancel,
-				 &error);
-		if (error == NULL) {
-			/* ok, now we can open the output file for appending */
-			rb_debug ("seek to offset %" G_GUINT64_FORMAT " successful", data->download_offset);
-			data->out_stream = g_file_append_to (data->destination,
-							     G_FILE_CREATE_NONE,
-							     data->cancel,
-							     &error);
-			downloaded = data->download_offset;
-		} else if (error->domain == G_IO_ERROR &&
-			   error->code == G_IO_ERROR_NOT_SUPPORTED) {
-			/* can't seek, download the whole thing */
-			rb_debug ("seeking failed: %s", error->message);
-			g_clear_error (&error);
-		}
-	}
-	if (error != NULL) {
-		download_error (data, error);
-		g_error_free (error);
-		return NULL;
-	}
-
-	/* set the downloaded location for the episode
-	 * and do it before opening the file, so that the monitor
-	 * doesn't add a normal entry for us
-	 */
-	if (get_download_location (data->entry) == NULL) {
-		GValue val = {0,};
-		char *uri = g_file_get_uri (data->destination);
-
-		g_value_init (&val, G_TYPE_STRING);
-		g_value_set_string (&val, uri);
-		set_download_location (data->pd->priv->db, data->entry, &val);
-		g_value_unset (&val);
-
-		rhythmdb_commit (data->pd->priv->db);
-		g_free (uri);
-	}
-
-	/* gvfs doesn't do file info queries from streams, so this doesn't help, but
-	 * maybe some day it will..
-	 */
-	if (data->download_size == 0) {
-		GFileInfo *info;
-
-		info = g_file_input_stream_query_info (data->in_stream,
-						       G_FILE_ATTRIBUTE_STANDARD_SIZE,
-						       NULL,
-						       &error);
-		if (error != NULL) {
-			rb_debug ("stream info query failed: %s", error->message);
-			g_clear_error (&error);
-		} else {
-			data->download_size = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_SIZE);
-			rb_debug ("got file size from stream: %" G_GINT64_FORMAT, data->download_size);
-			g_object_unref (info);
-		}
-	}
-
-	/* open local file */
-	if (data->out_stream == NULL) {
-		data->out_stream = g_file_create (data->destination,
-						  G_FILE_CREATE_NONE,
-						  data->cancel,
-						  &error);
-		if (error != NULL) {
-			download_error (data, error);
-			g_error_free (error);
-			return NULL;
-		}
-	}
-
-	/* loop, copying from input stream to output stream */
-	while (TRUE) {
-		char *p;
-		n_read = g_input_stream_read (G_INPUT_STREAM (data->in_stream),
-					      buf, sizeof (buf),
-					      data->cancel,
-					      &error);
-		if (n_read < 1) {
-			break;
-		}
-
-		p = buf;
-		while (n_read > 0) {
-			n_written = g_output_stream_write (G_OUTPUT_STREAM (data->out_stream),
-							   p, n_read,
-							   data->cancel,
-							   &error);
-			if (n_written == -1) {
-				break;
-			}
-			p += n_written;
-			n_read -= n_written;
-			downloaded += n_written;
-		}
-		if (n_written == -1)
-			break;
+	RBPodcastManager *pd = data->pd;
+	GValue val = {0,};
 
-		download_progress (data, downloaded, data->download_size, FALSE);
-	}
+	g_assert (rb_is_main_thread ());
 
-	/* close everything - don't allow these operations to be cancelled */
-	g_input_stream_close (G_INPUT_STREAM (data->in_stream), NULL, NULL);
-	g_object_unref (data->in_stream);
+	rb_debug ("cleaning up download of %s",
+		  get_remote_location (data->entry));
 
-	g_output_stream_close (G_OUTPUT_STREAM (data->out_stream), NULL, &error);
-	g_object_unref (data->out_stream);
+	/* the downloader frees the download info after this returns */
+	data->download = NULL;
+	pd->priv->download_list = g_list_remove (pd->priv->download_list, data);
 
 	if (error != NULL) {
 		download_error (data, error);
-		g_error_free (error);
-	} else {
-		download_progress (data, downloaded, data->download_size, TRUE);
+		return;
 	}
 
-	rb_debug ("exiting download thread");
-	return NULL;
-}
+	rb_debug ("download of %s completed", get_remote_location (data->entry));
 
-static gboolean
-end_job	(RBPodcastManagerInfo *data)
-{
-	RBPodcastManager *pd = data->pd;
-
-	g_assert (rb_is_main_thread ());
+	g_value_init (&val, G_TYPE_UINT64);
+	g_value_set_uint64 (&val, downloaded);
+	rhythmdb_entry_set (pd->priv->db, data->entry, RHYTHMDB_PROP_FILE_SIZE, &val);
+	g_value_unset (&val);
 
-	rb_debug ("cleaning up download of %s",
-		  get_remote_location (data->entry));
+	if (total == 0 || downloaded >= total) {
+		g_value_init (&val, G_TYPE_ULONG);
+		g_value_set_ulong (&val, RHYTHMDB_PODCAST_STATUS_COMPLETE);
+		rhythmdb_entry_set (pd->priv->db, data->entry, RHYTHMDB_PROP_STATUS, &val);
+		g_value_unset (&val);
+	}
 
-	data->pd->priv->download_list = g_list_remove (data->pd->priv->download_list, data);
+	rb_podcast_manager_save_metadata (pd, data->entry);
 
-	g_signal_emit (data->pd, rb_podcast_manager_signals[FINISH_DOWNLOAD],
+	g_signal_emit (pd, rb_podcast_manager_signals[FINISH_DOWNLOAD],
 		       0, data->entry);
-
-	g_assert (pd->priv->active_download == data);
-	pd->priv->active_download = NULL;
-
-	download_info_free (data);
-
-	if (pd->priv->next_file_id == 0) {
-		pd->priv->next_file_id =
-			g_idle_add ((GSourceFunc) rb_podcast_manager_next_file, pd);
-	}
-	return FALSE;
 }
 
 static void
@@ -1676,19 +1431,12 @@ cancel_job (RBPodcastManagerInfo *data)
 	g_assert (rb_is_main_thread ());
 	rb_debug ("cancelling download of %s", get_remote_location (data->entry));
 
-	/* is this the active download? */
-	if (data == data->pd->priv->active_download) {
-		g_cancellable_cancel (data->cancel);
-
-		/* download data will be cleaned up after next progress callback */
-	} else {
-		/* destroy download data */
-		data->pd->priv->download_list = g_list_remove (data->pd->priv->download_list, data);
-		download_info_free (data);
-	}
+	/* download data will be cleaned up when the downloader
+	 * reports that the download is done.
+	 */
+	rb_podcast_downloader_cancel (data->pd->priv->downloader, data->download);
 }
 
-
 void
 rb_podcast_manager_unsubscribe_feed (RhythmDB *db, const char *url)
 {
@@ -1728,7 +1476,7 @@ rb_podcast_manager_remove_feed (RBPodcastManager *pd, const char *url, gboolean
 				RHYTHMDB_QUERY_RESULTS (query_model),
 				RHYTHMDB_QUERY_PROP_EQUALS,
 				RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_PODCAST_POST,
-				RHYTHMDB_QUERY_PROP_LIKE,
+				RHYTHMDB_QUERY_PROP_EQUALS,
 				RHYTHMDB_PROP_SUBTITLE, get_remote_location (entry),
 				RHYTHMDB_QUERY_END);
 
@@ -1899,6 +1647,22 @@ rb_podcast_manager_insert_feed_url (RBPodcastManager *pd, const char *url)
 	g_value_unset (&last_update_val);
 }
 
+static void
+set_feed_validators (RhythmDB *db, RhythmDBEntry *entry, RBPodcastChannel *data)
+{
+	GValue v = {0,};
+
+	/* validators the server didn't send are cleared */
+	g_value_init (&v, G_TYPE_STRING);
+	g_value_set_string (&v, data->etag ? data->etag : "");
+	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_FEED_ETAG, &v);
+	g_value_set_string (&v, data->last_modified ? data->last_modified : "");
+	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_FEED_LAST_MODIFIED, &v);
+	g_value_set_string (&v, data->checksum ? data->checksum : "");
+	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_FEED_CHECKSUM, &v);
+	g_value_unset (&v);
+}
+
 void
 rb_podcast_manager_add_parsed_feed (RBPodcastManager *pd, RBPodcastChannel *data)
 {
@@ -2034,6 +1798,8 @@ rb_podcast_manager_add_parsed_feed (RBPodcastManager *pd, RBPodcastChannel *data
 	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_PLAYBACK_ERROR, &error_val);
 	g_value_unset (&error_val);
 
+	set_feed_validators (db, entry, data);
+
 	if (g_settings_get_enum (pd->priv->settings, PODCAST_DOWNLOAD_INTERVAL) == PODCAST_INTERVAL_MANUAL) {
 		/* if automatic updates are disabled, don't download anything */
 		rb_debug ("not downloading any new episodes");
@@ -2173,6 +1939,37 @@ rb_podcast_manager_add_parsed_feed (RBPodcastManager *pd, RBPodcastChannel *data
 	rhythmdb_commit (db);
 }
 
+static void
+rb_podcast_manager_feed_unchanged (RBPodcastManager *pd, RBPodcastChannel *data)
+{
+	RhythmDBEntry *entry;
+	GValue v = {0,};
+
+	entry = rhythmdb_entry_lookup_by_location (pd->priv->db, data->url);
+	if (entry == NULL || rhythmdb_entry_get_entry_type (entry) != RHYTHMDB_ENTRY_TYPE_PODCAST_FEED)
+		return;
+
+	rb_debug ("podcast feed %s hasn't changed", data->url);
+
+	g_value_init (&v, G_TYPE_ULONG);
+	g_value_set_ulong (&v, RHYTHMDB_PODCAST_FEED_STATUS_NORMAL);
+	rhythmdb_entry_set (pd->priv->db, entry, RHYTHMDB_PROP_STATUS, &v);
+	g_value_unset (&v);
+
+	g_value_init (&v, G_TYPE_STRING);
+	g_value_set_string (&v, NULL);
+	rhythmdb_entry_set (pd->priv->db, entry, RHYTHMDB_PROP_PLAYBACK_ERROR, &v);
+	g_value_unset (&v);
+
+	g_value_init (&v, G_TYPE_ULONG);
+	g_value_set_ulong (&v, time (NULL));
+	rhythmdb_entry_set (pd->priv->db, entry, RHYTHMDB_PROP_LAST_SEEN, &v);
+	g_value_unset (&v);
+
+	set_feed_validators (pd->priv->db, entry, data);
+	rhythmdb_commit (pd->priv->db);
+}
+
 static void
 rb_podcast_manager_handle_feed_error (RBPodcastManager *mgr,
 				      const char *url,
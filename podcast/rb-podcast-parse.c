@@ -35,6 +35,9 @@
 #include <gio/gio.h>
 #include <glib.h>
 #include <glib/gprintf.h>
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+#include <unistd.h>
 
 #include "rb-debug.h"
 #include "rb-podcast-parse.h"
@@ -148,6 +151,214 @@ entry_parsed (TotemPlParser *parser,
 	channel->posts = g_list_prepend (channel->posts, item);
 }
 
+static gboolean
+check_content_type (RBPodcastChannel *data, const char *content_type, GError **error)
+{
+	if (content_type != NULL
+	    && strstr (content_type, "html") == NULL
+	    && strstr (content_type, "xml") == NULL
+	    && strstr (content_type, "rss") == NULL
+	    && strstr (content_type, "opml") == NULL) {
+		g_set_error (error,
+			     RB_PODCAST_PARSE_ERROR,
+			     RB_PODCAST_PARSE_ERROR_MIME_TYPE,
+			     _("Unexpected file type: %s"),
+			     content_type);
+		return FALSE;
+	} else if (content_type != NULL
+		   && strstr (content_type, "opml") != NULL) {
+		data->is_opml = TRUE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+parse_feed (RBPodcastChannel *data, const char *uri, const char *base, GError **error)
+{
+	TotemPlParser *plparser;
+	TotemPlParserResult result;
+
+	plparser = totem_pl_parser_new ();
+	g_object_set (plparser, "recurse", FALSE, "force", TRUE, NULL);
+	g_signal_connect (G_OBJECT (plparser), "entry-parsed", G_CALLBACK (entry_parsed), data);
+	g_signal_connect (G_OBJECT (plparser), "playlist-started", G_CALLBACK (playlist_started), data);
+	g_signal_connect (G_OBJECT (plparser), "playlist-ended", G_CALLBACK (playlist_ended), data);
+
+	if (base != NULL) {
+		result = totem_pl_parser_parse_with_base (plparser, uri, base, FALSE);
+	} else {
+		result = totem_pl_parser_parse (plparser, uri, FALSE);
+	}
+	g_object_unref (plparser);
+
+	if (result != TOTEM_PL_PARSER_RESULT_SUCCESS) {
+		rb_debug ("Parsing %s as a Podcast failed", data->url);
+		g_set_error (error,
+			     RB_PODCAST_PARSE_ERROR,
+			     RB_PODCAST_PARSE_ERROR_XML_PARSE,
+			     _("Unable to parse the feed contents"));
+		return FALSE;
+	}
+
+	/* treat empty feeds, or feeds that don't contain any downloadable items, as
+	 * an error.
+	 */
+	if (data->posts == NULL) {
+		rb_debug ("Parsing %s as a podcast succeeded, but the feed contains no downloadable items", data->url);
+		g_set_error (error,
+			     RB_PODCAST_PARSE_ERROR,
+			     RB_PODCAST_PARSE_ERROR_NO_ITEMS,
+			     _("The feed does not contain any downloadable items"));
+		return FALSE;
+	}
+
+	rb_debug ("Parsing %s as a Podcast succeeded", data->url);
+	return TRUE;
+}
+
+static void
+update_validator (char **field, const char *value, gboolean replace)
+{
+	if (value != NULL || replace) {
+		g_free (*field);
+		*field = g_strdup (value);
+	}
+}
+
+/*
+ * All feed fetches share one session, so refreshing several feeds from the
+ * same server can reuse its connections.  Feeds are loaded on worker
+ * threads, which SoupSessionSync allows.
+ */
+static SoupSession *
+get_feed_session (void)
+{
+	static gsize session = 0;
+
+	if (g_once_init_enter (&session)) {
+		SoupSession *s;
+
+		s = soup_session_sync_new_with_options (SOUP_SESSION_ADD_FEATURE_BY_TYPE,
+							SOUP_TYPE_PROXY_RESOLVER_DEFAULT,
+							SOUP_SESSION_USER_AGENT,
+							"Rhythmbox/" VERSION " ",
+							SOUP_SESSION_SSL_USE_SYSTEM_CA_FILE,
+							TRUE,
+							NULL);
+		g_once_init_leave (&session, (gsize) s);
+	}
+	return (SoupSession *) session;
+}
+
+static gboolean
+load_http_feed (RBPodcastChannel *data, gboolean check_mime_type, GError **error)
+{
+	SoupMessage *message;
+	char *checksum;
+	char *tmp_name = NULL;
+	char *tmp_uri = NULL;
+	int tmp_fd;
+	gboolean ret = FALSE;
+
+	message = soup_message_new (SOUP_METHOD_GET, data->url);
+	if (message == NULL) {
+		g_set_error (error,
+			     RB_PODCAST_PARSE_ERROR,
+			     RB_PODCAST_PARSE_ERROR_FILE_INFO,
+			     _("Invalid URL"));
+		return FALSE;
+	}
+
+	if (data->etag != NULL && data->etag[0] != '\0')
+		soup_message_headers_replace (message->request_headers, "If-None-Match", data->etag);
+	if (data->last_modified != NULL && data->last_modified[0] != '\0')
+		soup_message_headers_replace (message->request_headers, "If-Modified-Since", data->last_modified);
+
+	soup_session_send_message (get_feed_session (), message);
+
+	if (message->status_code == SOUP_STATUS_NOT_MODIFIED) {
+		rb_debug ("feed %s not modified", data->url);
+		/* a 304 response may refresh the validators, but leaves any it
+		 * doesn't include as they were.
+		 */
+		update_validator (&data->etag, soup_message_headers_get_one (message->response_headers, "ETag"), FALSE);
+		update_validator (&data->last_modified, soup_message_headers_get_one (message->response_headers, "Last-Modified"), FALSE);
+		data->unchanged = TRUE;
+		ret = TRUE;
+		goto out;
+	} else if (SOUP_STATUS_IS_SUCCESSFUL (message->status_code) == FALSE) {
+		g_set_error (error,
+			     RB_PODCAST_PARSE_ERROR,
+			     RB_PODCAST_PARSE_ERROR_FILE_INFO,
+			     _("Unable to download the feed: %s"),
+			     message->reason_phrase ? message->reason_phrase : soup_status_get_phrase (message->status_code));
+		goto out;
+	}
+
+	/* a full response replaces the validators, so ones the server no
+	 * longer sends aren't sent back to it.
+	 */
+	update_validator (&data->etag, soup_message_headers_get_one (message->response_headers, "ETag"), TRUE);
+	update_validator (&data->last_modified, soup_message_headers_get_one (message->response_headers, "Last-Modified"), TRUE);
+
+	/* plenty of servers don't support conditional requests, so also check
+	 * whether the contents are the same as last time.
+	 */
+	checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+						(const guchar *) message->response_body->data,
+						message->response_body->length);
+	if (g_strcmp0 (checksum, data->checksum) == 0) {
+		rb_debug ("feed %s contents unchanged", data->url);
+		g_free (checksum);
+		data->unchanged = TRUE;
+		ret = TRUE;
+		goto out;
+	}
+	g_free (data->checksum);
+	data->checksum = checksum;
+
+	if (check_mime_type &&
+	    check_content_type (data, soup_message_headers_get_content_type (message->response_headers, NULL), error) == FALSE) {
+		goto out;
+	}
+
+	/* totem-pl-parser can't parse from memory, so write the feed out to
+	 * a temporary file and parse that, resolving any relative links against
+	 * the feed URL.
+	 */
+	tmp_fd = g_file_open_tmp ("rb-podcast-feed-XXXXXX.xml", &tmp_name, NULL);
+	if (tmp_fd == -1 ||
+	    write (tmp_fd, message->response_body->data, message->response_body->length) != message->response_body->length) {
+		g_set_error (error,
+			     RB_PODCAST_PARSE_ERROR,
+			     RB_PODCAST_PARSE_ERROR_FILE_INFO,
+			     _("Unable to save the feed contents"));
+		if (tmp_fd != -1)
+			close (tmp_fd);
+		goto out;
+	}
+	close (tmp_fd);
+
+	tmp_uri = g_filename_to_uri (tmp_name, NULL, NULL);
+	ret = parse_feed (data, tmp_uri, data->url, error);
+
+out:
+	if (tmp_name != NULL) {
+		g_unlink (tmp_name);
+		g_free (tmp_name);
+	}
+	g_free (tmp_uri);
+	g_object_unref (message);
+	return ret;
+}
+
+/*
+ * For HTTP feeds, if the channel contains validators from a previous load of
+ * the same feed, the feed is only fetched if the server says it has changed,
+ * and only parsed if its contents differ from last time.  Otherwise the
+ * channel is marked unchanged and has no posts.
+ */
 gboolean
 rb_podcast_parse_load_feed (RBPodcastChannel *data,
 			    const char *file_name,
@@ -156,9 +367,10 @@ rb_podcast_parse_load_feed (RBPodcastChannel *data,
 {
 	GFile *file;
 	GFileInfo *fileinfo;
-	TotemPlParser *plparser;
+	gboolean check_mime_type;
 
 	data->url = g_strdup (file_name);
+	data->unchanged = FALSE;
 
 	/* if the URL has a .rss, .xml or .atom extension (before the query string),
 	 * don't bother checking the MIME type.
@@ -166,9 +378,19 @@ rb_podcast_parse_load_feed (RBPodcastChannel *data,
 	if (rb_uri_could_be_podcast (file_name, &data->is_opml) || existing_feed) {
 		rb_debug ("not checking mime type for %s (should be %s file)", file_name,
 			  data->is_opml ? "OPML" : "Podcast");
+		check_mime_type = FALSE;
 	} else {
+		check_mime_type = TRUE;
+	}
+
+	if (g_str_has_prefix (file_name, "http://") || g_str_has_prefix (file_name, "https://")) {
+		return load_http_feed (data, check_mime_type, error);
+	}
+
+	if (check_mime_type) {
 		GError *ferror = NULL;
 		char *content_type;
+		gboolean ok;
 
 		rb_debug ("checking mime type for %s", file_name);
 
@@ -189,57 +411,13 @@ rb_podcast_parse_load_feed (RBPodcastChannel *data,
 		g_object_unref (file);
 		g_object_unref (fileinfo);
 
-		if (content_type != NULL
-		    && strstr (content_type, "html") == NULL
-		    && strstr (content_type, "xml") == NULL
-		    && strstr (content_type, "rss") == NULL
-		    && strstr (content_type, "opml") == NULL) {
-			g_set_error (error,
-				     RB_PODCAST_PARSE_ERROR,
-				     RB_PODCAST_PARSE_ERROR_MIME_TYPE,
-				     _("Unexpected file type: %s"),
-				     content_type);
-			g_free (content_type);
-			return FALSE;
-		} else if (content_type != NULL
-			   && strstr (content_type, "opml") != NULL) {
-			data->is_opml = TRUE;
-		}
-
+		ok = check_content_type (data, content_type, error);
 		g_free (content_type);
+		if (ok == FALSE)
+			return FALSE;
 	}
 
-	plparser = totem_pl_parser_new ();
-	g_object_set (plparser, "recurse", FALSE, "force", TRUE, NULL);
-	g_signal_connect (G_OBJECT (plparser), "entry-parsed", G_CALLBACK (entry_parsed), data);
-	g_signal_connect (G_OBJECT (plparser), "playlist-started", G_CALLBACK (playlist_started), data);
-	g_signal_connect (G_OBJECT (plparser), "playlist-ended", G_CALLBACK (playlist_ended), data);
-
-	if (totem_pl_parser_parse (plparser, file_name, FALSE) != TOTEM_PL_PARSER_RESULT_SUCCESS) {
-		rb_debug ("Parsing %s as a Podcast failed", file_name);
-		g_set_error (error,
-			     RB_PODCAST_PARSE_ERROR,
-			     RB_PODCAST_PARSE_ERROR_XML_PARSE,
-			     _("Unable to parse the feed contents"));
-		g_object_unref (plparser);
-		return FALSE;
-	}
-	g_object_unref (plparser);
-
-	/* treat empty feeds, or feeds that don't contain any downloadable items, as
-	 * an error.
-	 */
-	if (data->posts == NULL) {
-		rb_debug ("Parsing %s as a podcast succeeded, but the feed contains no downloadable items", file_name);
-		g_set_error (error,
-			     RB_PODCAST_PARSE_ERROR,
-			     RB_PODCAST_PARSE_ERROR_NO_ITEMS,
-			     _("The feed does not contain any downloadable items"));
-		return FALSE;
-	}
-
-	rb_debug ("Parsing %s as a Podcast succeeded", file_name);
-	return TRUE;
+	return parse_feed (data, file_name, NULL, error);
 }
 
 RBPodcastChannel *
@@ -257,6 +435,10 @@ rb_podcast_parse_channel_copy (RBPodcastChannel *data)
 	copy->pub_date = data->pub_date;
 	copy->copyright = g_strdup (data->copyright);
 	copy->is_opml = data->is_opml;
+	copy->etag = g_strdup (data->etag);
+	copy->last_modified = g_strdup (data->last_modified);
+	copy->checksum = g_strdup (data->checksum);
+	copy->unchanged = data->unchanged;
 
 	if (data->posts != NULL) {
 		GList *l;
@@ -290,6 +472,9 @@ rb_podcast_parse_channel_free (RBPodcastChannel *data)
 	g_free (data->contact);
 	g_free (data->img);
 	g_free (data->copyright);
+	g_free (data->etag);
+	g_free (data->last_modified);
+	g_free (data->checksum);
 
 	g_free (data);
 	data = NULL;
@@ -68,6 +68,14 @@ typedef struct
 
 	GList *posts;
 	int num_posts;
+
+	/* validators for conditional fetching.  set these before loading
+	 * a feed to skip it if it hasn't changed; loading updates them.
+	 */
+	char *etag;
+	char *last_modified;
+	char *checksum;
+	gboolean unchanged;
 } RBPodcastChannel;
 
 GType	rb_podcast_channel_get_type (void);
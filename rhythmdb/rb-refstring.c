@@ -33,12 +33,26 @@
 #include "rb-cut-and-paste-code.h"
 #include "rb-refstring.h"
 
-GHashTable *rb_refstrings;
-GMutex rb_refstrings_mutex;
+/*
+ * The intern table is split into shards, each with its own lock, so
+ * threads interning different strings rarely wait for each other.
+ * The shard is chosen by the string's hash, which is stored in the
+ * refstring so releasing the last reference doesn't need to rehash it.
+ */
+#define RB_REFSTRING_SHARDS	64
+
+typedef struct {
+	GMutex lock;
+	GHashTable *table;
+	gint contended;
+} RBRefStringShard;
+
+static RBRefStringShard rb_refstring_shards[RB_REFSTRING_SHARDS];
 
 struct RBRefString
 {
 	gint refcount;
+	guint hash;
 	gpointer folded;
 	gpointer sortkey;
 	char value[1];
@@ -55,6 +69,22 @@ rb_refstring_free (RBRefString *refstr)
 	g_free (refstr);
 }
 
+static inline RBRefStringShard *
+rb_refstring_shard (guint hash)
+{
+	/* the hash tables use the low bits, so use the high ones here */
+	return &rb_refstring_shards[(hash >> 24) % RB_REFSTRING_SHARDS];
+}
+
+static inline void
+rb_refstring_shard_lock (RBRefStringShard *shard)
+{
+	if (G_UNLIKELY (g_mutex_trylock (&shard->lock) == FALSE)) {
+		g_atomic_int_inc (&shard->contended);
+		g_mutex_lock (&shard->lock);
+	}
+}
+
 /**
  * rb_refstring_system_init:
  *
@@ -63,8 +93,14 @@ rb_refstring_free (RBRefString *refstr)
 void
 rb_refstring_system_init ()
 {
-	rb_refstrings = g_hash_table_new_full (g_str_hash, g_str_equal,
-					       NULL, (GDestroyNotify) rb_refstring_free);
+	int i;
+
+	for (i = 0; i < RB_REFSTRING_SHARDS; i++) {
+		g_mutex_init (&rb_refstring_shards[i].lock);
+		rb_refstring_shards[i].table = g_hash_table_new_full (g_str_hash, g_str_equal,
+								      NULL, (GDestroyNotify) rb_refstring_free);
+		rb_refstring_shards[i].contended = 0;
+	}
 }
 
 /**
@@ -80,26 +116,34 @@ rb_refstring_system_init ()
 RBRefString *
 rb_refstring_new (const char *init)
 {
+	RBRefStringShard *shard;
 	RBRefString *ret;
+	guint hash;
+	gsize len;
+
+	hash = g_str_hash (init);
+	shard = rb_refstring_shard (hash);
 
-	g_mutex_lock (&rb_refstrings_mutex);
-	ret = g_hash_table_lookup (rb_refstrings, init);
+	rb_refstring_shard_lock (shard);
+	ret = g_hash_table_lookup (shard->table, init);
 
 	if (ret) {
 		rb_refstring_ref (ret);
-		g_mutex_unlock (&rb_refstrings_mutex);
+		g_mutex_unlock (&shard->lock);
 		return ret;
 	}
 
-	ret = g_malloc (sizeof (RBRefString) + strlen (init));
+	len = strlen (init);
+	ret = g_malloc (sizeof (RBRefString) + len);
 
-	g_strlcpy (ret->value, init, strlen (init) + 1);
+	memcpy (ret->value, init, len + 1);
 	g_atomic_int_set (&ret->refcount, 1);
+	ret->hash = hash;
 	ret->folded = NULL;
 	ret->sortkey = NULL;
 
-	g_hash_table_insert (rb_refstrings, ret->value, ret);
-	g_mutex_unlock (&rb_refstrings_mutex);
+	g_hash_table_insert (shard->table, ret->value, ret);
+	g_mutex_unlock (&shard->lock);
 	return ret;
 }
 
@@ -116,15 +160,20 @@ rb_refstring_new (const char *init)
 RBRefString *
 rb_refstring_find (const char *init)
 {
+	RBRefStringShard *shard;
 	RBRefString *ret;
+	guint hash;
 
-	g_mutex_lock (&rb_refstrings_mutex);
-	ret = g_hash_table_lookup (rb_refstrings, init);
+	hash = g_str_hash (init);
+	shard = rb_refstring_shard (hash);
+
+	rb_refstring_shard_lock (shard);
+	ret = g_hash_table_lookup (shard->table, init);
 
 	if (ret)
 		rb_refstring_ref (ret);
 
-	g_mutex_unlock (&rb_refstrings_mutex);
+	g_mutex_unlock (&shard->lock);
 	return ret;
 }
 
@@ -144,12 +193,14 @@ rb_refstring_unref (RBRefString *val)
 	g_return_if_fail (g_atomic_int_get (&val->refcount) > 0);
 
 	if (g_atomic_int_dec_and_test (&val->refcount)) {
-		g_mutex_lock (&rb_refstrings_mutex);
+		RBRefStringShard *shard = rb_refstring_shard (val->hash);
+
+		rb_refstring_shard_lock (shard);
 		/* ensure it's still not referenced, as something may have called
 		 * rb_refstring_new since we decremented the count */
 		if (g_atomic_int_get (&val->refcount) == 0)
-			g_hash_table_remove (rb_refstrings, val->value);
-		g_mutex_unlock (&rb_refstrings_mutex);
+			g_hash_table_remove (shard->table, val->value);
+		g_mutex_unlock (&shard->lock);
 	}
 }
 
@@ -162,7 +213,34 @@ rb_refstring_unref (RBRefString *val)
 void
 rb_refstring_system_shutdown (void)
 {
-	g_hash_table_destroy (rb_refstrings);
+	int i;
+
+	for (i = 0; i < RB_REFSTRING_SHARDS; i++) {
+		g_hash_table_destroy (rb_refstring_shards[i].table);
+		rb_refstring_shards[i].table = NULL;
+		g_mutex_clear (&rb_refstring_shards[i].lock);
+	}
+}
+
+/**
+ * rb_refstring_system_get_contention:
+ *
+ * Returns the number of times a thread has had to wait for another
+ * thread to access the refstring table since the refstring system was
+ * set up.  This is only useful for benchmarking.
+ *
+ * Return value: number of contended table accesses
+ */
+guint
+rb_refstring_system_get_contention (void)
+{
+	guint total = 0;
+	int i;
+
+	for (i = 0; i < RB_REFSTRING_SHARDS; i++) {
+		total += g_atomic_int_get (&rb_refstring_shards[i].contended);
+	}
+	return total;
 }
 
 /**
@@ -300,7 +378,7 @@ guint
 rb_refstring_hash (gconstpointer p)
 {
 	const RBRefString *ref = p;
-	return g_str_hash (rb_refstring_get (ref));
+	return ref->hash;
 }
 
 /**
@@ -37,6 +37,7 @@ typedef struct RBRefString RBRefString;
 
 void		rb_refstring_system_init (void);
 void		rb_refstring_system_shutdown (void);
+guint		rb_refstring_system_get_contention (void);
 
 RBRefString *	rb_refstring_new (const char *init);
 RBRefString *	rb_refstring_find (const char *init);
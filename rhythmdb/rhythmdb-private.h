@@ -31,6 +31,7 @@
 #include <rhythmdb/rhythmdb.h>
 #include <rhythmdb/rb-refstring.h>
 #include <metadata/rb-metadata.h>
+#include <lib/rb-trace.h>
 
 G_BEGIN_DECLS
 
@@ -51,6 +52,11 @@ typedef struct {
 			   102: wait
 			   103: pause */
 	gulong post_time;
+
+	/* feeds only: used to avoid refetching and reparsing unchanged feeds */
+	RBRefString *etag;
+	RBRefString *last_modified;
+	RBRefString *checksum;
 } RhythmDBPodcastFields;
 
 enum {
@@ -120,6 +126,17 @@ struct _RhythmDBEntry {
 	RBRefString *playback_error;
 };
 
+/* Properties of an entry that changed since the database was last saved.
+ * Entries that were added, moved, or had their keywords changed since then
+ * have @full set and must be written out in full.
+ */
+typedef struct {
+	gboolean full;
+	guint32 props[(RHYTHMDB_NUM_PROPERTIES + 31) / 32];
+} RhythmDBJournalChanges;
+
+#define RHYTHMDB_JOURNAL_CHANGES_HAS_PROP(c, propid) (((c)->props[(propid) / 32] & (1U << ((propid) % 32))) != 0)
+
 struct _RhythmDBPrivate
 {
 	char *name;
@@ -135,9 +152,18 @@ struct _RhythmDBPrivate
 	gint outstanding_threads;
 	GAsyncQueue *action_queue;
 	GAsyncQueue *event_queue;
+	GMutex event_queue_mutex;
+	GCond event_queue_cond;
+	gint event_queue_waiters;
 	GAsyncQueue *restored_queue;
 	GAsyncQueue *delayed_write_queue;
 	GThreadPool *query_thread_pool;
+	GThreadPool *load_thread_pool;
+	guint metadata_helpers;
+
+	/* updated whenever an event or action is queued or processed */
+	RBTraceCounter *event_queue_counter;
+	RBTraceCounter *action_queue_counter;
 
 	GList *stat_list;
 	GList *outstanding_stats;
@@ -163,6 +189,13 @@ struct _RhythmDBPrivate
 	GHashTable *changed_entries;
 	GHashTable *deleted_entries;
 
+	/* changes since the last save, for backends that keep a journal */
+	gboolean journal_active;
+	gboolean journal_invalid;
+	gboolean journal_compact;
+	GHashTable *journal_changes;	/* RhythmDBEntry -> RhythmDBJournalChanges */
+	GList *journal_deleted;		/* RBRefString locations, most recent first */
+
 	GHashTable *propname_map;
 
 	GMutex exit_mutex;
@@ -253,6 +286,13 @@ GList *rhythmdb_get_active_mounts (RhythmDB *db);
 GPtrArray *rhythmdb_query_parse_valist (RhythmDB *db, va_list args);
 void       rhythmdb_read_encoded_property (RhythmDB *db, const char *data, RhythmDBPropType propid, GValue *val);
 
+typedef struct _RhythmDBQueryProgram RhythmDBQueryProgram;
+RhythmDBQueryProgram *rhythmdb_query_program_compile (RhythmDB *db, GPtrArray *query);
+gboolean   rhythmdb_query_program_matches (RhythmDBQueryProgram *program, GPtrArray *query);
+gboolean   rhythmdb_query_program_run (RhythmDBQueryProgram *program, RhythmDBEntry *entry);
+void       rhythmdb_query_program_free (RhythmDBQueryProgram *program);
+gboolean   rhythmdb_query_evaluate_uncompiled (RhythmDB *db, GPtrArray *query, RhythmDBEntry *entry);
+
 /* from rhythmdb-song-entry-types.c */
 void       rhythmdb_register_song_entry_types (RhythmDB *db);
 
@@ -81,6 +81,9 @@ static void rhythmdb_property_model_prop_changed_cb (RhythmDB *db, RhythmDBEntry
 						     RhythmDBPropType prop, const GValue *old,
 						     const GValue *new,
 						     RhythmDBPropertyModel *propmodel);
+static void rhythmdb_property_model_query_complete_cb (RhythmDBQueryModel *model,
+						       RhythmDBPropertyModel *propmodel);
+static void rhythmdb_property_model_publish_pending (RhythmDBPropertyModel *propmodel);
 static void rhythmdb_property_model_entry_removed_cb (RhythmDBQueryModel *model,
 						      RhythmDBEntry *entry,
 						      RhythmDBPropertyModel *propmodel);
@@ -186,6 +189,9 @@ struct RhythmDBPropertyModelPrivate
 	GSequence *properties;
 	GHashTable *reverse_map;
 
+	/* property string -> RhythmDBPropertyModelEntry, while the query is running */
+	GHashTable *pending;
+
 	RhythmDBPropertyModelEntry *all;
 
 	guint syncing_id;
@@ -347,6 +353,8 @@ static void
 rhythmdb_property_model_set_query_model_internal (RhythmDBPropertyModel *model,
 						  RhythmDBQueryModel    *query_model)
 {
+	gboolean query_running;
+
 	if (model->priv->query_model != NULL) {
 		g_signal_handlers_disconnect_by_func (model->priv->query_model,
 						      G_CALLBACK (rhythmdb_property_model_row_inserted_cb),
@@ -357,6 +365,9 @@ rhythmdb_property_model_set_query_model_internal (RhythmDBPropertyModel *model,
 		g_signal_handlers_disconnect_by_func (model->priv->query_model,
 						      G_CALLBACK (rhythmdb_property_model_prop_changed_cb),
 						      model);
+		g_signal_handlers_disconnect_by_func (model->priv->query_model,
+						      G_CALLBACK (rhythmdb_property_model_query_complete_cb),
+						      model);
 
 		gtk_tree_model_foreach (GTK_TREE_MODEL (model->priv->query_model),
 					(GtkTreeModelForeachFunc)_remove_entry_cb,
@@ -365,12 +376,33 @@ rhythmdb_property_model_set_query_model_internal (RhythmDBPropertyModel *model,
 		g_object_unref (model->priv->query_model);
 	}
 
+	if (model->priv->pending != NULL) {
+		g_assert (g_hash_table_size (model->priv->pending) == 0);
+		g_hash_table_destroy (model->priv->pending);
+		model->priv->pending = NULL;
+	}
+
 	model->priv->query_model = query_model;
 	g_assert (rhythmdb_property_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 1);
 
 	if (model->priv->query_model != NULL) {
 		g_object_ref (model->priv->query_model);
 
+		/* collect the property values for the rows already in the
+		 * query model, and for any added while its query is running,
+		 * without updating the model, then add them all at once.
+		 */
+		model->priv->pending = g_hash_table_new (g_str_hash, g_str_equal);
+		query_running = rhythmdb_query_model_query_running (model->priv->query_model);
+		if (query_running) {
+			rb_debug ("query is running; building property model in bulk");
+			g_signal_connect_object (model->priv->query_model,
+						 "complete",
+						 G_CALLBACK (rhythmdb_property_model_query_complete_cb),
+						 model,
+						 0);
+		}
+
 		g_signal_connect_object (model->priv->query_model,
 					 "row_inserted",
 					 G_CALLBACK (rhythmdb_property_model_row_inserted_cb),
@@ -389,6 +421,10 @@ rhythmdb_property_model_set_query_model_internal (RhythmDBPropertyModel *model,
 		gtk_tree_model_foreach (GTK_TREE_MODEL (model->priv->query_model),
 					(GtkTreeModelForeachFunc)_add_entry_cb,
 					model);
+
+		if (query_running == FALSE) {
+			rhythmdb_property_model_publish_pending (model);
+		}
 	}
 }
 
@@ -521,6 +557,12 @@ _prop_model_entry_cleanup (RhythmDBPropertyModelEntry *prop, gpointer data)
 	g_free (prop);
 }
 
+static void
+_pending_entry_cleanup (gpointer key, RhythmDBPropertyModelEntry *prop, gpointer data)
+{
+	_prop_model_entry_cleanup (prop, data);
+}
+
 static void
 rhythmdb_property_model_dispose (GObject *object)
 {
@@ -564,6 +606,11 @@ rhythmdb_property_model_finalize (GObject *object)
 
 	g_hash_table_destroy (model->priv->reverse_map);
 
+	if (model->priv->pending != NULL) {
+		g_hash_table_foreach (model->priv->pending, (GHFunc)_pending_entry_cleanup, NULL);
+		g_hash_table_destroy (model->priv->pending);
+	}
+
 	g_sequence_foreach (model->priv->properties, (GFunc)_prop_model_entry_cleanup, NULL);
 	g_sequence_free (model->priv->properties);
 
@@ -650,6 +697,17 @@ rhythmdb_property_model_prop_changed_cb (RhythmDB *db,
 			for (pi = 0; pi < propmodel->priv->sort_propids->len; pi++) {
 				if (propid == g_array_index (propmodel->priv->sort_propids, RhythmDBPropType, pi)) {
 					propstr = rhythmdb_entry_get_string (entry, propmodel->priv->propid);
+					if (propmodel->priv->pending != NULL) {
+						/* not in the model yet, so no need to move it */
+						prop = g_hash_table_lookup (propmodel->priv->pending, propstr);
+						if (update_sort_string (propmodel, prop, entry) == FALSE &&
+						    pi == prop->sort_string_from) {
+							rb_refstring_unref (prop->sort_string);
+							prop->sort_string = rb_refstring_new (g_value_get_string (new));
+						}
+						break;
+					}
+
 					ptr = g_hash_table_lookup (propmodel->priv->reverse_map, propstr);
 					prop = g_sequence_get (ptr);
 					iter.stamp = propmodel->priv->stamp;
@@ -695,6 +753,76 @@ rhythmdb_property_model_compare (RhythmDBPropertyModelEntry *a,
 	return strcmp (a_str, b_str);
 }
 
+static gint
+rhythmdb_property_model_compare_pending (RhythmDBPropertyModelEntry **a,
+					 RhythmDBPropertyModelEntry **b,
+					 RhythmDBPropertyModel *model)
+{
+	return rhythmdb_property_model_compare (*a, *b, model);
+}
+
+static void
+rhythmdb_property_model_publish_pending (RhythmDBPropertyModel *propmodel)
+{
+	GPtrArray *props;
+	GHashTableIter hiter;
+	gpointer value;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	guint i;
+
+	if (propmodel->priv->pending == NULL)
+		return;
+
+	/* sort the collected values once and add them to the model in order */
+	props = g_ptr_array_sized_new (g_hash_table_size (propmodel->priv->pending));
+	g_hash_table_iter_init (&hiter, propmodel->priv->pending);
+	while (g_hash_table_iter_next (&hiter, NULL, &value)) {
+		g_ptr_array_add (props, value);
+	}
+	g_hash_table_destroy (propmodel->priv->pending);
+	propmodel->priv->pending = NULL;
+
+	g_ptr_array_sort_with_data (props,
+				    (GCompareDataFunc) rhythmdb_property_model_compare_pending,
+				    propmodel);
+
+	rb_debug ("adding %u properties", props->len);
+	for (i = 0; i < props->len; i++) {
+		RhythmDBPropertyModelEntry *prop = g_ptr_array_index (props, i);
+		GSequenceIter *ptr;
+
+		ptr = g_sequence_append (propmodel->priv->properties, prop);
+		g_hash_table_insert (propmodel->priv->reverse_map,
+				     (gpointer)rb_refstring_get (prop->string),
+				     ptr);
+	}
+
+	iter.stamp = propmodel->priv->stamp;
+	path = gtk_tree_path_new_from_indices (1, -1);
+	for (i = 0; i < props->len; i++) {
+		RhythmDBPropertyModelEntry *prop = g_ptr_array_index (props, i);
+
+		iter.user_data = g_hash_table_lookup (propmodel->priv->reverse_map, rb_refstring_get (prop->string));
+		gtk_tree_model_row_inserted (GTK_TREE_MODEL (propmodel), path, &iter);
+		gtk_tree_path_next (path);
+	}
+	gtk_tree_path_free (path);
+	g_ptr_array_free (props, TRUE);
+
+	rhythmdb_property_model_sync (propmodel);
+}
+
+static void
+rhythmdb_property_model_query_complete_cb (RhythmDBQueryModel *query_model,
+					   RhythmDBPropertyModel *propmodel)
+{
+	g_signal_handlers_disconnect_by_func (query_model,
+					      G_CALLBACK (rhythmdb_property_model_query_complete_cb),
+					      propmodel);
+	rhythmdb_property_model_publish_pending (propmodel);
+}
+
 /*
  * looks for an updated sort string in a new entry for the specified
  * property.  if the new entry provides a value for a higher priority
@@ -806,6 +934,23 @@ rhythmdb_property_model_insert (RhythmDBPropertyModel *model,
 
 	g_atomic_int_inc (&model->priv->all->refcount);
 
+	if (model->priv->pending != NULL) {
+		prop = g_hash_table_lookup (model->priv->pending, propstr);
+		if (prop != NULL) {
+			g_atomic_int_inc (&prop->refcount);
+			update_sort_string (model, prop, entry);
+		} else {
+			prop = g_new0 (RhythmDBPropertyModelEntry, 1);
+			prop->string = rb_refstring_new (propstr);
+			update_sort_string (model, prop, entry);
+			g_atomic_int_set (&prop->refcount, 1);
+			g_hash_table_insert (model->priv->pending,
+					     (gpointer)rb_refstring_get (prop->string),
+					     prop);
+		}
+		return prop;
+	}
+
 	if ((ptr = g_hash_table_lookup (model->priv->reverse_map, propstr))) {
 		iter.user_data = ptr;
 		prop = g_sequence_get (ptr);
@@ -867,6 +1012,18 @@ rhythmdb_property_model_delete_prop (RhythmDBPropertyModel *model,
 	GtkTreeIter iter;
 	gboolean ret;
 
+	if (model->priv->pending != NULL) {
+		g_atomic_int_dec_and_test (&model->priv->all->refcount);
+
+		prop = g_hash_table_lookup (model->priv->pending, propstr);
+		g_assert (prop != NULL);
+		if (g_atomic_int_dec_and_test (&prop->refcount)) {
+			g_hash_table_remove (model->priv->pending, propstr);
+			_prop_model_entry_cleanup (prop, NULL);
+		}
+		return;
+	}
+
 	g_assert ((ptr = g_hash_table_lookup (model->priv->reverse_map, propstr)));
 
 	iter.stamp = model->priv->stamp;
@@ -38,6 +38,7 @@
 #include <gtk/gtk.h>
 
 #include "rhythmdb-query-model.h"
+#include "rhythmdb-private.h"
 #include "rb-debug.h"
 #include "rb-tree-dnd.h"
 #include "rb-marshal.h"
@@ -81,8 +82,8 @@ static void rhythmdb_query_model_do_insert (RhythmDBQueryModel *model,
 					    gint index);
 static void rhythmdb_query_model_entry_added_cb (RhythmDB *db, RhythmDBEntry *entry,
 						 RhythmDBQueryModel *model);
-static void rhythmdb_query_model_entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry,
-						   GPtrArray *changes, RhythmDBQueryModel *model);
+static void rhythmdb_query_model_entries_changed_cb (RhythmDB *db, GHashTable *changes,
+						     RhythmDBQueryModel *model);
 static void rhythmdb_query_model_entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry,
 						   RhythmDBQueryModel *model);
 
@@ -90,6 +91,7 @@ static void rhythmdb_query_model_filter_out_entry (RhythmDBQueryModel *model,
 						   RhythmDBEntry *entry);
 static gboolean rhythmdb_query_model_do_reorder (RhythmDBQueryModel *model, RhythmDBEntry *entry);
 static gboolean rhythmdb_query_model_emit_reorder (RhythmDBQueryModel *model, gint old_pos, gint new_pos);
+static void rhythmdb_query_model_resort (RhythmDBQueryModel *model);
 static gboolean rhythmdb_query_model_drag_data_get (RbTreeDragSource *dragsource,
 							  GList *paths,
 							  GtkSelectionData *selection_data);
@@ -220,6 +222,7 @@ struct _RhythmDBQueryModelPrivate
 
 	GPtrArray *query;
 	GPtrArray *original_query;
+	RhythmDBQueryProgram *query_program;
 
 	guint stamp;
 
@@ -236,6 +239,7 @@ struct _RhythmDBQueryModelPrivate
 	GHashTable *hidden_entry_map;
 
 	gint pending_update_count;
+	gboolean query_running;
 
 	gboolean reorder_drag_and_drop;
 	gboolean show_hidden;
@@ -243,6 +247,9 @@ struct _RhythmDBQueryModelPrivate
 	gint query_reapply_timeout_id;
 };
 
+/* number of changed entries above which the model is re-sorted at once */
+#define RHYTHMDB_QUERY_MODEL_BULK_REORDER_MIN	16
+
 #define RHYTHMDB_QUERY_MODEL_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RHYTHMDB_TYPE_QUERY_MODEL, RhythmDBQueryModelPrivate))
 
 enum
@@ -546,12 +553,18 @@ rhythmdb_query_model_set_query_internal (RhythmDBQueryModel *model,
 	if (query == model->priv->original_query)
 		return;
 
+	if (model->priv->query_program != NULL) {
+		rhythmdb_query_program_free (model->priv->query_program);
+		model->priv->query_program = NULL;
+	}
 	rhythmdb_query_free (model->priv->query);
 	rhythmdb_query_free (model->priv->original_query);
 
 	model->priv->query = rhythmdb_query_copy (query);
 	model->priv->original_query = rhythmdb_query_copy (model->priv->query);
 	rhythmdb_query_preprocess (model->priv->db, model->priv->query);
+	if (model->priv->query != NULL)
+		model->priv->query_program = rhythmdb_query_program_compile (model->priv->db, model->priv->query);
 
 	/* if the query contains time-relative criteria, re-run it periodically.
 	 * currently it's just every minute, but perhaps it could be smarter.
@@ -567,6 +580,17 @@ rhythmdb_query_model_set_query_internal (RhythmDBQueryModel *model,
 	}
 }
 
+/* evaluates the model's query, which is compiled when it is set */
+static gboolean
+rhythmdb_query_model_evaluate_query (RhythmDBQueryModel *model,
+				     RhythmDBEntry *entry)
+{
+	if (model->priv->query_program == NULL)
+		return TRUE;
+
+	return rhythmdb_query_program_run (model->priv->query_program, entry);
+}
+
 static void
 rhythmdb_query_model_set_property (GObject *object,
 				   guint prop_id,
@@ -707,8 +731,8 @@ rhythmdb_query_model_constructed (GObject *object)
 				 G_CALLBACK (rhythmdb_query_model_entry_added_cb),
 				 model, 0);
 	g_signal_connect_object (G_OBJECT (model->priv->db),
-				 "entry_changed",
-				 G_CALLBACK (rhythmdb_query_model_entry_changed_cb),
+				 "entries-changed",
+				 G_CALLBACK (rhythmdb_query_model_entries_changed_cb),
 				 model, 0);
 	g_signal_connect_object (G_OBJECT (model->priv->db),
 				 "entry_deleted",
@@ -786,6 +810,8 @@ rhythmdb_query_model_finalize (GObject *object)
 
 	g_hash_table_destroy (model->priv->hidden_entry_map);
 
+	if (model->priv->query_program)
+		rhythmdb_query_program_free (model->priv->query_program);
 	if (model->priv->query)
 		rhythmdb_query_free (model->priv->query);
 	if (model->priv->original_query)
@@ -880,7 +906,7 @@ static void
 _copy_contents_foreach_cb (RhythmDBEntry *entry, RhythmDBQueryModel *dest)
 {
 	if (dest->priv->query == NULL ||
-	    rhythmdb_evaluate_query (dest->priv->db, dest->priv->query, entry)) {
+	    rhythmdb_query_model_evaluate_query (dest, entry)) {
 		if (dest->priv->show_hidden || (rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN) == FALSE))
 			rhythmdb_query_model_do_insert (dest, entry, -1);
 	}
@@ -1007,6 +1033,27 @@ rhythmdb_query_model_has_pending_changes (RhythmDBQueryModel *model)
 	return result;
 }
 
+/**
+ * rhythmdb_query_model_query_running:
+ * @model: a #RhythmDBQueryModel
+ *
+ * Checks if a database query is still populating the model, or the
+ * model it is chained to.  The #RhythmDBQueryModel::complete signal
+ * will be emitted when the query is finished.
+ *
+ * Return value: %TRUE if a query is running
+ */
+gboolean
+rhythmdb_query_model_query_running (RhythmDBQueryModel *model)
+{
+	if (model->priv->query_running)
+		return TRUE;
+	if (model->priv->base_model)
+		return rhythmdb_query_model_query_running (model->priv->base_model);
+
+	return FALSE;
+}
+
 static void
 rhythmdb_query_model_entry_added_cb (RhythmDB *db,
 				     RhythmDBEntry *entry,
@@ -1026,7 +1073,7 @@ rhythmdb_query_model_entry_added_cb (RhythmDB *db,
 	}
 
 	if (model->priv->query != NULL) {
-		insert = rhythmdb_evaluate_query (db, model->priv->query, entry);
+		insert = rhythmdb_query_model_evaluate_query (model, entry);
 	} else {
 		index = GPOINTER_TO_INT (g_hash_table_lookup (model->priv->hidden_entry_map, entry));
 		insert = g_hash_table_remove (model->priv->hidden_entry_map, entry);
@@ -1039,11 +1086,12 @@ rhythmdb_query_model_entry_added_cb (RhythmDB *db,
 	}
 }
 
-static void
-rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
-				       RhythmDBEntry *entry,
-				       GPtrArray *changes,
-				       RhythmDBQueryModel *model)
+/* returns TRUE if the entry is still in the model and may need to be moved */
+static gboolean
+rhythmdb_query_model_entry_changed (RhythmDB *db,
+				    RhythmDBEntry *entry,
+				    GPtrArray *changes,
+				    RhythmDBQueryModel *model)
 {
 	gboolean hidden = FALSE;
 	int i;
@@ -1056,7 +1104,7 @@ rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
 			 * so we test it */
 			rhythmdb_query_model_entry_added_cb (db, entry, model);
 		}
-		return;
+		return FALSE;
 	}
 
 	if (hidden) {
@@ -1107,7 +1155,7 @@ rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
 		}
 
 		rhythmdb_query_model_filter_out_entry (model, entry);
-		return;
+		return FALSE;
 	}
 
 	/* emit separate change signals for each property
@@ -1133,25 +1181,79 @@ rhythmdb_query_model_entry_changed_cb (RhythmDB *db,
 	}
 
 	if (model->priv->query &&
-	    !rhythmdb_evaluate_query (db, model->priv->query, entry)) {
+	    !rhythmdb_query_model_evaluate_query (model, entry)) {
 		rhythmdb_query_model_filter_out_entry (model, entry);
-		return;
+		return FALSE;
 	}
 
-	/* it may have moved, so we can't just emit a changed entry */
-	if (!rhythmdb_query_model_do_reorder (model, entry)) {
-		/* but if it didn't, we can */
-		GtkTreeIter iter;
-		GtkTreePath *path;
+	return TRUE;
+}
 
-		if (rhythmdb_query_model_entry_to_iter (model, entry, &iter)) {
-			path = rhythmdb_query_model_get_path (GTK_TREE_MODEL (model),
-							      &iter);
-			gtk_tree_model_row_changed (GTK_TREE_MODEL (model),
-						     path, &iter);
-			gtk_tree_path_free (path);
+static void
+rhythmdb_query_model_emit_row_changed (RhythmDBQueryModel *model,
+				       RhythmDBEntry *entry)
+{
+	GtkTreeIter iter;
+	GtkTreePath *path;
+
+	if (rhythmdb_query_model_entry_to_iter (model, entry, &iter)) {
+		path = rhythmdb_query_model_get_path (GTK_TREE_MODEL (model),
+						      &iter);
+		gtk_tree_model_row_changed (GTK_TREE_MODEL (model),
+					     path, &iter);
+		gtk_tree_path_free (path);
+	}
+}
+
+static void
+rhythmdb_query_model_entries_changed_cb (RhythmDB *db,
+					 GHashTable *changes,
+					 RhythmDBQueryModel *model)
+{
+	GHashTableIter iter;
+	RhythmDBEntry *entry;
+	GPtrArray *entry_changes;
+	GPtrArray *updated;
+	int i;
+
+	/* add, remove and update entries, collecting the ones that stay */
+	updated = g_ptr_array_new_with_free_func ((GDestroyNotify) rhythmdb_entry_unref);
+	g_hash_table_iter_init (&iter, changes);
+	while (g_hash_table_iter_next (&iter, (gpointer *)&entry, (gpointer *)&entry_changes)) {
+		if (rhythmdb_query_model_entry_changed (db, entry, entry_changes, model))
+			g_ptr_array_add (updated, rhythmdb_entry_ref (entry));
+	}
+
+	/* moving entries one at a time emits a re-order for each one that
+	 * moves, each of which is as expensive as sorting the whole model,
+	 * so for larger change sets, re-sort once and emit a single re-order.
+	 * this doesn't work with limited models, as entries may need to move
+	 * between the main and limited lists.
+	 */
+	if (updated->len >= RHYTHMDB_QUERY_MODEL_BULK_REORDER_MIN &&
+	    model->priv->sort_func != NULL &&
+	    g_sequence_get_length (model->priv->limited_entries) == 0) {
+		rb_debug ("re-sorting model after %u entries changed", updated->len);
+		rhythmdb_query_model_resort (model);
+
+		for (i = 0; i < updated->len; i++) {
+			rhythmdb_query_model_emit_row_changed (model, g_ptr_array_index (updated, i));
+		}
+	} else {
+		for (i = 0; i < updated->len; i++) {
+			entry = g_ptr_array_index (updated, i);
+			if (g_hash_table_lookup (model->priv->reverse_map, entry) == NULL)
+				continue;
+
+			/* it may have moved, so we can't just emit a changed entry */
+			if (!rhythmdb_query_model_do_reorder (model, entry)) {
+				/* but if it didn't, we can */
+				rhythmdb_query_model_emit_row_changed (model, entry);
+			}
 		}
 	}
+
+	g_ptr_array_free (updated, TRUE);
 }
 
 static void
@@ -1235,6 +1337,7 @@ idle_process_update (struct RhythmDBQueryModelUpdate *update)
 		break;
 	}
 	case RHYTHMDB_QUERY_MODEL_UPDATE_QUERY_COMPLETE:
+		update->model->priv->query_running = FALSE;
 		g_signal_emit (G_OBJECT (update->model), rhythmdb_query_model_signals[COMPLETE], 0);
 		break;
 	}
@@ -2253,6 +2356,7 @@ rhythmdb_query_model_row_drop_position (RbTreeDragDest *drag_dest,
 static void
 rhythmdb_query_model_set_query (RhythmDBQueryResults *results, GPtrArray *query)
 {
+	RHYTHMDB_QUERY_MODEL (results)->priv->query_running = TRUE;
 	g_object_set (G_OBJECT (results), "query", query, NULL);
 }
 
@@ -2541,6 +2645,359 @@ apply_updated_entry_sequence (RhythmDBQueryModel *model,
 	g_free (reorder_map);
 }
 
+/*
+ * Bulk re-sorting.
+ *
+ * Sorting by inserting entries into a sequence one at a time calls the sort
+ * function O(n log n) times, and each call looks up several properties of
+ * both entries.  For the standard sort functions, we instead build a byte
+ * string for each entry that compares (with memcmp) the same way the sort
+ * function does, sort those with an MSD radix sort, and build the new
+ * sequence in order.
+ *
+ * Strings are encoded as a marker byte (0 for NULL, 1 otherwise) followed by
+ * the string and its terminating nul, so shorter strings sort before longer
+ * strings with the same prefix.  Numbers are encoded big-endian.
+ */
+
+typedef struct {
+	const guint8 *key;
+	gsize len;
+	RhythmDBEntry *entry;
+} RhythmDBQueryModelSortItem;
+
+#define SORT_ITEM_INSERTION_SORT_THRESHOLD	32
+
+static void
+append_sort_key_marker (GByteArray *key, guint8 marker)
+{
+	g_byte_array_append (key, &marker, 1);
+}
+
+static void
+append_sort_key_string (GByteArray *key, const char *str)
+{
+	if (str == NULL) {
+		append_sort_key_marker (key, 0);
+		return;
+	}
+
+	append_sort_key_marker (key, 1);
+	g_byte_array_append (key, (const guint8 *) str, strlen (str) + 1);
+}
+
+static void
+append_sort_key_uint64 (GByteArray *key, guint64 val)
+{
+	guint8 buf[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		buf[i] = (val >> (56 - (i * 8))) & 0xff;
+	}
+	g_byte_array_append (key, buf, sizeof (buf));
+}
+
+static void
+append_sort_key_double (GByteArray *key, gdouble val)
+{
+	union {
+		gdouble d;
+		guint64 i;
+	} u;
+
+	/* -0.0 and 0.0 compare equal */
+	u.d = (val == 0.0) ? 0.0 : val;
+
+	/* flip the bits so negative values sort before positive values */
+	if (u.i & G_GUINT64_CONSTANT (0x8000000000000000))
+		u.i = ~u.i;
+	else
+		u.i |= G_GUINT64_CONSTANT (0x8000000000000000);
+	append_sort_key_uint64 (key, u.i);
+}
+
+static void
+append_sort_key_sortname (GByteArray *key,
+			  RhythmDBEntry *entry,
+			  RhythmDBPropType sortname_prop,
+			  RhythmDBPropType prop)
+{
+	const char *val;
+
+	val = rhythmdb_entry_get_string (entry, sortname_prop);
+	if (val[0] == '\0') {
+		val = rhythmdb_entry_get_string (entry, prop);
+	}
+	append_sort_key_string (key, val);
+}
+
+/* matches rhythmdb_query_model_album_sort_func */
+static void
+append_album_sort_key (GByteArray *key, RhythmDBEntry *entry)
+{
+	gulong num;
+
+	append_sort_key_sortname (key, entry,
+				  RHYTHMDB_PROP_ALBUM_SORTNAME_SORT_KEY,
+				  RHYTHMDB_PROP_ALBUM_SORT_KEY);
+
+	num = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DISC_NUMBER);
+	append_sort_key_uint64 (key, num ? num : 1);
+	append_sort_key_uint64 (key, rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_TRACK_NUMBER));
+
+	/* the album sort function only checks whether the titles are set */
+	append_sort_key_marker (key, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_TITLE_SORT_KEY) != NULL);
+	append_sort_key_string (key, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION));
+}
+
+/* matches rhythmdb_query_model_artist_sort_func */
+static void
+append_artist_sort_key (GByteArray *key, RhythmDBEntry *entry)
+{
+	append_sort_key_sortname (key, entry,
+				  RHYTHMDB_PROP_ARTIST_SORTNAME_SORT_KEY,
+				  RHYTHMDB_PROP_ARTIST_SORT_KEY);
+	append_album_sort_key (key, entry);
+}
+
+/* Appends a key for the entry matching the sort function to the byte array.
+ * Returns FALSE if the sort function isn't one of the standard ones.
+ */
+static gboolean
+append_sort_key (GByteArray *key,
+		 RhythmDBEntry *entry,
+		 GCompareDataFunc sort_func,
+		 gpointer sort_data)
+{
+	const char *location;
+	RhythmDBPropType prop_id = (RhythmDBPropType) GPOINTER_TO_INT (sort_data);
+
+	location = rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_LOCATION);
+
+	if (sort_func == (GCompareDataFunc) rhythmdb_query_model_location_sort_func) {
+		append_sort_key_string (key, location);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_title_sort_func) {
+		append_sort_key_string (key, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_TITLE_SORT_KEY));
+		append_sort_key_string (key, location);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_album_sort_func ||
+		   sort_func == (GCompareDataFunc) rhythmdb_query_model_track_sort_func) {
+		append_album_sort_key (key, entry);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_artist_sort_func) {
+		append_artist_sort_key (key, entry);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_composer_sort_func) {
+		append_sort_key_sortname (key, entry,
+					  RHYTHMDB_PROP_COMPOSER_SORTNAME_SORT_KEY,
+					  RHYTHMDB_PROP_COMPOSER_SORT_KEY);
+		append_album_sort_key (key, entry);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_genre_sort_func) {
+		append_sort_key_string (key, rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_GENRE_SORT_KEY));
+		append_artist_sort_key (key, entry);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_double_ceiling_sort_func) {
+		append_sort_key_double (key, ceil (rhythmdb_entry_get_double (entry, prop_id)));
+		append_sort_key_string (key, location);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_ulong_sort_func) {
+		append_sort_key_uint64 (key, rhythmdb_entry_get_ulong (entry, prop_id));
+		append_sort_key_string (key, location);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_bitrate_sort_func) {
+		if (rhythmdb_entry_is_lossless (entry)) {
+			append_sort_key_marker (key, 1);
+		} else {
+			append_sort_key_marker (key, 0);
+			append_sort_key_uint64 (key, rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_BITRATE));
+		}
+		append_sort_key_string (key, location);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_date_sort_func) {
+		append_sort_key_uint64 (key, rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DATE));
+		append_album_sort_key (key, entry);
+	} else if (sort_func == (GCompareDataFunc) rhythmdb_query_model_string_sort_func) {
+		append_sort_key_string (key, rhythmdb_entry_get_string (entry, prop_id));
+		append_sort_key_string (key, location);
+	} else {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int
+compare_sort_items (const RhythmDBQueryModelSortItem *a,
+		    const RhythmDBQueryModelSortItem *b,
+		    gsize depth)
+{
+	gsize a_len = a->len - depth;
+	gsize b_len = b->len - depth;
+	int ret;
+
+	ret = memcmp (a->key + depth, b->key + depth, MIN (a_len, b_len));
+	if (ret != 0)
+		return ret;
+	if (a_len != b_len)
+		return (a_len < b_len) ? -1 : 1;
+	return 0;
+}
+
+/* sorts items whose keys are known to be equal up to depth */
+static void
+radix_sort_items (RhythmDBQueryModelSortItem *items,
+		  RhythmDBQueryModelSortItem *tmp,
+		  gsize n,
+		  gsize depth)
+{
+	gsize bounds[258];
+	gsize i, j;
+
+	while (n >= SORT_ITEM_INSERTION_SORT_THRESHOLD) {
+		gsize largest = 0;
+
+		/* bucket 0 holds keys that end at this depth */
+		memset (bounds, 0, sizeof (bounds));
+		for (i = 0; i < n; i++) {
+			guint bucket = (depth < items[i].len) ? items[i].key[depth] + 1 : 0;
+			bounds[bucket + 1]++;
+		}
+		for (i = 1; i < G_N_ELEMENTS (bounds); i++) {
+			largest = MAX (largest, bounds[i]);
+			bounds[i] += bounds[i - 1];
+		}
+
+		/* all keys share the byte at this depth, so move on to the next */
+		if (largest == n && bounds[1] == 0) {
+			depth++;
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			guint bucket = (depth < items[i].len) ? items[i].key[depth] + 1 : 0;
+			tmp[bounds[bucket]++] = items[i];
+		}
+		memcpy (items, tmp, n * sizeof (RhythmDBQueryModelSortItem));
+
+		/* bounds[b] is now the end of bucket b */
+		for (i = 1; i < 257; i++) {
+			gsize start = bounds[i - 1];
+			if (bounds[i] - start > 1)
+				radix_sort_items (items + start, tmp, bounds[i] - start, depth + 1);
+		}
+		return;
+	}
+
+	for (i = 1; i < n; i++) {
+		RhythmDBQueryModelSortItem item = items[i];
+
+		for (j = i; j > 0 && compare_sort_items (&items[j - 1], &item, depth) > 0; j--) {
+			items[j] = items[j - 1];
+		}
+		items[j] = item;
+	}
+}
+
+static gint
+sort_entries_compare (gconstpointer a, gconstpointer b, gpointer data)
+{
+	struct ReverseSortData *sort = data;
+	return sort->func (*(RhythmDBEntry **) a, *(RhythmDBEntry **) b, sort->data);
+}
+
+/* returns a new sequence containing the model's entries in sorted order */
+static GSequence *
+rhythmdb_query_model_sort_entries (RhythmDBQueryModel *model)
+{
+	RhythmDBQueryModelSortItem *items;
+	RhythmDBQueryModelSortItem *tmp;
+	GSequence *new_entries;
+	GSequenceIter *ptr;
+	GByteArray *keys;
+	gboolean keyed = TRUE;
+	gsize length, i;
+
+	length = g_sequence_get_length (model->priv->entries);
+	items = g_new0 (RhythmDBQueryModelSortItem, length);
+	keys = g_byte_array_sized_new (length * 64);
+
+	ptr = g_sequence_get_begin_iter (model->priv->entries);
+	for (i = 0; i < length; i++) {
+		gsize offset = keys->len;
+
+		items[i].entry = g_sequence_get (ptr);
+		if (keyed) {
+			keyed = append_sort_key (keys, items[i].entry,
+						 model->priv->sort_func,
+						 model->priv->sort_data);
+			/* the key offset is converted to a pointer once the array is complete */
+			items[i].key = GSIZE_TO_POINTER (offset);
+			items[i].len = keys->len - offset;
+		}
+		ptr = g_sequence_iter_next (ptr);
+	}
+
+	if (keyed) {
+		for (i = 0; i < length; i++) {
+			items[i].key = keys->data + GPOINTER_TO_SIZE (items[i].key);
+		}
+
+		tmp = g_new (RhythmDBQueryModelSortItem, length);
+		radix_sort_items (items, tmp, length, 0);
+		g_free (tmp);
+	} else {
+		struct ReverseSortData sort;
+		RhythmDBEntry **entries;
+
+		/* not a sort function we know how to build keys for, so sort
+		 * an array using it rather than inserting entries one by one.
+		 */
+		entries = g_new (RhythmDBEntry *, length);
+		for (i = 0; i < length; i++) {
+			entries[i] = items[i].entry;
+		}
+		sort.func = model->priv->sort_func;
+		sort.data = model->priv->sort_data;
+		g_qsort_with_data (entries, length, sizeof (RhythmDBEntry *), sort_entries_compare, &sort);
+		for (i = 0; i < length; i++) {
+			items[i].entry = entries[i];
+		}
+		g_free (entries);
+	}
+
+	new_entries = g_sequence_new (NULL);
+	for (i = 0; i < length; i++) {
+		gsize index = model->priv->sort_reverse ? (length - i - 1) : i;
+		g_sequence_append (new_entries, items[index].entry);
+	}
+
+	g_byte_array_free (keys, TRUE);
+	g_free (items);
+	return new_entries;
+}
+
+/* re-sorts the model, emitting a re-order if any entries moved */
+static void
+rhythmdb_query_model_resort (RhythmDBQueryModel *model)
+{
+	GSequence *new_entries;
+	GSequenceIter *old_ptr;
+	GSequenceIter *new_ptr;
+
+	if (g_sequence_get_length (model->priv->entries) == 0)
+		return;
+
+	new_entries = rhythmdb_query_model_sort_entries (model);
+
+	old_ptr = g_sequence_get_begin_iter (model->priv->entries);
+	new_ptr = g_sequence_get_begin_iter (new_entries);
+	while (!g_sequence_iter_is_end (old_ptr) &&
+	       g_sequence_get (old_ptr) == g_sequence_get (new_ptr)) {
+		old_ptr = g_sequence_iter_next (old_ptr);
+		new_ptr = g_sequence_iter_next (new_ptr);
+	}
+
+	if (g_sequence_iter_is_end (old_ptr)) {
+		g_sequence_free (new_entries);
+	} else {
+		apply_updated_entry_sequence (model, new_entries);
+	}
+}
+
 /**
  * rhythmdb_query_model_set_sort_order:
  * @model: a #RhythmDBQueryModel
@@ -2559,11 +3016,6 @@ rhythmdb_query_model_set_sort_order (RhythmDBQueryModel *model,
 				     GDestroyNotify sort_data_destroy,
 				     gboolean sort_reverse)
 {
-	GSequence *new_entries;
-	GSequenceIter *ptr;
-	int length, i;
-	struct ReverseSortData reverse_data;
-
 	if ((model->priv->sort_func == sort_func) &&
 	    (model->priv->sort_data == sort_data) &&
 	    (model->priv->sort_data_destroy == sort_data_destroy) &&
@@ -2583,28 +3035,9 @@ rhythmdb_query_model_set_sort_order (RhythmDBQueryModel *model,
 	model->priv->sort_data_destroy = sort_data_destroy;
 	model->priv->sort_reverse = sort_reverse;
 
-	if (model->priv->sort_reverse) {
-		reverse_data.func = sort_func;
-		reverse_data.data = sort_data;
-		sort_func = (GCompareDataFunc) _reverse_sorting_func;
-		sort_data = &reverse_data;
-	}
-
 	/* create the new sorted entry sequence */
-	length = g_sequence_get_length (model->priv->entries);
-	if (length > 0) {
-		new_entries = g_sequence_new (NULL);
-		ptr = g_sequence_get_begin_iter (model->priv->entries);
-		for (i = 0; i < length; i++) {
-			gpointer entry = g_sequence_get (ptr);
-
-			g_sequence_insert_sorted (new_entries, entry,
-						  sort_func,
-						  sort_data);
-			ptr = g_sequence_iter_next (ptr);
-		}
-
-		apply_updated_entry_sequence (model, new_entries);
+	if (sort_func != NULL && g_sequence_get_length (model->priv->entries) > 0) {
+		apply_updated_entry_sequence (model, rhythmdb_query_model_sort_entries (model));
 	}
 }
 
@@ -2681,7 +3114,7 @@ rhythmdb_query_model_base_row_inserted (GtkTreeModel *tree_model,
 	if (!model->priv->show_hidden && rhythmdb_entry_get_boolean (entry, RHYTHMDB_PROP_HIDDEN))
 		goto out;
 
-	if (rhythmdb_evaluate_query (model->priv->db, model->priv->query, entry)) {
+	if (rhythmdb_query_model_evaluate_query (model, entry)) {
 		/* find the closest previous entry that is in the filter model, and it it after that */
 		prev_entry = rhythmdb_query_model_get_previous_from_entry (base_model, entry);
 		while (prev_entry && g_hash_table_lookup (model->priv->reverse_map, prev_entry) == NULL) {
@@ -2790,9 +3223,7 @@ typedef struct {
 static void
 _reapply_query_foreach_cb (RhythmDBEntry *entry, _ReapplyQueryForeachData *data)
 {
-	if (!rhythmdb_evaluate_query (data->model->priv->db,
-				      data->model->priv->query,
-				      entry)) {
+	if (!rhythmdb_query_model_evaluate_query (data->model, entry)) {
 		data->remove = g_list_prepend (data->remove, entry);
 	}
 }
@@ -134,6 +134,7 @@ gboolean		rhythmdb_query_model_entry_to_iter	(RhythmDBQueryModel *model,
 								 GtkTreeIter *iter);
 
 gboolean		rhythmdb_query_model_has_pending_changes	(RhythmDBQueryModel *model);
+gboolean		rhythmdb_query_model_query_running		(RhythmDBQueryModel *model);
 
 RhythmDBEntry *		rhythmdb_query_model_tree_path_to_entry	(RhythmDBQueryModel *model,
 								 GtkTreePath *path);
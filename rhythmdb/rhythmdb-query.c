@@ -1043,6 +1043,629 @@ rhythmdb_query_to_string (RhythmDB *db, GPtrArray *query)
 	return g_string_free (buf, FALSE);
 }
 
+/*
+ * Compiled queries.
+ *
+ * A preprocessed query can be compiled into a flat program that can be
+ * run against entries without allocating memory.  Each term becomes one
+ * instruction with its property type and, where possible, the offset of
+ * the entry field it reads resolved in advance.  Disjunctions and
+ * subqueries become jumps: when a term doesn't match, evaluation continues
+ * at the instruction's target, which is the start of the next alternative
+ * or the final REJECT instruction.
+ *
+ * Programs refer to values held by the query, so whoever compiles one
+ * owns it and must free it before freeing or modifying the query.
+ */
+
+typedef enum {
+	QUERY_OP_ACCEPT,
+	QUERY_OP_REJECT,
+	QUERY_OP_JUMP,
+	QUERY_OP_COMPARE_STRING,
+	QUERY_OP_COMPARE_ULONG,
+	QUERY_OP_COMPARE_BOOLEAN,
+	QUERY_OP_COMPARE_UINT64,
+	QUERY_OP_COMPARE_DOUBLE,
+	QUERY_OP_COMPARE_OBJECT,
+	QUERY_OP_LIKE,
+	QUERY_OP_PREFIX,
+	QUERY_OP_SUFFIX,
+	QUERY_OP_SEARCH_MATCH,
+	QUERY_OP_KEYWORD,
+	QUERY_OP_TIME_WITHIN
+} RhythmDBQueryOp;
+
+typedef enum {
+	QUERY_ACCESS_GENERIC,
+	QUERY_ACCESS_FIELD,
+	QUERY_ACCESS_FOLDED,
+	QUERY_ACCESS_SORT_KEY
+} RhythmDBQueryAccess;
+
+typedef struct {
+	RhythmDBQueryOp op;
+	RhythmDBQueryType type;		/* for comparisons */
+	gboolean negate;		/* for LIKE, SEARCH_MATCH, KEYWORD and TIME_WITHIN */
+	RhythmDBQueryAccess access;
+	guint propid;
+	gsize offset;
+	guint target;			/* where to go if the term doesn't match */
+	union {
+		const char *string;
+		char **words;
+		gulong ulong_val;
+		gboolean boolean;
+		guint64 uint64;
+		gdouble dbl;
+		gpointer object;
+	} value;
+} RhythmDBQueryInstruction;
+
+struct _RhythmDBQueryProgram
+{
+	RhythmDB *db;
+	guint n_terms;
+	gpointer *terms;		/* the query's terms, to check the program is still valid */
+	RhythmDBQueryInstruction *code;
+};
+
+static const struct {
+	RhythmDBPropType propid;
+	RhythmDBQueryAccess access;
+	gsize offset;
+} query_string_fields[] = {
+	{ RHYTHMDB_PROP_TITLE, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, title) },
+	{ RHYTHMDB_PROP_ARTIST, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, artist) },
+	{ RHYTHMDB_PROP_ALBUM, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, album) },
+	{ RHYTHMDB_PROP_ALBUM_ARTIST, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, album_artist) },
+	{ RHYTHMDB_PROP_COMPOSER, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, composer) },
+	{ RHYTHMDB_PROP_GENRE, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, genre) },
+	{ RHYTHMDB_PROP_COMMENT, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, comment) },
+	{ RHYTHMDB_PROP_LOCATION, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, location) },
+	{ RHYTHMDB_PROP_MOUNTPOINT, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, mountpoint) },
+	{ RHYTHMDB_PROP_MEDIA_TYPE, QUERY_ACCESS_FIELD, G_STRUCT_OFFSET (RhythmDBEntry, media_type) },
+	{ RHYTHMDB_PROP_TITLE_FOLDED, QUERY_ACCESS_FOLDED, G_STRUCT_OFFSET (RhythmDBEntry, title) },
+	{ RHYTHMDB_PROP_ARTIST_FOLDED, QUERY_ACCESS_FOLDED, G_STRUCT_OFFSET (RhythmDBEntry, artist) },
+	{ RHYTHMDB_PROP_ALBUM_FOLDED, QUERY_ACCESS_FOLDED, G_STRUCT_OFFSET (RhythmDBEntry, album) },
+	{ RHYTHMDB_PROP_ALBUM_ARTIST_FOLDED, QUERY_ACCESS_FOLDED, G_STRUCT_OFFSET (RhythmDBEntry, album_artist) },
+	{ RHYTHMDB_PROP_COMPOSER_FOLDED, QUERY_ACCESS_FOLDED, G_STRUCT_OFFSET (RhythmDBEntry, composer) },
+	{ RHYTHMDB_PROP_GENRE_FOLDED, QUERY_ACCESS_FOLDED, G_STRUCT_OFFSET (RhythmDBEntry, genre) },
+	{ RHYTHMDB_PROP_TITLE_SORT_KEY, QUERY_ACCESS_SORT_KEY, G_STRUCT_OFFSET (RhythmDBEntry, title) },
+	{ RHYTHMDB_PROP_ARTIST_SORT_KEY, QUERY_ACCESS_SORT_KEY, G_STRUCT_OFFSET (RhythmDBEntry, artist) },
+	{ RHYTHMDB_PROP_ALBUM_SORT_KEY, QUERY_ACCESS_SORT_KEY, G_STRUCT_OFFSET (RhythmDBEntry, album) },
+	{ RHYTHMDB_PROP_ALBUM_ARTIST_SORT_KEY, QUERY_ACCESS_SORT_KEY, G_STRUCT_OFFSET (RhythmDBEntry, album_artist) },
+	{ RHYTHMDB_PROP_COMPOSER_SORT_KEY, QUERY_ACCESS_SORT_KEY, G_STRUCT_OFFSET (RhythmDBEntry, composer) },
+	{ RHYTHMDB_PROP_GENRE_SORT_KEY, QUERY_ACCESS_SORT_KEY, G_STRUCT_OFFSET (RhythmDBEntry, genre) },
+};
+
+static const struct {
+	RhythmDBPropType propid;
+	gsize offset;
+} query_ulong_fields[] = {
+	{ RHYTHMDB_PROP_TRACK_NUMBER, G_STRUCT_OFFSET (RhythmDBEntry, tracknum) },
+	{ RHYTHMDB_PROP_TRACK_TOTAL, G_STRUCT_OFFSET (RhythmDBEntry, tracktotal) },
+	{ RHYTHMDB_PROP_DISC_NUMBER, G_STRUCT_OFFSET (RhythmDBEntry, discnum) },
+	{ RHYTHMDB_PROP_DISC_TOTAL, G_STRUCT_OFFSET (RhythmDBEntry, disctotal) },
+	{ RHYTHMDB_PROP_DURATION, G_STRUCT_OFFSET (RhythmDBEntry, duration) },
+	{ RHYTHMDB_PROP_BITRATE, G_STRUCT_OFFSET (RhythmDBEntry, bitrate) },
+	{ RHYTHMDB_PROP_MTIME, G_STRUCT_OFFSET (RhythmDBEntry, mtime) },
+	{ RHYTHMDB_PROP_FIRST_SEEN, G_STRUCT_OFFSET (RhythmDBEntry, first_seen) },
+	{ RHYTHMDB_PROP_LAST_SEEN, G_STRUCT_OFFSET (RhythmDBEntry, last_seen) },
+	{ RHYTHMDB_PROP_LAST_PLAYED, G_STRUCT_OFFSET (RhythmDBEntry, last_played) },
+};
+
+static void
+resolve_field (RhythmDBQueryInstruction *instr, GType type)
+{
+	guint i;
+
+	instr->access = QUERY_ACCESS_GENERIC;
+	if (type == G_TYPE_STRING) {
+		for (i = 0; i < G_N_ELEMENTS (query_string_fields); i++) {
+			if (query_string_fields[i].propid == instr->propid) {
+				instr->access = query_string_fields[i].access;
+				instr->offset = query_string_fields[i].offset;
+				break;
+			}
+		}
+	} else if (type == G_TYPE_ULONG) {
+		for (i = 0; i < G_N_ELEMENTS (query_ulong_fields); i++) {
+			if (query_ulong_fields[i].propid == instr->propid) {
+				instr->access = QUERY_ACCESS_FIELD;
+				instr->offset = query_ulong_fields[i].offset;
+				break;
+			}
+		}
+	}
+}
+
+static inline const char *
+query_get_string (const RhythmDBQueryInstruction *instr, RhythmDBEntry *entry)
+{
+	switch (instr->access) {
+	case QUERY_ACCESS_FIELD:
+		return rb_refstring_get (G_STRUCT_MEMBER (RBRefString *, entry, instr->offset));
+	case QUERY_ACCESS_FOLDED:
+		return rb_refstring_get_folded (G_STRUCT_MEMBER (RBRefString *, entry, instr->offset));
+	case QUERY_ACCESS_SORT_KEY:
+		return rb_refstring_get_sort_key (G_STRUCT_MEMBER (RBRefString *, entry, instr->offset));
+	case QUERY_ACCESS_GENERIC:
+	default:
+		return rhythmdb_entry_get_string (entry, instr->propid);
+	}
+}
+
+static inline gulong
+query_get_ulong (const RhythmDBQueryInstruction *instr, RhythmDBEntry *entry)
+{
+	if (instr->access == QUERY_ACCESS_FIELD)
+		return G_STRUCT_MEMBER (gulong, entry, instr->offset);
+	return rhythmdb_entry_get_ulong (entry, instr->propid);
+}
+
+/* fills in @instr to evaluate a single term; @instr must be zeroed */
+static void
+build_instruction (RhythmDB *db, RhythmDBQueryData *data, RhythmDBQueryInstruction *instr)
+{
+	GType type;
+
+	instr->propid = data->propid;
+	instr->type = data->type;
+	type = rhythmdb_get_property_type (db, data->propid);
+
+	switch (data->type) {
+	case RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN:
+	case RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN:
+		g_assert (type == G_TYPE_ULONG);
+		instr->op = QUERY_OP_TIME_WITHIN;
+		instr->negate = (data->type == RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN);
+		instr->value.ulong_val = g_value_get_ulong (data->val);
+		resolve_field (instr, type);
+		break;
+
+	case RHYTHMDB_QUERY_PROP_PREFIX:
+	case RHYTHMDB_QUERY_PROP_SUFFIX:
+		g_assert (type == G_TYPE_STRING);
+		instr->op = (data->type == RHYTHMDB_QUERY_PROP_PREFIX) ? QUERY_OP_PREFIX : QUERY_OP_SUFFIX;
+		instr->value.string = g_value_get_string (data->val);
+		resolve_field (instr, type);
+		break;
+
+	case RHYTHMDB_QUERY_PROP_LIKE:
+	case RHYTHMDB_QUERY_PROP_NOT_LIKE:
+		if (data->propid == RHYTHMDB_PROP_KEYWORD) {
+			instr->op = QUERY_OP_KEYWORD;
+			instr->negate = (data->type == RHYTHMDB_QUERY_PROP_NOT_LIKE);
+			instr->value.string = g_value_get_string (data->val);
+			break;
+		} else if (type == G_TYPE_STRING) {
+			instr->negate = (data->type == RHYTHMDB_QUERY_PROP_NOT_LIKE);
+			if (data->propid == RHYTHMDB_PROP_SEARCH_MATCH) {
+				instr->op = QUERY_OP_SEARCH_MATCH;
+				instr->value.words = g_value_get_boxed (data->val);
+			} else {
+				instr->op = QUERY_OP_LIKE;
+				instr->value.string = g_value_get_string (data->val);
+				resolve_field (instr, type);
+			}
+			break;
+		}
+		/* like the old evaluator, non-string likes are treated as equality */
+		instr->type = RHYTHMDB_QUERY_PROP_EQUALS;
+		/* fall through */
+	case RHYTHMDB_QUERY_PROP_EQUALS:
+	case RHYTHMDB_QUERY_PROP_NOT_EQUAL:
+	case RHYTHMDB_QUERY_PROP_GREATER:
+	case RHYTHMDB_QUERY_PROP_LESS:
+		resolve_field (instr, type);
+		switch (type) {
+		case G_TYPE_STRING:
+			instr->op = QUERY_OP_COMPARE_STRING;
+			instr->value.string = g_value_get_string (data->val);
+			break;
+		case G_TYPE_ULONG:
+			instr->op = QUERY_OP_COMPARE_ULONG;
+			instr->value.ulong_val = g_value_get_ulong (data->val);
+			break;
+		case G_TYPE_BOOLEAN:
+			instr->op = QUERY_OP_COMPARE_BOOLEAN;
+			instr->value.boolean = g_value_get_boolean (data->val);
+			break;
+		case G_TYPE_UINT64:
+			instr->op = QUERY_OP_COMPARE_UINT64;
+			instr->value.uint64 = g_value_get_uint64 (data->val);
+			break;
+		case G_TYPE_DOUBLE:
+			instr->op = QUERY_OP_COMPARE_DOUBLE;
+			instr->value.dbl = g_value_get_double (data->val);
+			break;
+		case G_TYPE_OBJECT:
+			instr->op = QUERY_OP_COMPARE_OBJECT;
+			instr->value.object = g_value_get_object (data->val);
+			break;
+		default:
+			g_warning ("Unexpected type: %s", g_type_name (type));
+			g_assert_not_reached ();
+		}
+		break;
+
+	case RHYTHMDB_QUERY_END:
+	case RHYTHMDB_QUERY_DISJUNCTION:
+	case RHYTHMDB_QUERY_SUBQUERY:
+	case RHYTHMDB_QUERY_PROP_YEAR_EQUALS:
+	case RHYTHMDB_QUERY_PROP_YEAR_NOT_EQUAL:
+	case RHYTHMDB_QUERY_PROP_YEAR_LESS:
+	case RHYTHMDB_QUERY_PROP_YEAR_GREATER:
+		g_assert_not_reached ();
+		break;
+	}
+}
+
+static guint
+compile_term (RhythmDB *db, GArray *code, RhythmDBQueryData *data)
+{
+	RhythmDBQueryInstruction instr = {0,};
+
+	build_instruction (db, data, &instr);
+	g_array_append_val (code, instr);
+	return code->len - 1;
+}
+
+static void
+patch_targets (GArray *code, GArray *patches, guint target)
+{
+	guint i;
+
+	for (i = 0; i < patches->len; i++) {
+		g_array_index (code, RhythmDBQueryInstruction, g_array_index (patches, guint, i)).target = target;
+	}
+}
+
+/* Compiles a disjunction of conjunctions.  If the whole query fails to
+ * match, evaluation continues at the targets of the instructions added
+ * to @fail_patches; if it matches, evaluation continues after it.
+ */
+static void
+compile_disjunction (RhythmDB *db,
+		     GArray *code,
+		     GPtrArray *query,
+		     gboolean toplevel,
+		     GArray *fail_patches)
+{
+	GArray *groups;
+	GArray *success_patches;
+	guint start;
+	guint i, g;
+
+	/* find the conjunctions; empty conjunctions match everything at the
+	 * top level, and are ignored in subqueries.
+	 */
+	groups = g_array_new (FALSE, FALSE, sizeof (guint));
+	for (i = 0, start = 0; i <= query->len; i++) {
+		if (i < query->len &&
+		    ((RhythmDBQueryData *) g_ptr_array_index (query, i))->type != RHYTHMDB_QUERY_DISJUNCTION)
+			continue;
+
+		if (i > start || toplevel) {
+			g_array_append_val (groups, start);
+			g_array_append_val (groups, i);
+		}
+		start = i + 1;
+	}
+
+	success_patches = g_array_new (FALSE, FALSE, sizeof (guint));
+	for (g = 0; g < groups->len; g += 2) {
+		GArray *group_fail;
+		guint end = g_array_index (groups, guint, g + 1);
+
+		group_fail = g_array_new (FALSE, FALSE, sizeof (guint));
+		for (i = g_array_index (groups, guint, g); i < end; i++) {
+			RhythmDBQueryData *data = g_ptr_array_index (query, i);
+
+			if (data->type == RHYTHMDB_QUERY_SUBQUERY) {
+				compile_disjunction (db, code, data->subquery, FALSE, group_fail);
+			} else {
+				guint idx = compile_term (db, code, data);
+				g_array_append_val (group_fail, idx);
+			}
+		}
+
+		if (g + 2 < groups->len) {
+			RhythmDBQueryInstruction jump = {0,};
+			guint jump_idx;
+
+			/* this conjunction matched, so skip the rest */
+			jump.op = QUERY_OP_JUMP;
+			g_array_append_val (code, jump);
+			jump_idx = code->len - 1;
+			g_array_append_val (success_patches, jump_idx);
+
+			patch_targets (code, group_fail, code->len);
+		} else {
+			g_array_append_vals (fail_patches, group_fail->data, group_fail->len);
+		}
+		g_array_free (group_fail, TRUE);
+	}
+
+	patch_targets (code, success_patches, code->len);
+	g_array_free (success_patches, TRUE);
+	g_array_free (groups, TRUE);
+}
+
+/**
+ * rhythmdb_query_program_compile: (skip)
+ * @db: the #RhythmDB
+ * @query: a preprocessed query
+ *
+ * Compiles @query into a program that can be evaluated against entries
+ * without allocating memory.  The program refers to values held by the
+ * query, so it must be freed before the query is.
+ *
+ * Return value: compiled query program
+ */
+RhythmDBQueryProgram *
+rhythmdb_query_program_compile (RhythmDB *db, GPtrArray *query)
+{
+	RhythmDBQueryProgram *program;
+	RhythmDBQueryInstruction instr = {0,};
+	GArray *code;
+	GArray *fail_patches;
+
+	code = g_array_new (FALSE, FALSE, sizeof (RhythmDBQueryInstruction));
+	fail_patches = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	compile_disjunction (db, code, query, TRUE, fail_patches);
+
+	instr.op = QUERY_OP_ACCEPT;
+	g_array_append_val (code, instr);
+	instr.op = QUERY_OP_REJECT;
+	g_array_append_val (code, instr);
+	patch_targets (code, fail_patches, code->len - 1);
+	g_array_free (fail_patches, TRUE);
+
+	program = g_new0 (RhythmDBQueryProgram, 1);
+	program->db = db;
+	program->n_terms = query->len;
+	program->terms = g_memdup (query->pdata, query->len * sizeof (gpointer));
+	program->code = (RhythmDBQueryInstruction *) g_array_free (code, FALSE);
+	return program;
+}
+
+/**
+ * rhythmdb_query_program_matches: (skip)
+ * @program: a compiled query program
+ * @query: a query
+ *
+ * Checks whether @program was compiled from a query with the same terms
+ * as @query.
+ *
+ * Return value: %TRUE if @program can be used to evaluate @query
+ */
+gboolean
+rhythmdb_query_program_matches (RhythmDBQueryProgram *program, GPtrArray *query)
+{
+	return (program->n_terms == query->len &&
+		memcmp (program->terms, query->pdata, query->len * sizeof (gpointer)) == 0);
+}
+
+/**
+ * rhythmdb_query_program_free: (skip)
+ * @program: a compiled query program
+ *
+ * Frees a compiled query program.
+ */
+void
+rhythmdb_query_program_free (RhythmDBQueryProgram *program)
+{
+	g_free (program->terms);
+	g_free (program->code);
+	g_free (program);
+}
+
+#define QUERY_TEST(type, a, b)						\
+	((type) == RHYTHMDB_QUERY_PROP_EQUALS ? ((a) == (b)) :		\
+	 (type) == RHYTHMDB_QUERY_PROP_NOT_EQUAL ? ((a) != (b)) :	\
+	 (type) == RHYTHMDB_QUERY_PROP_GREATER ? !((a) < (b)) :		\
+	 !((a) > (b)))
+
+static gboolean
+search_match_properties (RhythmDBEntry *entry, gchar **words)
+{
+	RBRefString *props[] = {
+		entry->title,
+		entry->album,
+		entry->artist,
+		entry->composer,
+		entry->genre
+	};
+	gchar **current;
+	int i;
+
+	for (current = words; *current != NULL; current++) {
+		gboolean word_found = FALSE;
+
+		for (i = 0; i < G_N_ELEMENTS (props); i++) {
+			const char *entry_string = rb_refstring_get_folded (props[i]);
+			if (entry_string && (strstr (entry_string, *current) != NULL)) {
+				/* the word was found, go to the next one */
+				word_found = TRUE;
+				break;
+			}
+		}
+		if (!word_found) {
+			/* the word wasn't in any of the properties*/
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* evaluates a single term; control instructions are handled by the caller */
+static gboolean
+run_instruction (RhythmDB *db, const RhythmDBQueryInstruction *instr, RhythmDBEntry *entry)
+{
+	switch (instr->op) {
+	case QUERY_OP_COMPARE_STRING:
+		return QUERY_TEST (instr->type, g_strcmp0 (query_get_string (instr, entry), instr->value.string), 0);
+	case QUERY_OP_COMPARE_ULONG:
+		return QUERY_TEST (instr->type, query_get_ulong (instr, entry), instr->value.ulong_val);
+	case QUERY_OP_COMPARE_BOOLEAN:
+		return QUERY_TEST (instr->type, rhythmdb_entry_get_boolean (entry, instr->propid), instr->value.boolean);
+	case QUERY_OP_COMPARE_UINT64:
+		return QUERY_TEST (instr->type, rhythmdb_entry_get_uint64 (entry, instr->propid), instr->value.uint64);
+	case QUERY_OP_COMPARE_DOUBLE:
+		return QUERY_TEST (instr->type, rhythmdb_entry_get_double (entry, instr->propid), instr->value.dbl);
+	case QUERY_OP_COMPARE_OBJECT:
+		return QUERY_TEST (instr->type, (gpointer) rhythmdb_entry_get_object (entry, instr->propid), instr->value.object);
+
+	case QUERY_OP_LIKE:
+	{
+		const char *entry_string = query_get_string (instr, entry);
+
+		/* check in case the property is NULL, the value should never be NULL */
+		if (entry_string == NULL)
+			return FALSE;
+		return (strstr (entry_string, instr->value.string) != NULL) ^ instr->negate;
+	}
+	case QUERY_OP_PREFIX:
+		return g_str_has_prefix (query_get_string (instr, entry), instr->value.string);
+	case QUERY_OP_SUFFIX:
+		return g_str_has_suffix (query_get_string (instr, entry), instr->value.string);
+	case QUERY_OP_SEARCH_MATCH:
+		return search_match_properties (entry, instr->value.words) ^ instr->negate;
+	case QUERY_OP_KEYWORD:
+	{
+		RBRefString *keyword;
+		gboolean has = FALSE;
+
+		keyword = rb_refstring_find (instr->value.string);
+		if (keyword != NULL) {
+			has = rhythmdb_entry_keyword_has (db, entry, keyword);
+			rb_refstring_unref (keyword);
+		}
+		return has ^ instr->negate;
+	}
+	case QUERY_OP_TIME_WITHIN:
+	{
+		GTimeVal current_time;
+		gulong value;
+
+		g_get_current_time (&current_time);
+		value = query_get_ulong (instr, entry);
+		return (value >= (current_time.tv_sec - instr->value.ulong_val)) ^ instr->negate;
+	}
+
+	case QUERY_OP_ACCEPT:
+	case QUERY_OP_REJECT:
+	case QUERY_OP_JUMP:
+		break;
+	}
+
+	g_assert_not_reached ();
+	return FALSE;
+}
+
+/**
+ * rhythmdb_query_program_run: (skip)
+ * @program: a compiled query program
+ * @entry: a #RhythmDBEntry
+ *
+ * Evaluates a compiled query against an entry.
+ *
+ * Return value: %TRUE if the entry matches the query
+ */
+gboolean
+rhythmdb_query_program_run (RhythmDBQueryProgram *program, RhythmDBEntry *entry)
+{
+	const RhythmDBQueryInstruction *instr;
+	guint pc = 0;
+
+	for (;;) {
+		instr = &program->code[pc];
+		switch (instr->op) {
+		case QUERY_OP_ACCEPT:
+			return TRUE;
+		case QUERY_OP_REJECT:
+			return FALSE;
+		case QUERY_OP_JUMP:
+			pc = instr->target;
+			break;
+		default:
+			pc = run_instruction (program->db, instr, entry) ? pc + 1 : instr->target;
+			break;
+		}
+	}
+}
+
+static gboolean evaluate_disjunction (RhythmDB *db, GPtrArray *query, gboolean toplevel, RhythmDBEntry *entry);
+
+static gboolean
+evaluate_conjunction (RhythmDB *db, GPtrArray *query, guint start, guint end, RhythmDBEntry *entry)
+{
+	guint i;
+
+	for (i = start; i < end; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (query, i);
+
+		if (data->type == RHYTHMDB_QUERY_SUBQUERY) {
+			if (evaluate_disjunction (db, data->subquery, FALSE, entry) == FALSE)
+				return FALSE;
+		} else {
+			RhythmDBQueryInstruction instr = {0,};
+
+			build_instruction (db, data, &instr);
+			if (run_instruction (db, &instr, entry) == FALSE)
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/* follows the same rules as compile_disjunction: empty conjunctions match
+ * everything at the top level and are ignored in subqueries.
+ */
+static gboolean
+evaluate_disjunction (RhythmDB *db, GPtrArray *query, gboolean toplevel, RhythmDBEntry *entry)
+{
+	gboolean any = FALSE;
+	guint start;
+	guint i;
+
+	for (i = 0, start = 0; i <= query->len; i++) {
+		if (i < query->len &&
+		    ((RhythmDBQueryData *) g_ptr_array_index (query, i))->type != RHYTHMDB_QUERY_DISJUNCTION)
+			continue;
+
+		if (i > start || toplevel) {
+			if (evaluate_conjunction (db, query, start, i, entry))
+				return TRUE;
+			any = TRUE;
+		}
+		start = i + 1;
+	}
+	return !any;
+}
+
+/**
+ * rhythmdb_query_evaluate_uncompiled: (skip)
+ * @db: the #RhythmDB
+ * @query: a preprocessed query
+ * @entry: a #RhythmDBEntry
+ *
+ * Evaluates @query against an entry term by term, without compiling it.
+ * This gives the same result as compiling the query and running the
+ * program, and avoids allocating anything for a single evaluation.
+ *
+ * Return value: %TRUE if the entry matches the query
+ */
+gboolean
+rhythmdb_query_evaluate_uncompiled (RhythmDB *db, GPtrArray *query, RhythmDBEntry *entry)
+{
+	return evaluate_disjunction (db, query, TRUE, entry);
+}
+
 GType
 rhythmdb_query_get_type (void)
 {
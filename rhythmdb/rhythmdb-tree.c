@@ -41,6 +41,7 @@
 #include <string.h>
 #include <math.h>
 #include <glib/gprintf.h>
+#include <glib/gstdio.h>
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
@@ -70,9 +71,19 @@ typedef struct RhythmDBTreeProperty
 G_DEFINE_TYPE(RhythmDBTree, rhythmdb_tree, RHYTHMDB_TYPE)
 
 static void rhythmdb_tree_finalize (GObject *object);
+static void rhythmdb_tree_set_property (GObject *object,
+					guint prop_id,
+					const GValue *value,
+					GParamSpec *pspec);
+static void rhythmdb_tree_get_property (GObject *object,
+					guint prop_id,
+					GValue *value,
+					GParamSpec *pspec);
 
 static gboolean rhythmdb_tree_load (RhythmDB *rdb, GCancellable *cancel, GError **error);
-static void rhythmdb_tree_save (RhythmDB *rdb);
+static gboolean rhythmdb_tree_save (RhythmDB *rdb);
+static void rhythmdb_tree_save_unchecked (RhythmDB *rdb);
+static gboolean rhythmdb_tree_save_journal (RhythmDB *rdb, GList *deleted, GHashTable *changes);
 static void rhythmdb_tree_entry_new (RhythmDB *db, RhythmDBEntry *entry);
 static void rhythmdb_tree_entry_new_internal (RhythmDB *db, RhythmDBEntry *entry);
 static gboolean rhythmdb_tree_entry_set (RhythmDB *db, RhythmDBEntry *entry,
@@ -128,10 +139,9 @@ static RhythmDBTreeProperty *get_or_create_genre (RhythmDBTree *db, RhythmDBEntr
 
 static void remove_entry_from_album (RhythmDBTree *db, RhythmDBEntry *entry);
 static void remove_entry_from_keywords (RhythmDBTree *db, RhythmDBEntry *entry);
+static void search_index_set_enabled (RhythmDBTree *db, gboolean enabled);
 
 static GList *split_query_by_disjunctions (RhythmDBTree *db, GPtrArray *query);
-static gboolean evaluate_conjunctive_subquery (RhythmDBTree *db, GPtrArray *query,
-					       guint base, guint max, RhythmDBEntry *entry);
 
 struct RhythmDBTreePrivate
 {
@@ -148,6 +158,21 @@ struct RhythmDBTreePrivate
 	GHashTable *unknown_entry_types;
 	gboolean finalizing;
 
+	gboolean use_snapshot;
+	guint load_threads;
+
+	/* search index, NULL if disabled */
+	GHashTable *search_strings;	/* GHashTable<RBRefString, RhythmDBTreeSearchString> */
+	GHashTable *search_trigrams;	/* GHashTable<trigram, GHashTable<RhythmDBTreeSearchString>> */
+	GMutex search_index_lock;
+
+	/* podcast feed index */
+	GHashTable *feed_posts;		/* GHashTable<RBRefString, GHashTable<RhythmDBEntry, 1>> */
+	GMutex feed_index_lock;
+
+	/* changes read from the journal while loading, keyed by location */
+	GHashTable *journal_records;
+
 	guint idle_load_id;
 };
 
@@ -163,11 +188,23 @@ typedef struct
 	GList *properties;
 } RhythmDBUnknownEntry;
 
+typedef struct
+{
+	RhythmDBEntry *entry;	/* replaces the entry at this location */
+	GArray *changes;	/* RhythmDBEntryChange, applied to the entry at this location */
+	RhythmDBUnknownEntry *unknown;	/* entry or update of a type that isn't registered */
+	gboolean unknown_update;
+	gboolean deleted;
+} RhythmDBTreeJournalRecord;
+
 #define RHYTHMDB_TREE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RHYTHMDB_TYPE_TREE, RhythmDBTreePrivate))
 
 enum
 {
 	PROP_0,
+	PROP_USE_SNAPSHOT,
+	PROP_LOAD_THREADS,
+	PROP_SEARCH_INDEX
 };
 
 const int RHYTHMDB_TREE_PARSER_INITIAL_BUFFER_SIZE = 512;
@@ -189,9 +226,13 @@ rhythmdb_tree_class_init (RhythmDBTreeClass *klass)
 	RhythmDBClass *rhythmdb_class = RHYTHMDB_CLASS (klass);
 
 	object_class->finalize = rhythmdb_tree_finalize;
+	object_class->set_property = rhythmdb_tree_set_property;
+	object_class->get_property = rhythmdb_tree_get_property;
 
 	rhythmdb_class->impl_load = rhythmdb_tree_load;
-	rhythmdb_class->impl_save = rhythmdb_tree_save;
+	rhythmdb_class->impl_save = rhythmdb_tree_save_unchecked;
+	rhythmdb_class->impl_save_checked = rhythmdb_tree_save;
+	rhythmdb_class->impl_save_journal = rhythmdb_tree_save_journal;
 	rhythmdb_class->impl_entry_new = rhythmdb_tree_entry_new;
 	rhythmdb_class->impl_entry_set = rhythmdb_tree_entry_set;
 	rhythmdb_class->impl_entry_delete = rhythmdb_tree_entry_delete;
@@ -210,6 +251,47 @@ rhythmdb_tree_class_init (RhythmDBTreeClass *klass)
 	rhythmdb_class->impl_do_full_query = rhythmdb_tree_do_full_query;
 	rhythmdb_class->impl_entry_type_registered = rhythmdb_tree_entry_type_registered;
 
+	/**
+	 * RhythmDBTree:use-snapshot:
+	 *
+	 * If %TRUE, the database is loaded from the binary snapshot written
+	 * alongside the XML file when the snapshot is up to date.
+	 * The XML file is still written on every save.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_USE_SNAPSHOT,
+					 g_param_spec_boolean ("use-snapshot",
+							       "use snapshot",
+							       "Whether to load from the binary snapshot",
+							       TRUE,
+							       G_PARAM_READWRITE));
+	/**
+	 * RhythmDBTree:load-threads:
+	 *
+	 * The number of threads used to parse the XML file.
+	 * If 0, one thread is used per processor.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_LOAD_THREADS,
+					 g_param_spec_uint ("load-threads",
+							    "load threads",
+							    "Number of threads used to parse the database",
+							    0, G_MAXUINT, 0,
+							    G_PARAM_READWRITE));
+	/**
+	 * RhythmDBTree:search-index:
+	 *
+	 * If %TRUE, an index of the strings used for searching is kept
+	 * so that searches only need to examine entries that may match.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_SEARCH_INDEX,
+					 g_param_spec_boolean ("search-index",
+							       "search index",
+							       "Whether to maintain an index for searches",
+							       TRUE,
+							       G_PARAM_READWRITE));
+
 	g_type_class_add_private (klass, sizeof (RhythmDBTreePrivate));
 }
 
@@ -228,6 +310,60 @@ rhythmdb_tree_init (RhythmDBTree *db)
 						  NULL, (GDestroyNotify)g_hash_table_destroy);
 
 	db->priv->unknown_entry_types = g_hash_table_new (rb_refstring_hash, rb_refstring_equal);
+
+	db->priv->feed_posts = g_hash_table_new_full (rb_refstring_hash, rb_refstring_equal,
+						      (GDestroyNotify)rb_refstring_unref, (GDestroyNotify)g_hash_table_destroy);
+
+	db->priv->use_snapshot = TRUE;
+	search_index_set_enabled (db, TRUE);
+}
+
+static void
+rhythmdb_tree_set_property (GObject *object,
+			    guint prop_id,
+			    const GValue *value,
+			    GParamSpec *pspec)
+{
+	RhythmDBTree *db = RHYTHMDB_TREE (object);
+
+	switch (prop_id) {
+	case PROP_USE_SNAPSHOT:
+		db->priv->use_snapshot = g_value_get_boolean (value);
+		break;
+	case PROP_LOAD_THREADS:
+		db->priv->load_threads = g_value_get_uint (value);
+		break;
+	case PROP_SEARCH_INDEX:
+		search_index_set_enabled (db, g_value_get_boolean (value));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+rhythmdb_tree_get_property (GObject *object,
+			    guint prop_id,
+			    GValue *value,
+			    GParamSpec *pspec)
+{
+	RhythmDBTree *db = RHYTHMDB_TREE (object);
+
+	switch (prop_id) {
+	case PROP_USE_SNAPSHOT:
+		g_value_set_boolean (value, db->priv->use_snapshot);
+		break;
+	case PROP_LOAD_THREADS:
+		g_value_set_uint (value, db->priv->load_threads);
+		break;
+	case PROP_SEARCH_INDEX:
+		g_value_set_boolean (value, db->priv->search_strings != NULL);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
 }
 
 /* must be called with the genres lock held */
@@ -241,30 +377,65 @@ unparent_entries (gpointer key,
 	remove_entry_from_album (db, entry);
 }
 
+static void
+free_unknown_entry_property (RhythmDBUnknownEntryProperty *prop)
+{
+	rb_refstring_unref (prop->name);
+	rb_refstring_unref (prop->value);
+	g_free (prop);
+}
+
+static void
+free_unknown_entry (RhythmDBUnknownEntry *entry)
+{
+	rb_refstring_unref (entry->typename);
+	g_list_free_full (entry->properties, (GDestroyNotify) free_unknown_entry_property);
+	g_free (entry);
+}
+
 static void
 free_unknown_entries (RBRefString *name,
 		      GList *entries,
 		      gpointer nah)
 {
-	GList *e;
-	for (e = entries; e != NULL; e = e->next) {
-		RhythmDBUnknownEntry *entry;
-		GList *p;
+	g_list_free_full (entries, (GDestroyNotify) free_unknown_entry);
+}
 
-		entry = (RhythmDBUnknownEntry *)e->data;
-		rb_refstring_unref (entry->typename);
-		for (p = entry->properties; p != NULL; p = p->next) {
-			RhythmDBUnknownEntryProperty *prop;
+static RhythmDBUnknownEntryProperty *
+unknown_entry_get_property (RhythmDBUnknownEntry *entry, const char *name)
+{
+	GList *p;
 
-			prop = (RhythmDBUnknownEntryProperty *)p->data;
-			rb_refstring_unref (prop->name);
-			rb_refstring_unref (prop->value);
-			g_free (prop);
-		}
+	for (p = entry->properties; p != NULL; p = p->next) {
+		RhythmDBUnknownEntryProperty *prop = p->data;
+		if (strcmp (rb_refstring_get (prop->name), name) == 0)
+			return prop;
+	}
+	return NULL;
+}
+
+/* moves the properties of @update into @entry, replacing existing values */
+static void
+unknown_entry_merge (RhythmDBUnknownEntry *entry, RhythmDBUnknownEntry *update)
+{
+	GList *p;
 
-		g_list_free (entry->properties);
+	for (p = update->properties; p != NULL; p = p->next) {
+		RhythmDBUnknownEntryProperty *prop = p->data;
+		RhythmDBUnknownEntryProperty *existing;
+
+		existing = unknown_entry_get_property (entry, rb_refstring_get (prop->name));
+		if (existing != NULL) {
+			rb_refstring_unref (existing->value);
+			existing->value = rb_refstring_ref (prop->value);
+			free_unknown_entry_property (prop);
+		} else {
+			entry->properties = g_list_append (entry->properties, prop);
+		}
 	}
-	g_list_free (entries);
+	g_list_free (update->properties);
+	update->properties = NULL;
+	free_unknown_entry (update);
 }
 
 static void
@@ -290,6 +461,9 @@ rhythmdb_tree_finalize (GObject *object)
 
 	g_hash_table_destroy (db->priv->keywords);
 
+	search_index_set_enabled (db, FALSE);
+	g_hash_table_destroy (db->priv->feed_posts);
+
 	g_hash_table_destroy (db->priv->genres);
 
 	g_hash_table_foreach (db->priv->unknown_entry_types,
@@ -313,6 +487,7 @@ struct RhythmDBTreeLoadContext
 		RHYTHMDB_TREE_PARSER_STATE_ENTRY_KEYWORD,
 		RHYTHMDB_TREE_PARSER_STATE_UNKNOWN_ENTRY,
 		RHYTHMDB_TREE_PARSER_STATE_UNKNOWN_ENTRY_PROPERTY,
+		RHYTHMDB_TREE_PARSER_STATE_DELETED,
 		RHYTHMDB_TREE_PARSER_STATE_END,
 	} state;
 	guint in_unknown_elt;
@@ -329,8 +504,342 @@ struct RhythmDBTreeLoadContext
 	guint reload_all_metadata : 1;
 	guint update_podcasts : 1;
 	guint update_local_mountpoints : 1;
+
+	/* replaying the journal */
+	guint journal : 1;
+	guint journal_update : 1;
+	RBRefString *journal_location;
+	GArray *journal_changes;
+
+	/* entries parsed by a load worker thread */
+	GPtrArray *loaded_entries;
 };
 
+/*
+ * Change journal.
+ *
+ * Between full saves, changes to the database are appended to a journal
+ * file next to the XML file.  The journal starts with a line identifying
+ * the XML file it applies to, followed by XML fragments: <deleted> elements
+ * holding the locations of deleted entries, complete <entry> elements for
+ * entries that were added or replaced, and <entry update="true"> elements
+ * holding only the location and the changed properties of existing entries.
+ *
+ * When loading, the journal is read first and reduced to one record per
+ * location, which is then applied to entries as they are loaded from the
+ * XML file or snapshot.  Records for entry types that aren't registered when
+ * the journal is read are kept as unknown entries, the same way the XML
+ * loader keeps them, so the next full save writes them back out.
+ */
+
+#define RHYTHMDB_TREE_JOURNAL_SUFFIX		".journal"
+#define RHYTHMDB_TREE_JOURNAL_MIN_COMPACT_SIZE	(64 * 1024)
+
+static char *
+rhythmdb_tree_journal_path (const char *name)
+{
+	return g_strconcat (name, RHYTHMDB_TREE_JOURNAL_SUFFIX, NULL);
+}
+
+static char *
+rhythmdb_tree_journal_header (const GStatBuf *xml_stat)
+{
+	return g_strdup_printf ("RBJOURNAL %" G_GUINT64_FORMAT " %" G_GINT64_FORMAT " %" G_GUINT64_FORMAT "\n",
+				(guint64) xml_stat->st_size,
+				(gint64) xml_stat->st_mtime,
+				(guint64) xml_stat->st_ino);
+}
+
+static void
+free_journal_changes (GArray *changes)
+{
+	guint i;
+
+	for (i = 0; i < changes->len; i++) {
+		g_value_unset (&g_array_index (changes, RhythmDBEntryChange, i).new);
+	}
+	g_array_free (changes, TRUE);
+}
+
+static void
+discard_loaded_entry (RhythmDBTree *db, RhythmDBEntry *entry)
+{
+	g_mutex_lock (&db->priv->keywords_lock);
+	remove_entry_from_keywords (db, entry);
+	g_mutex_unlock (&db->priv->keywords_lock);
+	rhythmdb_entry_unref (entry);
+}
+
+static void
+journal_record_clear (RhythmDBTree *db, RhythmDBTreeJournalRecord *record)
+{
+	if (record->entry != NULL) {
+		discard_loaded_entry (db, record->entry);
+		record->entry = NULL;
+	}
+	if (record->changes != NULL) {
+		free_journal_changes (record->changes);
+		record->changes = NULL;
+	}
+	if (record->unknown != NULL) {
+		free_unknown_entry (record->unknown);
+		record->unknown = NULL;
+	}
+	record->unknown_update = FALSE;
+	record->deleted = FALSE;
+}
+
+static void
+journal_apply_changes (RhythmDBTree *db, RhythmDBEntry *entry, GArray *changes)
+{
+	guint i;
+
+	for (i = 0; i < changes->len; i++) {
+		RhythmDBEntryChange *change = &g_array_index (changes, RhythmDBEntryChange, i);
+		rhythmdb_entry_set_internal (RHYTHMDB (db), entry, FALSE, change->prop, &change->new);
+	}
+}
+
+static RhythmDBTreeJournalRecord *
+journal_get_record (RhythmDBTree *db, RBRefString *location)
+{
+	RhythmDBTreeJournalRecord *record;
+
+	record = g_hash_table_lookup (db->priv->journal_records, location);
+	if (record == NULL) {
+		record = g_new0 (RhythmDBTreeJournalRecord, 1);
+		g_hash_table_insert (db->priv->journal_records, rb_refstring_ref (location), record);
+	}
+	return record;
+}
+
+static void
+journal_record_deleted (RhythmDBTree *db, const char *location)
+{
+	RhythmDBTreeJournalRecord *record;
+	RBRefString *loc;
+
+	loc = rb_refstring_new (location);
+	record = journal_get_record (db, loc);
+	rb_refstring_unref (loc);
+
+	journal_record_clear (db, record);
+	record->deleted = TRUE;
+}
+
+static void
+journal_record_entry (RhythmDBTree *db, RhythmDBEntry *entry)
+{
+	RhythmDBTreeJournalRecord *record;
+
+	if (entry->location == NULL || rb_refstring_get (entry->location)[0] == '\0') {
+		rb_debug ("found journal entry without location");
+		discard_loaded_entry (db, entry);
+		return;
+	}
+
+	record = journal_get_record (db, entry->location);
+	journal_record_clear (db, record);
+	record->entry = entry;
+}
+
+static void
+journal_record_unknown (RhythmDBTree *db, RhythmDBUnknownEntry *unknown, gboolean update)
+{
+	RhythmDBTreeJournalRecord *record;
+	RhythmDBUnknownEntryProperty *location;
+
+	location = unknown_entry_get_property (unknown, "location");
+	if (location == NULL || location->value == NULL) {
+		rb_debug ("found journal entry of unknown type without location");
+		free_unknown_entry (unknown);
+		return;
+	}
+
+	record = journal_get_record (db, location->value);
+	if (update == FALSE) {
+		journal_record_clear (db, record);
+		record->unknown = unknown;
+	} else if (record->deleted) {
+		free_unknown_entry (unknown);
+	} else if (record->unknown != NULL) {
+		unknown_entry_merge (record->unknown, unknown);
+	} else {
+		record->unknown = unknown;
+		record->unknown_update = TRUE;
+	}
+}
+
+/* applies journal records for unknown entry types to the unknown entries
+ * loaded from the XML file, then adds the ones that weren't there.
+ * must be called with the entries lock held.
+ */
+static void
+journal_apply_unknown (RhythmDBTree *db)
+{
+	GHashTableIter iter;
+	RhythmDBTreeJournalRecord *record;
+	GList *entries;
+	GList *e;
+	GList *n;
+
+	rb_assert_locked (&db->priv->entries_lock);
+
+	g_hash_table_iter_init (&iter, db->priv->unknown_entry_types);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entries)) {
+		for (e = entries; e != NULL; e = n) {
+			RhythmDBUnknownEntry *entry = e->data;
+			RhythmDBUnknownEntryProperty *location;
+
+			n = e->next;
+			location = unknown_entry_get_property (entry, "location");
+			if (location == NULL || location->value == NULL)
+				continue;
+
+			record = g_hash_table_lookup (db->priv->journal_records, location->value);
+			if (record == NULL) {
+				continue;
+			} else if (record->deleted) {
+				entries = g_list_delete_link (entries, e);
+				free_unknown_entry (entry);
+			} else if (record->unknown != NULL && record->unknown_update) {
+				unknown_entry_merge (entry, record->unknown);
+				record->unknown = NULL;
+			} else if (record->unknown != NULL) {
+				e->data = record->unknown;
+				record->unknown = NULL;
+				free_unknown_entry (entry);
+			}
+		}
+
+		/* the key is the type name of one of the entries, so it's
+		 * still valid as long as there are any left.
+		 */
+		if (entries == NULL)
+			g_hash_table_iter_remove (&iter);
+		else
+			g_hash_table_iter_replace (&iter, entries);
+	}
+
+	g_hash_table_iter_init (&iter, db->priv->journal_records);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &record)) {
+		if (record->unknown == NULL || record->unknown_update)
+			continue;
+
+		entries = g_hash_table_lookup (db->priv->unknown_entry_types, record->unknown->typename);
+		entries = g_list_prepend (entries, record->unknown);
+		g_hash_table_insert (db->priv->unknown_entry_types, record->unknown->typename, entries);
+		record->unknown = NULL;
+	}
+}
+
+static void
+journal_record_update (RhythmDBTree *db, RBRefString *location, GArray *changes)
+{
+	RhythmDBTreeJournalRecord *record;
+
+	if (location == NULL) {
+		rb_debug ("found journal update without location");
+		free_journal_changes (changes);
+		return;
+	}
+
+	record = journal_get_record (db, location);
+	if (record->entry != NULL) {
+		journal_apply_changes (db, record->entry, changes);
+		free_journal_changes (changes);
+	} else if (record->deleted) {
+		free_journal_changes (changes);
+	} else if (record->changes == NULL) {
+		record->changes = changes;
+	} else {
+		/* the values now belong to record->changes */
+		g_array_append_vals (record->changes, changes->data, changes->len);
+		g_array_free (changes, TRUE);
+	}
+}
+
+/* Applies the journal to an entry loaded from the XML file or snapshot.
+ * Returns the entry to add to the database, which may be a newer version
+ * of the entry from the journal, or NULL if it has since been deleted.
+ */
+static RhythmDBEntry *
+rhythmdb_tree_journal_apply (RhythmDBTree *db, RhythmDBEntry *entry)
+{
+	RhythmDBTreeJournalRecord *record;
+	RhythmDBEntry *replacement;
+
+	if (db->priv->journal_records == NULL)
+		return entry;
+
+	record = g_hash_table_lookup (db->priv->journal_records, entry->location);
+	if (record == NULL)
+		return entry;
+
+	/* keep deletions around in case the location occurs again */
+	if (record->deleted) {
+		discard_loaded_entry (db, entry);
+		return NULL;
+	}
+
+	if (record->changes != NULL)
+		journal_apply_changes (db, entry, record->changes);
+	replacement = record->entry;
+	record->entry = NULL;
+
+	g_hash_table_remove (db->priv->journal_records, entry->location);
+	journal_record_clear (db, record);
+	g_free (record);
+
+	if (replacement != NULL) {
+		discard_loaded_entry (db, entry);
+		return replacement;
+	}
+	return entry;
+}
+
+/* adds entries from the journal that weren't in the XML file or snapshot */
+static void
+rhythmdb_tree_journal_finish (RhythmDBTree *db)
+{
+	GHashTableIter iter;
+	RhythmDBTreeJournalRecord *record;
+	gint batch_count = 0;
+
+	if (db->priv->journal_records == NULL)
+		return;
+
+	g_mutex_lock (&db->priv->entries_lock);
+	journal_apply_unknown (db);
+	g_mutex_unlock (&db->priv->entries_lock);
+
+	g_hash_table_iter_init (&iter, db->priv->journal_records);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &record)) {
+		if (record->entry != NULL) {
+			g_mutex_lock (&db->priv->entries_lock);
+			if (g_hash_table_lookup (db->priv->entries, record->entry->location) == NULL) {
+				rhythmdb_tree_entry_new_internal (RHYTHMDB (db), record->entry);
+				rhythmdb_entry_insert (RHYTHMDB (db), record->entry);
+				record->entry = NULL;
+				if (++batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
+					rhythmdb_commit (RHYTHMDB (db));
+					batch_count = 0;
+				}
+			}
+			g_mutex_unlock (&db->priv->entries_lock);
+		}
+
+		journal_record_clear (db, record);
+		g_free (record);
+	}
+
+	if (batch_count)
+		rhythmdb_commit (RHYTHMDB (db));
+
+	g_hash_table_destroy (db->priv->journal_records);
+	db->priv->journal_records = NULL;
+}
+
 /* Returns the version as an int, multiplied by 100,
  * eg. "1.4" becomes 140 */
 static int
@@ -432,16 +941,22 @@ rhythmdb_tree_parser_start_element (struct RhythmDBTreeLoadContext *ctx,
 		if (!strcmp (name, "entry")) {
 			RhythmDBEntryType *type = NULL;
 			const char *typename = NULL;
+			gboolean update = FALSE;
 			for (; *attrs; attrs +=2) {
 				if (!strcmp (*attrs, "type")) {
 					typename = *(attrs+1);
 					type = rhythmdb_entry_type_get_by_name (RHYTHMDB (ctx->db), typename);
-					break;
+				} else if (!strcmp (*attrs, "update")) {
+					update = !strcmp (*(attrs+1), "true");
 				}
 			}
 
 			g_assert (typename);
-			if (type != NULL) {
+			if (update && type != NULL) {
+				ctx->state = RHYTHMDB_TREE_PARSER_STATE_ENTRY;
+				ctx->journal_update = TRUE;
+				ctx->journal_changes = g_array_new (FALSE, TRUE, sizeof (RhythmDBEntryChange));
+			} else if (type != NULL) {
 				ctx->state = RHYTHMDB_TREE_PARSER_STATE_ENTRY;
 				ctx->entry = rhythmdb_entry_allocate (RHYTHMDB (ctx->db), type);
 				ctx->entry->flags |= RHYTHMDB_ENTRY_TREE_LOADING;
@@ -451,14 +966,18 @@ rhythmdb_tree_parser_start_element (struct RhythmDBTreeLoadContext *ctx,
 				ctx->state = RHYTHMDB_TREE_PARSER_STATE_UNKNOWN_ENTRY;
 				ctx->unknown_entry = g_new0 (RhythmDBUnknownEntry, 1);
 				ctx->unknown_entry->typename = rb_refstring_new (typename);
+				ctx->journal_update = update;
 			}
+		} else if (ctx->journal && !strcmp (name, "deleted")) {
+			ctx->state = RHYTHMDB_TREE_PARSER_STATE_DELETED;
+			g_string_truncate (ctx->buf, 0);
 		} else {
 			ctx->in_unknown_elt++;
 		}
 		break;
 	}
 	case RHYTHMDB_TREE_PARSER_STATE_ENTRY:
-		if (strcmp (name, "keyword") == 0) {
+		if (strcmp (name, "keyword") == 0 && ctx->entry != NULL) {
 			ctx->state = RHYTHMDB_TREE_PARSER_STATE_ENTRY_KEYWORD;
 		} else {
 			int val = rhythmdb_propid_from_nice_elt_name (RHYTHMDB (ctx->db), BAD_CAST name);
@@ -487,11 +1006,86 @@ rhythmdb_tree_parser_start_element (struct RhythmDBTreeLoadContext *ctx,
 	case RHYTHMDB_TREE_PARSER_STATE_UNKNOWN_ENTRY_PROPERTY:
 	case RHYTHMDB_TREE_PARSER_STATE_ENTRY_PROPERTY:
 	case RHYTHMDB_TREE_PARSER_STATE_ENTRY_KEYWORD:
+	case RHYTHMDB_TREE_PARSER_STATE_DELETED:
 	case RHYTHMDB_TREE_PARSER_STATE_END:
 	break;
 	}
 }
 
+/* adds the entry that was just parsed to the database, merging it with
+ * any existing entry with the same location.
+ */
+static void
+rhythmdb_tree_parser_add_entry (struct RhythmDBTreeLoadContext *ctx)
+{
+	RhythmDBEntry *entry;
+
+	if (ctx->entry->location != NULL && rb_refstring_get (ctx->entry->location)[0] != '\0' &&
+	    (ctx->entry = rhythmdb_tree_journal_apply (ctx->db, ctx->entry)) == NULL) {
+		rb_debug ("entry was deleted after the database was saved");
+	} else if (ctx->entry->location != NULL && rb_refstring_get (ctx->entry->location)[0] != '\0') {
+		g_mutex_lock (&ctx->db->priv->entries_lock);
+		entry = g_hash_table_lookup (ctx->db->priv->entries, ctx->entry->location);
+		if (entry == NULL) {
+			rhythmdb_tree_entry_new_internal (RHYTHMDB (ctx->db), ctx->entry);
+			rhythmdb_entry_insert (RHYTHMDB (ctx->db), ctx->entry);
+			if (++ctx->batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
+				rhythmdb_commit (RHYTHMDB (ctx->db));
+				ctx->batch_count = 0;
+			}
+		} else if (ctx->entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST &&
+			   entry->type == RHYTHMDB_ENTRY_TYPE_SONG) {
+			rb_debug ("found song entry with duplicate location for Podcast post %s. merging metadata",
+				  rb_refstring_get (ctx->entry->location));
+
+			ctx->entry->play_count += entry->play_count;
+			if (ctx->entry->last_played < entry->last_played)
+				ctx->entry->last_played = entry->last_played;
+
+			/* Remove the song entry,
+			 * deleting requires relinquishing the locks */
+			g_mutex_unlock (&ctx->db->priv->entries_lock);
+			rhythmdb_entry_delete (RHYTHMDB(ctx->db), entry);
+			g_mutex_lock (&ctx->db->priv->entries_lock);
+			rhythmdb_commit (RHYTHMDB (ctx->db));
+
+			/* And add the Podcast entry to the database */
+			rhythmdb_tree_entry_new_internal (RHYTHMDB (ctx->db), ctx->entry);
+			rhythmdb_entry_insert (RHYTHMDB (ctx->db), ctx->entry);
+			if (++ctx->batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
+				rhythmdb_commit (RHYTHMDB (ctx->db));
+				ctx->batch_count = 0;
+			}
+		} else {
+			rb_debug ("found entry with duplicate location %s. merging metadata",
+				  rb_refstring_get (ctx->entry->location));
+
+			entry->play_count += ctx->entry->play_count;
+
+			if (entry->rating < 0.01)
+				entry->rating = ctx->entry->rating;
+			else if (ctx->entry->rating > 0.01)
+				entry->rating = (entry->rating + ctx->entry->rating) / 2;
+
+			if (ctx->entry->last_played > entry->last_played)
+				entry->last_played = ctx->entry->last_played;
+
+			if (ctx->entry->first_seen < entry->first_seen)
+				entry->first_seen = ctx->entry->first_seen;
+
+			if (ctx->entry->last_seen > entry->last_seen)
+				entry->last_seen = ctx->entry->last_seen;
+
+			rhythmdb_entry_unref (ctx->entry);
+		}
+		g_mutex_unlock (&ctx->db->priv->entries_lock);
+	} else {
+		rb_debug ("found entry without location");
+		rhythmdb_entry_unref (ctx->entry);
+	}
+	ctx->entry = NULL;
+}
+
 static void
 rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 				  const char *name)
@@ -513,6 +1107,18 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 		break;
 	case RHYTHMDB_TREE_PARSER_STATE_ENTRY:
 	{
+		if (ctx->journal_update) {
+			journal_record_update (ctx->db, ctx->journal_location, ctx->journal_changes);
+			if (ctx->journal_location != NULL) {
+				rb_refstring_unref (ctx->journal_location);
+				ctx->journal_location = NULL;
+			}
+			ctx->journal_changes = NULL;
+			ctx->journal_update = FALSE;
+			ctx->state = RHYTHMDB_TREE_PARSER_STATE_RHYTHMDB;
+			break;
+		}
+
 		if (!ctx->has_date || ctx->reload_all_metadata) {
 			/* there is no date metadata, so this is from an old version
 			 * reset the last-modified timestamp, so that the file is re-read
@@ -567,67 +1173,13 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 			}
 		}
 
-		if (ctx->entry->location != NULL && rb_refstring_get (ctx->entry->location)[0] != '\0') {
-			RhythmDBEntry *entry;
-
-			g_mutex_lock (&ctx->db->priv->entries_lock);
-			entry = g_hash_table_lookup (ctx->db->priv->entries, ctx->entry->location);
-			if (entry == NULL) {
-				rhythmdb_tree_entry_new_internal (RHYTHMDB (ctx->db), ctx->entry);
-				rhythmdb_entry_insert (RHYTHMDB (ctx->db), ctx->entry);
-				if (++ctx->batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
-					rhythmdb_commit (RHYTHMDB (ctx->db));
-					ctx->batch_count = 0;
-				}
-			} else if (ctx->entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST &&
-				   entry->type == RHYTHMDB_ENTRY_TYPE_SONG) {
-				rb_debug ("found song entry with duplicate location for Podcast post %s. merging metadata",
-					  rb_refstring_get (ctx->entry->location));
-
-				ctx->entry->play_count += entry->play_count;
-				if (ctx->entry->last_played < entry->last_played)
-					ctx->entry->last_played = entry->last_played;
-
-				/* Remove the song entry,
-				 * deleting requires relinquishing the locks */
-				g_mutex_unlock (&ctx->db->priv->entries_lock);
-				rhythmdb_entry_delete (RHYTHMDB(ctx->db), entry);
-				g_mutex_lock (&ctx->db->priv->entries_lock);
-				rhythmdb_commit (RHYTHMDB (ctx->db));
-
-				/* And add the Podcast entry to the database */
-				rhythmdb_tree_entry_new_internal (RHYTHMDB (ctx->db), ctx->entry);
-				rhythmdb_entry_insert (RHYTHMDB (ctx->db), ctx->entry);
-				if (++ctx->batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
-					rhythmdb_commit (RHYTHMDB (ctx->db));
-					ctx->batch_count = 0;
-				}
-			} else {
-				rb_debug ("found entry with duplicate location %s. merging metadata",
-					  rb_refstring_get (ctx->entry->location));
-
-				entry->play_count += ctx->entry->play_count;
-
-				if (entry->rating < 0.01)
-					entry->rating = ctx->entry->rating;
-				else if (ctx->entry->rating > 0.01)
-					entry->rating = (entry->rating + ctx->entry->rating) / 2;
-
-				if (ctx->entry->last_played > entry->last_played)
-					entry->last_played = ctx->entry->last_played;
-
-				if (ctx->entry->first_seen < entry->first_seen)
-					entry->first_seen = ctx->entry->first_seen;
-
-				if (ctx->entry->last_seen > entry->last_seen)
-					entry->last_seen = ctx->entry->last_seen;
-
-				rhythmdb_entry_unref (ctx->entry);
-			}
-			g_mutex_unlock (&ctx->db->priv->entries_lock);
+		if (ctx->journal) {
+			journal_record_entry (ctx->db, ctx->entry);
+		} else if (ctx->loaded_entries != NULL) {
+			/* added to the database once all chunks have been parsed */
+			g_ptr_array_add (ctx->loaded_entries, ctx->entry);
 		} else {
-			rb_debug ("found entry without location");
-			rhythmdb_entry_unref (ctx->entry);
+			rhythmdb_tree_parser_add_entry (ctx);
 		}
 		ctx->state = RHYTHMDB_TREE_PARSER_STATE_RHYTHMDB;
 		ctx->entry = NULL;
@@ -640,6 +1192,14 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 		rb_debug ("finished reading unknown entry");
 		ctx->unknown_entry->properties = g_list_reverse (ctx->unknown_entry->properties);
 
+		if (ctx->journal) {
+			journal_record_unknown (ctx->db, ctx->unknown_entry, ctx->journal_update);
+			ctx->journal_update = FALSE;
+			ctx->state = RHYTHMDB_TREE_PARSER_STATE_RHYTHMDB;
+			ctx->unknown_entry = NULL;
+			break;
+		}
+
 		g_mutex_lock (&ctx->db->priv->entries_lock);
 		entry_list = g_hash_table_lookup (ctx->db->priv->unknown_entry_types, ctx->unknown_entry->typename);
 		entry_list = g_list_prepend (entry_list, ctx->unknown_entry);
@@ -656,6 +1216,22 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 		gboolean set = FALSE;
 		gboolean skip = FALSE;
 
+		if (ctx->journal_update) {
+			if (ctx->propid == RHYTHMDB_PROP_LOCATION) {
+				if (ctx->journal_location != NULL)
+					rb_refstring_unref (ctx->journal_location);
+				ctx->journal_location = rb_refstring_new (ctx->buf->str);
+			} else {
+				RhythmDBEntryChange change = {0,};
+
+				change.prop = ctx->propid;
+				rhythmdb_read_encoded_property (RHYTHMDB (ctx->db), ctx->buf->str, ctx->propid, &change.new);
+				g_array_append_val (ctx->journal_changes, change);
+			}
+			ctx->state = RHYTHMDB_TREE_PARSER_STATE_ENTRY;
+			break;
+		}
+
 		/* special case some properties for upgrade handling etc. */
 		switch (ctx->propid) {
 		case RHYTHMDB_PROP_DATE:
@@ -717,6 +1293,10 @@ rhythmdb_tree_parser_end_element (struct RhythmDBTreeLoadContext *ctx,
 		ctx->state = RHYTHMDB_TREE_PARSER_STATE_UNKNOWN_ENTRY;
 		break;
 	}
+	case RHYTHMDB_TREE_PARSER_STATE_DELETED:
+		journal_record_deleted (ctx->db, ctx->buf->str);
+		ctx->state = RHYTHMDB_TREE_PARSER_STATE_RHYTHMDB;
+		break;
 	case RHYTHMDB_TREE_PARSER_STATE_START:
 	case RHYTHMDB_TREE_PARSER_STATE_END:
 	break;
@@ -738,6 +1318,7 @@ rhythmdb_tree_parser_characters (struct RhythmDBTreeLoadContext *ctx,
 	case RHYTHMDB_TREE_PARSER_STATE_ENTRY_PROPERTY:
 	case RHYTHMDB_TREE_PARSER_STATE_ENTRY_KEYWORD:
 	case RHYTHMDB_TREE_PARSER_STATE_UNKNOWN_ENTRY_PROPERTY:
+	case RHYTHMDB_TREE_PARSER_STATE_DELETED:
 		g_string_append_len (ctx->buf, data, len);
 		break;
 	case RHYTHMDB_TREE_PARSER_STATE_ENTRY:
@@ -749,7 +1330,711 @@ rhythmdb_tree_parser_characters (struct RhythmDBTreeLoadContext *ctx,
 	}
 }
 
-static gboolean
+/*
+ * Binary snapshot of the database.
+ *
+ * The snapshot is written next to the XML file every time the database is
+ * saved, and is used in preference to the XML file on load as long as it was
+ * written along with the XML file it sits next to.  The XML file remains the
+ * canonical format, so the snapshot can be deleted at any time.
+ *
+ * The file consists of a header followed by a fixed-width record for each
+ * entry, a table of entry type names, a table of keywords, and a deduplicated
+ * string table.  All strings are referred to by their index in the string
+ * table; index 0 is reserved for NULL.  The snapshot is written in host byte
+ * order and is mapped into memory directly when loading.
+ */
+
+#define RHYTHMDB_TREE_SNAPSHOT_SUFFIX		".snapshot"
+#define RHYTHMDB_TREE_SNAPSHOT_MAGIC		"RBDBSNAP"
+#define RHYTHMDB_TREE_SNAPSHOT_VERSION		2
+#define RHYTHMDB_TREE_SNAPSHOT_BYTE_ORDER	0x01020304
+
+static const gsize snapshot_entry_strings[] = {
+	G_STRUCT_OFFSET (RhythmDBEntry, title),
+	G_STRUCT_OFFSET (RhythmDBEntry, artist),
+	G_STRUCT_OFFSET (RhythmDBEntry, composer),
+	G_STRUCT_OFFSET (RhythmDBEntry, album),
+	G_STRUCT_OFFSET (RhythmDBEntry, album_artist),
+	G_STRUCT_OFFSET (RhythmDBEntry, genre),
+	G_STRUCT_OFFSET (RhythmDBEntry, comment),
+	G_STRUCT_OFFSET (RhythmDBEntry, musicbrainz_trackid),
+	G_STRUCT_OFFSET (RhythmDBEntry, musicbrainz_artistid),
+	G_STRUCT_OFFSET (RhythmDBEntry, musicbrainz_albumid),
+	G_STRUCT_OFFSET (RhythmDBEntry, musicbrainz_albumartistid),
+	G_STRUCT_OFFSET (RhythmDBEntry, artist_sortname),
+	G_STRUCT_OFFSET (RhythmDBEntry, composer_sortname),
+	G_STRUCT_OFFSET (RhythmDBEntry, album_sortname),
+	G_STRUCT_OFFSET (RhythmDBEntry, album_artist_sortname),
+	G_STRUCT_OFFSET (RhythmDBEntry, location),
+	G_STRUCT_OFFSET (RhythmDBEntry, mountpoint),
+	G_STRUCT_OFFSET (RhythmDBEntry, media_type)
+};
+#define RHYTHMDB_TREE_SNAPSHOT_ENTRY_STRINGS 18
+#define RHYTHMDB_TREE_SNAPSHOT_LOCATION 15
+
+static const gsize snapshot_entry_ulongs[] = {
+	G_STRUCT_OFFSET (RhythmDBEntry, tracknum),
+	G_STRUCT_OFFSET (RhythmDBEntry, tracktotal),
+	G_STRUCT_OFFSET (RhythmDBEntry, discnum),
+	G_STRUCT_OFFSET (RhythmDBEntry, disctotal),
+	G_STRUCT_OFFSET (RhythmDBEntry, duration),
+	G_STRUCT_OFFSET (RhythmDBEntry, bitrate),
+	G_STRUCT_OFFSET (RhythmDBEntry, mtime),
+	G_STRUCT_OFFSET (RhythmDBEntry, first_seen),
+	G_STRUCT_OFFSET (RhythmDBEntry, last_seen),
+	G_STRUCT_OFFSET (RhythmDBEntry, last_played)
+};
+#define RHYTHMDB_TREE_SNAPSHOT_ENTRY_ULONGS 10
+
+static const gsize snapshot_podcast_strings[] = {
+	G_STRUCT_OFFSET (RhythmDBPodcastFields, description),
+	G_STRUCT_OFFSET (RhythmDBPodcastFields, subtitle),
+	G_STRUCT_OFFSET (RhythmDBPodcastFields, summary),
+	G_STRUCT_OFFSET (RhythmDBPodcastFields, lang),
+	G_STRUCT_OFFSET (RhythmDBPodcastFields, copyright),
+	G_STRUCT_OFFSET (RhythmDBPodcastFields, image),
+	G_STRUCT_OFFSET (RhythmDBPodcastFields, etag),
+	G_STRUCT_OFFSET (RhythmDBPodcastFields, last_modified),
+	G_STRUCT_OFFSET (RhythmDBPodcastFields, checksum)
+};
+#define RHYTHMDB_TREE_SNAPSHOT_PODCAST_STRINGS 9
+
+typedef struct
+{
+	char magic[8];
+	guint32 byte_order;
+	guint32 version;
+	guint32 db_version;
+	guint32 record_size;
+
+	/* identifies the XML file written along with the snapshot */
+	guint64 xml_size;
+	gint64 xml_mtime;
+	guint64 xml_inode;
+
+	guint32 n_entries;
+	guint32 n_types;
+	guint32 n_keywords;
+	guint32 n_strings;
+
+	guint64 entries_offset;
+	guint64 types_offset;
+	guint64 keywords_offset;
+	guint64 string_offsets_offset;
+	guint64 strings_offset;
+	guint64 strings_size;
+} RhythmDBTreeSnapshotHeader;
+
+typedef struct
+{
+	guint64 ulongs[RHYTHMDB_TREE_SNAPSHOT_ENTRY_ULONGS];
+	guint64 status;
+	guint64 post_time;
+	guint64 file_size;
+	gint64 play_count;
+	double rating;
+	double bpm;
+	guint32 strings[RHYTHMDB_TREE_SNAPSHOT_ENTRY_STRINGS];
+	guint32 podcast_strings[RHYTHMDB_TREE_SNAPSHOT_PODCAST_STRINGS];
+	guint32 type;
+	guint32 julian;
+	guint32 hidden;
+	guint32 keywords_start;
+	guint32 keywords_count;
+} RhythmDBTreeSnapshotRecord;
+
+G_STATIC_ASSERT (G_N_ELEMENTS (snapshot_entry_strings) == RHYTHMDB_TREE_SNAPSHOT_ENTRY_STRINGS);
+G_STATIC_ASSERT (G_N_ELEMENTS (snapshot_entry_ulongs) == RHYTHMDB_TREE_SNAPSHOT_ENTRY_ULONGS);
+G_STATIC_ASSERT (G_N_ELEMENTS (snapshot_podcast_strings) == RHYTHMDB_TREE_SNAPSHOT_PODCAST_STRINGS);
+G_STATIC_ASSERT (sizeof (RhythmDBTreeSnapshotHeader) % 8 == 0);
+G_STATIC_ASSERT (sizeof (RhythmDBTreeSnapshotRecord) % 8 == 0);
+
+static char *
+rhythmdb_tree_snapshot_path (const char *name)
+{
+	return g_strconcat (name, RHYTHMDB_TREE_SNAPSHOT_SUFFIX, NULL);
+}
+
+struct RhythmDBTreeSnapshotLoadContext
+{
+	const char *data;
+	const RhythmDBTreeSnapshotHeader *header;
+	const RhythmDBTreeSnapshotRecord *records;
+	const guint32 *types;
+	const guint32 *keywords;
+	const guint32 *string_offsets;
+	const char *strings;
+
+	RhythmDBEntryType **entry_types;
+	RBRefString **refstrings;
+};
+
+static gboolean
+snapshot_section_valid (gsize file_size, guint64 offset, guint64 count, gsize element_size)
+{
+	if (offset % 8 != 0 || offset > file_size)
+		return FALSE;
+	return (count * element_size <= file_size - offset);
+}
+
+/* returns a new reference to the refstring at the given index,
+ * interning each distinct string only once per load.
+ */
+static RBRefString *
+snapshot_get_string (struct RhythmDBTreeSnapshotLoadContext *ctx, guint32 index)
+{
+	if (index == 0)
+		return NULL;
+
+	if (ctx->refstrings[index] == NULL)
+		ctx->refstrings[index] = rb_refstring_new (ctx->strings + ctx->string_offsets[index]);
+
+	return rb_refstring_ref (ctx->refstrings[index]);
+}
+
+static gboolean
+snapshot_validate (RhythmDBTree *db,
+		   struct RhythmDBTreeSnapshotLoadContext *ctx,
+		   gsize size,
+		   const GStatBuf *xml_stat)
+{
+	const RhythmDBTreeSnapshotHeader *header = ctx->header;
+	guint32 i;
+
+	if (size < sizeof (RhythmDBTreeSnapshotHeader))
+		return FALSE;
+
+	if (memcmp (header->magic, RHYTHMDB_TREE_SNAPSHOT_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->byte_order != RHYTHMDB_TREE_SNAPSHOT_BYTE_ORDER ||
+	    header->version != RHYTHMDB_TREE_SNAPSHOT_VERSION ||
+	    header->db_version != RHYTHMDB_TREE_XML_VERSION_INT ||
+	    header->record_size != sizeof (RhythmDBTreeSnapshotRecord)) {
+		rb_debug ("snapshot header doesn't match");
+		return FALSE;
+	}
+
+	if (header->xml_size != (guint64) xml_stat->st_size ||
+	    header->xml_mtime != (gint64) xml_stat->st_mtime ||
+	    header->xml_inode != (guint64) xml_stat->st_ino) {
+		rb_debug ("snapshot was not written with the current XML file");
+		return FALSE;
+	}
+
+	if (header->n_strings == 0 ||
+	    !snapshot_section_valid (size, header->entries_offset, header->n_entries, sizeof (RhythmDBTreeSnapshotRecord)) ||
+	    !snapshot_section_valid (size, header->types_offset, header->n_types, sizeof (guint32)) ||
+	    !snapshot_section_valid (size, header->keywords_offset, header->n_keywords, sizeof (guint32)) ||
+	    !snapshot_section_valid (size, header->string_offsets_offset, header->n_strings, sizeof (guint32)) ||
+	    !snapshot_section_valid (size, header->strings_offset, header->strings_size, 1) ||
+	    header->strings_size == 0) {
+		rb_debug ("snapshot sections are out of bounds");
+		return FALSE;
+	}
+
+	ctx->records = (const RhythmDBTreeSnapshotRecord *) (ctx->data + header->entries_offset);
+	ctx->types = (const guint32 *) (ctx->data + header->types_offset);
+	ctx->keywords = (const guint32 *) (ctx->data + header->keywords_offset);
+	ctx->string_offsets = (const guint32 *) (ctx->data + header->string_offsets_offset);
+	ctx->strings = ctx->data + header->strings_offset;
+
+	if (ctx->strings[header->strings_size - 1] != '\0')
+		return FALSE;
+	for (i = 0; i < header->n_strings; i++) {
+		if (ctx->string_offsets[i] >= header->strings_size)
+			return FALSE;
+	}
+
+	for (i = 0; i < header->n_keywords; i++) {
+		if (ctx->keywords[i] == 0 || ctx->keywords[i] >= header->n_strings)
+			return FALSE;
+	}
+
+	/* all entry types must be registered, otherwise the XML loader
+	 * needs to preserve the entries as unknown entries.
+	 */
+	ctx->entry_types = g_new0 (RhythmDBEntryType *, header->n_types);
+	for (i = 0; i < header->n_types; i++) {
+		const char *typename;
+
+		if (ctx->types[i] == 0 || ctx->types[i] >= header->n_strings)
+			return FALSE;
+
+		typename = ctx->strings + ctx->string_offsets[ctx->types[i]];
+		ctx->entry_types[i] = rhythmdb_entry_type_get_by_name (RHYTHMDB (db), typename);
+		if (ctx->entry_types[i] == NULL) {
+			rb_debug ("snapshot contains entries of unknown type %s", typename);
+			return FALSE;
+		}
+	}
+
+	for (i = 0; i < header->n_entries; i++) {
+		const RhythmDBTreeSnapshotRecord *record = &ctx->records[i];
+		int j;
+
+		if (record->type >= header->n_types ||
+		    record->strings[RHYTHMDB_TREE_SNAPSHOT_LOCATION] == 0 ||
+		    record->keywords_start > header->n_keywords ||
+		    record->keywords_count > header->n_keywords - record->keywords_start)
+			return FALSE;
+
+		for (j = 0; j < RHYTHMDB_TREE_SNAPSHOT_ENTRY_STRINGS; j++) {
+			if (record->strings[j] >= header->n_strings)
+				return FALSE;
+		}
+		for (j = 0; j < RHYTHMDB_TREE_SNAPSHOT_PODCAST_STRINGS; j++) {
+			if (record->podcast_strings[j] >= header->n_strings)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static RhythmDBEntry *
+snapshot_create_entry (RhythmDBTree *db,
+		       struct RhythmDBTreeSnapshotLoadContext *ctx,
+		       const RhythmDBTreeSnapshotRecord *record)
+{
+	RhythmDBEntry *entry;
+	guint32 i;
+
+	entry = rhythmdb_entry_allocate (RHYTHMDB (db), ctx->entry_types[record->type]);
+	entry->flags |= RHYTHMDB_ENTRY_TREE_LOADING;
+
+	for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_ENTRY_STRINGS; i++) {
+		RBRefString **field;
+
+		if (record->strings[i] == 0)
+			continue;
+
+		field = &G_STRUCT_MEMBER (RBRefString *, entry, snapshot_entry_strings[i]);
+		rb_refstring_unref (*field);
+		*field = snapshot_get_string (ctx, record->strings[i]);
+	}
+
+	for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_ENTRY_ULONGS; i++) {
+		G_STRUCT_MEMBER (gulong, entry, snapshot_entry_ulongs[i]) = record->ulongs[i];
+	}
+
+	entry->file_size = record->file_size;
+	entry->play_count = record->play_count;
+	entry->rating = record->rating;
+	entry->bpm = record->bpm;
+	if (record->julian > 0)
+		g_date_set_julian (&entry->date, record->julian);
+	else
+		g_date_clear (&entry->date, 1);
+	if (record->hidden)
+		entry->flags |= RHYTHMDB_ENTRY_HIDDEN;
+
+	if (entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_FEED ||
+	    entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST) {
+		RhythmDBPodcastFields *podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+
+		for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_PODCAST_STRINGS; i++) {
+			RBRefString **field;
+
+			if (record->podcast_strings[i] == 0)
+				continue;
+
+			field = &G_STRUCT_MEMBER (RBRefString *, podcast, snapshot_podcast_strings[i]);
+			rb_refstring_unref (*field);
+			*field = snapshot_get_string (ctx, record->podcast_strings[i]);
+		}
+		podcast->status = record->status;
+		podcast->post_time = record->post_time;
+	}
+
+	for (i = 0; i < record->keywords_count; i++) {
+		RBRefString *keyword;
+
+		keyword = snapshot_get_string (ctx, ctx->keywords[record->keywords_start + i]);
+		rhythmdb_entry_keyword_add (RHYTHMDB (db), entry, keyword);
+		rb_refstring_unref (keyword);
+	}
+
+	return entry;
+}
+
+/* Returns FALSE if the snapshot can't be used, in which case
+ * the database should be loaded from the XML file instead.
+ */
+static gboolean
+rhythmdb_tree_load_snapshot (RhythmDBTree *db,
+			     const char *name,
+			     GCancellable *cancel)
+{
+	struct RhythmDBTreeSnapshotLoadContext ctx = {0,};
+	GMappedFile *mapped;
+	GStatBuf xml_stat;
+	GError *error = NULL;
+	char *path;
+	gboolean ret = FALSE;
+	gint batch_count = 0;
+	guint32 i;
+
+	if (g_stat (name, &xml_stat) != 0)
+		return FALSE;
+
+	path = rhythmdb_tree_snapshot_path (name);
+	mapped = g_mapped_file_new (path, FALSE, &error);
+	if (mapped == NULL) {
+		rb_debug ("unable to map database snapshot %s: %s", path, error->message);
+		g_clear_error (&error);
+		g_free (path);
+		return FALSE;
+	}
+
+	ctx.data = g_mapped_file_get_contents (mapped);
+	ctx.header = (const RhythmDBTreeSnapshotHeader *) ctx.data;
+	if (snapshot_validate (db, &ctx, g_mapped_file_get_length (mapped), &xml_stat) == FALSE) {
+		rb_debug ("not using database snapshot %s", path);
+		goto out;
+	}
+
+	rb_debug ("loading %u entries from database snapshot %s", ctx.header->n_entries, path);
+	ctx.refstrings = g_new0 (RBRefString *, ctx.header->n_strings);
+	for (i = 0; i < ctx.header->n_entries; i++) {
+		RhythmDBEntry *entry;
+
+		if ((i % RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) == 0 &&
+		    g_cancellable_is_cancelled (cancel))
+			break;
+
+		entry = snapshot_create_entry (db, &ctx, &ctx.records[i]);
+		entry = rhythmdb_tree_journal_apply (db, entry);
+		if (entry == NULL)
+			continue;
+
+		g_mutex_lock (&db->priv->entries_lock);
+		if (g_hash_table_lookup (db->priv->entries, entry->location) == NULL) {
+			rhythmdb_tree_entry_new_internal (RHYTHMDB (db), entry);
+			rhythmdb_entry_insert (RHYTHMDB (db), entry);
+			if (++batch_count == RHYTHMDB_QUERY_MODEL_SUGGESTED_UPDATE_CHUNK) {
+				rhythmdb_commit (RHYTHMDB (db));
+				batch_count = 0;
+			}
+		} else {
+			rb_debug ("found entry with duplicate location %s in snapshot",
+				  rb_refstring_get (entry->location));
+			rhythmdb_entry_unref (entry);
+		}
+		g_mutex_unlock (&db->priv->entries_lock);
+	}
+
+	if (batch_count)
+		rhythmdb_commit (RHYTHMDB (db));
+
+	for (i = 0; i < ctx.header->n_strings; i++) {
+		rb_refstring_unref (ctx.refstrings[i]);
+	}
+	g_free (ctx.refstrings);
+	ret = TRUE;
+out:
+	g_free (ctx.entry_types);
+	g_mapped_file_unref (mapped);
+	g_free (path);
+	return ret;
+}
+
+/*
+ * Parallel XML loading.
+ *
+ * The body of the XML file is split into chunks at <entry> element
+ * boundaries, and each chunk is parsed on its own thread, wrapped in the
+ * document's own <rhythmdb> element so version upgrades still apply.
+ * Workers only build entries; they're added to the database in file order
+ * once all chunks have been parsed, so duplicate handling and the genre,
+ * artist and album hierarchy are built the same way as for a serial load.
+ * Since the database writer never splits an element's start tag, and text
+ * content can't contain a literal '<', the chunk boundaries can be found
+ * with a plain string search.
+ */
+
+#define RHYTHMDB_TREE_PARALLEL_LOAD_MIN_SIZE	(512 * 1024)
+
+struct RhythmDBTreeLoadChunk
+{
+	struct RhythmDBTreeLoadContext ctx;
+	const char *preamble;
+	gsize preamble_len;
+	const char *data;
+	gsize len;
+	const char *filename;
+	GError *error;
+};
+
+static const char *
+find_entry_start (const char *p, const char *end)
+{
+	static const char entry_tag[] = "<entry ";
+
+	while ((p = memchr (p, '<', end - p)) != NULL) {
+		if (end - p >= (gssize) (sizeof (entry_tag) - 1) &&
+		    memcmp (p, entry_tag, sizeof (entry_tag) - 1) == 0)
+			return p;
+		p++;
+	}
+	return end;
+}
+
+static const char *
+find_last (const char *data, const char *end, const char *str)
+{
+	gsize len = strlen (str);
+	const char *p;
+
+	if (end - data < (gssize) len)
+		return NULL;
+
+	for (p = end - len; p >= data; p--) {
+		if (memcmp (p, str, len) == 0)
+			return p;
+	}
+	return NULL;
+}
+
+static gpointer
+load_chunk_thread (struct RhythmDBTreeLoadChunk *chunk)
+{
+	static const char xml_end[] = "</rhythmdb>\n";
+	xmlSAXHandler sax_handler = {0,};
+	xmlParserCtxtPtr ctxt;
+
+	sax_handler.startElement = (startElementSAXFunc) rhythmdb_tree_parser_start_element;
+	sax_handler.endElement = (endElementSAXFunc) rhythmdb_tree_parser_end_element;
+	sax_handler.characters = (charactersSAXFunc) rhythmdb_tree_parser_characters;
+
+	ctxt = xmlCreatePushParserCtxt (&sax_handler, &chunk->ctx, NULL, 0, chunk->filename);
+	chunk->ctx.xmlctx = ctxt;
+	xmlParseChunk (ctxt, chunk->preamble, chunk->preamble_len, 0);
+	xmlParseChunk (ctxt, chunk->data, chunk->len, 0);
+	xmlParseChunk (ctxt, xml_end, sizeof (xml_end) - 1, 1);
+	ctxt->sax = NULL;
+	xmlFreeParserCtxt (ctxt);
+
+	/* drop any incomplete entry at the end of the file */
+	if (chunk->ctx.entry != NULL) {
+		discard_loaded_entry (chunk->ctx.db, chunk->ctx.entry);
+		chunk->ctx.entry = NULL;
+	}
+	if (chunk->ctx.unknown_entry != NULL) {
+		free_unknown_entries (NULL, g_list_prepend (NULL, chunk->ctx.unknown_entry), NULL);
+		chunk->ctx.unknown_entry = NULL;
+	}
+
+	return NULL;
+}
+
+static gboolean
+rhythmdb_tree_load_parallel (RhythmDBTree *db,
+			     const char *name,
+			     struct RhythmDBTreeLoadContext *ctx)
+{
+	struct RhythmDBTreeLoadChunk *chunks;
+	GThread **threads;
+	GMappedFile *mapped;
+	GError *error = NULL;
+	const char *data;
+	const char *end;
+	const char *body;
+	const char *body_end;
+	const char *p;
+	guint n_threads;
+	guint n_chunks;
+	guint i, j;
+	gsize len;
+
+	n_threads = db->priv->load_threads;
+	if (n_threads == 0)
+		n_threads = g_get_num_processors ();
+	if (n_threads < 2)
+		return FALSE;
+
+	mapped = g_mapped_file_new (name, FALSE, &error);
+	if (mapped == NULL) {
+		rb_debug ("unable to map database %s: %s", name, error->message);
+		g_clear_error (&error);
+		return FALSE;
+	}
+
+	data = g_mapped_file_get_contents (mapped);
+	len = g_mapped_file_get_length (mapped);
+	end = data + len;
+	if (len < RHYTHMDB_TREE_PARALLEL_LOAD_MIN_SIZE) {
+		g_mapped_file_unref (mapped);
+		return FALSE;
+	}
+
+	/* the preamble is everything up to the end of the <rhythmdb> start tag */
+	p = g_strstr_len (data, MIN (len, 4096), "<rhythmdb");
+	if (p != NULL)
+		p = memchr (p, '>', end - p);
+	if (p == NULL) {
+		rb_debug ("couldn't find the start of the database, loading it serially");
+		g_mapped_file_unref (mapped);
+		return FALSE;
+	}
+	body = p + 1;
+	body_end = find_last (body, end, "</rhythmdb>");
+	if (body_end == NULL)
+		body_end = end;
+
+	rb_debug ("loading %s using %u threads", name, n_threads);
+	chunks = g_new0 (struct RhythmDBTreeLoadChunk, n_threads);
+	threads = g_new0 (GThread *, n_threads);
+	n_chunks = 0;
+	p = body;
+	for (i = 0; i < n_threads && p < body_end; i++) {
+		struct RhythmDBTreeLoadChunk *chunk = &chunks[n_chunks];
+		const char *chunk_end;
+
+		if (i == n_threads - 1) {
+			chunk_end = body_end;
+		} else {
+			chunk_end = find_entry_start (body + ((body_end - body) / n_threads) * (i + 1), body_end);
+			if (chunk_end < p)
+				chunk_end = p;
+		}
+		if (chunk_end == p)
+			continue;
+
+		chunk->preamble = data;
+		chunk->preamble_len = body - data;
+		chunk->data = p;
+		chunk->len = chunk_end - p;
+		chunk->filename = name;
+		chunk->ctx.state = RHYTHMDB_TREE_PARSER_STATE_START;
+		chunk->ctx.db = db;
+		chunk->ctx.cancel = ctx->cancel;
+		chunk->ctx.buf = g_string_sized_new (RHYTHMDB_TREE_PARSER_INITIAL_BUFFER_SIZE);
+		chunk->ctx.error = &chunk->error;
+		chunk->ctx.loaded_entries = g_ptr_array_new ();
+
+		threads[n_chunks] = g_thread_new ("rhythmdb-load", (GThreadFunc) load_chunk_thread, chunk);
+		n_chunks++;
+		p = chunk_end;
+	}
+
+	for (i = 0; i < n_chunks; i++) {
+		g_thread_join (threads[i]);
+		if (chunks[i].error != NULL && *ctx->error == NULL) {
+			g_propagate_error (ctx->error, chunks[i].error);
+			chunks[i].error = NULL;
+		}
+		g_clear_error (&chunks[i].error);
+	}
+
+	/* add the entries in the order they appear in the file */
+	for (i = 0; i < n_chunks; i++) {
+		GPtrArray *entries = chunks[i].ctx.loaded_entries;
+
+		for (j = 0; j < entries->len; j++) {
+			if (*ctx->error != NULL || g_cancellable_is_cancelled (ctx->cancel)) {
+				discard_loaded_entry (db, g_ptr_array_index (entries, j));
+			} else {
+				ctx->entry = g_ptr_array_index (entries, j);
+				rhythmdb_tree_parser_add_entry (ctx);
+			}
+		}
+
+		g_ptr_array_free (entries, TRUE);
+		g_string_free (chunks[i].ctx.buf, TRUE);
+	}
+
+	if (ctx->batch_count)
+		rhythmdb_commit (RHYTHMDB (db));
+
+	g_free (threads);
+	g_free (chunks);
+	g_mapped_file_unref (mapped);
+	return TRUE;
+}
+
+static void
+rhythmdb_tree_load_journal (RhythmDBTree *db,
+			    const char *name,
+			    xmlSAXHandlerPtr sax_handler,
+			    struct RhythmDBTreeLoadContext *ctx)
+{
+	static const char xml_start[] = "<?xml version=\"1.0\" standalone=\"yes\"?>\n"
+		"<rhythmdb version=\"" RHYTHMDB_TREE_XML_VERSION "\">\n";
+	static const char xml_end[] = "</rhythmdb>\n";
+	xmlParserCtxtPtr ctxt;
+	GStatBuf xml_stat;
+	GError *error = NULL;
+	char *path;
+	char *contents;
+	char *header;
+	gsize length;
+	gsize header_len;
+
+	if (g_stat (name, &xml_stat) != 0)
+		return;
+
+	path = rhythmdb_tree_journal_path (name);
+	if (g_file_get_contents (path, &contents, &length, &error) == FALSE) {
+		if (g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT) == FALSE)
+			rb_debug ("unable to read database journal %s: %s", path, error->message);
+		g_clear_error (&error);
+		g_free (path);
+		return;
+	}
+
+	header = rhythmdb_tree_journal_header (&xml_stat);
+	header_len = strlen (header);
+	if (length < header_len || memcmp (contents, header, header_len) != 0) {
+		rb_debug ("database journal %s doesn't match the database, ignoring it", path);
+		goto out;
+	}
+
+	rb_debug ("replaying database journal %s", path);
+	db->priv->journal_records = g_hash_table_new_full (rb_refstring_hash,
+							   rb_refstring_equal,
+							   (GDestroyNotify) rb_refstring_unref,
+							   NULL);
+
+	ctx->journal = TRUE;
+	ctx->state = RHYTHMDB_TREE_PARSER_STATE_START;
+	ctxt = xmlCreatePushParserCtxt (sax_handler, ctx, NULL, 0, path);
+	ctx->xmlctx = ctxt;
+	xmlParseChunk (ctxt, xml_start, sizeof (xml_start) - 1, 0);
+	xmlParseChunk (ctxt, contents + header_len, length - header_len, 0);
+	xmlParseChunk (ctxt, xml_end, sizeof (xml_end) - 1, 1);
+	ctxt->sax = NULL;
+	xmlFreeParserCtxt (ctxt);
+
+	/* a partial record at the end of the journal is ignored */
+	if (ctx->entry != NULL) {
+		discard_loaded_entry (db, ctx->entry);
+		ctx->entry = NULL;
+	}
+	if (ctx->journal_changes != NULL) {
+		free_journal_changes (ctx->journal_changes);
+		ctx->journal_changes = NULL;
+	}
+	if (ctx->unknown_entry != NULL) {
+		free_unknown_entry (ctx->unknown_entry);
+		ctx->unknown_entry = NULL;
+	}
+	if (ctx->journal_location != NULL) {
+		rb_refstring_unref (ctx->journal_location);
+		ctx->journal_location = NULL;
+	}
+
+	ctx->xmlctx = NULL;
+	ctx->journal = FALSE;
+	ctx->journal_update = FALSE;
+	ctx->in_unknown_elt = 0;
+	ctx->state = RHYTHMDB_TREE_PARSER_STATE_START;
+out:
+	g_free (header);
+	g_free (contents);
+	g_free (path);
+}
+
+static gboolean
 rhythmdb_tree_load (RhythmDB *rdb,
 		    GCancellable *cancel,
 		    GError **error)
@@ -779,7 +2064,13 @@ rhythmdb_tree_load (RhythmDB *rdb,
 
 	g_object_get (G_OBJECT (db), "name", &name, NULL);
 
-	if (g_file_test (name, G_FILE_TEST_EXISTS)) {
+	rhythmdb_tree_load_journal (db, name, sax_handler, ctx);
+
+	if (db->priv->use_snapshot && rhythmdb_tree_load_snapshot (db, name, cancel)) {
+		rb_debug ("loaded database from snapshot");
+	} else if (rhythmdb_tree_load_parallel (db, name, ctx)) {
+		rb_debug ("loaded database using multiple threads");
+	} else if (g_file_test (name, G_FILE_TEST_EXISTS)) {
 		ctxt = xmlCreateFileParserCtxt (name);
 		ctx->xmlctx = ctxt;
 		xmlFree (ctxt->sax);
@@ -793,6 +2084,8 @@ rhythmdb_tree_load (RhythmDB *rdb,
 			rhythmdb_commit (RHYTHMDB (ctx->db));
 	}
 
+	rhythmdb_tree_journal_finish (db);
+
 	ret = TRUE;
 	if (local_error != NULL) {
 		g_propagate_error (error, local_error);
@@ -807,11 +2100,30 @@ rhythmdb_tree_load (RhythmDB *rdb,
 	return ret;
 }
 
+struct RhythmDBTreeSnapshotWriter
+{
+	FILE *handle;
+	char *error;
+	guint64 offset;
+
+	guint32 n_entries;
+	GHashTable *string_ids;		/* RBRefString -> index */
+	GArray *string_offsets;
+	GByteArray *strings;
+	GHashTable *type_ids;		/* RhythmDBEntryType -> index */
+	GArray *types;
+	GArray *keywords;
+};
+
 struct RhythmDBTreeSaveContext
 {
 	RhythmDBTree *db;
 	FILE *handle;
 	char *error;
+	struct RhythmDBTreeSnapshotWriter *snapshot;
+
+	/* write properties even if they're empty, for journal updates */
+	gboolean write_empty;
 };
 
 #ifdef HAVE_GNU_FWRITE_UNLOCKED
@@ -878,7 +2190,7 @@ save_entry_string_if_set (struct RhythmDBTreeSaveContext *ctx,
 			  const xmlChar *elt_name,
 			  const char *str)
 {
-	if (str == NULL || str[0] == '\0')
+	if (str == NULL || (str[0] == '\0' && !ctx->write_empty))
 		return;
 	save_entry_string (ctx, elt_name, str);
 }
@@ -889,7 +2201,7 @@ save_entry_int (struct RhythmDBTreeSaveContext *ctx,
 		int num)
 {
 	char buf[92];
-	if (num == 0)
+	if (num == 0 && !ctx->write_empty)
 		return;
 	write_elt_name_open (ctx, elt_name);
 	g_snprintf (buf, sizeof (buf), "%d", num);
@@ -905,7 +2217,7 @@ save_entry_ulong (struct RhythmDBTreeSaveContext *ctx,
 {
 	char buf[92];
 
-	if (num == 0 && !save_zeroes)
+	if (num == 0 && !save_zeroes && !ctx->write_empty)
 		return;
 	write_elt_name_open (ctx, elt_name);
 	g_snprintf (buf, sizeof (buf), "%lu", num);
@@ -928,7 +2240,7 @@ save_entry_uint64 (struct RhythmDBTreeSaveContext *ctx,
 {
 	char buf[92];
 
-	if (num == 0)
+	if (num == 0 && !ctx->write_empty)
 		return;
 
 	write_elt_name_open (ctx, elt_name);
@@ -944,7 +2256,7 @@ save_entry_double (struct RhythmDBTreeSaveContext *ctx,
 {
 	char buf[G_ASCII_DTOSTR_BUF_SIZE+1];
 
-	if (num > -0.001 && num < 0.001)
+	if (num > -0.001 && num < 0.001 && !ctx->write_empty)
 		return;
 
 	write_elt_name_open (ctx, elt_name);
@@ -953,241 +2265,521 @@ save_entry_double (struct RhythmDBTreeSaveContext *ctx,
 	write_elt_name_close (ctx, elt_name);
 }
 
-/* This code is intended to be highly optimized.  This came at a small
- * readability cost.  Sorry about that.
- */
+static struct RhythmDBTreeSnapshotWriter *
+snapshot_writer_new (const char *path)
+{
+	struct RhythmDBTreeSnapshotWriter *writer;
+	RhythmDBTreeSnapshotHeader header;
+	guint32 offset = 0;
+	FILE *f;
+
+	f = fopen (path, "w");
+	if (f == NULL) {
+		g_warning ("Can't save database snapshot: %s", g_strerror (errno));
+		return NULL;
+	}
+
+	writer = g_new0 (struct RhythmDBTreeSnapshotWriter, 1);
+	writer->handle = f;
+	writer->string_ids = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						    (GDestroyNotify) rb_refstring_unref, NULL);
+	writer->string_offsets = g_array_new (FALSE, FALSE, sizeof (guint32));
+	writer->strings = g_byte_array_new ();
+	writer->type_ids = g_hash_table_new (g_direct_hash, g_direct_equal);
+	writer->types = g_array_new (FALSE, FALSE, sizeof (guint32));
+	writer->keywords = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+	/* string 0 stands for NULL */
+	g_array_append_val (writer->string_offsets, offset);
+	g_byte_array_append (writer->strings, (const guint8 *) "", 1);
+
+	/* the header is filled in once everything else has been written */
+	memset (&header, 0, sizeof (header));
+	RHYTHMDB_FWRITE (&header, sizeof (header), 1, writer->handle, writer->error);
+	writer->offset = sizeof (header);
+
+	return writer;
+}
+
 static void
-save_entry (RhythmDBTree *db,
-	    RhythmDBEntry *entry,
-	    struct RhythmDBTreeSaveContext *ctx)
+snapshot_writer_free (struct RhythmDBTreeSnapshotWriter *writer)
 {
-	RhythmDBPropType i;
-	RhythmDBPodcastFields *podcast = NULL;
-	xmlChar *encoded;
-	GList *keywords, *l;
+	g_hash_table_destroy (writer->string_ids);
+	g_array_free (writer->string_offsets, TRUE);
+	g_byte_array_free (writer->strings, TRUE);
+	g_hash_table_destroy (writer->type_ids);
+	g_array_free (writer->types, TRUE);
+	g_array_free (writer->keywords, TRUE);
+	g_free (writer->error);
+	g_free (writer);
+}
 
-	if (ctx->error)
-		return;
+static void
+snapshot_writer_abort (struct RhythmDBTreeSnapshotWriter *writer, const char *path)
+{
+	fclose (writer->handle);
+	unlink (path);
+	snapshot_writer_free (writer);
+}
 
-	if (entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_FEED ||
-	    entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST)
-		podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+static guint32
+snapshot_string_id (struct RhythmDBTreeSnapshotWriter *writer, RBRefString *str)
+{
+	guint32 id;
 
-	RHYTHMDB_FWRITE_STATICSTR ("  <entry type=\"", ctx->handle, ctx->error);
-	encoded	= xmlEncodeEntitiesReentrant (NULL, BAD_CAST rhythmdb_entry_type_get_name (entry->type));
-	RHYTHMDB_FWRITE (encoded, 1, xmlStrlen (encoded), ctx->handle, ctx->error);
-	g_free (encoded);
+	if (str == NULL)
+		return 0;
 
-	RHYTHMDB_FWRITE_STATICSTR ("\">\n", ctx->handle, ctx->error);
+	id = GPOINTER_TO_UINT (g_hash_table_lookup (writer->string_ids, str));
+	if (id == 0) {
+		const char *value = rb_refstring_get (str);
+		guint32 offset = writer->strings->len;
 
-	/* Skip over the first property - the type */
-	for (i = 1; i < RHYTHMDB_NUM_PROPERTIES; i++) {
-		const xmlChar *elt_name;
+		id = writer->string_offsets->len;
+		g_array_append_val (writer->string_offsets, offset);
+		g_byte_array_append (writer->strings, (const guint8 *) value, strlen (value) + 1);
+		g_hash_table_insert (writer->string_ids, rb_refstring_ref (str), GUINT_TO_POINTER (id));
+	}
 
-		if (ctx->error)
-			return;
+	return id;
+}
 
-		elt_name = rhythmdb_nice_elt_name_from_propid ((RhythmDB *) ctx->db, i);
+static guint32
+snapshot_type_id (struct RhythmDBTreeSnapshotWriter *writer, RhythmDBEntryType *type)
+{
+	guint32 id;
 
-		switch (i) {
-		case RHYTHMDB_PROP_TYPE:
-			break;
-		case RHYTHMDB_PROP_ENTRY_ID:
-			break;
-		case RHYTHMDB_PROP_TITLE:
-			save_entry_string(ctx, elt_name, rb_refstring_get (entry->title));
-			break;
-		case RHYTHMDB_PROP_ALBUM:
-			save_entry_string(ctx, elt_name, rb_refstring_get (entry->album));
-			break;
-		case RHYTHMDB_PROP_ARTIST:
-			save_entry_string(ctx, elt_name, rb_refstring_get (entry->artist));
-			break;
-		case RHYTHMDB_PROP_COMPOSER:
-			save_entry_string_if_set(ctx, elt_name, rb_refstring_get (entry->composer));
-			break;
-		case RHYTHMDB_PROP_ALBUM_ARTIST:
-			save_entry_string_if_set(ctx, elt_name, rb_refstring_get (entry->album_artist));
-			break;
-		case RHYTHMDB_PROP_GENRE:
-			save_entry_string(ctx, elt_name, rb_refstring_get (entry->genre));
-			break;
-		case RHYTHMDB_PROP_COMMENT:
-			save_entry_string_if_set(ctx, elt_name, rb_refstring_get (entry->comment));
-			break;
-		case RHYTHMDB_PROP_MUSICBRAINZ_TRACKID:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_trackid));
-			break;
-		case RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_artistid));
-			break;
-		case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMID:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_albumid));
-			break;
-		case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_albumartistid));
-			break;
-		case RHYTHMDB_PROP_ARTIST_SORTNAME:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->artist_sortname));
-			break;
-		case RHYTHMDB_PROP_COMPOSER_SORTNAME:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->composer_sortname));
-			break;
-		case RHYTHMDB_PROP_ALBUM_SORTNAME:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->album_sortname));
-			break;
-		case RHYTHMDB_PROP_ALBUM_ARTIST_SORTNAME:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->album_artist_sortname));
-			break;
-		case RHYTHMDB_PROP_TRACK_NUMBER:
-			save_entry_ulong (ctx, elt_name, entry->tracknum, FALSE);
-			break;
-		case RHYTHMDB_PROP_TRACK_TOTAL:
-			save_entry_ulong (ctx, elt_name, entry->tracktotal, FALSE);
-			break;
-		case RHYTHMDB_PROP_DISC_NUMBER:
-			save_entry_ulong (ctx, elt_name, entry->discnum, FALSE);
-			break;
-		case RHYTHMDB_PROP_DISC_TOTAL:
-			save_entry_ulong (ctx, elt_name, entry->disctotal, FALSE);
-			break;
-		case RHYTHMDB_PROP_DATE:
-			if (g_date_valid (&entry->date))
-				save_entry_ulong (ctx, elt_name, g_date_get_julian (&entry->date), TRUE);
-			else
-				save_entry_ulong (ctx, elt_name, 0, TRUE);
-			break;
-		case RHYTHMDB_PROP_DURATION:
-			save_entry_ulong (ctx, elt_name, entry->duration, FALSE);
-			break;
-		case RHYTHMDB_PROP_BITRATE:
-			save_entry_int(ctx, elt_name, entry->bitrate);
-			break;
-		case RHYTHMDB_PROP_LOCATION:
-			save_entry_string(ctx, elt_name, rb_refstring_get (entry->location));
-			break;
-		case RHYTHMDB_PROP_BPM:
-			save_entry_double(ctx, elt_name, entry->bpm);
-			break;
-		case RHYTHMDB_PROP_MOUNTPOINT:
-			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->mountpoint));
-			break;
-		case RHYTHMDB_PROP_FILE_SIZE:
-			save_entry_uint64(ctx, elt_name, entry->file_size);
-			break;
-		case RHYTHMDB_PROP_MEDIA_TYPE:
-			save_entry_string(ctx, elt_name, rb_refstring_get (entry->media_type));
-			break;
-		case RHYTHMDB_PROP_MTIME:
-			save_entry_ulong (ctx, elt_name, entry->mtime, FALSE);
-			break;
-		case RHYTHMDB_PROP_FIRST_SEEN:
-			save_entry_ulong (ctx, elt_name, entry->first_seen, FALSE);
-			break;
-		case RHYTHMDB_PROP_LAST_SEEN:
-			save_entry_ulong (ctx, elt_name, entry->last_seen, FALSE);
-			break;
-		case RHYTHMDB_PROP_RATING:
-			save_entry_double(ctx, elt_name, entry->rating);
-			break;
-		case RHYTHMDB_PROP_PLAY_COUNT:
-			save_entry_ulong (ctx, elt_name, entry->play_count, FALSE);
-			break;
-		case RHYTHMDB_PROP_LAST_PLAYED:
-			save_entry_ulong (ctx, elt_name, entry->last_played, FALSE);
-			break;
-		case RHYTHMDB_PROP_HIDDEN:
-			{
-				gboolean hidden = ((entry->flags & RHYTHMDB_ENTRY_HIDDEN) != 0);
-				save_entry_boolean (ctx, elt_name, hidden);
-			}
-			break;
-		case RHYTHMDB_PROP_STATUS:
-			if (podcast)
-				save_entry_ulong (ctx, elt_name, podcast->status, FALSE);
-			break;
-		case RHYTHMDB_PROP_DESCRIPTION:
-			if (podcast && podcast->description)
-				save_entry_string(ctx, elt_name, rb_refstring_get (podcast->description));
-			break;
-		case RHYTHMDB_PROP_SUBTITLE:
-			if (podcast && podcast->subtitle)
-				save_entry_string(ctx, elt_name, rb_refstring_get (podcast->subtitle));
-			break;
-		case RHYTHMDB_PROP_SUMMARY:
-			if (podcast && podcast->summary)
-				save_entry_string(ctx, elt_name, rb_refstring_get (podcast->summary));
-			break;
-		case RHYTHMDB_PROP_LANG:
-			if (podcast && podcast->lang)
-				save_entry_string(ctx, elt_name, rb_refstring_get (podcast->lang));
-			break;
-		case RHYTHMDB_PROP_COPYRIGHT:
-			if (podcast && podcast->copyright)
-				save_entry_string(ctx, elt_name, rb_refstring_get (podcast->copyright));
-			break;
-		case RHYTHMDB_PROP_IMAGE:
-			if (podcast && podcast->image)
-				save_entry_string(ctx, elt_name, rb_refstring_get (podcast->image));
-			break;
-		case RHYTHMDB_PROP_POST_TIME:
-			if (podcast)
-				save_entry_ulong (ctx, elt_name, podcast->post_time, FALSE);
-			break;
-		case RHYTHMDB_PROP_KEYWORD:
-			keywords = rhythmdb_entry_keywords_get (RHYTHMDB (db), entry);
+	/* type ids are stored off by one so 0 can mean 'not found' */
+	id = GPOINTER_TO_UINT (g_hash_table_lookup (writer->type_ids, type));
+	if (id == 0) {
+		RBRefString *name;
+		guint32 name_id;
 
-			for (l = keywords; l != NULL; l = g_list_next (l)) {
-				RBRefString *keyword = (RBRefString*)l->data;
+		name = rb_refstring_new (rhythmdb_entry_type_get_name (type));
+		name_id = snapshot_string_id (writer, name);
+		rb_refstring_unref (name);
 
-				RHYTHMDB_FWRITE_STATICSTR ("    <keyword>", ctx->handle, ctx->error);
-				encoded	= xmlEncodeEntitiesReentrant (NULL, BAD_CAST rb_refstring_get (keyword));
-				RHYTHMDB_FWRITE (encoded, 1, xmlStrlen (encoded), ctx->handle, ctx->error);
-				g_free (encoded);
-				RHYTHMDB_FWRITE_STATICSTR ("</keyword>\n", ctx->handle, ctx->error);
+		g_array_append_val (writer->types, name_id);
+		id = writer->types->len;
+		g_hash_table_insert (writer->type_ids, type, GUINT_TO_POINTER (id));
+	}
 
-				rb_refstring_unref (keyword);
-			}
+	return id - 1;
+}
 
-			g_list_free (keywords);
-			break;
-		case RHYTHMDB_PROP_TITLE_SORT_KEY:
-		case RHYTHMDB_PROP_GENRE_SORT_KEY:
-		case RHYTHMDB_PROP_ARTIST_SORT_KEY:
-		case RHYTHMDB_PROP_COMPOSER_SORT_KEY:
-		case RHYTHMDB_PROP_ALBUM_SORT_KEY:
-		case RHYTHMDB_PROP_ALBUM_ARTIST_SORT_KEY:
-		case RHYTHMDB_PROP_ARTIST_SORTNAME_SORT_KEY:
-		case RHYTHMDB_PROP_COMPOSER_SORTNAME_SORT_KEY:
-		case RHYTHMDB_PROP_ALBUM_SORTNAME_SORT_KEY:
-		case RHYTHMDB_PROP_ALBUM_ARTIST_SORTNAME_SORT_KEY:
-		case RHYTHMDB_PROP_TITLE_FOLDED:
-		case RHYTHMDB_PROP_GENRE_FOLDED:
-		case RHYTHMDB_PROP_ARTIST_FOLDED:
-		case RHYTHMDB_PROP_COMPOSER_FOLDED:
-		case RHYTHMDB_PROP_ALBUM_FOLDED:
-		case RHYTHMDB_PROP_ALBUM_ARTIST_FOLDED:
-		case RHYTHMDB_PROP_ARTIST_SORTNAME_FOLDED:
-		case RHYTHMDB_PROP_COMPOSER_SORTNAME_FOLDED:
-		case RHYTHMDB_PROP_ALBUM_SORTNAME_FOLDED:
-		case RHYTHMDB_PROP_ALBUM_ARTIST_SORTNAME_FOLDED:
-		case RHYTHMDB_PROP_LAST_PLAYED_STR:
-		case RHYTHMDB_PROP_PLAYBACK_ERROR:
-		case RHYTHMDB_PROP_FIRST_SEEN_STR:
-		case RHYTHMDB_PROP_LAST_SEEN_STR:
-		case RHYTHMDB_PROP_SEARCH_MATCH:
-		case RHYTHMDB_PROP_YEAR:
-		case RHYTHMDB_NUM_PROPERTIES:
-		/* obsolete replaygain properties */
-		case RHYTHMDB_PROP_TRACK_GAIN:
-		case RHYTHMDB_PROP_TRACK_PEAK:
-		case RHYTHMDB_PROP_ALBUM_GAIN:
-		case RHYTHMDB_PROP_ALBUM_PEAK:
-			break;
+static void
+snapshot_write_entry (RhythmDBTree *db,
+		      struct RhythmDBTreeSnapshotWriter *writer,
+		      RhythmDBEntry *entry)
+{
+	RhythmDBTreeSnapshotRecord record;
+	GList *keywords, *l;
+	guint32 i;
+
+	if (writer->error)
+		return;
+
+	memset (&record, 0, sizeof (record));
+	record.type = snapshot_type_id (writer, entry->type);
+
+	for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_ENTRY_STRINGS; i++) {
+		RBRefString *str = G_STRUCT_MEMBER (RBRefString *, entry, snapshot_entry_strings[i]);
+		record.strings[i] = snapshot_string_id (writer, str);
+	}
+	for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_ENTRY_ULONGS; i++) {
+		record.ulongs[i] = G_STRUCT_MEMBER (gulong, entry, snapshot_entry_ulongs[i]);
+	}
+
+	record.file_size = entry->file_size;
+	record.play_count = entry->play_count;
+	record.rating = entry->rating;
+	record.bpm = entry->bpm;
+	record.julian = g_date_valid (&entry->date) ? g_date_get_julian (&entry->date) : 0;
+	record.hidden = ((entry->flags & RHYTHMDB_ENTRY_HIDDEN) != 0);
+
+	if (entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_FEED ||
+	    entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST) {
+		RhythmDBPodcastFields *podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+
+		for (i = 0; i < RHYTHMDB_TREE_SNAPSHOT_PODCAST_STRINGS; i++) {
+			RBRefString *str = G_STRUCT_MEMBER (RBRefString *, podcast, snapshot_podcast_strings[i]);
+			record.podcast_strings[i] = snapshot_string_id (writer, str);
 		}
+		record.status = podcast->status;
+		record.post_time = podcast->post_time;
+	}
+
+	record.keywords_start = writer->keywords->len;
+	keywords = rhythmdb_entry_keywords_get (RHYTHMDB (db), entry);
+	for (l = keywords; l != NULL; l = l->next) {
+		guint32 id;
+
+		id = snapshot_string_id (writer, (RBRefString *) l->data);
+		g_array_append_val (writer->keywords, id);
+		rb_refstring_unref ((RBRefString *) l->data);
+	}
+	g_list_free (keywords);
+	record.keywords_count = writer->keywords->len - record.keywords_start;
+
+	RHYTHMDB_FWRITE (&record, sizeof (record), 1, writer->handle, writer->error);
+	writer->offset += sizeof (record);
+	writer->n_entries++;
+}
+
+static guint64
+snapshot_write_section (struct RhythmDBTreeSnapshotWriter *writer,
+			gconstpointer data,
+			gsize len)
+{
+	static const char padding[8] = {0,};
+	guint64 offset;
+	gsize pad;
+
+	pad = (8 - (writer->offset % 8)) % 8;
+	if (pad > 0) {
+		RHYTHMDB_FWRITE (padding, 1, pad, writer->handle, writer->error);
+		writer->offset += pad;
+	}
+
+	offset = writer->offset;
+	if (len > 0) {
+		RHYTHMDB_FWRITE (data, 1, len, writer->handle, writer->error);
+		writer->offset += len;
+	}
+	return offset;
+}
+
+/* writes out the remaining sections and the header, identifying
+ * the XML file that was just written, then moves the snapshot
+ * into place.
+ */
+static void
+snapshot_writer_finish (struct RhythmDBTreeSnapshotWriter *writer,
+			const char *tmp_path,
+			const char *path,
+			const char *xml_path)
+{
+	RhythmDBTreeSnapshotHeader header;
+	GStatBuf xml_stat;
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, RHYTHMDB_TREE_SNAPSHOT_MAGIC, sizeof (header.magic));
+	header.byte_order = RHYTHMDB_TREE_SNAPSHOT_BYTE_ORDER;
+	header.version = RHYTHMDB_TREE_SNAPSHOT_VERSION;
+	header.db_version = RHYTHMDB_TREE_XML_VERSION_INT;
+	header.record_size = sizeof (RhythmDBTreeSnapshotRecord);
+
+	header.n_entries = writer->n_entries;
+	header.entries_offset = sizeof (header);
+	header.n_types = writer->types->len;
+	header.types_offset = snapshot_write_section (writer,
+						      writer->types->data,
+						      writer->types->len * sizeof (guint32));
+	header.n_keywords = writer->keywords->len;
+	header.keywords_offset = snapshot_write_section (writer,
+							 writer->keywords->data,
+							 writer->keywords->len * sizeof (guint32));
+	header.n_strings = writer->string_offsets->len;
+	header.string_offsets_offset = snapshot_write_section (writer,
+							       writer->string_offsets->data,
+							       writer->string_offsets->len * sizeof (guint32));
+	header.strings_size = writer->strings->len;
+	header.strings_offset = snapshot_write_section (writer,
+							writer->strings->data,
+							writer->strings->len);
+
+	if (g_stat (xml_path, &xml_stat) != 0) {
+		snapshot_writer_abort (writer, tmp_path);
+		return;
+	}
+	header.xml_size = xml_stat.st_size;
+	header.xml_mtime = xml_stat.st_mtime;
+	header.xml_inode = xml_stat.st_ino;
+
+	if (writer->error == NULL && fseek (writer->handle, 0, SEEK_SET) < 0)
+		writer->error = g_strdup (g_strerror (errno));
+	RHYTHMDB_FWRITE (&header, sizeof (header), 1, writer->handle, writer->error);
+
+	if (fclose (writer->handle) < 0 && writer->error == NULL)
+		writer->error = g_strdup (g_strerror (errno));
+
+	if (writer->error != NULL) {
+		g_warning ("Writing the database snapshot failed: %s", writer->error);
+		unlink (tmp_path);
+	} else if (rename (tmp_path, path) < 0) {
+		g_warning ("Couldn't rename %s to %s: %s",
+			   tmp_path, path,
+			   g_strerror (errno));
+		unlink (tmp_path);
+	} else {
+		rb_debug ("wrote %u entries and %u strings to database snapshot",
+			  header.n_entries, header.n_strings);
+	}
+
+	snapshot_writer_free (writer);
+}
+
+static void
+save_entry_property (RhythmDBTree *db,
+		     RhythmDBEntry *entry,
+		     RhythmDBPodcastFields *podcast,
+		     RhythmDBPropType propid,
+		     struct RhythmDBTreeSaveContext *ctx)
+{
+	const xmlChar *elt_name;
+	xmlChar *encoded;
+	GList *keywords, *l;
+
+	elt_name = rhythmdb_nice_elt_name_from_propid ((RhythmDB *) ctx->db, propid);
+
+	switch (propid) {
+	case RHYTHMDB_PROP_TYPE:
+		break;
+	case RHYTHMDB_PROP_ENTRY_ID:
+		break;
+	case RHYTHMDB_PROP_TITLE:
+		save_entry_string(ctx, elt_name, rb_refstring_get (entry->title));
+		break;
+	case RHYTHMDB_PROP_ALBUM:
+		save_entry_string(ctx, elt_name, rb_refstring_get (entry->album));
+		break;
+	case RHYTHMDB_PROP_ARTIST:
+		save_entry_string(ctx, elt_name, rb_refstring_get (entry->artist));
+		break;
+	case RHYTHMDB_PROP_COMPOSER:
+		save_entry_string_if_set(ctx, elt_name, rb_refstring_get (entry->composer));
+		break;
+	case RHYTHMDB_PROP_ALBUM_ARTIST:
+		save_entry_string_if_set(ctx, elt_name, rb_refstring_get (entry->album_artist));
+		break;
+	case RHYTHMDB_PROP_GENRE:
+		save_entry_string(ctx, elt_name, rb_refstring_get (entry->genre));
+		break;
+	case RHYTHMDB_PROP_COMMENT:
+		save_entry_string_if_set(ctx, elt_name, rb_refstring_get (entry->comment));
+		break;
+	case RHYTHMDB_PROP_MUSICBRAINZ_TRACKID:
+		save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_trackid));
+		break;
+	case RHYTHMDB_PROP_MUSICBRAINZ_ARTISTID:
+		save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_artistid));
+		break;
+	case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMID:
+		save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_albumid));
+		break;
+	case RHYTHMDB_PROP_MUSICBRAINZ_ALBUMARTISTID:
+		save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->musicbrainz_albumartistid));
+		break;
+	case RHYTHMDB_PROP_ARTIST_SORTNAME:
+		save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->artist_sortname));
+		break;
+	case RHYTHMDB_PROP_COMPOSER_SORTNAME:
+		save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->composer_sortname));
+		break;
+	case RHYTHMDB_PROP_ALBUM_SORTNAME:
+		save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->album_sortname));
+		break;
+	case RHYTHMDB_PROP_ALBUM_ARTIST_SORTNAME:
+		save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->album_artist_sortname));
+		break;
+	case RHYTHMDB_PROP_TRACK_NUMBER:
+		save_entry_ulong (ctx, elt_name, entry->tracknum, FALSE);
+		break;
+	case RHYTHMDB_PROP_TRACK_TOTAL:
+		save_entry_ulong (ctx, elt_name, entry->tracktotal, FALSE);
+		break;
+	case RHYTHMDB_PROP_DISC_NUMBER:
+		save_entry_ulong (ctx, elt_name, entry->discnum, FALSE);
+		break;
+	case RHYTHMDB_PROP_DISC_TOTAL:
+		save_entry_ulong (ctx, elt_name, entry->disctotal, FALSE);
+		break;
+	case RHYTHMDB_PROP_DATE:
+		if (g_date_valid (&entry->date))
+			save_entry_ulong (ctx, elt_name, g_date_get_julian (&entry->date), TRUE);
+		else
+			save_entry_ulong (ctx, elt_name, 0, TRUE);
+		break;
+	case RHYTHMDB_PROP_DURATION:
+		save_entry_ulong (ctx, elt_name, entry->duration, FALSE);
+		break;
+	case RHYTHMDB_PROP_BITRATE:
+		save_entry_int(ctx, elt_name, entry->bitrate);
+		break;
+	case RHYTHMDB_PROP_LOCATION:
+		save_entry_string(ctx, elt_name, rb_refstring_get (entry->location));
+		break;
+	case RHYTHMDB_PROP_BPM:
+		save_entry_double(ctx, elt_name, entry->bpm);
+		break;
+	case RHYTHMDB_PROP_MOUNTPOINT:
+		save_entry_string_if_set (ctx, elt_name, rb_refstring_get (entry->mountpoint));
+		break;
+	case RHYTHMDB_PROP_FILE_SIZE:
+		save_entry_uint64(ctx, elt_name, entry->file_size);
+		break;
+	case RHYTHMDB_PROP_MEDIA_TYPE:
+		save_entry_string(ctx, elt_name, rb_refstring_get (entry->media_type));
+		break;
+	case RHYTHMDB_PROP_MTIME:
+		save_entry_ulong (ctx, elt_name, entry->mtime, FALSE);
+		break;
+	case RHYTHMDB_PROP_FIRST_SEEN:
+		save_entry_ulong (ctx, elt_name, entry->first_seen, FALSE);
+		break;
+	case RHYTHMDB_PROP_LAST_SEEN:
+		save_entry_ulong (ctx, elt_name, entry->last_seen, FALSE);
+		break;
+	case RHYTHMDB_PROP_RATING:
+		save_entry_double(ctx, elt_name, entry->rating);
+		break;
+	case RHYTHMDB_PROP_PLAY_COUNT:
+		save_entry_ulong (ctx, elt_name, entry->play_count, FALSE);
+		break;
+	case RHYTHMDB_PROP_LAST_PLAYED:
+		save_entry_ulong (ctx, elt_name, entry->last_played, FALSE);
+		break;
+	case RHYTHMDB_PROP_HIDDEN:
+		{
+			gboolean hidden = ((entry->flags & RHYTHMDB_ENTRY_HIDDEN) != 0);
+			save_entry_boolean (ctx, elt_name, hidden);
+		}
+		break;
+	case RHYTHMDB_PROP_STATUS:
+		if (podcast)
+			save_entry_ulong (ctx, elt_name, podcast->status, FALSE);
+		break;
+	case RHYTHMDB_PROP_DESCRIPTION:
+		if (podcast && podcast->description)
+			save_entry_string(ctx, elt_name, rb_refstring_get (podcast->description));
+		break;
+	case RHYTHMDB_PROP_SUBTITLE:
+		if (podcast && podcast->subtitle)
+			save_entry_string(ctx, elt_name, rb_refstring_get (podcast->subtitle));
+		break;
+	case RHYTHMDB_PROP_SUMMARY:
+		if (podcast && podcast->summary)
+			save_entry_string(ctx, elt_name, rb_refstring_get (podcast->summary));
+		break;
+	case RHYTHMDB_PROP_LANG:
+		if (podcast && podcast->lang)
+			save_entry_string(ctx, elt_name, rb_refstring_get (podcast->lang));
+		break;
+	case RHYTHMDB_PROP_COPYRIGHT:
+		if (podcast && podcast->copyright)
+			save_entry_string(ctx, elt_name, rb_refstring_get (podcast->copyright));
+		break;
+	case RHYTHMDB_PROP_IMAGE:
+		if (podcast && podcast->image)
+			save_entry_string(ctx, elt_name, rb_refstring_get (podcast->image));
+		break;
+	case RHYTHMDB_PROP_POST_TIME:
+		if (podcast)
+			save_entry_ulong (ctx, elt_name, podcast->post_time, FALSE);
+		break;
+	case RHYTHMDB_PROP_FEED_ETAG:
+		if (podcast)
+			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (podcast->etag));
+		break;
+	case RHYTHMDB_PROP_FEED_LAST_MODIFIED:
+		if (podcast)
+			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (podcast->last_modified));
+		break;
+	case RHYTHMDB_PROP_FEED_CHECKSUM:
+		if (podcast)
+			save_entry_string_if_set (ctx, elt_name, rb_refstring_get (podcast->checksum));
+		break;
+	case RHYTHMDB_PROP_KEYWORD:
+		keywords = rhythmdb_entry_keywords_get (RHYTHMDB (db), entry);
+
+		for (l = keywords; l != NULL; l = g_list_next (l)) {
+			RBRefString *keyword = (RBRefString*)l->data;
+
+			RHYTHMDB_FWRITE_STATICSTR ("    <keyword>", ctx->handle, ctx->error);
+			encoded	= xmlEncodeEntitiesReentrant (NULL, BAD_CAST rb_refstring_get (keyword));
+			RHYTHMDB_FWRITE (encoded, 1, xmlStrlen (encoded), ctx->handle, ctx->error);
+			g_free (encoded);
+			RHYTHMDB_FWRITE_STATICSTR ("</keyword>\n", ctx->handle, ctx->error);
+
+			rb_refstring_unref (keyword);
+		}
+
+		g_list_free (keywords);
+		break;
+	case RHYTHMDB_PROP_TITLE_SORT_KEY:
+	case RHYTHMDB_PROP_GENRE_SORT_KEY:
+	case RHYTHMDB_PROP_ARTIST_SORT_KEY:
+	case RHYTHMDB_PROP_COMPOSER_SORT_KEY:
+	case RHYTHMDB_PROP_ALBUM_SORT_KEY:
+	case RHYTHMDB_PROP_ALBUM_ARTIST_SORT_KEY:
+	case RHYTHMDB_PROP_ARTIST_SORTNAME_SORT_KEY:
+	case RHYTHMDB_PROP_COMPOSER_SORTNAME_SORT_KEY:
+	case RHYTHMDB_PROP_ALBUM_SORTNAME_SORT_KEY:
+	case RHYTHMDB_PROP_ALBUM_ARTIST_SORTNAME_SORT_KEY:
+	case RHYTHMDB_PROP_TITLE_FOLDED:
+	case RHYTHMDB_PROP_GENRE_FOLDED:
+	case RHYTHMDB_PROP_ARTIST_FOLDED:
+	case RHYTHMDB_PROP_COMPOSER_FOLDED:
+	case RHYTHMDB_PROP_ALBUM_FOLDED:
+	case RHYTHMDB_PROP_ALBUM_ARTIST_FOLDED:
+	case RHYTHMDB_PROP_ARTIST_SORTNAME_FOLDED:
+	case RHYTHMDB_PROP_COMPOSER_SORTNAME_FOLDED:
+	case RHYTHMDB_PROP_ALBUM_SORTNAME_FOLDED:
+	case RHYTHMDB_PROP_ALBUM_ARTIST_SORTNAME_FOLDED:
+	case RHYTHMDB_PROP_LAST_PLAYED_STR:
+	case RHYTHMDB_PROP_PLAYBACK_ERROR:
+	case RHYTHMDB_PROP_FIRST_SEEN_STR:
+	case RHYTHMDB_PROP_LAST_SEEN_STR:
+	case RHYTHMDB_PROP_SEARCH_MATCH:
+	case RHYTHMDB_PROP_YEAR:
+	case RHYTHMDB_NUM_PROPERTIES:
+	/* obsolete replaygain properties */
+	case RHYTHMDB_PROP_TRACK_GAIN:
+	case RHYTHMDB_PROP_TRACK_PEAK:
+	case RHYTHMDB_PROP_ALBUM_GAIN:
+	case RHYTHMDB_PROP_ALBUM_PEAK:
+		break;
+	}
+}
+
+/* This code is intended to be highly optimized.  This came at a small
+ * readability cost.  Sorry about that.
+ */
+static void
+save_entry (RhythmDBTree *db,
+	    RhythmDBEntry *entry,
+	    struct RhythmDBTreeSaveContext *ctx)
+{
+	RhythmDBPropType i;
+	RhythmDBPodcastFields *podcast = NULL;
+	xmlChar *encoded;
+
+	if (ctx->error)
+		return;
+
+	if (entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_FEED ||
+	    entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST)
+		podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+
+	RHYTHMDB_FWRITE_STATICSTR ("  <entry type=\"", ctx->handle, ctx->error);
+	encoded	= xmlEncodeEntitiesReentrant (NULL, BAD_CAST rhythmdb_entry_type_get_name (entry->type));
+	RHYTHMDB_FWRITE (encoded, 1, xmlStrlen (encoded), ctx->handle, ctx->error);
+	g_free (encoded);
+
+	RHYTHMDB_FWRITE_STATICSTR ("\">\n", ctx->handle, ctx->error);
+
+	/* Skip over the first property - the type */
+	for (i = 1; i < RHYTHMDB_NUM_PROPERTIES; i++) {
+		if (ctx->error)
+			return;
+
+		save_entry_property (db, entry, podcast, i, ctx);
 	}
 
 	RHYTHMDB_FWRITE_STATICSTR ("  </entry>\n", ctx->handle, ctx->error);
+
+	if (ctx->snapshot != NULL)
+		snapshot_write_entry (db, ctx->snapshot, entry);
 }
 
 static void
@@ -1240,97 +2832,613 @@ save_unknown_entry_type (RBRefString *typename,
 	}
 }
 
-static void
+static gboolean
 rhythmdb_tree_save (RhythmDB *rdb)
 {
 	RhythmDBTree *db = RHYTHMDB_TREE (rdb);
 	char *name;
+	char *snapshot_path;
+	char *snapshot_tmp_path;
 	GString *savepath;
 	FILE *f;
 	struct RhythmDBTreeSaveContext ctx;
+	gboolean ret = FALSE;
 
 	g_object_get (G_OBJECT (db), "name", &name, NULL);
 
 	savepath = g_string_new (name);
 	g_string_append (savepath, ".tmp");
 
-	f = fopen (savepath->str, "w");
+	snapshot_path = rhythmdb_tree_snapshot_path (name);
+	snapshot_tmp_path = g_strconcat (snapshot_path, ".tmp", NULL);
+	ctx.snapshot = NULL;
+
+	f = fopen (savepath->str, "w");
+
+	if (!f) {
+		g_warning ("Can't save XML: %s", g_strerror (errno));
+		goto out;
+	}
+
+	ctx.db = db;
+	ctx.handle = f;
+	ctx.error = NULL;
+	ctx.write_empty = FALSE;
+
+	/* the snapshot can't represent entries of unknown types,
+	 * so those are only preserved in the XML file.
+	 */
+	g_mutex_lock (&db->priv->entries_lock);
+	if (g_hash_table_size (db->priv->unknown_entry_types) == 0)
+		ctx.snapshot = snapshot_writer_new (snapshot_tmp_path);
+	g_mutex_unlock (&db->priv->entries_lock);
+
+	if (ctx.snapshot == NULL)
+		unlink (snapshot_path);
+
+	RHYTHMDB_FWRITE_STATICSTR ("<?xml version=\"1.0\" standalone=\"yes\"?>\n"
+				   "<rhythmdb version=\"" RHYTHMDB_TREE_XML_VERSION "\">\n",
+				   ctx.handle, ctx.error);
+
+	rhythmdb_entry_type_foreach (rdb, (GHFunc) save_entry_type, &ctx);
+	g_mutex_lock (&RHYTHMDB_TREE(rdb)->priv->entries_lock);
+	g_hash_table_foreach (db->priv->unknown_entry_types,
+			      (GHFunc) save_unknown_entry_type,
+			      &ctx);
+	g_mutex_unlock (&RHYTHMDB_TREE(rdb)->priv->entries_lock);
+
+	RHYTHMDB_FWRITE_STATICSTR ("</rhythmdb>\n", ctx.handle, ctx.error);
+
+	if (fclose (f) < 0) {
+		g_warning ("Couldn't close %s: %s",
+			   savepath->str,
+			   g_strerror (errno));
+		unlink (savepath->str);
+		goto out;
+	}
+
+	if (ctx.error != NULL) {
+		g_warning ("Writing to the database failed: %s", ctx.error);
+		g_free (ctx.error);
+		unlink (savepath->str);
+	} else {
+		if (rename (savepath->str, name) < 0) {
+			g_warning ("Couldn't rename %s to %s: %s",
+				   name, savepath->str,
+				   g_strerror (errno));
+			unlink (savepath->str);
+		} else {
+			char *journal_path;
+
+			/* everything in the journal is now in the XML file */
+			journal_path = rhythmdb_tree_journal_path (name);
+			unlink (journal_path);
+			g_free (journal_path);
+
+			if (ctx.snapshot != NULL) {
+				snapshot_writer_finish (ctx.snapshot, snapshot_tmp_path, snapshot_path, name);
+				ctx.snapshot = NULL;
+			}
+			ret = TRUE;
+		}
+	}
+
+out:
+	if (ctx.snapshot != NULL)
+		snapshot_writer_abort (ctx.snapshot, snapshot_tmp_path);
+	g_string_free (savepath, TRUE);
+	g_free (snapshot_tmp_path);
+	g_free (snapshot_path);
+	g_free (name);
+	return ret;
+}
+
+static void
+rhythmdb_tree_save_unchecked (RhythmDB *rdb)
+{
+	rhythmdb_tree_save (rdb);
+}
+
+static gboolean
+journal_type_saved (GHashTable *saved_types, RhythmDBEntryType *type)
+{
+	gpointer value;
+
+	if (g_hash_table_lookup_extended (saved_types, type, NULL, &value) == FALSE) {
+		gboolean save_to_disk = FALSE;
+
+		g_object_get (type, "save-to-disk", &save_to_disk, NULL);
+		value = GINT_TO_POINTER (save_to_disk);
+		g_hash_table_insert (saved_types, type, value);
+	}
+	return GPOINTER_TO_INT (value);
+}
+
+static void
+save_journal_update (RhythmDBTree *db,
+		     RhythmDBEntry *entry,
+		     RhythmDBJournalChanges *changes,
+		     struct RhythmDBTreeSaveContext *ctx)
+{
+	RhythmDBPodcastFields *podcast = NULL;
+	RhythmDBPropType i;
+	xmlChar *encoded;
+
+	if (entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_FEED ||
+	    entry->type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST)
+		podcast = RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields);
+
+	RHYTHMDB_FWRITE_STATICSTR ("  <entry type=\"", ctx->handle, ctx->error);
+	encoded	= xmlEncodeEntitiesReentrant (NULL, BAD_CAST rhythmdb_entry_type_get_name (entry->type));
+	RHYTHMDB_FWRITE (encoded, 1, xmlStrlen (encoded), ctx->handle, ctx->error);
+	g_free (encoded);
+	RHYTHMDB_FWRITE_STATICSTR ("\" update=\"true\">\n", ctx->handle, ctx->error);
+
+	/* the location identifies the entry, so it has to come first */
+	save_entry_property (db, entry, podcast, RHYTHMDB_PROP_LOCATION, ctx);
+	for (i = 1; i < RHYTHMDB_NUM_PROPERTIES; i++) {
+		if (ctx->error)
+			return;
+
+		if (i == RHYTHMDB_PROP_LOCATION || i == RHYTHMDB_PROP_KEYWORD)
+			continue;
+		if (RHYTHMDB_JOURNAL_CHANGES_HAS_PROP (changes, i))
+			save_entry_property (db, entry, podcast, i, ctx);
+	}
+
+	RHYTHMDB_FWRITE_STATICSTR ("  </entry>\n", ctx->handle, ctx->error);
+}
+
+static gboolean
+rhythmdb_tree_save_journal (RhythmDB *rdb, GList *deleted, GHashTable *changes)
+{
+	RhythmDBTree *db = RHYTHMDB_TREE (rdb);
+	struct RhythmDBTreeSaveContext ctx;
+	GHashTable *saved_types;
+	GHashTableIter iter;
+	RhythmDBEntry *entry;
+	RhythmDBJournalChanges *entry_changes;
+	GStatBuf xml_stat;
+	GStatBuf journal_stat;
+	gboolean new_journal;
+	char *name;
+	char *path;
+	char *header;
+	GList *l;
+	gboolean ret = FALSE;
+
+	g_object_get (G_OBJECT (db), "name", &name, NULL);
+	path = rhythmdb_tree_journal_path (name);
+	header = NULL;
+
+	if (g_stat (name, &xml_stat) != 0) {
+		rb_debug ("no database to journal changes against");
+		goto out;
+	}
+	header = rhythmdb_tree_journal_header (&xml_stat);
+
+	new_journal = (g_stat (path, &journal_stat) != 0);
+	if (new_journal == FALSE) {
+		char buf[128];
+		FILE *f;
+
+		/* once the journal gets too big, loading it costs more than
+		 * rewriting the XML file saves.
+		 */
+		if (journal_stat.st_size > MAX (RHYTHMDB_TREE_JOURNAL_MIN_COMPACT_SIZE, xml_stat.st_size / 4)) {
+			rb_debug ("database journal is too big, compacting");
+			goto out;
+		}
+
+		f = fopen (path, "r");
+		if (f == NULL || fgets (buf, sizeof (buf), f) == NULL || strcmp (buf, header) != 0) {
+			rb_debug ("database journal doesn't match the database");
+			if (f != NULL)
+				fclose (f);
+			goto out;
+		}
+		fclose (f);
+	}
+
+	ctx.db = db;
+	ctx.error = NULL;
+	ctx.snapshot = NULL;
+	ctx.write_empty = FALSE;
+	ctx.handle = fopen (path, "a");
+	if (ctx.handle == NULL) {
+		g_warning ("Can't open database journal %s: %s", path, g_strerror (errno));
+		goto out;
+	}
+
+	if (new_journal)
+		RHYTHMDB_FWRITE (header, 1, strlen (header), ctx.handle, ctx.error);
+
+	for (l = deleted; l != NULL; l = l->next) {
+		xmlChar *encoded;
+
+		RHYTHMDB_FWRITE_STATICSTR ("  <deleted>", ctx.handle, ctx.error);
+		encoded	= xmlEncodeEntitiesReentrant (NULL, BAD_CAST rb_refstring_get (l->data));
+		RHYTHMDB_FWRITE (encoded, 1, xmlStrlen (encoded), ctx.handle, ctx.error);
+		g_free (encoded);
+		RHYTHMDB_FWRITE_STATICSTR ("</deleted>\n", ctx.handle, ctx.error);
+	}
+
+	saved_types = g_hash_table_new (NULL, NULL);
+	g_hash_table_iter_init (&iter, changes);
+	while (ctx.error == NULL && g_hash_table_iter_next (&iter, (gpointer *) &entry, (gpointer *) &entry_changes)) {
+		if (entry->flags & RHYTHMDB_ENTRY_TREE_REMOVED)
+			continue;
+		if (journal_type_saved (saved_types, entry->type) == FALSE)
+			continue;
+
+		if (entry_changes->full) {
+			ctx.write_empty = FALSE;
+			save_entry (db, entry, &ctx);
+		} else {
+			ctx.write_empty = TRUE;
+			save_journal_update (db, entry, entry_changes, &ctx);
+		}
+	}
+	g_hash_table_destroy (saved_types);
+
+	if (ctx.error == NULL && fflush (ctx.handle) != 0)
+		ctx.error = g_strdup (g_strerror (errno));
+	if (ctx.error == NULL && fsync (fileno (ctx.handle)) != 0)
+		ctx.error = g_strdup (g_strerror (errno));
+	if (fclose (ctx.handle) < 0 && ctx.error == NULL)
+		ctx.error = g_strdup (g_strerror (errno));
+
+	if (ctx.error != NULL) {
+		/* a partial record at the end of the journal is ignored when
+		 * loading, and the full save that follows replaces it.
+		 */
+		g_warning ("Writing to the database journal failed: %s", ctx.error);
+		g_free (ctx.error);
+	} else {
+		ret = TRUE;
+	}
+
+out:
+	g_free (header);
+	g_free (path);
+	g_free (name);
+	return ret;
+}
+
+#undef RHYTHMDB_FWRITE_ENCODED_STR
+#undef RHYTHMDB_FWRITE_STATICSTR
+#undef RHYTHMDB_FPUTC
+#undef RHYTHMDB_FWRITE
+
+RhythmDB *
+rhythmdb_tree_new (const char *name)
+{
+	RhythmDBTree *db = g_object_new (RHYTHMDB_TYPE_TREE, "name", name, NULL);
+
+	g_return_val_if_fail (db->priv != NULL, NULL);
+
+	return RHYTHMDB (db);
+}
+
+/* must be called with the genres_lock held */
+static void
+set_entry_album (RhythmDBTree *db,
+		 RhythmDBEntry *entry,
+		 RhythmDBTreeProperty *artist,
+		 RBRefString *name)
+{
+	struct RhythmDBTreeProperty *prop;
+
+	prop = get_or_create_album (db, artist, name);
+	g_hash_table_insert (prop->children, entry, NULL);
+	entry->data = prop;
+}
+
+/*
+ * Search index.
+ *
+ * To avoid running strstr on every entry for each search word, the tree
+ * keeps an index from each three byte sequence (trigram) to the distinct
+ * folded strings containing it, and from each string to the entries using
+ * it as their title, artist, album, composer or genre.  A search word of at
+ * least three bytes can only match the strings listed under each of its
+ * trigrams, so the least common one gives a small set of candidate entries
+ * to evaluate the whole query against.  Strings shorter than three bytes
+ * once folded contain no trigrams, so they're left out entirely.
+ *
+ * Both the trigram and entry sets are hash tables rather than arrays, so
+ * removing an entry doesn't require a scan of everything sharing its strings.
+ * An entry can use the same string for more than one of its fields (an
+ * album named after the artist, for instance), so each string counts how
+ * many of an entry's fields use it and only drops the entry when the last
+ * of them changes.
+ */
+
+typedef struct {
+	RBRefString *string;
+	GHashTable *entries;	/* GHashTable<RhythmDBEntry, use count> */
+} RhythmDBTreeSearchString;
+
+#define SEARCH_TRIGRAM(s) (GUINT_TO_POINTER (((guint) (guchar) (s)[0] << 16) | \
+					     ((guint) (guchar) (s)[1] << 8) | \
+					     ((guint) (guchar) (s)[2])))
+
+static void
+search_string_free (RhythmDBTreeSearchString *ss)
+{
+	rb_refstring_unref (ss->string);
+	g_hash_table_destroy (ss->entries);
+	g_free (ss);
+}
+
+static gboolean
+search_string_indexable (const char *folded)
+{
+	return (folded[0] != '\0' && folded[1] != '\0' && folded[2] != '\0');
+}
+
+static RBRefString **
+search_index_entry_strings (RhythmDBEntry *entry, RBRefString **strings)
+{
+	strings[0] = entry->title;
+	strings[1] = entry->artist;
+	strings[2] = entry->album;
+	strings[3] = entry->composer;
+	strings[4] = entry->genre;
+	return strings;
+}
+
+/* must be called with the search index lock held */
+static void
+search_index_add (RhythmDBTree *db, RhythmDBEntry *entry, RBRefString *string)
+{
+	RhythmDBTreeSearchString *ss;
+	const char *folded;
+	const char *p;
+	guint count;
+
+	if (string == NULL)
+		return;
+
+	ss = g_hash_table_lookup (db->priv->search_strings, string);
+	if (ss == NULL) {
+		folded = rb_refstring_get_folded (string);
+		if (search_string_indexable (folded) == FALSE)
+			return;
+
+		ss = g_new0 (RhythmDBTreeSearchString, 1);
+		ss->string = rb_refstring_ref (string);
+		ss->entries = g_hash_table_new (g_direct_hash, g_direct_equal);
+		g_hash_table_insert (db->priv->search_strings, string, ss);
+
+		for (p = folded; p[0] != '\0' && p[1] != '\0' && p[2] != '\0'; p++) {
+			GHashTable *strings;
+
+			strings = g_hash_table_lookup (db->priv->search_trigrams, SEARCH_TRIGRAM (p));
+			if (strings == NULL) {
+				strings = g_hash_table_new (g_direct_hash, g_direct_equal);
+				g_hash_table_insert (db->priv->search_trigrams, SEARCH_TRIGRAM (p), strings);
+			}
+			g_hash_table_add (strings, ss);
+		}
+	}
+
+	count = GPOINTER_TO_UINT (g_hash_table_lookup (ss->entries, entry));
+	g_hash_table_insert (ss->entries, entry, GUINT_TO_POINTER (count + 1));
+}
+
+/* must be called with the search index lock held */
+static void
+search_index_remove (RhythmDBTree *db, RhythmDBEntry *entry, RBRefString *string)
+{
+	RhythmDBTreeSearchString *ss;
+	const char *folded;
+	const char *p;
+	guint count;
+
+	if (string == NULL)
+		return;
+
+	ss = g_hash_table_lookup (db->priv->search_strings, string);
+	if (ss == NULL)
+		return;
+
+	count = GPOINTER_TO_UINT (g_hash_table_lookup (ss->entries, entry));
+	if (count > 1) {
+		/* another of the entry's fields still uses this string */
+		g_hash_table_insert (ss->entries, entry, GUINT_TO_POINTER (count - 1));
+		return;
+	}
+
+	g_hash_table_remove (ss->entries, entry);
+	if (g_hash_table_size (ss->entries) > 0)
+		return;
+
+	folded = rb_refstring_get_folded (ss->string);
+	for (p = folded; p[0] != '\0' && p[1] != '\0' && p[2] != '\0'; p++) {
+		GHashTable *strings;
+
+		strings = g_hash_table_lookup (db->priv->search_trigrams, SEARCH_TRIGRAM (p));
+		if (strings == NULL)
+			continue;
+
+		g_hash_table_remove (strings, ss);
+		if (g_hash_table_size (strings) == 0)
+			g_hash_table_remove (db->priv->search_trigrams, SEARCH_TRIGRAM (p));
+	}
+
+	g_hash_table_remove (db->priv->search_strings, string);
+}
+
+static void
+search_index_add_entry (RhythmDBTree *db, RhythmDBEntry *entry)
+{
+	RBRefString *strings[5];
+	int i;
+
+	g_mutex_lock (&db->priv->search_index_lock);
+	if (db->priv->search_strings != NULL) {
+		search_index_entry_strings (entry, strings);
+		for (i = 0; i < G_N_ELEMENTS (strings); i++) {
+			search_index_add (db, entry, strings[i]);
+		}
+	}
+	g_mutex_unlock (&db->priv->search_index_lock);
+}
+
+static void
+search_index_remove_entry (RhythmDBTree *db, RhythmDBEntry *entry)
+{
+	RBRefString *strings[5];
+	int i;
+
+	g_mutex_lock (&db->priv->search_index_lock);
+	if (db->priv->search_strings != NULL) {
+		search_index_entry_strings (entry, strings);
+		for (i = 0; i < G_N_ELEMENTS (strings); i++) {
+			search_index_remove (db, entry, strings[i]);
+		}
+	}
+	g_mutex_unlock (&db->priv->search_index_lock);
+}
+
+static void
+search_index_update_entry (RhythmDBTree *db,
+			   RhythmDBEntry *entry,
+			   RBRefString *old,
+			   const char *value)
+{
+	RBRefString *new;
+
+	g_mutex_lock (&db->priv->search_index_lock);
+	if (db->priv->search_strings != NULL) {
+		new = rb_refstring_new (value);
+		if (new != old) {
+			search_index_remove (db, entry, old);
+			search_index_add (db, entry, new);
+		}
+		rb_refstring_unref (new);
+	}
+	g_mutex_unlock (&db->priv->search_index_lock);
+}
+
+static void
+search_index_add_one (RBRefString *location, RhythmDBEntry *entry, RhythmDBTree *db)
+{
+	RBRefString *strings[5];
+	int i;
+
+	search_index_entry_strings (entry, strings);
+	for (i = 0; i < G_N_ELEMENTS (strings); i++) {
+		search_index_add (db, entry, strings[i]);
+	}
+}
+
+static void
+search_index_set_enabled (RhythmDBTree *db, gboolean enabled)
+{
+	g_mutex_lock (&db->priv->entries_lock);
+	g_mutex_lock (&db->priv->search_index_lock);
+	if (enabled && db->priv->search_strings == NULL) {
+		db->priv->search_strings = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+								  NULL, (GDestroyNotify) search_string_free);
+		db->priv->search_trigrams = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+								   NULL, (GDestroyNotify) g_hash_table_destroy);
+		g_hash_table_foreach (db->priv->entries, (GHFunc) search_index_add_one, db);
+	} else if (!enabled && db->priv->search_strings != NULL) {
+		g_hash_table_destroy (db->priv->search_trigrams);
+		g_hash_table_destroy (db->priv->search_strings);
+		db->priv->search_trigrams = NULL;
+		db->priv->search_strings = NULL;
+	}
+	g_mutex_unlock (&db->priv->search_index_lock);
+	g_mutex_unlock (&db->priv->entries_lock);
+}
+
+/*
+ * The feed index maps podcast feed URLs (stored in the subtitle property of
+ * podcast posts) to the posts in each feed, so finding the posts in a feed
+ * doesn't involve looking at every podcast post in the database.
+ */
 
-	if (!f) {
-		g_warning ("Can't save XML: %s", g_strerror (errno));
-		goto out;
-	}
+static RBRefString *
+feed_index_entry_feed (RhythmDBEntry *entry)
+{
+	if (entry->type != RHYTHMDB_ENTRY_TYPE_PODCAST_POST)
+		return NULL;
 
-	ctx.db = db;
-	ctx.handle = f;
-	ctx.error = NULL;
-	RHYTHMDB_FWRITE_STATICSTR ("<?xml version=\"1.0\" standalone=\"yes\"?>\n"
-				   "<rhythmdb version=\"" RHYTHMDB_TREE_XML_VERSION "\">\n",
-				   ctx.handle, ctx.error);
+	return RHYTHMDB_ENTRY_GET_TYPE_DATA (entry, RhythmDBPodcastFields)->subtitle;
+}
 
-	rhythmdb_entry_type_foreach (rdb, (GHFunc) save_entry_type, &ctx);
-	g_mutex_lock (&RHYTHMDB_TREE(rdb)->priv->entries_lock);
-	g_hash_table_foreach (db->priv->unknown_entry_types,
-			      (GHFunc) save_unknown_entry_type,
-			      &ctx);
-	g_mutex_unlock (&RHYTHMDB_TREE(rdb)->priv->entries_lock);
+/* must be called with the feed index lock held */
+static void
+feed_index_add (RhythmDBTree *db, RhythmDBEntry *entry, RBRefString *feed)
+{
+	GHashTable *posts;
 
-	RHYTHMDB_FWRITE_STATICSTR ("</rhythmdb>\n", ctx.handle, ctx.error);
+	if (feed == NULL)
+		return;
 
-	if (fclose (f) < 0) {
-		g_warning ("Couldn't close %s: %s",
-			   savepath->str,
-			   g_strerror (errno));
-		unlink (savepath->str);
-		goto out;
+	posts = g_hash_table_lookup (db->priv->feed_posts, feed);
+	if (posts == NULL) {
+		posts = g_hash_table_new (g_direct_hash, g_direct_equal);
+		g_hash_table_insert (db->priv->feed_posts, rb_refstring_ref (feed), posts);
 	}
+	g_hash_table_add (posts, entry);
+}
 
-	if (ctx.error != NULL) {
-		g_warning ("Writing to the database failed: %s", ctx.error);
-		g_free (ctx.error);
-		unlink (savepath->str);
-	} else {
-		if (rename (savepath->str, name) < 0) {
-			g_warning ("Couldn't rename %s to %s: %s",
-				   name, savepath->str,
-				   g_strerror (errno));
-			unlink (savepath->str);
-		}
-	}
+/* must be called with the feed index lock held */
+static void
+feed_index_remove (RhythmDBTree *db, RhythmDBEntry *entry, RBRefString *feed)
+{
+	GHashTable *posts;
 
-out:
-	g_string_free (savepath, TRUE);
-	g_free (name);
-	return;
-}
+	if (feed == NULL)
+		return;
 
-#undef RHYTHMDB_FWRITE_ENCODED_STR
-#undef RHYTHMDB_FWRITE_STATICSTR
-#undef RHYTHMDB_FPUTC
-#undef RHYTHMDB_FWRITE
+	posts = g_hash_table_lookup (db->priv->feed_posts, feed);
+	if (posts == NULL)
+		return;
 
-RhythmDB *
-rhythmdb_tree_new (const char *name)
-{
-	RhythmDBTree *db = g_object_new (RHYTHMDB_TYPE_TREE, "name", name, NULL);
+	g_hash_table_remove (posts, entry);
+	if (g_hash_table_size (posts) == 0)
+		g_hash_table_remove (db->priv->feed_posts, feed);
+}
 
-	g_return_val_if_fail (db->priv != NULL, NULL);
+static void
+feed_index_add_entry (RhythmDBTree *db, RhythmDBEntry *entry)
+{
+	g_mutex_lock (&db->priv->feed_index_lock);
+	feed_index_add (db, entry, feed_index_entry_feed (entry));
+	g_mutex_unlock (&db->priv->feed_index_lock);
+}
 
-	return RHYTHMDB (db);
+static void
+feed_index_remove_entry (RhythmDBTree *db, RhythmDBEntry *entry)
+{
+	g_mutex_lock (&db->priv->feed_index_lock);
+	feed_index_remove (db, entry, feed_index_entry_feed (entry));
+	g_mutex_unlock (&db->priv->feed_index_lock);
 }
 
-/* must be called with the genres_lock held */
 static void
-set_entry_album (RhythmDBTree *db,
-		 RhythmDBEntry *entry,
-		 RhythmDBTreeProperty *artist,
-		 RBRefString *name)
+feed_index_update_entry (RhythmDBTree *db, RhythmDBEntry *entry, const char *value)
 {
-	struct RhythmDBTreeProperty *prop;
+	RBRefString *old;
+	RBRefString *new;
 
-	prop = get_or_create_album (db, artist, name);
-	g_hash_table_insert (prop->children, entry, NULL);
-	entry->data = prop;
+	old = feed_index_entry_feed (entry);
+	if (old == NULL)
+		return;
+
+	g_mutex_lock (&db->priv->feed_index_lock);
+	new = rb_refstring_new (value);
+	if (new != old) {
+		feed_index_remove (db, entry, old);
+		feed_index_add (db, entry, new);
+	}
+	rb_refstring_unref (new);
+	g_mutex_unlock (&db->priv->feed_index_lock);
 }
 
 static void
@@ -1383,6 +3491,9 @@ rhythmdb_tree_entry_new_internal (RhythmDB *rdb, RhythmDBEntry *entry)
 	set_entry_album (db, entry, artist, entry->album);
 	g_mutex_unlock (&db->priv->genres_lock);
 
+	search_index_add_entry (db, entry);
+	feed_index_add_entry (db, entry);
+
 	/* this accounts for the initial reference on the entry */
 	g_hash_table_insert (db->priv->entries, entry->location, entry);
 	g_hash_table_insert (db->priv->entry_ids, GINT_TO_POINTER (entry->id), entry);
@@ -1592,11 +3703,22 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 	/* Handle special properties */
 	switch (propid)
 	{
+	case RHYTHMDB_PROP_TITLE:
+		search_index_update_entry (db, entry, entry->title, g_value_get_string (value));
+		break;
+	case RHYTHMDB_PROP_COMPOSER:
+		search_index_update_entry (db, entry, entry->composer, g_value_get_string (value));
+		break;
+	case RHYTHMDB_PROP_SUBTITLE:
+		feed_index_update_entry (db, entry, g_value_get_string (value));
+		break;
 	case RHYTHMDB_PROP_TYPE:
 	{
 		RhythmDBTreeProperty *artist;
 		RhythmDBTreeProperty *genre;
 
+		feed_index_remove_entry (db, entry);
+
 		g_mutex_lock (&db->priv->genres_lock);
 		remove_entry_from_album (db, entry);
 
@@ -1607,6 +3729,7 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 		set_entry_album (db, entry, artist, entry->album);
 		g_mutex_unlock (&db->priv->genres_lock);
 
+		feed_index_add_entry (db, entry);
 		return TRUE;
 	}
 	case RHYTHMDB_PROP_LOCATION:
@@ -1632,6 +3755,7 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 	{
 		const char *albumname = g_value_get_string (value);
 
+		search_index_update_entry (db, entry, entry->album, albumname);
 		if (strcmp (rb_refstring_get (entry->album), albumname)) {
 			RhythmDBTreeProperty *artist;
 			RhythmDBTreeProperty *genre;
@@ -1657,6 +3781,7 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 	{
 		const char *artistname = g_value_get_string (value);
 
+		search_index_update_entry (db, entry, entry->artist, artistname);
 		if (strcmp (rb_refstring_get (entry->artist), artistname)) {
 			RhythmDBTreeProperty *new_artist;
 			RhythmDBTreeProperty *genre;
@@ -1683,6 +3808,7 @@ rhythmdb_tree_entry_set (RhythmDB *adb,
 	{
 		const char *genrename = g_value_get_string (value);
 
+		search_index_update_entry (db, entry, entry->genre, genrename);
 		if (strcmp (rb_refstring_get (entry->genre), genrename)) {
 			RhythmDBTreeProperty *new_genre;
 			RhythmDBTreeProperty *new_artist;
@@ -1722,6 +3848,9 @@ rhythmdb_tree_entry_delete (RhythmDB *adb,
 	remove_entry_from_album (db, entry);
 	g_mutex_unlock (&db->priv->genres_lock);
 
+	search_index_remove_entry (db, entry);
+	feed_index_remove_entry (db, entry);
+
 	/* remove all keywords */
 	g_mutex_lock (&db->priv->keywords_lock);
 	remove_entry_from_keywords (db, entry);
@@ -1760,6 +3889,8 @@ remove_one_song (gpointer key,
 		remove_entry_from_keywords (db, entry);
 		g_mutex_unlock (&db->priv->keywords_lock);
 		remove_entry_from_album (db, entry);
+		search_index_remove_entry (db, entry);
+		feed_index_remove_entry (db, entry);
 		g_hash_table_remove (db->priv->entry_ids, GINT_TO_POINTER (entry->id));
 		entry->flags |= RHYTHMDB_ENTRY_TREE_REMOVED;
 		rhythmdb_entry_unref (entry);
@@ -1802,6 +3933,7 @@ struct RhythmDBTreeTraversalData
 {
 	RhythmDBTree *db;
 	GPtrArray *query;
+	RhythmDBQueryProgram *program;
 	RhythmDBTreeTraversalFunc func;
 	gpointer data;
 	gboolean *cancel;
@@ -1812,247 +3944,11 @@ rhythmdb_tree_evaluate_query (RhythmDB *adb,
 			      GPtrArray *query,
 			      RhythmDBEntry *entry)
 {
-	RhythmDBTree *db = RHYTHMDB_TREE (adb);
-	guint i;
-	guint last_disjunction;
-
-	for (i = 0, last_disjunction = 0; i < query->len; i++) {
-		RhythmDBQueryData *data = g_ptr_array_index (query, i);
-
-		if (data->type == RHYTHMDB_QUERY_DISJUNCTION) {
-			if (evaluate_conjunctive_subquery (db, query, last_disjunction, i, entry))
-				return TRUE;
-
-			last_disjunction = i + 1;
-		}
-	}
-	if (evaluate_conjunctive_subquery (db, query, last_disjunction, query->len, entry))
-		return TRUE;
-	return FALSE;
-}
-
-#define RHYTHMDB_PROPERTY_COMPARE(OP) \
-			switch (rhythmdb_get_property_type (db, data->propid)) { \
-			case G_TYPE_STRING: \
-				if (g_strcmp0 (rhythmdb_entry_get_string (entry, data->propid), \
-					    g_value_get_string (data->val)) OP 0) \
-					return FALSE; \
-				break; \
-			case G_TYPE_ULONG: \
-				if (rhythmdb_entry_get_ulong (entry, data->propid) OP \
-				    g_value_get_ulong (data->val)) \
-					return FALSE; \
-				break; \
-			case G_TYPE_BOOLEAN: \
-				if (rhythmdb_entry_get_boolean (entry, data->propid) OP \
-				    g_value_get_boolean (data->val)) \
-					return FALSE; \
-				break; \
-			case G_TYPE_UINT64: \
-				if (rhythmdb_entry_get_uint64 (entry, data->propid) OP \
-				    g_value_get_uint64 (data->val)) \
-					return FALSE; \
-				break; \
-			case G_TYPE_DOUBLE: \
-				if (rhythmdb_entry_get_double (entry, data->propid) OP \
-				    g_value_get_double (data->val)) \
-					return FALSE; \
-				break; \
-                        case G_TYPE_OBJECT: \
-                                if ((gpointer)rhythmdb_entry_get_object (entry, data->propid) OP \
-                                    g_value_get_object (data->val)) \
-                                        return FALSE; \
-                                break; \
-			default: \
-                                g_warning ("Unexpected type: %s", g_type_name (rhythmdb_get_property_type (db, data->propid))); \
-				g_assert_not_reached (); \
-			}
-
-static gboolean
-search_match_properties (RhythmDB *db,
-			 RhythmDBEntry *entry,
-			 gchar **words)
-{
-	const RhythmDBPropType props[] = {
-		RHYTHMDB_PROP_TITLE_FOLDED,
-		RHYTHMDB_PROP_ALBUM_FOLDED,
-		RHYTHMDB_PROP_ARTIST_FOLDED,
-		RHYTHMDB_PROP_COMPOSER_FOLDED,
-		RHYTHMDB_PROP_GENRE_FOLDED
-	};
-	gboolean islike = TRUE;
-	gchar **current;
-	int i;
-
-	for (current = words; *current != NULL; current++) {
-		gboolean word_found = FALSE;
-
-		for (i = 0; i < G_N_ELEMENTS (props); i++) {
-			const char *entry_string = rhythmdb_entry_get_string (entry, props[i]);
-			if (entry_string && (strstr (entry_string, *current) != NULL)) {
-				/* the word was found, go to the next one */
-				word_found = TRUE;
-				break;
-			}
-		}
-		if (!word_found) {
-			/* the word wasn't in any of the properties*/
-			islike = FALSE;
-			break;
-		}
-	}
-
-	return islike;
-}
-
-static gboolean
-evaluate_conjunctive_subquery (RhythmDBTree *dbtree,
-			       GPtrArray *query,
-			       guint base,
-			       guint max,
-			       RhythmDBEntry *entry)
-
-{
-	RhythmDB *db = (RhythmDB *) dbtree;
-	guint i;
-/* Optimization possibility - we may get here without actually having
- * anything in the query.  It would be faster to instead just merge
- * the child hash table into the query result hash.
- */
-	for (i = base; i < max; i++) {
-		RhythmDBQueryData *data = g_ptr_array_index (query, i);
-
-		switch (data->type) {
-		case RHYTHMDB_QUERY_SUBQUERY:
-		{
-			gboolean matched = FALSE;
-			GList *conjunctions = split_query_by_disjunctions (dbtree, data->subquery);
-			GList *tem;
-
-			if (conjunctions == NULL)
-				matched = TRUE;
-
-			for (tem = conjunctions; tem; tem = tem->next) {
-				GPtrArray *subquery = tem->data;
-				if (!matched && evaluate_conjunctive_subquery (dbtree, subquery,
-									       0, subquery->len,
-									       entry)) {
-					matched = TRUE;
-				}
-				g_ptr_array_free (tem->data, TRUE);
-			}
-			g_list_free (conjunctions);
-			if (!matched)
-				return FALSE;
-		}
-		break;
-		case RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN:
-		case RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN:
-		{
-			gulong relative_time;
-			GTimeVal current_time;
-
-			g_assert (rhythmdb_get_property_type (db, data->propid) == G_TYPE_ULONG);
-
-			relative_time = g_value_get_ulong (data->val);
-			g_get_current_time  (&current_time);
-
-			if (data->type == RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN) {
-				if (!(rhythmdb_entry_get_ulong (entry, data->propid) >= (current_time.tv_sec - relative_time)))
-					return FALSE;
-			} else {
-				if (!(rhythmdb_entry_get_ulong (entry, data->propid) < (current_time.tv_sec - relative_time)))
-					return FALSE;
-			}
-			break;
-		}
-		case RHYTHMDB_QUERY_PROP_PREFIX:
-		case RHYTHMDB_QUERY_PROP_SUFFIX:
-		{
-			const char *value_s;
-			const char *entry_s;
-
-			g_assert (rhythmdb_get_property_type (db, data->propid) == G_TYPE_STRING);
-
-			value_s = g_value_get_string (data->val);
-			entry_s = rhythmdb_entry_get_string (entry, data->propid);
-
-			if (data->type == RHYTHMDB_QUERY_PROP_PREFIX && !g_str_has_prefix (entry_s, value_s))
-				return FALSE;
-			if (data->type == RHYTHMDB_QUERY_PROP_SUFFIX && !g_str_has_suffix (entry_s, value_s))
-				return FALSE;
-
-			break;
-		}
-		case RHYTHMDB_QUERY_PROP_LIKE:
-		case RHYTHMDB_QUERY_PROP_NOT_LIKE:
-		{
-			if (data->propid == RHYTHMDB_PROP_KEYWORD) {
-				const char *str;
-				RBRefString *keyword;
-				gboolean has;
-
-				str = g_value_get_string (data->val);
-				keyword = rb_refstring_find (str);
-				if (keyword != NULL) {
-					has = rhythmdb_tree_entry_keyword_has (db, entry, keyword);
-				} else {
-					has = FALSE;
-				}
-				if ((data->type == RHYTHMDB_QUERY_PROP_LIKE) ^ has)
-					return FALSE;
-				else
-					continue;
-				break;
-			} else if (rhythmdb_get_property_type (db, data->propid) == G_TYPE_STRING) {
-				gboolean islike;
-
-				if (data->propid == RHYTHMDB_PROP_SEARCH_MATCH) {
-					/* this is a special property, that should match several things */
-					islike = search_match_properties (db, entry, g_value_get_boxed (data->val));
-
-				} else {
-					const gchar *value_string = g_value_get_string (data->val);
-					const char *entry_string = rhythmdb_entry_get_string (entry, data->propid);
-
-					/* check in case the property is NULL, the value should never be NULL */
-					if (entry_string == NULL)
-						return FALSE;
-
-					islike = (strstr (entry_string, value_string) != NULL);
-				}
-
-				if ((data->type == RHYTHMDB_QUERY_PROP_LIKE) ^ islike)
-					return FALSE;
-				else
-					continue;
-				break;
-			}
-			/* Fall through */
-		}
-		case RHYTHMDB_QUERY_PROP_EQUALS:
-			RHYTHMDB_PROPERTY_COMPARE (!=)
-			break;
-		case RHYTHMDB_QUERY_PROP_NOT_EQUAL:
-			RHYTHMDB_PROPERTY_COMPARE (==)
-			break;
-		case RHYTHMDB_QUERY_PROP_GREATER:
-			RHYTHMDB_PROPERTY_COMPARE (<)
-			break;
-		case RHYTHMDB_QUERY_PROP_LESS:
-			RHYTHMDB_PROPERTY_COMPARE (>)
-			break;
-		case RHYTHMDB_QUERY_END:
-		case RHYTHMDB_QUERY_DISJUNCTION:
-		case RHYTHMDB_QUERY_PROP_YEAR_EQUALS:
-		case RHYTHMDB_QUERY_PROP_YEAR_NOT_EQUAL:
-		case RHYTHMDB_QUERY_PROP_YEAR_LESS:
-		case RHYTHMDB_QUERY_PROP_YEAR_GREATER:
-			g_assert_not_reached ();
-			break;
-		}
-	}
-	return TRUE;
+	/* callers evaluating a query against many entries keep their own
+	 * compiled program rather than coming through here, so compiling
+	 * one for a single entry would only add allocations.
+	 */
+	return rhythmdb_query_evaluate_uncompiled (adb, query, entry);
 }
 
 static void
@@ -2063,8 +3959,7 @@ do_conjunction (RhythmDBEntry *entry,
 	if (G_UNLIKELY (*data->cancel))
 		return;
 	/* Finally, we actually evaluate the query! */
-	if (evaluate_conjunctive_subquery (data->db, data->query, 0, data->query->len,
-					   entry)) {
+	if (rhythmdb_query_program_run (data->program, entry)) {
 		data->func (data->db, entry, data->data);
 	}
 }
@@ -2076,6 +3971,15 @@ conjunctive_query_songs (const char *name,
 {
 	if (G_UNLIKELY (*data->cancel))
 		return;
+
+	/* the query is trimmed as we descend the tree, so recompile it
+	 * whenever it has changed since it was last compiled.
+	 */
+	if (data->program == NULL || !rhythmdb_query_program_matches (data->program, data->query)) {
+		if (data->program != NULL)
+			rhythmdb_query_program_free (data->program);
+		data->program = rhythmdb_query_program_compile (RHYTHMDB (data->db), data->query);
+	}
 	g_hash_table_foreach (album->children, (GHFunc) do_conjunction, data);
 }
 
@@ -2222,6 +4126,241 @@ conjunctive_query_genre (RhythmDBTree *db,
 	g_hash_table_foreach (genres, (GHFunc) conjunctive_query_artists, data);
 }
 
+/* returns FALSE if the index can't be used for the query */
+static gboolean
+search_index_query (RhythmDBTree *db,
+		    GPtrArray *query,
+		    RhythmDBTreeTraversalFunc func,
+		    gpointer data,
+		    gboolean *cancel)
+{
+	GHashTable *best_strings = NULL;
+	const char *best_word = NULL;
+	RhythmDBQueryProgram *program;
+	GHashTable *candidates;
+	GHashTableIter iter;
+	GPtrArray *matches;
+	gpointer string;
+	gpointer entry;
+	guint i;
+
+	g_mutex_lock (&db->priv->search_index_lock);
+	if (db->priv->search_strings == NULL) {
+		g_mutex_unlock (&db->priv->search_index_lock);
+		return FALSE;
+	}
+
+	/* find the least common trigram in any of the search words */
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *qdata = g_ptr_array_index (query, i);
+		char **words;
+		int w;
+
+		if (qdata->type != RHYTHMDB_QUERY_PROP_LIKE ||
+		    qdata->propid != RHYTHMDB_PROP_SEARCH_MATCH)
+			continue;
+
+		words = g_value_get_boxed (qdata->val);
+		for (w = 0; words[w] != NULL; w++) {
+			const char *p;
+
+			for (p = words[w]; p[0] != '\0' && p[1] != '\0' && p[2] != '\0'; p++) {
+				GHashTable *strings;
+
+				strings = g_hash_table_lookup (db->priv->search_trigrams, SEARCH_TRIGRAM (p));
+				if (strings == NULL) {
+					/* no string contains this word, so nothing matches */
+					g_mutex_unlock (&db->priv->search_index_lock);
+					rb_debug ("search word \"%s\" not found in index", words[w]);
+					return TRUE;
+				}
+
+				if (best_strings == NULL || g_hash_table_size (strings) < g_hash_table_size (best_strings)) {
+					best_strings = strings;
+					best_word = words[w];
+				}
+			}
+		}
+	}
+
+	if (best_strings == NULL) {
+		/* all search words are too short */
+		g_mutex_unlock (&db->priv->search_index_lock);
+		return FALSE;
+	}
+
+	candidates = g_hash_table_new (g_direct_hash, g_direct_equal);
+	g_hash_table_iter_init (&iter, best_strings);
+	while (g_hash_table_iter_next (&iter, &string, NULL)) {
+		RhythmDBTreeSearchString *ss = string;
+		GHashTableIter eiter;
+
+		if (strstr (rb_refstring_get_folded (ss->string), best_word) == NULL)
+			continue;
+
+		g_hash_table_iter_init (&eiter, ss->entries);
+		while (g_hash_table_iter_next (&eiter, &entry, NULL)) {
+			g_hash_table_add (candidates, entry);
+		}
+	}
+	rb_debug ("search word \"%s\" matched %d candidate entries from %u strings",
+		  best_word, g_hash_table_size (candidates), g_hash_table_size (best_strings));
+
+	/* evaluate the query on the candidates, holding references to the
+	 * matching entries so the index can be unlocked before passing
+	 * them on.
+	 */
+	matches = g_ptr_array_new_with_free_func ((GDestroyNotify) rhythmdb_entry_unref);
+	program = rhythmdb_query_program_compile (RHYTHMDB (db), query);
+	g_hash_table_iter_init (&iter, candidates);
+	while (g_hash_table_iter_next (&iter, &entry, NULL)) {
+		if (G_UNLIKELY (*cancel))
+			break;
+
+		if (((RhythmDBEntry *) entry)->flags & RHYTHMDB_ENTRY_TREE_REMOVED)
+			continue;
+
+		if (rhythmdb_query_program_run (program, entry))
+			g_ptr_array_add (matches, rhythmdb_entry_ref (entry));
+	}
+	rhythmdb_query_program_free (program);
+	g_hash_table_destroy (candidates);
+	g_mutex_unlock (&db->priv->search_index_lock);
+
+	for (i = 0; i < matches->len && !*cancel; i++) {
+		func (db, g_ptr_array_index (matches, i), data);
+	}
+	g_ptr_array_free (matches, TRUE);
+	return TRUE;
+}
+
+static const char *
+feed_index_query_feed (GPtrArray *query)
+{
+	guint i;
+
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *qdata = g_ptr_array_index (query, i);
+
+		if (qdata->type == RHYTHMDB_QUERY_PROP_EQUALS &&
+		    qdata->propid == RHYTHMDB_PROP_SUBTITLE)
+			return g_value_get_string (qdata->val);
+	}
+	return NULL;
+}
+
+/* finds the feeds a query for podcast posts is restricted to, either by a
+ * single feed URL or by a subquery matching any of several feeds.
+ */
+static GPtrArray *
+feed_index_query_feeds (RhythmDBTree *db, GPtrArray *query)
+{
+	GPtrArray *feeds = NULL;
+	gboolean posts = FALSE;
+	const char *feed;
+	guint i;
+
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *qdata = g_ptr_array_index (query, i);
+
+		if (qdata->type == RHYTHMDB_QUERY_PROP_EQUALS &&
+		    qdata->propid == RHYTHMDB_PROP_TYPE &&
+		    g_value_get_object (qdata->val) == RHYTHMDB_ENTRY_TYPE_PODCAST_POST) {
+			posts = TRUE;
+		} else if (feeds == NULL &&
+			   qdata->type == RHYTHMDB_QUERY_PROP_EQUALS &&
+			   qdata->propid == RHYTHMDB_PROP_SUBTITLE) {
+			feeds = g_ptr_array_new ();
+			g_ptr_array_add (feeds, (gpointer) g_value_get_string (qdata->val));
+		} else if (feeds == NULL && qdata->type == RHYTHMDB_QUERY_SUBQUERY) {
+			GList *conjunctions, *l;
+
+			feeds = g_ptr_array_new ();
+			conjunctions = split_query_by_disjunctions (db, qdata->subquery);
+			for (l = conjunctions; l != NULL; l = l->next) {
+				feed = feeds ? feed_index_query_feed (l->data) : NULL;
+				if (feed != NULL) {
+					g_ptr_array_add (feeds, (gpointer) feed);
+				} else if (feeds != NULL) {
+					g_ptr_array_free (feeds, TRUE);
+					feeds = NULL;
+				}
+				g_ptr_array_free (l->data, TRUE);
+			}
+			g_list_free (conjunctions);
+		}
+	}
+
+	if (feeds != NULL && (posts == FALSE || feeds->len == 0)) {
+		g_ptr_array_free (feeds, TRUE);
+		feeds = NULL;
+	}
+	return feeds;
+}
+
+static gboolean
+feed_index_query (RhythmDBTree *db,
+		  GPtrArray *query,
+		  RhythmDBTreeTraversalFunc func,
+		  gpointer data,
+		  gboolean *cancel)
+{
+	RhythmDBQueryProgram *program;
+	GPtrArray *feeds;
+	GPtrArray *matches;
+	GHashTable *seen;
+	guint i;
+
+	feeds = feed_index_query_feeds (db, query);
+	if (feeds == NULL)
+		return FALSE;
+
+	matches = g_ptr_array_new_with_free_func ((GDestroyNotify) rhythmdb_entry_unref);
+	seen = g_hash_table_new (g_direct_hash, g_direct_equal);
+	program = rhythmdb_query_program_compile (RHYTHMDB (db), query);
+
+	g_mutex_lock (&db->priv->feed_index_lock);
+	for (i = 0; i < feeds->len && !*cancel; i++) {
+		const char *url = g_ptr_array_index (feeds, i);
+		RBRefString *feed;
+		GHashTable *posts;
+		GHashTableIter iter;
+		gpointer entry;
+
+		/* if nothing has this string, no posts are in the feed */
+		feed = url ? rb_refstring_find (url) : NULL;
+		if (feed == NULL)
+			continue;
+
+		posts = g_hash_table_lookup (db->priv->feed_posts, feed);
+		rb_refstring_unref (feed);
+		if (posts == NULL || g_hash_table_contains (seen, posts))
+			continue;
+		g_hash_table_add (seen, posts);
+
+		g_hash_table_iter_init (&iter, posts);
+		while (g_hash_table_iter_next (&iter, &entry, NULL)) {
+			if (((RhythmDBEntry *) entry)->flags & RHYTHMDB_ENTRY_TREE_REMOVED)
+				continue;
+
+			if (rhythmdb_query_program_run (program, entry))
+				g_ptr_array_add (matches, rhythmdb_entry_ref (entry));
+		}
+	}
+	g_mutex_unlock (&db->priv->feed_index_lock);
+	rhythmdb_query_program_free (program);
+	g_hash_table_destroy (seen);
+
+	rb_debug ("feed index query over %u feeds matched %u posts", feeds->len, matches->len);
+	g_ptr_array_free (feeds, TRUE);
+
+	for (i = 0; i < matches->len && !*cancel; i++) {
+		func (db, g_ptr_array_index (matches, i), data);
+	}
+	g_ptr_array_free (matches, TRUE);
+	return TRUE;
+}
+
 static void
 conjunctive_query (RhythmDBTree *db,
 		   GPtrArray *query,
@@ -2233,6 +4372,12 @@ conjunctive_query (RhythmDBTree *db,
 	guint i;
 	struct RhythmDBTreeTraversalData *traversal_data;
 
+	if (feed_index_query (db, query, func, data, cancel))
+		return;
+
+	if (search_index_query (db, query, func, data, cancel))
+		return;
+
 	for (i = 0; i < query->len; i++) {
 		RhythmDBQueryData *qdata = g_ptr_array_index (query, i);
 		if (qdata->type == RHYTHMDB_QUERY_PROP_EQUALS
@@ -2247,6 +4392,7 @@ conjunctive_query (RhythmDBTree *db,
 	traversal_data = g_new (struct RhythmDBTreeTraversalData, 1);
 	traversal_data->db = db;
 	traversal_data->query = query;
+	traversal_data->program = NULL;
 	traversal_data->func = func;
 	traversal_data->data = data;
 	traversal_data->cancel = cancel;
@@ -2274,6 +4420,8 @@ conjunctive_query (RhythmDBTree *db,
 	}
 	g_mutex_unlock (&db->priv->genres_lock);
 
+	if (traversal_data->program != NULL)
+		rhythmdb_query_program_free (traversal_data->program);
 	g_free (traversal_data);
 }
 
@@ -163,6 +163,10 @@ static const RhythmDBPropertyDef rhythmdb_properties[] = {
 	PROP_ENTRY(COMPOSER_SORTNAME_SORT_KEY, G_TYPE_STRING, "composer-sortname-sort-key"),
 	PROP_ENTRY(COMPOSER_SORTNAME_FOLDED, G_TYPE_STRING, "composer-sortname-folded"),
 
+	PROP_ENTRY(FEED_ETAG, G_TYPE_STRING, "feed-etag"),
+	PROP_ENTRY(FEED_LAST_MODIFIED, G_TYPE_STRING, "feed-last-modified"),
+	PROP_ENTRY(FEED_CHECKSUM, G_TYPE_STRING, "feed-checksum"),
+
 	{ 0, 0, 0, 0 }
 };
 
@@ -213,6 +217,28 @@ struct media_type_filter {
  */
 #define REALLY_SMALL_FILE_SIZE	(4096)
 
+/*
+ * Upper limit on the number of metadata helper processes started by default.
+ * Each one is a separate process with its own GStreamer pipeline, so beyond
+ * this we mostly just compete for disk bandwidth.
+ */
+#define RHYTHMDB_MAX_DEFAULT_METADATA_HELPERS	(4)
+
+/*
+ * Number of file info queries the stat thread keeps in flight, and the number
+ * of directories enumerated at once.  These mostly help on network mounts,
+ * where each request spends most of its time waiting for the server.
+ */
+#define RHYTHMDB_STAT_QUERIES_IN_FLIGHT		(16)
+#define RHYTHMDB_ENUM_DIR_THREADS		(4)
+
+/*
+ * When the scanner threads get this far ahead of the main thread, they stop
+ * and wait for the event queue to drain down to the low water mark.
+ */
+#define RHYTHMDB_EVENT_QUEUE_HIGH_WATER		(2000)
+#define RHYTHMDB_EVENT_QUEUE_LOW_WATER		(500)
+
 
 typedef struct
 {
@@ -285,6 +311,8 @@ static gboolean rhythmdb_entry_extra_metadata_accumulator (GSignalInvocationHint
 							   gpointer data);
 
 static void rhythmdb_event_free (RhythmDB *db, RhythmDBEvent *event);
+static guint get_metadata_helpers (RhythmDB *db);
+static void rhythmdb_execute_enum_dir (RhythmDB *db, RhythmDBAction *action);
 static void rhythmdb_add_to_stat_list (RhythmDB *db,
 				       const char *uri,
 				       RhythmDBEntry *entry,
@@ -292,6 +320,7 @@ static void rhythmdb_add_to_stat_list (RhythmDB *db,
 				       RhythmDBEntryType *ignore_type,
 				       RhythmDBEntryType *error_type);
 static void free_entry_changes (GSList *entry_changes);
+static RhythmDBJournalChanges *journal_changes_for_entry (RhythmDB *db, RhythmDBEntry *entry);
 
 static void perform_next_mount (RhythmDB *db);
 
@@ -301,12 +330,14 @@ enum
 	PROP_NAME,
 	PROP_DRY_RUN,
 	PROP_NO_UPDATE,
+	PROP_METADATA_HELPERS,
 };
 
 enum
 {
 	ENTRY_ADDED,
 	ENTRY_CHANGED,
+	ENTRIES_CHANGED,
 	ENTRY_DELETED,
 	ENTRY_KEYWORD_ADDED,
 	ENTRY_KEYWORD_REMOVED,
@@ -370,6 +401,21 @@ rhythmdb_class_init (RhythmDBClass *klass)
 							       "Whether or not to update the database",
 							       FALSE,
 							       G_PARAM_READWRITE));
+	/**
+	 * RhythmDB:metadata-helpers:
+	 *
+	 * The number of metadata helper processes used to read tags from
+	 * files being added to the library.  If 0, a number is chosen
+	 * based on the number of processors available.  This is bound to
+	 * the metadata-helpers setting.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_METADATA_HELPERS,
+					 g_param_spec_uint ("metadata-helpers",
+							    "metadata helpers",
+							    "Number of metadata helper processes",
+							    0, G_MAXUINT, 0,
+							    G_PARAM_READWRITE));
 	/**
 	 * RhythmDB::entry-added:
 	 * @db: the #RhythmDB
@@ -423,6 +469,27 @@ rhythmdb_class_init (RhythmDBClass *klass)
 			      G_TYPE_NONE, 2,
 			      RHYTHMDB_TYPE_ENTRY, G_TYPE_PTR_ARRAY);
 
+	/**
+	 * RhythmDB::entries-changed:
+	 * @db: the #RhythmDB
+	 * @changes: (element-type RB.RhythmDBEntry GPtrArray): a #GHashTable mapping each
+	 *   changed #RhythmDBEntry to a #GPtrArray of #RhythmDBEntryChange structures
+	 *
+	 * Emitted once for each set of changes committed to the database,
+	 * before #RhythmDB::entry-changed is emitted for each entry in the set.
+	 * Handlers that need to do work for each change can use this to
+	 * process all the changes at once.
+	 */
+	rhythmdb_signals[ENTRIES_CHANGED] =
+		g_signal_new ("entries-changed",
+			      RHYTHMDB_TYPE,
+			      G_SIGNAL_RUN_LAST,
+			      G_STRUCT_OFFSET (RhythmDBClass, entries_changed),
+			      NULL, NULL,
+			      g_cclosure_marshal_VOID__BOXED,
+			      G_TYPE_NONE, 1,
+			      G_TYPE_HASH_TABLE);
+
 	/**
 	 * RhythmDB::entry-keyword-added:
 	 * @db: the #RhythmDB
@@ -622,9 +689,47 @@ static void
 rhythmdb_push_event (RhythmDB *db, RhythmDBEvent *event)
 {
 	g_async_queue_push (db->priv->event_queue, event);
+	rb_trace_counter_set_value (db->priv->event_queue_counter, g_async_queue_length (db->priv->event_queue));
 	g_main_context_wakeup (g_main_context_default ());
 }
 
+static void
+rhythmdb_push_action (RhythmDB *db, RhythmDBAction *action)
+{
+	g_async_queue_push (db->priv->action_queue, action);
+	rb_trace_counter_set_value (db->priv->action_queue_counter, g_async_queue_length (db->priv->action_queue));
+}
+
+/*
+ * Like rhythmdb_push_event, but blocks while the main thread has too many
+ * events to process.  Only for use in the scanner threads, never the main
+ * thread.
+ */
+static void
+rhythmdb_push_event_throttled (RhythmDB *db, RhythmDBEvent *event)
+{
+	if (g_async_queue_length (db->priv->event_queue) > RHYTHMDB_EVENT_QUEUE_HIGH_WATER) {
+		g_mutex_lock (&db->priv->event_queue_mutex);
+		g_atomic_int_inc (&db->priv->event_queue_waiters);
+		while (g_async_queue_length (db->priv->event_queue) > RHYTHMDB_EVENT_QUEUE_LOW_WATER &&
+		       g_cancellable_is_cancelled (db->priv->exiting) == FALSE) {
+			g_cond_wait (&db->priv->event_queue_cond, &db->priv->event_queue_mutex);
+		}
+		g_atomic_int_add (&db->priv->event_queue_waiters, -1);
+		g_mutex_unlock (&db->priv->event_queue_mutex);
+	}
+
+	rhythmdb_push_event (db, event);
+}
+
+static void
+rhythmdb_wake_event_queue_waiters (RhythmDB *db)
+{
+	g_mutex_lock (&db->priv->event_queue_mutex);
+	g_cond_broadcast (&db->priv->event_queue_cond);
+	g_mutex_unlock (&db->priv->event_queue_mutex);
+}
+
 static gboolean
 metadata_field_from_prop (RhythmDBPropType prop,
 			  RBMetaDataField *field)
@@ -711,6 +816,8 @@ rhythmdb_init (RhythmDB *db)
 
 	db->priv->action_queue = g_async_queue_new ();
 	db->priv->event_queue = g_async_queue_new ();
+	db->priv->action_queue_counter = rb_trace_counter_lookup ("rhythmdb.action-queue");
+	db->priv->event_queue_counter = rb_trace_counter_lookup ("rhythmdb.event-queue");
 	db->priv->delayed_write_queue = g_async_queue_new ();
 	db->priv->event_queue_watch_id = rb_async_queue_watch_new (db->priv->event_queue,
 								   G_PRIORITY_LOW,		/* really? */
@@ -757,6 +864,10 @@ rhythmdb_init (RhythmDB *db)
 							   NULL,
 							   (GDestroyNotify) rhythmdb_entry_unref,
 							   NULL);
+	db->priv->journal_changes = g_hash_table_new_full (NULL,
+							   NULL,
+							   (GDestroyNotify) rhythmdb_entry_unref,
+							   g_free);
 
 	db->priv->can_save = TRUE;
 	db->priv->exiting = g_cancellable_new ();
@@ -770,6 +881,9 @@ rhythmdb_init (RhythmDB *db)
 
 	rhythmdb_init_monitoring (db);
 
+	/* this also sizes the metadata helper pool */
+	g_settings_bind (db->priv->settings, "metadata-helpers", db, "metadata-helpers", G_SETTINGS_BIND_GET);
+
 	rhythmdb_dbus_register (db);
 }
 
@@ -811,59 +925,119 @@ rhythmdb_ignore_media_type (const char *media_type)
 typedef struct {
 	RhythmDB *db;
 	GList *stat_list;
+	GList *next;
+	GMainContext *context;
+	int in_flight;
 } RhythmDBStatThreadData;
 
-static gpointer
-stat_thread_main (RhythmDBStatThreadData *data)
+typedef struct {
+	RhythmDBStatThreadData *data;
+	RhythmDBEvent *event;
+} RhythmDBStatQuery;
+
+static void stat_thread_start_queries (RhythmDBStatThreadData *data);
+
+static void
+stat_thread_query_cb (GObject *object, GAsyncResult *result, RhythmDBStatQuery *query)
 {
-	GList *i;
+	RhythmDBStatThreadData *data = query->data;
+	RhythmDBEvent *event = query->event;
+	RhythmDB *db = data->db;
 	GError *error = NULL;
-	RhythmDBEvent *result;
 
-	data->db->priv->stat_thread_count = g_list_length (data->stat_list);
-	data->db->priv->stat_thread_done = 0;
+	g_slice_free (RhythmDBStatQuery, query);
+	data->in_flight--;
 
-	rb_debug ("entering stat thread: %d to process", data->db->priv->stat_thread_count);
-	for (i = data->stat_list; i != NULL; i = i->next) {
-		RhythmDBEvent *event = (RhythmDBEvent *)i->data;
+	event->file_info = g_file_query_info_finish (G_FILE (object), result, &error);
+	if (g_cancellable_is_cancelled (db->priv->exiting)) {
+		g_clear_error (&error);
+		rhythmdb_event_free (db, event);
+	} else {
+		if (error != NULL) {
+			event->error = make_access_failed_error (rb_refstring_get (event->uri), error);
+			g_clear_error (&error);
+
+			if (event->file_info != NULL) {
+				g_object_unref (event->file_info);
+				event->file_info = NULL;
+			}
+		}
+
+		rhythmdb_push_event_throttled (db, event);
+		g_atomic_int_inc (&db->priv->stat_thread_done);
+	}
+
+	stat_thread_start_queries (data);
+}
+
+static void
+stat_thread_start_queries (RhythmDBStatThreadData *data)
+{
+	RhythmDB *db = data->db;
+
+	while (data->next != NULL && data->in_flight < RHYTHMDB_STAT_QUERIES_IN_FLIGHT) {
+		RhythmDBEvent *event = (RhythmDBEvent *)data->next->data;
+		RhythmDBStatQuery *query;
 		GFile *file;
+		int done;
+
+		data->next = data->next->next;
 
 		/* if we've been cancelled, just free the event.  this will
 		 * clean up the list and then we'll exit the thread.
 		 */
-		if (g_cancellable_is_cancelled (data->db->priv->exiting)) {
-			rhythmdb_event_free (data->db, event);
+		if (g_cancellable_is_cancelled (db->priv->exiting)) {
+			rhythmdb_event_free (db, event);
 			continue;
 		}
 
-		if (data->db->priv->stat_thread_done > 0 &&
-		    data->db->priv->stat_thread_done % 1000 == 0) {
-			rb_debug ("%d file info queries done",
-				  data->db->priv->stat_thread_done);
+		done = g_atomic_int_get (&db->priv->stat_thread_done);
+		if (done > 0 && done % 1000 == 0) {
+			rb_debug ("%d file info queries done", done);
 		}
 
 		file = g_file_new_for_uri (rb_refstring_get (event->uri));
 		event->real_uri = rb_refstring_ref (event->uri);		/* what? */
-		event->file_info = g_file_query_info (file,
-						      G_FILE_ATTRIBUTE_TIME_MODIFIED,	/* anything else? */
-						      G_FILE_QUERY_INFO_NONE,
-						      data->db->priv->exiting,
-						      &error);
-		if (error != NULL) {
-			event->error = make_access_failed_error (rb_refstring_get (event->uri), error);
-			g_clear_error (&error);
+		query = g_slice_new0 (RhythmDBStatQuery);
+		query->data = data;
+		query->event = event;
+		data->in_flight++;
+		g_file_query_info_async (file,
+					 G_FILE_ATTRIBUTE_TIME_MODIFIED,	/* anything else? */
+					 G_FILE_QUERY_INFO_NONE,
+					 G_PRIORITY_DEFAULT,
+					 db->priv->exiting,
+					 (GAsyncReadyCallback) stat_thread_query_cb,
+					 query);
+		g_object_unref (file);
+	}
+}
 
-			if (event->file_info != NULL) {
-				g_object_unref (event->file_info);
-				event->file_info = NULL;
-			}
-		}
+static gpointer
+stat_thread_main (RhythmDBStatThreadData *data)
+{
+	RhythmDBEvent *result;
 
-		g_async_queue_push (data->db->priv->event_queue, event);
-		g_object_unref (file);
-		g_atomic_int_inc (&data->db->priv->stat_thread_done);
+	data->db->priv->stat_thread_count = g_list_length (data->stat_list);
+	data->db->priv->stat_thread_done = 0;
+
+	rb_debug ("entering stat thread: %d to process", data->db->priv->stat_thread_count);
+
+	/* the queries run asynchronously in a main context of our own,
+	 * with a limited number in flight at any time.
+	 */
+	data->context = g_main_context_new ();
+	g_main_context_push_thread_default (data->context);
+
+	data->next = data->stat_list;
+	stat_thread_start_queries (data);
+	while (data->in_flight > 0) {
+		g_main_context_iteration (data->context, TRUE);
 	}
 
+	g_main_context_pop_thread_default (data->context);
+	g_main_context_unref (data->context);
+
 	g_list_free (data->stat_list);
 
 	data->db->priv->stat_thread_running = FALSE;
@@ -1040,11 +1214,12 @@ rhythmdb_shutdown (RhythmDB *db)
 	g_return_if_fail (RHYTHMDB_IS (db));
 
 	g_cancellable_cancel (db->priv->exiting);
+	rhythmdb_wake_event_queue_waiters (db);
 
 	/* force the action thread to wake up and exit */
 	action = g_slice_new0 (RhythmDBAction);
 	action->type = RHYTHMDB_ACTION_QUIT;
-	g_async_queue_push (db->priv->action_queue, action);
+	rhythmdb_push_action (db, action);
 
 	/* abort all async io operations */
 	g_mutex_lock (&db->priv->stat_mutex);
@@ -1155,6 +1330,8 @@ rhythmdb_finalize (GObject *object)
 	g_hash_table_destroy (db->priv->added_entries);
 	g_hash_table_destroy (db->priv->deleted_entries);
 	g_hash_table_destroy (db->priv->changed_entries);
+	g_hash_table_destroy (db->priv->journal_changes);
+	g_list_free_full (db->priv->journal_deleted, (GDestroyNotify) rb_refstring_unref);
 
 	rb_refstring_unref (db->priv->empty_string);
 	rb_refstring_unref (db->priv->octet_stream_str);
@@ -1185,6 +1362,17 @@ rhythmdb_set_property (GObject *object,
 	case PROP_NO_UPDATE:
 		db->priv->no_update = g_value_get_boolean (value);
 		break;
+	case PROP_METADATA_HELPERS:
+		db->priv->metadata_helpers = g_value_get_uint (value);
+		rb_metadata_set_max_helpers (get_metadata_helpers (db));
+		g_mutex_lock (&db->priv->stat_mutex);
+		if (db->priv->load_thread_pool != NULL) {
+			g_thread_pool_set_max_threads (db->priv->load_thread_pool,
+						       get_metadata_helpers (db),
+						       NULL);
+		}
+		g_mutex_unlock (&db->priv->stat_mutex);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -1209,6 +1397,9 @@ rhythmdb_get_property (GObject *object,
 	case PROP_NO_UPDATE:
 		g_value_set_boolean (value, source->priv->no_update);
 		break;
+	case PROP_METADATA_HELPERS:
+		g_value_set_uint (value, source->priv->metadata_helpers);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -1350,8 +1541,11 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 
 	g_mutex_unlock (&db->priv->change_mutex);
 
-	/* emit changed entries */
+	/* emit changed entries, first as a set, then individually */
 	if (changed_entries != NULL) {
+		GHashTable *emit_set;
+
+		emit_set = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_ptr_array_unref);
 		g_hash_table_iter_init (&iter, changed_entries);
 		while (g_hash_table_iter_next (&iter, (gpointer *)&entry, (gpointer *)&entry_changes)) {
 			GPtrArray *emit_changes;
@@ -1361,10 +1555,18 @@ rhythmdb_emit_entry_signals_idle (RhythmDB *db)
 			for (c = entry_changes; c != NULL; c = c->next) {
 				g_ptr_array_add (emit_changes, c->data); 
 			}
-			g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_CHANGED], 0, entry, emit_changes);
-			g_ptr_array_unref (emit_changes);
+			g_hash_table_insert (emit_set, entry, emit_changes);
+		}
+
+		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRIES_CHANGED], 0, emit_set);
+
+		g_hash_table_iter_init (&iter, changed_entries);
+		while (g_hash_table_iter_next (&iter, (gpointer *)&entry, NULL)) {
+			g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_CHANGED], 0,
+				       entry, g_hash_table_lookup (emit_set, entry));
 			g_hash_table_iter_remove (&iter);
 		}
+		g_hash_table_destroy (emit_set);
 	}
 
 	/* emit added entries */
@@ -1535,7 +1737,7 @@ sync_entry_changed (RhythmDBEntry *entry,
 			action->type = RHYTHMDB_ACTION_SYNC;
 			action->uri = rb_refstring_ref (entry->location);
 			action->data.changes = copy_entry_changes (changes);
-			g_async_queue_push (db->priv->action_queue, action);
+			rhythmdb_push_action (db, action);
 			break;
 		}
 	}
@@ -1744,6 +1946,8 @@ rhythmdb_entry_insert (RhythmDB *db,
 	rhythmdb_entry_ref (entry);
 	g_mutex_lock (&db->priv->change_mutex);
 	g_hash_table_insert (db->priv->added_entries, entry, g_thread_self ());
+	if (db->priv->journal_active)
+		journal_changes_for_entry (db, entry)->full = TRUE;
 	g_mutex_unlock (&db->priv->change_mutex);
 }
 
@@ -2205,7 +2409,7 @@ rhythmdb_process_stat_event (RhythmDB *db,
 				action->data.types.entry_type = event->entry_type;
 				action->data.types.ignore_type = event->ignore_type;
 				action->data.types.error_type = event->error_type;
-				g_async_queue_push (db->priv->action_queue, action);
+				rhythmdb_push_action (db, action);
 			}
 		} else {
 			/* push a LOAD action */
@@ -2216,7 +2420,7 @@ rhythmdb_process_stat_event (RhythmDB *db,
 			action->data.types.ignore_type = event->ignore_type;
 			action->data.types.error_type = event->error_type;
 			rb_debug ("queuing a RHYTHMDB_ACTION_LOAD: %s", rb_refstring_get (action->uri));
-			g_async_queue_push (db->priv->action_queue, action);
+			rhythmdb_push_action (db, action);
 		}
 		break;
 
@@ -2230,7 +2434,7 @@ rhythmdb_process_stat_event (RhythmDB *db,
 		action->data.types.ignore_type = event->ignore_type;
 		action->data.types.error_type = event->error_type;
 		rb_debug ("queuing a RHYTHMDB_ACTION_ENUM_DIR: %s", rb_refstring_get (action->uri));
-		g_async_queue_push (db->priv->action_queue, action);
+		rhythmdb_push_action (db, action);
 		break;
 
 	case G_FILE_TYPE_SYMBOLIC_LINK:
@@ -2611,6 +2815,14 @@ rhythmdb_process_one_event (RhythmDBEvent *event, RhythmDB *db)
 {
 	gboolean free = TRUE;
 
+	rb_trace_counter_set_value (db->priv->event_queue_counter, g_async_queue_length (db->priv->event_queue));
+
+	/* let the scanner threads continue once we've caught up */
+	if (g_atomic_int_get (&db->priv->event_queue_waiters) > 0 &&
+	    g_async_queue_length (db->priv->event_queue) <= RHYTHMDB_EVENT_QUEUE_LOW_WATER) {
+		rhythmdb_wake_event_queue_waiters (db);
+	}
+
 	/* if the database is read-only, we can't process those events
 	 * since they call rhythmdb_entry_set. Doing it this way
 	 * is safe if we assume all calls to read_enter/read_leave
@@ -2664,6 +2876,7 @@ rhythmdb_process_one_event (RhythmDBEvent *event, RhythmDB *db)
 	case RHYTHMDB_EVENT_DB_SAVED:
 		rb_debug ("processing RHYTHMDB_EVENT_DB_SAVED");
 		rhythmdb_read_leave (db);
+		g_signal_emit (G_OBJECT (db), rhythmdb_signals[SAVE_COMPLETE], 0);
 		break;
 	case RHYTHMDB_EVENT_QUERY_COMPLETE:
 		rb_debug ("processing RHYTHMDB_EVENT_QUERY_COMPLETE");
@@ -2850,6 +3063,15 @@ rhythmdb_execute_load (RhythmDB *db,
 		}
 
 		if (valid == FALSE) {
+			/* reading the tags is the slow part, so hand it off to the
+			 * load pool, where several metadata helpers can be working
+			 * on different files at once.
+			 */
+			if (db->priv->load_thread_pool != NULL) {
+				g_thread_pool_push (db->priv->load_thread_pool, event, NULL);
+				return;
+			}
+
 			event->metadata = rb_metadata_new ();
 			rb_metadata_load (event->metadata,
 					  rb_refstring_get (event->real_uri),
@@ -2860,6 +3082,42 @@ rhythmdb_execute_load (RhythmDB *db,
 	rhythmdb_push_event (db, event);
 }
 
+static void
+enum_dir_thread_main (RhythmDBAction *action,
+		      RhythmDB *db)
+{
+	if (g_cancellable_is_cancelled (db->priv->exiting) == FALSE) {
+		rb_debug ("executing RHYTHMDB_ACTION_ENUM_DIR for \"%s\"", rb_refstring_get (action->uri));
+		rhythmdb_execute_enum_dir (db, action);
+	}
+	rhythmdb_action_free (db, action);
+}
+
+static void
+load_thread_main (RhythmDBEvent *event,
+		  RhythmDB *db)
+{
+	if (g_cancellable_is_cancelled (db->priv->exiting)) {
+		rhythmdb_event_free (db, event);
+		return;
+	}
+
+	event->metadata = rb_metadata_new ();
+	rb_metadata_load (event->metadata,
+			  rb_refstring_get (event->real_uri),
+			  &event->error);
+	rhythmdb_push_event (db, event);
+}
+
+static guint
+get_metadata_helpers (RhythmDB *db)
+{
+	if (db->priv->metadata_helpers != 0)
+		return db->priv->metadata_helpers;
+
+	return CLAMP (g_get_num_processors (), 1, RHYTHMDB_MAX_DEFAULT_METADATA_HELPERS);
+}
+
 static void
 rhythmdb_execute_enum_dir (RhythmDB *db,
 			   RhythmDBAction *action)
@@ -2925,7 +3183,7 @@ rhythmdb_execute_enum_dir (RhythmDB *db,
 		result->file_info = file_info;
 		result->error = error;
 
-		rhythmdb_push_event (db, result);
+		rhythmdb_push_event_throttled (db, result);
 		g_free (child_uri);
 	}
 
@@ -3009,11 +3267,28 @@ static gpointer
 action_thread_main (RhythmDB *db)
 {
 	RhythmDBEvent *result;
+	GThreadPool *load_pool;
+	GThreadPool *enum_dir_pool;
+
+	load_pool = g_thread_pool_new ((GFunc) load_thread_main,
+				       db,
+				       get_metadata_helpers (db),
+				       FALSE,
+				       NULL);
+	enum_dir_pool = g_thread_pool_new ((GFunc) enum_dir_thread_main,
+					   db,
+					   RHYTHMDB_ENUM_DIR_THREADS,
+					   FALSE,
+					   NULL);
+	g_mutex_lock (&db->priv->stat_mutex);
+	db->priv->load_thread_pool = load_pool;
+	g_mutex_unlock (&db->priv->stat_mutex);
 
 	while (!g_cancellable_is_cancelled (db->priv->exiting)) {
 		RhythmDBAction *action;
 
 		action = g_async_queue_pop (db->priv->action_queue);
+		rb_trace_counter_set_value (db->priv->action_queue_counter, g_async_queue_length (db->priv->action_queue));
 
 		/* hrm, do we need this check at all? */
 		if (!g_cancellable_is_cancelled (db->priv->exiting)) {
@@ -3045,8 +3320,10 @@ action_thread_main (RhythmDB *db)
 				break;
 
 			case RHYTHMDB_ACTION_ENUM_DIR:
-				rb_debug ("executing RHYTHMDB_ACTION_ENUM_DIR for \"%s\"", rb_refstring_get (action->uri));
-				rhythmdb_execute_enum_dir (db, action);
+				/* the enum dir pool frees the action when it's done */
+				rb_debug ("queuing RHYTHMDB_ACTION_ENUM_DIR for \"%s\"", rb_refstring_get (action->uri));
+				g_thread_pool_push (enum_dir_pool, action, NULL);
+				action = NULL;
 				break;
 
 			case RHYTHMDB_ACTION_SYNC:
@@ -3090,9 +3367,19 @@ action_thread_main (RhythmDB *db)
 			}
 		}
 
-		rhythmdb_action_free (db, action);
+		if (action != NULL)
+			rhythmdb_action_free (db, action);
 	}
 
+	/* wait for loads and directory enumerations that are already running;
+	 * any still queued are dropped as the exiting cancellable is set.
+	 */
+	g_mutex_lock (&db->priv->stat_mutex);
+	db->priv->load_thread_pool = NULL;
+	g_mutex_unlock (&db->priv->stat_mutex);
+	g_thread_pool_free (enum_dir_pool, FALSE, TRUE);
+	g_thread_pool_free (load_pool, FALSE, TRUE);
+
 	rb_debug ("exiting action thread");
 	result = g_slice_new0 (RhythmDBEvent);
 	result->db = db;
@@ -3201,7 +3488,7 @@ rhythmdb_add_uri_with_types (RhythmDB *db,
 		action->data.types.ignore_type = ignore_type;
 		action->data.types.error_type = error_type;
 
-		g_async_queue_push (db->priv->action_queue, action);
+		rhythmdb_push_action (db, action);
 	} else {
 		rhythmdb_add_to_stat_list (db, uri, entry, type, ignore_type, error_type);
 		g_mutex_unlock (&db->priv->stat_mutex);
@@ -3236,7 +3523,7 @@ rhythmdb_load_thread_main (RhythmDB *db)
 
 	db->priv->active_mounts = rhythmdb_get_active_mounts (db);
 
-	rb_profile_start ("loading db");
+	rb_trace_begin ("rhythmdb", "load");
 	g_mutex_lock (&db->priv->saving_mutex);
 	if (klass->impl_load (db, db->priv->exiting, &error) == FALSE) {
 		rb_debug ("db load failed: disabling saving");
@@ -3245,8 +3532,14 @@ rhythmdb_load_thread_main (RhythmDB *db)
 		if (error) {
 			g_idle_add ((GSourceFunc) rhythmdb_load_error_cb, error);
 		}
+	} else {
+		/* changes made from here on can be saved to the journal */
+		g_mutex_lock (&db->priv->change_mutex);
+		db->priv->journal_active = TRUE;
+		g_mutex_unlock (&db->priv->change_mutex);
 	}
 	g_mutex_unlock (&db->priv->saving_mutex);
+	rb_trace_end ("rhythmdb", "load");
 
 	rb_list_deep_free (db->priv->active_mounts);
 	db->priv->active_mounts = NULL;
@@ -3279,11 +3572,141 @@ rhythmdb_load (RhythmDB *db)
 	rhythmdb_thread_create (db, NULL, (GThreadFunc) rhythmdb_load_thread_main, db);
 }
 
+/* Takes the changes made since the last save, so changes made while
+ * saving are kept for the next save.  Must be called with the change
+ * mutex held.  The deleted locations are returned oldest first.
+ */
+static void
+rhythmdb_journal_take (RhythmDB *db, GHashTable **changes, GList **deleted)
+{
+	*changes = db->priv->journal_changes;
+	*deleted = g_list_reverse (db->priv->journal_deleted);
+	db->priv->journal_changes = g_hash_table_new_full (NULL,
+							   NULL,
+							   (GDestroyNotify) rhythmdb_entry_unref,
+							   g_free);
+	db->priv->journal_deleted = NULL;
+}
+
+static void
+rhythmdb_journal_free (GHashTable *changes, GList *deleted)
+{
+	g_hash_table_destroy (changes);
+	g_list_free_full (deleted, (GDestroyNotify) rb_refstring_unref);
+}
+
+/* Puts back changes taken by rhythmdb_journal_take after a failed save,
+ * merging them with anything that changed since.
+ */
+static void
+rhythmdb_journal_restore (RhythmDB *db, GHashTable *changes, GList *deleted)
+{
+	GHashTableIter iter;
+	RhythmDBEntry *entry;
+	RhythmDBJournalChanges *old_changes;
+
+	g_mutex_lock (&db->priv->change_mutex);
+	g_hash_table_iter_init (&iter, changes);
+	while (g_hash_table_iter_next (&iter, (gpointer *) &entry, (gpointer *) &old_changes)) {
+		RhythmDBJournalChanges *new_changes;
+		guint i;
+
+		/* entries deleted since then are skipped by the backend */
+		new_changes = journal_changes_for_entry (db, entry);
+		new_changes->full |= old_changes->full;
+		for (i = 0; i < G_N_ELEMENTS (new_changes->props); i++)
+			new_changes->props[i] |= old_changes->props[i];
+	}
+
+	/* the older deletions go after the newer ones, which are most recent first */
+	db->priv->journal_deleted = g_list_concat (db->priv->journal_deleted, g_list_reverse (deleted));
+	g_mutex_unlock (&db->priv->change_mutex);
+
+	g_hash_table_destroy (changes);
+}
+
+/* Hands the changes made since the last save to the backend to append
+ * to its journal.  Returns FALSE if a full save is required instead, in
+ * which case the changes are kept.
+ */
+static gboolean
+rhythmdb_save_journal (RhythmDB *db)
+{
+	RhythmDBClass *klass = RHYTHMDB_GET_CLASS (db);
+	GHashTable *changes;
+	GList *deleted;
+
+	if (klass->impl_save_journal == NULL)
+		return FALSE;
+
+	g_mutex_lock (&db->priv->change_mutex);
+	if (db->priv->journal_active == FALSE ||
+	    db->priv->journal_invalid ||
+	    db->priv->journal_compact) {
+		g_mutex_unlock (&db->priv->change_mutex);
+		return FALSE;
+	}
+	rhythmdb_journal_take (db, &changes, &deleted);
+	g_mutex_unlock (&db->priv->change_mutex);
+
+	rb_debug ("saving %d changed and %d deleted entries to the journal",
+		  g_hash_table_size (changes), g_list_length (deleted));
+	if (klass->impl_save_journal (db, deleted, changes) == FALSE) {
+		rhythmdb_journal_restore (db, changes, deleted);
+		return FALSE;
+	}
+
+	rhythmdb_journal_free (changes, deleted);
+	return TRUE;
+}
+
+/* Writes out the whole database.  If that fails, the changes since the
+ * last successful save are kept and the next save is a full save too.
+ */
+static gboolean
+rhythmdb_save_full (RhythmDB *db)
+{
+	RhythmDBClass *klass = RHYTHMDB_GET_CLASS (db);
+	GHashTable *changes;
+	GList *deleted;
+	gboolean journal_invalid;
+	gboolean saved;
+
+	g_mutex_lock (&db->priv->change_mutex);
+	rhythmdb_journal_take (db, &changes, &deleted);
+	journal_invalid = db->priv->journal_invalid;
+	db->priv->journal_invalid = FALSE;
+	db->priv->journal_compact = FALSE;
+	g_mutex_unlock (&db->priv->change_mutex);
+
+	if (klass->impl_save_checked != NULL) {
+		saved = klass->impl_save_checked (db);
+	} else {
+		/* no way to tell, so assume it worked */
+		klass->impl_save (db);
+		saved = TRUE;
+	}
+
+	if (saved == FALSE) {
+		rb_debug ("full save failed, keeping changes for the next save");
+		rhythmdb_journal_restore (db, changes, deleted);
+
+		g_mutex_lock (&db->priv->change_mutex);
+		db->priv->journal_invalid |= journal_invalid;
+		db->priv->journal_compact = TRUE;
+		g_mutex_unlock (&db->priv->change_mutex);
+		return FALSE;
+	}
+
+	rhythmdb_journal_free (changes, deleted);
+	return TRUE;
+}
+
 static gpointer
 rhythmdb_save_thread_main (RhythmDB *db)
 {
-	RhythmDBClass *klass;
 	RhythmDBEvent *result;
+	gboolean saved;
 
 	rb_debug ("entering save thread");
 
@@ -3305,11 +3728,21 @@ rhythmdb_save_thread_main (RhythmDB *db)
 
 	rb_debug ("saving rhythmdb");
 
-	klass = RHYTHMDB_GET_CLASS (db);
-	klass->impl_save (db);
+	rb_trace_begin ("rhythmdb", "save");
+	if (rhythmdb_save_journal (db)) {
+		saved = TRUE;
+		rb_trace_counter_add ("rhythmdb.journal-saves", 1);
+	} else {
+		rb_debug ("doing a full save");
+		saved = rhythmdb_save_full (db);
+		rb_trace_counter_add ("rhythmdb.full-saves", 1);
+	}
+	rb_trace_end ("rhythmdb", "save");
 
 	db->priv->saving = FALSE;
-	db->priv->dirty = FALSE;
+	/* try again next time if the save failed */
+	if (saved)
+		db->priv->dirty = FALSE;
 
 	g_mutex_unlock (&db->priv->saving_mutex);
 
@@ -3357,6 +3790,11 @@ rhythmdb_save (RhythmDB *db)
 
 	rb_debug("saving the rhythmdb and blocking");
 
+	/* write out the whole database rather than appending to the journal */
+	g_mutex_lock (&db->priv->change_mutex);
+	db->priv->journal_compact = TRUE;
+	g_mutex_unlock (&db->priv->change_mutex);
+
 	g_mutex_lock (&db->priv->saving_mutex);
 	new_save_count = db->priv->save_count + 1;
 
@@ -3431,6 +3869,70 @@ rhythmdb_entry_set (RhythmDB *db,
 	}
 }
 
+/* must be called with the change mutex held */
+static RhythmDBJournalChanges *
+journal_changes_for_entry (RhythmDB *db,
+			   RhythmDBEntry *entry)
+{
+	RhythmDBJournalChanges *changes;
+
+	changes = g_hash_table_lookup (db->priv->journal_changes, entry);
+	if (changes == NULL) {
+		changes = g_new0 (RhythmDBJournalChanges, 1);
+		g_hash_table_insert (db->priv->journal_changes, rhythmdb_entry_ref (entry), changes);
+	}
+	return changes;
+}
+
+/* must be called with the change mutex held */
+static void
+journal_location_deleted (RhythmDB *db,
+			  RhythmDBEntry *entry,
+			  const char *location)
+{
+	gboolean save_to_disk = FALSE;
+
+	g_object_get (entry->type, "save-to-disk", &save_to_disk, NULL);
+	if (save_to_disk) {
+		db->priv->journal_deleted = g_list_prepend (db->priv->journal_deleted,
+							    rb_refstring_new (location));
+	}
+}
+
+/* must be called with the change mutex held */
+static void
+journal_entry_change (RhythmDB *db,
+		      RhythmDBEntry *entry,
+		      guint propid,
+		      const GValue *old_value)
+{
+	RhythmDBJournalChanges *changes;
+
+	if (db->priv->journal_active == FALSE)
+		return;
+
+	changes = journal_changes_for_entry (db, entry);
+	if (propid == RHYTHMDB_PROP_LOCATION) {
+		/* the entry has to be removed from its old location
+		 * and written out in full at the new one.
+		 */
+		journal_location_deleted (db, entry, g_value_get_string (old_value));
+		changes->full = TRUE;
+	} else {
+		changes->props[propid / 32] |= (1U << (propid % 32));
+	}
+}
+
+static void
+journal_entry_full (RhythmDB *db,
+		    RhythmDBEntry *entry)
+{
+	g_mutex_lock (&db->priv->change_mutex);
+	if (db->priv->journal_active)
+		journal_changes_for_entry (db, entry)->full = TRUE;
+	g_mutex_unlock (&db->priv->change_mutex);
+}
+
 static void
 record_entry_change (RhythmDB *db,
 		     RhythmDBEntry *entry,
@@ -3455,6 +3957,7 @@ record_entry_change (RhythmDB *db,
 	changelist = g_hash_table_lookup (db->priv->changed_entries, entry);
 	changelist = g_slist_append (changelist, changedata);
 	g_hash_table_insert (db->priv->changed_entries, entry, changelist);
+	journal_entry_change (db, entry, propid, old_value);
 	g_mutex_unlock (&db->priv->change_mutex);
 }
 
@@ -3523,8 +4026,14 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 		break;
 	}
 
-	if (nop == FALSE && (entry->flags & RHYTHMDB_ENTRY_INSERTED) && notify_if_inserted) {
-		record_entry_change (db, entry, propid, &old_value, value);
+	if (nop == FALSE && (entry->flags & RHYTHMDB_ENTRY_INSERTED)) {
+		if (notify_if_inserted) {
+			record_entry_change (db, entry, propid, &old_value, value);
+		} else {
+			g_mutex_lock (&db->priv->change_mutex);
+			journal_entry_change (db, entry, propid, &old_value);
+			g_mutex_unlock (&db->priv->change_mutex);
+		}
 	}
 	g_value_unset (&old_value);
 
@@ -3760,6 +4269,21 @@ rhythmdb_entry_set_internal (RhythmDB *db,
 			g_assert (podcast);
 			podcast->post_time = g_value_get_ulong (value);
 			break;
+		case RHYTHMDB_PROP_FEED_ETAG:
+			g_assert (podcast);
+			rb_refstring_unref (podcast->etag);
+			podcast->etag = rb_refstring_new (g_value_get_string (value));
+			break;
+		case RHYTHMDB_PROP_FEED_LAST_MODIFIED:
+			g_assert (podcast);
+			rb_refstring_unref (podcast->last_modified);
+			podcast->last_modified = rb_refstring_new (g_value_get_string (value));
+			break;
+		case RHYTHMDB_PROP_FEED_CHECKSUM:
+			g_assert (podcast);
+			rb_refstring_unref (podcast->checksum);
+			podcast->checksum = rb_refstring_new (g_value_get_string (value));
+			break;
 		case RHYTHMDB_NUM_PROPERTIES:
 			g_assert_not_reached ();
 			break;
@@ -3908,6 +4432,10 @@ rhythmdb_entry_delete (RhythmDB *db,
 
 	g_mutex_lock (&db->priv->change_mutex);
 	g_hash_table_insert (db->priv->deleted_entries, entry, g_thread_self ());
+	if (db->priv->journal_active) {
+		g_hash_table_remove (db->priv->journal_changes, entry);
+		journal_location_deleted (db, entry, rb_refstring_get (entry->location));
+	}
 	g_mutex_unlock (&db->priv->change_mutex);
 
 	/* deleting an entry makes the db dirty */
@@ -3971,6 +4499,11 @@ rhythmdb_entry_delete_by_type (RhythmDB *db,
 
 	if (klass->impl_entry_delete_by_type) {
 		klass->impl_entry_delete_by_type (db, type);
+
+		/* the journal can't describe this, so do a full save next time */
+		g_mutex_lock (&db->priv->change_mutex);
+		db->priv->journal_invalid = TRUE;
+		g_mutex_unlock (&db->priv->change_mutex);
 	} else {
 		g_warning ("delete_by_type not implemented");
 	}
@@ -4208,9 +4741,12 @@ rhythmdb_query_internal (RhythmDBQueryThreadData *data)
 
 	rb_debug ("doing query");
 
+	rb_trace_begin ("rhythmdb", "query");
 	klass->impl_do_full_query (data->db, data->query,
 				   data->results,
 				   &data->cancel);
+	rb_trace_end ("rhythmdb", "query");
+	rb_trace_counter_add ("rhythmdb.queries", 1);
 
 	rb_debug ("completed");
 	rhythmdb_query_results_query_complete (data->results);
@@ -5030,6 +5566,21 @@ rhythmdb_entry_get_string (RhythmDBEntry *entry,
 			return rb_refstring_get (podcast->image);
 		else
 			return NULL;
+	case RHYTHMDB_PROP_FEED_ETAG:
+		if (podcast)
+			return rb_refstring_get (podcast->etag);
+		else
+			return NULL;
+	case RHYTHMDB_PROP_FEED_LAST_MODIFIED:
+		if (podcast)
+			return rb_refstring_get (podcast->last_modified);
+		else
+			return NULL;
+	case RHYTHMDB_PROP_FEED_CHECKSUM:
+		if (podcast)
+			return rb_refstring_get (podcast->checksum);
+		else
+			return NULL;
 
 	default:
 		g_assert_not_reached ();
@@ -5328,6 +5879,8 @@ rhythmdb_entry_keyword_add	(RhythmDB *db,
 
 	ret = klass->impl_entry_keyword_add (db, entry, keyword);
 	if (!ret) {
+		if (entry->flags & RHYTHMDB_ENTRY_INSERTED)
+			journal_entry_full (db, entry);
 		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_KEYWORD_ADDED], 0, entry, keyword);
 	}
 	return ret;
@@ -5353,6 +5906,8 @@ rhythmdb_entry_keyword_remove	(RhythmDB *db,
 
 	ret = klass->impl_entry_keyword_remove (db, entry, keyword);
 	if (ret) {
+		if (entry->flags & RHYTHMDB_ENTRY_INSERTED)
+			journal_entry_full (db, entry);
 		g_signal_emit (G_OBJECT (db), rhythmdb_signals[ENTRY_KEYWORD_REMOVED], 0, entry, keyword);
 	}
 	return ret;
@@ -5448,7 +6003,7 @@ rhythmdb_entry_write_metadata_changes (RhythmDB *db,
 		load_action->type = RHYTHMDB_ACTION_LOAD;
 		load_action->uri = rb_refstring_ref (entry->location);
 		/* XXX entry types? */
-		g_async_queue_push (db->priv->action_queue, load_action);
+		rhythmdb_push_action (db, load_action);
 
 		g_propagate_error (error, local_error);
 	}
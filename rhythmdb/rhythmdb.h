@@ -175,6 +175,11 @@ typedef enum
 	RHYTHMDB_PROP_COMPOSER_SORTNAME,
 	RHYTHMDB_PROP_COMPOSER_SORTNAME_SORT_KEY,
 	RHYTHMDB_PROP_COMPOSER_SORTNAME_FOLDED,
+
+	/* Podcast feed validators */
+	RHYTHMDB_PROP_FEED_ETAG,
+	RHYTHMDB_PROP_FEED_LAST_MODIFIED,
+	RHYTHMDB_PROP_FEED_CHECKSUM,
 	
 	RHYTHMDB_NUM_PROPERTIES
 } RhythmDBPropType;
@@ -318,6 +323,13 @@ struct _RhythmDBClass
 							 RBRefString *keyword);
 	GList*		(*impl_entry_keywords_get)	(RhythmDB *db,
 							 RhythmDBEntry *entry);
+
+	gboolean	(*impl_save_journal)	(RhythmDB *db, GList *deleted, GHashTable *changes);
+
+	void	(*entries_changed)	(RhythmDB *db, GHashTable *changes); /* RhythmDBEntry -> array of RhythmDBEntryChanges */
+
+	/* like impl_save, but reports whether the save succeeded */
+	gboolean	(*impl_save_checked)	(RhythmDB *db);
 };
 
 GType		rhythmdb_get_type	(void);
@@ -600,7 +600,9 @@ rb_application_run (RBApplication *app, int argc, char **argv)
 	GOptionContext *context;
 	gboolean debug = FALSE;
 	char *debug_match = NULL;
+	char *trace_file = NULL;
 	int nargc;
+	int ret;
 	char **nargv;
 
 	GError *error = NULL;
@@ -611,6 +613,7 @@ rb_application_run (RBApplication *app, int argc, char **argv)
 	const GOptionEntry options []  = {
 		{ "debug",           'd', 0, G_OPTION_ARG_NONE,         &debug,           N_("Enable debug output"), NULL },
 		{ "debug-match",     'D', 0, G_OPTION_ARG_STRING,       &debug_match,     N_("Enable debug output matching a specified string"), NULL },
+		{ "trace-file",        0, 0, G_OPTION_ARG_FILENAME,     &trace_file,      N_("Record a performance trace to the specified file"), NULL },
 		{ "no-update",	       0, 0, G_OPTION_ARG_NONE,         &app->priv->no_update, N_("Do not update the library with file changes"), NULL },
 		{ "no-registration", 'n', 0, G_OPTION_ARG_NONE,         &app->priv->no_registration, N_("Do not register the shell"), NULL },
 		{ "dry-run",	       0, 0, G_OPTION_ARG_NONE,         &app->priv->dry_run,         N_("Don't save any data permanently (implies --no-registration)"), NULL },
@@ -641,9 +644,14 @@ rb_application_run (RBApplication *app, int argc, char **argv)
 	else
 		rb_debug_init (debug);
 
+	rb_trace_init (trace_file);
+	g_free (trace_file);
+
 	g_object_set (app, "register-session", !app->priv->no_registration, NULL);
 
-	return g_application_run (G_APPLICATION (app), nargc, nargv);
+	ret = g_application_run (G_APPLICATION (app), nargc, nargv);
+	rb_trace_shutdown ();
+	return ret;
 }
 
 /**
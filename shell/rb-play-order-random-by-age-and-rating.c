@@ -49,6 +49,7 @@ rb_random_play_order_by_age_and_rating_class_init (RBRandomPlayOrderByAgeAndRati
 
 	rorder = RB_RANDOM_PLAY_ORDER_CLASS (klass);
 	rorder->get_entry_weight = rb_random_by_age_and_rating_get_entry_weight;
+	rorder->weights_change_over_time = TRUE;
 }
 
 RBPlayOrder *
@@ -47,6 +47,7 @@ rb_random_play_order_by_age_class_init (RBRandomPlayOrderByAgeClass *klass)
 
 	rorder = RB_RANDOM_PLAY_ORDER_CLASS (klass);
 	rorder->get_entry_weight = rb_random_by_age_get_entry_weight;
+	rorder->weights_change_over_time = TRUE;
 }
 
 RBPlayOrder *
@@ -33,6 +33,14 @@
  * Subclasses only need to override get_entry_weight() to return the
  * right weight for a given entry.
  *
+ * The weights of the entries in the query model are kept in a binary indexed
+ * (Fenwick) tree, so picking an entry and updating the weight of an entry
+ * after it changes both take O(log N) time.  The tree is built when first
+ * needed after the query model changes, and then kept up to date as entries
+ * are added, removed and changed.  Subclasses whose weights depend on the
+ * current time should set weights_change_over_time in their class, which
+ * causes the tree to be rebuilt periodically.
+ *
  * This class also delays committing any changes until the user moves to the
  * next or previous song. So if the user changes the entry-view to contain
  * different songs, but changes it back before the current song finishes, they
@@ -42,6 +50,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <time.h>
 
 #include "rb-play-order-random-by-age.h"
 
@@ -64,16 +73,39 @@ static void rb_random_playing_entry_changed (RBPlayOrder *porder,
 					     RhythmDBEntry *old_entry,
 					     RhythmDBEntry *new_entry);
 static void rb_random_query_model_changed (RBPlayOrder *porder);
+static void rb_random_entry_added (RBPlayOrder *porder, RhythmDBEntry *entry);
+static void rb_random_entry_removed (RBPlayOrder *porder, RhythmDBEntry *entry);
 static void rb_random_db_entry_deleted (RBPlayOrder *porder, RhythmDBEntry *entry);
 
 static void rb_random_handle_query_model_changed (RBRandomPlayOrder *rorder);
 static void rb_random_filter_history (RBRandomPlayOrder *rorder, RhythmDBQueryModel *model);
+static void rb_random_weights_clear (RBRandomPlayOrder *rorder);
+
+/* how often weights that change over time are recalculated, in seconds */
+#define WEIGHT_REFRESH_INTERVAL		60
+
+#define MIN_WEIGHT_CAPACITY		64
 
 struct RBRandomPlayOrderPrivate
 {
 	RBHistory *history;
 
 	gboolean query_model_changed;
+
+	RhythmDBQueryModel *model;
+
+	/* entries in the query model, in no particular order, with their
+	 * weights and a Fenwick tree over the weights.  weight_tree is
+	 * indexed from 1 to weight_capacity, which is a power of two.
+	 */
+	gboolean weights_valid;
+	time_t weights_time;
+	GPtrArray *weight_entries;
+	GHashTable *weight_index;
+	double *weights;
+	double *weight_tree;
+	guint weight_capacity;
+	double total_weight;
 };
 
 G_DEFINE_TYPE (RBRandomPlayOrder, rb_random_play_order, RB_TYPE_PLAY_ORDER)
@@ -90,8 +122,8 @@ rb_random_play_order_class_init (RBRandomPlayOrderClass *klass)
 	porder = RB_PLAY_ORDER_CLASS (klass);
 	porder->db_changed = rb_random_db_changed;
 	porder->playing_entry_changed = rb_random_playing_entry_changed;
-	porder->entry_added = (void (*)(RBPlayOrder*,RhythmDBEntry*))rb_random_query_model_changed;
-	porder->entry_removed = (void (*)(RBPlayOrder*,RhythmDBEntry*))rb_random_query_model_changed;
+	porder->entry_added = rb_random_entry_added;
+	porder->entry_removed = rb_random_entry_removed;
 	porder->query_model_changed = rb_random_query_model_changed;
 	porder->db_entry_deleted = rb_random_db_entry_deleted;
 
@@ -115,6 +147,9 @@ rb_random_play_order_init (RBRandomPlayOrder *rorder)
 	rb_history_set_maximum_size (rorder->priv->history, 50);
 
 	rorder->priv->query_model_changed = TRUE;
+
+	rorder->priv->weight_entries = g_ptr_array_new_with_free_func ((GDestroyNotify) rhythmdb_entry_unref);
+	rorder->priv->weight_index = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 static void
@@ -129,6 +164,14 @@ rb_random_play_order_finalize (GObject *object)
 
 	g_object_unref (G_OBJECT (rorder->priv->history));
 
+	if (rorder->priv->model != NULL) {
+		g_signal_handlers_disconnect_by_data (rorder->priv->model, rorder);
+		g_object_unref (rorder->priv->model);
+	}
+	rb_random_weights_clear (rorder);
+	g_ptr_array_free (rorder->priv->weight_entries, TRUE);
+	g_hash_table_destroy (rorder->priv->weight_index);
+
 	G_OBJECT_CLASS (rb_random_play_order_parent_class)->finalize (object);
 }
 
@@ -147,58 +190,195 @@ get_history (RBRandomPlayOrder *rorder)
 	return rorder->priv->history;
 }
 
-typedef struct {
-	RhythmDBEntry *entry;
-	double weight;
-	double cumulative_weight;
-} EntryWeight;
+static void
+rb_random_weights_clear (RBRandomPlayOrder *rorder)
+{
+	rorder->priv->weights_valid = FALSE;
+	g_hash_table_remove_all (rorder->priv->weight_index);
+	g_ptr_array_set_size (rorder->priv->weight_entries, 0);
+
+	g_free (rorder->priv->weights);
+	g_free (rorder->priv->weight_tree);
+	rorder->priv->weights = NULL;
+	rorder->priv->weight_tree = NULL;
+	rorder->priv->weight_capacity = 0;
+	rorder->priv->total_weight = 0.0;
+}
 
-static GArray *
-get_query_model_contents (RBRandomPlayOrder *rorder, RhythmDBQueryModel *model)
+static void
+rb_random_weights_adjust (RBRandomPlayOrder *rorder, guint index, double delta)
 {
-	guint num_entries;
 	guint i;
+
+	for (i = index + 1; i <= rorder->priv->weight_capacity; i += i & (-i)) {
+		rorder->priv->weight_tree[i] += delta;
+	}
+	rorder->priv->total_weight += delta;
+}
+
+static void
+rb_random_weights_set (RBRandomPlayOrder *rorder, guint index, double weight)
+{
+	rb_random_weights_adjust (rorder, index, weight - rorder->priv->weights[index]);
+	rorder->priv->weights[index] = weight;
+}
+
+static void
+rb_random_weights_build (RBRandomPlayOrder *rorder)
+{
+	RhythmDBQueryModel *model;
 	RhythmDB *db;
-	double weight = 0.0;
-	double cumulative_weight = 0.0;
 	GtkTreeIter iter;
-	GArray *result;
+	guint num_entries;
+	guint i;
+	guint j;
 
-	if (model == NULL) {
-		return NULL;
+	rb_random_weights_clear (rorder);
+
+	model = rorder->priv->model;
+	num_entries = 0;
+	if (model != NULL)
+		num_entries = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL);
+
+	/* leave some room for entries to be added */
+	rorder->priv->weight_capacity = MIN_WEIGHT_CAPACITY;
+	while (rorder->priv->weight_capacity < num_entries + (num_entries / 4))
+		rorder->priv->weight_capacity *= 2;
+	rorder->priv->weights = g_new0 (double, rorder->priv->weight_capacity);
+	rorder->priv->weight_tree = g_new0 (double, rorder->priv->weight_capacity + 1);
+
+	db = rb_play_order_get_db (RB_PLAY_ORDER (rorder));
+	if (model != NULL && gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter)) {
+		do {
+			RhythmDBEntry *entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+			if (entry == NULL)
+				continue;
+
+			/* the model holds a reference, which we take over */
+			i = rorder->priv->weight_entries->len;
+			if (i == rorder->priv->weight_capacity) {
+				rhythmdb_entry_unref (entry);
+				break;
+			}
+			g_ptr_array_add (rorder->priv->weight_entries, entry);
+			g_hash_table_insert (rorder->priv->weight_index, entry, GUINT_TO_POINTER (i + 1));
+			rorder->priv->weights[i] = rb_random_play_order_get_entry_weight (rorder, db, entry);
+			rorder->priv->total_weight += rorder->priv->weights[i];
+		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
 	}
 
-	num_entries = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL);
-	if (num_entries == 0) {
-		return NULL;
+	/* build the tree in linear time by pushing each node's sum up to its parent */
+	for (i = 1; i <= rorder->priv->weight_capacity; i++) {
+		rorder->priv->weight_tree[i] += rorder->priv->weights[i - 1];
+		j = i + (i & (-i));
+		if (j <= rorder->priv->weight_capacity)
+			rorder->priv->weight_tree[j] += rorder->priv->weight_tree[i];
 	}
 
-	if (!gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter))
-		return NULL;
+	rorder->priv->weights_valid = TRUE;
+	time (&rorder->priv->weights_time);
+	rb_debug ("built weight tree for %u entries (total weight %f)",
+		  rorder->priv->weight_entries->len,
+		  rorder->priv->total_weight);
+}
 
-	i = 0;
-	result = g_array_new (FALSE, FALSE, sizeof (EntryWeight));
-	g_array_set_size (result, num_entries);
-	db = rb_play_order_get_db (RB_PLAY_ORDER (rorder));
-	do {
-		RhythmDBEntry *entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+static void
+rb_random_weights_add_entry (RBRandomPlayOrder *rorder, RhythmDBEntry *entry)
+{
+	guint i;
 
-		if (entry == NULL)
-			continue;
+	if (rorder->priv->weights_valid == FALSE)
+		return;
+	if (g_hash_table_lookup (rorder->priv->weight_index, entry) != NULL)
+		return;
 
-		weight = rb_random_play_order_get_entry_weight (rorder, db, entry);
+	i = rorder->priv->weight_entries->len;
+	if (i == rorder->priv->weight_capacity) {
+		/* out of room, so rebuild the tree next time we need it */
+		rb_random_weights_clear (rorder);
+		return;
+	}
 
-		g_array_index (result, EntryWeight, i).entry = entry;
-		g_array_index (result, EntryWeight, i).weight = weight;
-		g_array_index (result, EntryWeight, i).cumulative_weight = cumulative_weight;
-		cumulative_weight += weight;
-		i++;
+	g_ptr_array_add (rorder->priv->weight_entries, rhythmdb_entry_ref (entry));
+	g_hash_table_insert (rorder->priv->weight_index, entry, GUINT_TO_POINTER (i + 1));
+	rb_random_weights_set (rorder, i,
+			       rb_random_play_order_get_entry_weight (rorder,
+								      rb_play_order_get_db (RB_PLAY_ORDER (rorder)),
+								      entry));
+}
 
-		rhythmdb_entry_unref (entry);
+static void
+rb_random_weights_remove_entry (RBRandomPlayOrder *rorder, RhythmDBEntry *entry)
+{
+	guint i;
+	guint last;
 
-	} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
+	if (rorder->priv->weights_valid == FALSE)
+		return;
+	i = GPOINTER_TO_UINT (g_hash_table_lookup (rorder->priv->weight_index, entry));
+	if (i == 0)
+		return;
+	i--;
+
+	/* move the last entry into the slot being vacated */
+	last = rorder->priv->weight_entries->len - 1;
+	rb_random_weights_set (rorder, i, rorder->priv->weights[last]);
+	rb_random_weights_set (rorder, last, 0.0);
+
+	g_hash_table_remove (rorder->priv->weight_index, entry);
+	if (i != last) {
+		g_hash_table_insert (rorder->priv->weight_index,
+				     g_ptr_array_index (rorder->priv->weight_entries, last),
+				     GUINT_TO_POINTER (i + 1));
+	}
+	g_ptr_array_remove_index_fast (rorder->priv->weight_entries, i);
+}
+
+static void
+rb_random_weights_update_entry (RBRandomPlayOrder *rorder, RhythmDBEntry *entry)
+{
+	guint i;
+
+	if (rorder->priv->weights_valid == FALSE)
+		return;
+	i = GPOINTER_TO_UINT (g_hash_table_lookup (rorder->priv->weight_index, entry));
+	if (i == 0)
+		return;
 
-	return result;
+	rb_random_weights_set (rorder, i - 1,
+			       rb_random_play_order_get_entry_weight (rorder,
+								      rb_play_order_get_db (RB_PLAY_ORDER (rorder)),
+								      entry));
+}
+
+/* finds the entry whose sub-segment contains the point 'value' */
+static guint
+rb_random_weights_find (RBRandomPlayOrder *rorder, double value)
+{
+	guint pos = 0;
+	guint step;
+
+	for (step = rorder->priv->weight_capacity; step > 0; step >>= 1) {
+		if (pos + step <= rorder->priv->weight_capacity &&
+		    rorder->priv->weight_tree[pos + step] <= value) {
+			pos += step;
+			value -= rorder->priv->weight_tree[pos];
+		}
+	}
+
+	/* rounding errors could take us past the end */
+	return MIN (pos, rorder->priv->weight_entries->len - 1);
+}
+
+static void
+rb_random_model_entry_prop_changed_cb (RhythmDBQueryModel *model,
+				       RhythmDBEntry *entry,
+				       RhythmDBPropType prop,
+				       const GValue *old,
+				       const GValue *new_value,
+				       RBRandomPlayOrder *rorder)
+{
+	rb_random_weights_update_entry (rorder, entry);
 }
 
 static void
@@ -238,75 +418,48 @@ rb_random_filter_history (RBRandomPlayOrder *rorder, RhythmDBQueryModel *model)
 	g_ptr_array_free (history_contents, TRUE);
 }
 
-static inline double
-rb_random_get_total_weight (GArray *weights)
-{
-	EntryWeight *last;
-
-	g_return_val_if_fail (weights, 0.0);
-	if (weights->len == 0)
-		return 0.0;
-
-	last = &g_array_index (weights,
-			       EntryWeight,
-			       weights->len - 1);
-	return last->cumulative_weight + last->weight;
-}
-
 static RhythmDBEntry*
 rb_random_play_order_pick_entry (RBRandomPlayOrder *rorder)
 {
-	/* This is O(N) because we traverse the query model to get the entries
-	 * and weights.
-	 *
-	 * The general idea of this algorithm is that there is a line segment
+	/* The general idea of this algorithm is that there is a line segment
 	 * whose length is the sum of all the entries' weights. Each entry gets
 	 * a sub-segment whose length is equal to that entry's weight. A random
 	 * point is picked in the line segment, and the entry that point
 	 * belongs to is returned.
 	 *
-	 * The algorithm was contributed by treed.
+	 * The algorithm was contributed by treed.  The weights are kept in a
+	 * Fenwick tree, so finding the entry is O(log N).
 	 */
-	double total_weight, rnd;
-	int high, low;
-	GArray *entry_weights;
-	RhythmDBEntry *entry;
-	RhythmDBQueryModel *model;
+	double rnd;
+	guint num_entries;
+	guint i;
+	time_t now;
 
-	model = rb_play_order_get_query_model (RB_PLAY_ORDER (rorder));
-	entry_weights = get_query_model_contents (rorder, model);
-	if (entry_weights == NULL) {
-		rb_debug ("nothing to choose from");
-		return NULL;
+	time (&now);
+	if (rorder->priv->weights_valid == FALSE ||
+	    (RB_RANDOM_PLAY_ORDER_GET_CLASS (rorder)->weights_change_over_time &&
+	     now - rorder->priv->weights_time > WEIGHT_REFRESH_INTERVAL)) {
+		rb_random_weights_build (rorder);
 	}
 
-	total_weight = rb_random_get_total_weight (entry_weights);
-	if (total_weight == 0.0) {
-		low = g_random_int_range (0, entry_weights->len);
-		rb_debug ("total weight is 0; picked entry %d of %d randomly", low, entry_weights->len);
-		entry = g_array_index (entry_weights, EntryWeight, low).entry;
-		g_array_free (entry_weights, TRUE);
-		return entry;
+	num_entries = rorder->priv->weight_entries->len;
+	if (num_entries == 0) {
+		rb_debug ("nothing to choose from");
+		return NULL;
 	}
 
-	rnd = g_random_double_range (0, total_weight);
-	/* Binary search for the entry with cumulative weight closest to but
-	 * less than rnd */
-	low = -1; high = entry_weights->len;
-	while (high - low > 1) {
-		int mid = (high + low) / 2;
-		if (g_array_index (entry_weights, EntryWeight, mid).cumulative_weight > rnd)
-			high = mid;
-		else
-			low = mid;
+	if (rorder->priv->total_weight <= 0.0) {
+		i = g_random_int_range (0, num_entries);
+		rb_debug ("total weight is 0; picked entry %u of %u randomly", i, num_entries);
+		return g_ptr_array_index (rorder->priv->weight_entries, i);
 	}
-	entry = g_array_index (entry_weights, EntryWeight, low).entry;
-	rb_debug ("picked entry %d of %d (total weight %f) for random value %f",
-		  low, entry_weights->len, total_weight, rnd);
 
-	g_array_free (entry_weights, TRUE);
+	rnd = g_random_double_range (0, rorder->priv->total_weight);
+	i = rb_random_weights_find (rorder, rnd);
+	rb_debug ("picked entry %u of %u (total weight %f) for random value %f",
+		  i, num_entries, rorder->priv->total_weight, rnd);
 
-	return entry;
+	return g_ptr_array_index (rorder->priv->weight_entries, i);
 }
 
 static RhythmDBEntry*
@@ -436,6 +589,12 @@ rb_random_playing_entry_changed (RBPlayOrder *porder,
 	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
 	rorder = RB_RANDOM_PLAY_ORDER (porder);
 
+	/* weights may depend on which entry is playing */
+	if (old_entry)
+		rb_random_weights_update_entry (rorder, old_entry);
+	if (new_entry)
+		rb_random_weights_update_entry (rorder, new_entry);
+
 	if (new_entry) {
 		if (new_entry == rb_history_current (get_history (rorder))) {
 			/* Do nothing */
@@ -449,8 +608,59 @@ rb_random_playing_entry_changed (RBPlayOrder *porder,
 static void
 rb_random_query_model_changed (RBPlayOrder *porder)
 {
+	RBRandomPlayOrder *rorder;
+	RhythmDBQueryModel *model;
+
+	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
+	rorder = RB_RANDOM_PLAY_ORDER (porder);
+	rorder->priv->query_model_changed = TRUE;
+
+	model = rb_play_order_get_query_model (porder);
+	if (model == rorder->priv->model)
+		return;
+
+	if (rorder->priv->model != NULL) {
+		g_signal_handlers_disconnect_by_func (rorder->priv->model,
+						      G_CALLBACK (rb_random_model_entry_prop_changed_cb),
+						      rorder);
+		g_object_unref (rorder->priv->model);
+	}
+
+	rorder->priv->model = model;
+	if (model != NULL) {
+		g_object_ref (model);
+		g_signal_connect_object (model,
+					 "entry-prop-changed",
+					 G_CALLBACK (rb_random_model_entry_prop_changed_cb),
+					 rorder, 0);
+	}
+
+	/* rebuild the weight tree next time we pick an entry */
+	rb_random_weights_clear (rorder);
+}
+
+static void
+rb_random_entry_added (RBPlayOrder *porder, RhythmDBEntry *entry)
+{
+	RBRandomPlayOrder *rorder;
+
 	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
-	RB_RANDOM_PLAY_ORDER (porder)->priv->query_model_changed = TRUE;
+	rorder = RB_RANDOM_PLAY_ORDER (porder);
+
+	rorder->priv->query_model_changed = TRUE;
+	rb_random_weights_add_entry (rorder, entry);
+}
+
+static void
+rb_random_entry_removed (RBPlayOrder *porder, RhythmDBEntry *entry)
+{
+	RBRandomPlayOrder *rorder;
+
+	g_return_if_fail (RB_IS_RANDOM_PLAY_ORDER (porder));
+	rorder = RB_RANDOM_PLAY_ORDER (porder);
+
+	rorder->priv->query_model_changed = TRUE;
+	rb_random_weights_remove_entry (rorder, entry);
 }
 
 static void
@@ -68,6 +68,9 @@ struct _RBRandomPlayOrderClass
 	 * Return value: weighting for @entry
 	 */
 	double (*get_entry_weight) (RBRandomPlayOrder *rorder, RhythmDB *db, RhythmDBEntry *entry);
+
+	/* set if get_entry_weight depends on the current time */
+	gboolean weights_change_over_time;
 };
 
 GType				rb_random_play_order_get_type		(void);
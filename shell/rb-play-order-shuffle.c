@@ -26,6 +26,17 @@
  *
  */
 
+/*
+ * The shuffle order is a Fisher-Yates shuffle that is only carried out as far
+ * as it's needed.  The history holds the part of the order that has been
+ * decided so far, and the pool holds the remaining entries in no particular
+ * order.  Moving past the end of the history takes a random entry from the
+ * pool and appends it to the history.  Entries added to the query model just
+ * go into the pool, and entries removed from it are taken out of either the
+ * pool or the history, so changes to the query model never require the whole
+ * order to be rebuilt.
+ */
+
 #include "config.h"
 
 #include <string.h>
@@ -47,7 +58,8 @@ static RhythmDBEntry* rb_shuffle_play_order_get_previous (RBPlayOrder* method);
 static void rb_shuffle_play_order_go_previous (RBPlayOrder* method);
 
 static void rb_shuffle_sync_history_with_query_model (RBShufflePlayOrder *sorder);
-static GPtrArray *get_query_model_contents (RhythmDBQueryModel *model);
+static gboolean rb_shuffle_extend_history (RBShufflePlayOrder *sorder);
+static void rb_shuffle_pool_clear (RBShufflePlayOrder *sorder);
 
 static void rb_shuffle_db_changed (RBPlayOrder *porder, RhythmDB *db);
 static void rb_shuffle_playing_entry_changed (RBPlayOrder *porder,
@@ -57,7 +69,6 @@ static void rb_shuffle_entry_added (RBPlayOrder *porder, RhythmDBEntry *entry);
 static void rb_shuffle_entry_removed (RBPlayOrder *porder, RhythmDBEntry *entry);
 static void rb_shuffle_query_model_changed (RBPlayOrder *porder);
 static void rb_shuffle_db_entry_deleted (RBPlayOrder *porder, RhythmDBEntry *entry);
-static gboolean query_model_and_history_contents_match (RBShufflePlayOrder *sorder);
 
 struct RBShufflePlayOrderPrivate
 {
@@ -69,6 +80,12 @@ struct RBShufflePlayOrderPrivate
 	GHashTable *entries_removed;
 	GHashTable *entries_added;
 
+	/* entries not yet placed in the history, and their positions in the
+	 * pool array (plus one)
+	 */
+	GPtrArray *pool;
+	GHashTable *pool_index;
+
 	/* stores the playing entry if it comes from outside the query model */
 	RhythmDBEntry *external_playing_entry;
 };
@@ -130,6 +147,9 @@ rb_shuffle_play_order_init (RBShufflePlayOrder *sorder)
 							     (GDestroyNotify)rhythmdb_entry_unref, NULL);
 	sorder->priv->entries_removed = g_hash_table_new_full (g_direct_hash, g_direct_equal,
 							       (GDestroyNotify)rhythmdb_entry_unref, NULL);
+
+	sorder->priv->pool = g_ptr_array_new ();
+	sorder->priv->pool_index = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 static void
@@ -152,6 +172,8 @@ rb_shuffle_play_order_dispose (GObject *object)
 		sorder->priv->history = NULL;
 	}
 
+	rb_shuffle_pool_clear (sorder);
+
 	G_OBJECT_CLASS (rb_shuffle_play_order_parent_class)->dispose (object);
 }
 
@@ -167,6 +189,8 @@ rb_shuffle_play_order_finalize (GObject *object)
 
 	g_hash_table_destroy (sorder->priv->entries_added);
 	g_hash_table_destroy (sorder->priv->entries_removed);
+	g_ptr_array_free (sorder->priv->pool, TRUE);
+	g_hash_table_destroy (sorder->priv->pool_index);
 
 	G_OBJECT_CLASS (rb_shuffle_play_order_parent_class)->finalize (object);
 }
@@ -191,7 +215,8 @@ rb_shuffle_play_order_get_next (RBPlayOrder* porder)
 	if (current != NULL &&
 	    (current == sorder->priv->external_playing_entry ||
 	    current == rb_history_current (sorder->priv->history))) {
-		if (rb_history_current (sorder->priv->history) != rb_history_last (sorder->priv->history)) {
+		if (rb_history_current (sorder->priv->history) != rb_history_last (sorder->priv->history) ||
+		    rb_shuffle_extend_history (sorder)) {
 			rb_debug ("choosing next entry in shuffle");
 			entry = rb_history_next (sorder->priv->history);
 			if (entry)
@@ -203,8 +228,11 @@ rb_shuffle_play_order_get_next (RBPlayOrder* porder)
 		rb_debug ("choosing current entry in shuffle");
 		entry = rb_history_current (sorder->priv->history);
 
-		if (entry == NULL)
+		if (entry == NULL) {
+			if (rb_history_length (sorder->priv->history) == 0)
+				rb_shuffle_extend_history (sorder);
 			entry = rb_history_first (sorder->priv->history);
+		}
 
 		if (entry != NULL)
 			rhythmdb_entry_ref (entry);
@@ -233,11 +261,14 @@ rb_shuffle_play_order_go_next (RBPlayOrder* porder)
 		  entry == rb_history_current (sorder->priv->history)));
 
 	if (rb_history_current (sorder->priv->history) == NULL)  {
+		if (rb_history_length (sorder->priv->history) == 0)
+			rb_shuffle_extend_history (sorder);
 		rb_history_go_first (sorder->priv->history);
 	} else if (entry == rb_history_current (sorder->priv->history) ||
 		   (sorder->priv->external_playing_entry != NULL &&
 		    entry == sorder->priv->external_playing_entry)) {
-		if (rb_history_current (sorder->priv->history) != rb_history_last (sorder->priv->history))
+		if (rb_history_current (sorder->priv->history) != rb_history_last (sorder->priv->history) ||
+		    rb_shuffle_extend_history (sorder))
 			rb_history_go_next (sorder->priv->history);
 	}
 
@@ -304,16 +335,84 @@ rb_shuffle_play_order_go_previous (RBPlayOrder* porder)
 	}
 }
 
+static void
+rb_shuffle_pool_add (RBShufflePlayOrder *sorder, RhythmDBEntry *entry)
+{
+	/* the pool takes over the caller's reference */
+	g_ptr_array_add (sorder->priv->pool, entry);
+	g_hash_table_insert (sorder->priv->pool_index, entry, GUINT_TO_POINTER (sorder->priv->pool->len));
+}
+
+static void
+rb_shuffle_pool_remove_index (RBShufflePlayOrder *sorder, guint index)
+{
+	RhythmDBEntry *last;
+
+	g_hash_table_remove (sorder->priv->pool_index, g_ptr_array_index (sorder->priv->pool, index));
+
+	/* move the last entry into the gap */
+	last = g_ptr_array_index (sorder->priv->pool, sorder->priv->pool->len - 1);
+	if (index != sorder->priv->pool->len - 1)
+		g_hash_table_insert (sorder->priv->pool_index, last, GUINT_TO_POINTER (index + 1));
+	g_ptr_array_remove_index_fast (sorder->priv->pool, index);
+}
+
+/* removes the entry from the pool, giving its reference to the caller */
+static gboolean
+rb_shuffle_pool_take (RBShufflePlayOrder *sorder, RhythmDBEntry *entry)
+{
+	guint index;
+
+	index = GPOINTER_TO_UINT (g_hash_table_lookup (sorder->priv->pool_index, entry));
+	if (index == 0)
+		return FALSE;
+
+	rb_shuffle_pool_remove_index (sorder, index - 1);
+	return TRUE;
+}
+
+static void
+rb_shuffle_pool_clear (RBShufflePlayOrder *sorder)
+{
+	guint i;
+
+	for (i = 0; i < sorder->priv->pool->len; i++) {
+		rhythmdb_entry_unref (g_ptr_array_index (sorder->priv->pool, i));
+	}
+	g_ptr_array_set_size (sorder->priv->pool, 0);
+	g_hash_table_remove_all (sorder->priv->pool_index);
+}
+
+/*
+ * Takes the next step of the shuffle: moves a random entry from the pool
+ * to the end of the history.  Returns FALSE if the pool is empty.
+ */
+static gboolean
+rb_shuffle_extend_history (RBShufflePlayOrder *sorder)
+{
+	RhythmDBEntry *entry;
+	guint index;
+
+	if (sorder->priv->pool->len == 0)
+		return FALSE;
+
+	index = g_random_int_range (0, sorder->priv->pool->len);
+	entry = g_ptr_array_index (sorder->priv->pool, index);
+	rb_shuffle_pool_remove_index (sorder, index);
+
+	/* the history takes the pool's reference */
+	rb_history_append (sorder->priv->history, entry);
+	return TRUE;
+}
+
 static void
 handle_query_model_changed (RBShufflePlayOrder *sorder)
 {
-	GPtrArray *history;
 	RhythmDBEntry *entry;
 	RhythmDBEntry *playing_entry;
 	RhythmDBQueryModel *model;
 	GtkTreeIter iter;
 	gboolean found_playing_entry;
-	int i;
 
 	if (!sorder->priv->query_model_changed)
 		return;
@@ -324,32 +423,33 @@ handle_query_model_changed (RBShufflePlayOrder *sorder)
 	playing_entry = rb_play_order_get_playing_entry (RB_PLAY_ORDER (sorder));
 
 	/* This simulates removing every entry in the old query model
-	 * and then adding every entry in the new one. */
-	history = rb_history_dump (sorder->priv->history);
+	 * and then adding every entry in the new one, except that the
+	 * playing entry stays where it is.  The new entries all go into
+	 * the pool, so nothing is shuffled until it's needed.
+	 */
+	rb_shuffle_pool_clear (sorder);
 	found_playing_entry = FALSE;
-	for (i=0; i < history->len; ++i) {
-		entry = g_ptr_array_index (history, i);
-		g_hash_table_insert (sorder->priv->entries_removed, rhythmdb_entry_ref (entry), entry);
-		if (entry == playing_entry)
-			found_playing_entry = TRUE;
-	}
-	g_ptr_array_free (history, TRUE);
 
 	model = rb_play_order_get_query_model (RB_PLAY_ORDER (sorder));
-	if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter)) {
+	if (model != NULL && gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter)) {
 		do {
 			entry = rhythmdb_query_model_iter_to_entry (model, &iter);
-			/* don't move the playing entry */
-			if (found_playing_entry && (entry == playing_entry)) {
-				g_hash_table_remove (sorder->priv->entries_removed, entry);
+			if (entry == playing_entry &&
+			    rb_history_contains_entry (sorder->priv->history, entry)) {
+				found_playing_entry = TRUE;
 				rhythmdb_entry_unref (entry);
 			} else {
-				/* hash table takes the reference we got from the query model */
-				g_hash_table_insert (sorder->priv->entries_added, entry, entry);
+				/* pool takes the reference we got from the query model */
+				rb_shuffle_pool_add (sorder, entry);
 			}
 		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
 	}
 
+	rb_history_clear (sorder->priv->history);
+	if (found_playing_entry) {
+		rb_history_set_playing (sorder->priv->history, rhythmdb_entry_ref (playing_entry));
+	}
+
 	if (playing_entry)
 		rhythmdb_entry_unref (playing_entry);
 
@@ -359,29 +459,24 @@ handle_query_model_changed (RBShufflePlayOrder *sorder)
 static gboolean
 remove_from_history (RhythmDBEntry *entry, gpointer *unused, RBShufflePlayOrder *sorder)
 {
-	if (rb_history_contains_entry (sorder->priv->history, entry)) {
+	if (rb_shuffle_pool_take (sorder, entry)) {
+		rhythmdb_entry_unref (entry);
+	} else if (rb_history_contains_entry (sorder->priv->history, entry)) {
 		rb_history_remove_entry (sorder->priv->history, entry);
 	}
 	return TRUE;
 }
 
 static gboolean
-add_randomly_to_history (RhythmDBEntry *entry, gpointer *unused, RBShufflePlayOrder *sorder)
+add_to_pool (RhythmDBEntry *entry, gpointer *unused, RBShufflePlayOrder *sorder)
 {
-	gint history_size;
-	gint current_index;
-
-	if (rb_history_contains_entry (sorder->priv->history, entry))
+	if (rb_history_contains_entry (sorder->priv->history, entry) ||
+	    g_hash_table_lookup (sorder->priv->pool_index, entry) != NULL)
 		return TRUE;
 
-	history_size = rb_history_length (sorder->priv->history);
-	current_index = rb_history_get_current_index (sorder->priv->history);
-	/* Insert entry into the history at a random position between
-	 * just after current and the very end. */
-	rb_history_insert_at_index (sorder->priv->history,
-				    rhythmdb_entry_ref (entry),
-				    g_random_int_range (MIN (current_index, history_size-1) + 1,
-							history_size + 1));
+	/* Adding to the pool is equivalent to inserting the entry at a random
+	 * position in the part of the shuffle that hasn't been decided yet. */
+	rb_shuffle_pool_add (sorder, rhythmdb_entry_ref (entry));
 	return TRUE;
 }
 
@@ -392,11 +487,21 @@ rb_shuffle_sync_history_with_query_model (RBShufflePlayOrder *sorder)
 
 	handle_query_model_changed (sorder);
 	g_hash_table_foreach_remove (sorder->priv->entries_removed, (GHRFunc) remove_from_history, sorder);
-	g_hash_table_foreach_remove (sorder->priv->entries_added, (GHRFunc) add_randomly_to_history, sorder);
+	g_hash_table_foreach_remove (sorder->priv->entries_added, (GHRFunc) add_to_pool, sorder);
 
 	if (sorder->priv->external_playing_entry != NULL) {
-		if (rb_history_contains_entry (sorder->priv->history,
-					       sorder->priv->external_playing_entry)) {
+		if (rb_shuffle_pool_take (sorder, sorder->priv->external_playing_entry)) {
+			/* the previously external entry is now in the query model,
+			 * so it becomes the playing entry in the history, which
+			 * takes the pool's reference.
+			 */
+			rb_history_set_playing (sorder->priv->history,
+						sorder->priv->external_playing_entry);
+			rhythmdb_entry_unref (sorder->priv->external_playing_entry);
+			sorder->priv->external_playing_entry = NULL;
+			current = NULL;
+		} else if (rb_history_contains_entry (sorder->priv->history,
+						      sorder->priv->external_playing_entry)) {
 			/* history now contains the previously external entry, so
 			 * use it as the playing entry.
 			 */
@@ -416,47 +521,21 @@ rb_shuffle_sync_history_with_query_model (RBShufflePlayOrder *sorder)
 	}
 
 	/* postconditions */
-	g_assert (query_model_and_history_contents_match (sorder));
 	g_assert (g_hash_table_size (sorder->priv->entries_added) == 0);
 	g_assert (g_hash_table_size (sorder->priv->entries_removed) == 0);
 }
 
-/* NOTE: returned GPtrArray does not hold references to the entries */
-static GPtrArray *
-get_query_model_contents (RhythmDBQueryModel *model)
-{
-	guint num_entries;
-	guint i = 0;
-	GtkTreeIter iter;
-
-	GPtrArray *result = g_ptr_array_new ();
-	if (model == NULL)
-		return result;
-
-	num_entries = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL);
-	if (num_entries == 0)
-		return result;
-
-	g_ptr_array_set_size (result, num_entries);
-
-	if (!gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter))
-		return result;
-	do {
-		RhythmDBEntry *entry;
-		entry = rhythmdb_query_model_iter_to_entry (model, &iter);
-		g_ptr_array_index (result, i++) = entry;
-		rhythmdb_entry_unref (entry);
-	} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
-
-	return result;
-}
-
 static void
 rb_shuffle_db_changed (RBPlayOrder *porder, RhythmDB *db)
 {
+	RBShufflePlayOrder *sorder;
+
 	g_return_if_fail (RB_IS_SHUFFLE_PLAY_ORDER (porder));
+	sorder = RB_SHUFFLE_PLAY_ORDER (porder);
 
-	rb_history_clear (RB_SHUFFLE_PLAY_ORDER (porder)->priv->history);
+	rb_history_clear (sorder->priv->history);
+	rb_shuffle_pool_clear (sorder);
+	sorder->priv->query_model_changed = TRUE;
 }
 
 static void
@@ -480,6 +559,11 @@ rb_shuffle_playing_entry_changed (RBPlayOrder *porder,
 		} else if (rb_history_contains_entry (sorder->priv->history, new_entry)) {
 			rhythmdb_entry_ref (new_entry);
 			rb_history_set_playing (sorder->priv->history, new_entry);
+		} else if (rb_shuffle_pool_take (sorder, new_entry)) {
+			/* not reached in the shuffle yet, so it goes next;
+			 * the history takes the pool's reference.
+			 */
+			rb_history_set_playing (sorder->priv->history, new_entry);
 		} else {
 			/* playing an entry outside the query model;
 			 * track the entry separately as if it was between
@@ -490,7 +574,8 @@ rb_shuffle_playing_entry_changed (RBPlayOrder *porder,
 		}
 	} else {
 		/* go back to the start if we just finished the play order */
-		if (old_entry == rb_history_last (sorder->priv->history))
+		if (old_entry == rb_history_last (sorder->priv->history) &&
+		    sorder->priv->pool->len == 0)
 			rb_history_go_first (sorder->priv->history);
 	}
 }
@@ -527,44 +612,6 @@ rb_shuffle_db_entry_deleted (RBPlayOrder *porder, RhythmDBEntry *entry)
 	sorder = RB_SHUFFLE_PLAY_ORDER (porder);
 
 	rb_history_remove_entry (sorder->priv->history, entry);
-}
-
-/* For some reason g_ptr_array_sort() passes pointers to the array elements
- * rather than the elements themselves */
-static gint
-ptr_compare (gconstpointer a, gconstpointer b)
-{
-	if (*(gconstpointer*)a < *(gconstpointer*)b)
-		return -1;
-	if (*(gconstpointer*)b < *(gconstpointer*)a)
-		return 1;
-	return 0;
-}
-
-static gboolean
-query_model_and_history_contents_match (RBShufflePlayOrder *sorder)
-{
-	gboolean result = TRUE;
-	GPtrArray *history_contents;
-	GPtrArray *query_model_contents;
-
-	history_contents = rb_history_dump (sorder->priv->history);
-	query_model_contents = get_query_model_contents (rb_play_order_get_query_model (RB_PLAY_ORDER (sorder)));
-
-	if (history_contents->len != query_model_contents->len)
-		result = FALSE;
-	else {
-		int i;
-		g_ptr_array_sort (history_contents, ptr_compare);
-		g_ptr_array_sort (query_model_contents, ptr_compare);
-		for (i=0; i<history_contents->len; ++i) {
-			if (g_ptr_array_index (history_contents, i) != g_ptr_array_index (query_model_contents, i)) {
-				result = FALSE;
-				break;
-			}
-		}
-	}
-	g_ptr_array_free (history_contents, TRUE);
-	g_ptr_array_free (query_model_contents, TRUE);
-	return result;
+	if (rb_shuffle_pool_take (sorder, entry))
+		rhythmdb_entry_unref (entry);
 }
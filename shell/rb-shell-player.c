@@ -187,9 +187,25 @@ static void _play_order_description_free (RBPlayOrderDescription *order);
 
 static RBPlayOrder* rb_play_order_new (RBShellPlayer *player, const char* porder_name);
 
-/* number of nanoseconds before the end of a track to start prerolling the next */
+/* default number of nanoseconds before the end of a track to start prerolling
+ * the next, unless the player reports that streams take longer than this to preroll.
+ */
 #define PREROLL_TIME		RB_PLAYER_SECOND
 
+/* upper limit on how early we'll start prerolling the next track */
+#define PREROLL_TIME_MAX	(15 * RB_PLAYER_SECOND)
+
+/* how often (in milliseconds) we need the player to tell us the playback
+ * position.  this is enough to keep elapsed-changed up to date.  when the end
+ * of the track is close, we need to know more precisely when to start the
+ * transition to the next track.
+ */
+#define TICK_INTERVAL			1000
+#define TICK_INTERVAL_TRANSITION	200
+
+/* how long before the transition check we start ticking more often */
+#define TICK_TRANSITION_MARGIN	(2 * RB_PLAYER_SECOND)
+
 struct RBShellPlayerPrivate
 {
 	RhythmDB *db;
@@ -213,6 +229,10 @@ struct RBShellPlayerPrivate
 
 	guint elapsed;
 	gint64 track_transition_time;
+	gint64 preroll_time;
+	gint64 preroll_latency;
+	guint tick_subscription;
+	guint transition_tick_subscription;
 	RhythmDBEntry *playing_entry;
 	gboolean playing_entry_eos;
 
@@ -318,8 +338,13 @@ reemit_playing_signal (RBShellPlayer *player,
 		       GParamSpec *pspec,
 		       gpointer data)
 {
-	g_signal_emit (player, rb_shell_player_signals[PLAYING_CHANGED], 0,
-		       rb_player_playing (player->priv->mmplayer));
+	gboolean playing;
+
+	playing = rb_player_playing (player->priv->mmplayer);
+	rb_trace_instant ("player", playing ? "playing" : "not playing");
+	rb_trace_counter_set ("player.playing", playing);
+
+	g_signal_emit (player, rb_shell_player_signals[PLAYING_CHANGED], 0, playing);
 }
 
 static void
@@ -923,6 +948,13 @@ player_settings_changed_cb (GSettings *settings, const char *key, RBShellPlayer
 		rb_debug ("track transition time changed");
 		newtime = g_settings_get_double (player->priv->settings, "transition-time");
 		player->priv->track_transition_time = newtime * RB_PLAYER_SECOND;
+	} else if (g_strcmp0 (key, "preroll-time") == 0) {
+		double newtime;
+		newtime = g_settings_get_double (player->priv->settings, "preroll-time");
+		rb_debug ("preroll time changed to %f", newtime);
+		player->priv->preroll_time = newtime * RB_PLAYER_SECOND;
+		if (player->priv->preroll_time <= 0)
+			player->priv->preroll_time = PREROLL_TIME;
 	}
 }
 
@@ -2120,6 +2152,8 @@ rb_shell_player_stop (RBShellPlayer *player)
 
 	g_return_if_fail (RB_IS_SHELL_PLAYER (player));
 
+	rb_trace_instant ("player", "stop");
+
 	if (error == NULL)
 		rb_player_close (player->priv->mmplayer, NULL, &error);
 	if (error) {
@@ -2248,6 +2282,44 @@ rb_shell_player_get_playing_time (RBShellPlayer *player,
 	}
 }
 
+/**
+ * rb_shell_player_add_elapsed_subscription:
+ * @player: the #RBShellPlayer
+ * @interval: the longest acceptable time between updates, in milliseconds
+ *
+ * Requests that the 'elapsed-changed' and 'elapsed-nano-changed' signals
+ * be emitted at least every @interval milliseconds during playback.
+ * Without any subscriptions, the playback position is only reported
+ * about once a second.  Subscriptions should be removed when the
+ * caller no longer needs the extra precision, for example when
+ * the widget displaying the playback position is hidden.
+ *
+ * Return value: subscription ID, to be passed to #rb_shell_player_remove_elapsed_subscription
+ */
+guint
+rb_shell_player_add_elapsed_subscription (RBShellPlayer *player, guint interval)
+{
+	g_return_val_if_fail (player->priv->mmplayer != NULL, 0);
+
+	return rb_player_add_tick_subscription (player->priv->mmplayer, interval);
+}
+
+/**
+ * rb_shell_player_remove_elapsed_subscription:
+ * @player: the #RBShellPlayer
+ * @id: subscription ID returned by #rb_shell_player_add_elapsed_subscription
+ *
+ * Removes a subscription to playback position updates.
+ */
+void
+rb_shell_player_remove_elapsed_subscription (RBShellPlayer *player, guint id)
+{
+	if (player->priv->mmplayer == NULL)
+		return;
+
+	rb_player_remove_tick_subscription (player->priv->mmplayer, id);
+}
+
 /**
  * rb_shell_player_set_playing_time:
  * @player: the #RBShellPlayer
@@ -2505,6 +2577,9 @@ playing_stream_cb (RBPlayer *mmplayer,
 	player->priv->playing_entry = rhythmdb_entry_ref (entry);
 	player->priv->playing_entry_eos = FALSE;
 
+	rb_trace_instant ("player", "playing stream");
+	rb_trace_counter_add ("player.streams", 1);
+
 	if (entry_changed) {
 		const char *location;
 
@@ -2543,6 +2618,8 @@ error_cb (RBPlayer *mmplayer,
 	if (entry != player->priv->playing_entry) {
 		rb_debug ("got error for unexpected entry %p (expected %p)", entry, player->priv->playing_entry);
 	} else {
+		rb_trace_instant ("player", "error");
+		rb_trace_counter_add ("player.errors", 1);
 		rb_shell_player_error (player, TRUE, err);
 		rb_debug ("exiting error hander");
 	}
@@ -2598,13 +2675,34 @@ tick_cb (RBPlayer *mmplayer,
 		/* XXX update duration in various things? */
 	}
 
-	/* check if we should start a crossfade */
+	/* check if we should start prerolling the next track, or a crossfade.
+	 * when crossfading, the fade starts as soon as the next track is
+	 * opened, so we can't start any earlier than the transition time.
+	 * otherwise the next track is only prerolled, so allow twice the
+	 * recent preroll time so slow sources still have time to get ready.
+	 */
 	if (rb_player_multiple_open (mmplayer)) {
-		if (player->priv->track_transition_time < PREROLL_TIME) {
-			remaining_check = PREROLL_TIME;
+		if (player->priv->track_transition_time > 0) {
+			remaining_check = MAX (PREROLL_TIME, player->priv->track_transition_time);
 		} else {
-			remaining_check = player->priv->track_transition_time;
+			remaining_check = MAX (player->priv->preroll_time, 2 * player->priv->preroll_latency);
+			remaining_check = MIN (remaining_check, PREROLL_TIME_MAX);
+		}
+	}
+
+	/* tick more often as we approach the point where we need to
+	 * start the transition, so we don't start it late.
+	 */
+	if (remaining_check > 0 &&
+	    duration > 0 &&
+	    (duration - elapsed) <= remaining_check + TICK_TRANSITION_MARGIN) {
+		if (player->priv->transition_tick_subscription == 0) {
+			player->priv->transition_tick_subscription =
+				rb_player_add_tick_subscription (mmplayer, TICK_INTERVAL_TRANSITION);
 		}
+	} else if (player->priv->transition_tick_subscription != 0) {
+		rb_player_remove_tick_subscription (mmplayer, player->priv->transition_tick_subscription);
+		player->priv->transition_tick_subscription = 0;
 	}
 
 	/*
@@ -2624,6 +2722,25 @@ tick_cb (RBPlayer *mmplayer,
 	}
 }
 
+static void
+preroll_latency_changed_cb (GObject *mmplayer, GParamSpec *pspec, RBShellPlayer *player)
+{
+	gint64 latency;
+
+	/* keep a decaying average, so one slow stream doesn't make us
+	 * preroll early for the rest of the session.
+	 */
+	g_object_get (mmplayer, "preroll-latency", &latency, NULL);
+	if (player->priv->preroll_latency == 0) {
+		player->priv->preroll_latency = latency;
+	} else {
+		player->priv->preroll_latency = (3 * player->priv->preroll_latency + latency) / 4;
+	}
+	rb_debug ("preroll took %" G_GINT64_FORMAT " ms, recent average %" G_GINT64_FORMAT " ms",
+		  latency / (RB_PLAYER_SECOND / 1000),
+		  player->priv->preroll_latency / (RB_PLAYER_SECOND / 1000));
+}
+
 typedef struct {
 	RhythmDBEntry *entry;
 	RBShellPlayer *player;
@@ -2984,6 +3101,7 @@ rb_shell_player_constructed (GObject *object)
 	gtk_application_add_accelerator (GTK_APPLICATION (app), "<Ctrl>u", "app.play-shuffle", g_variant_new_boolean (TRUE));
 
 	player_settings_changed_cb (player->priv->settings, "transition-time", player);
+	player_settings_changed_cb (player->priv->settings, "preroll-time", player);
 	player_settings_changed_cb (player->priv->settings, "play-order", player);
 
 	action = g_action_map_lookup_action (G_ACTION_MAP (app), "play-previous");
@@ -3316,6 +3434,14 @@ rb_shell_player_init (RBShellPlayer *player)
 				 "tick",
 				 G_CALLBACK (tick_cb),
 				 player, 0);
+	player->priv->tick_subscription =
+		rb_player_add_tick_subscription (player->priv->mmplayer, TICK_INTERVAL);
+
+	/* only emitted by player backends that measure preroll latency */
+	g_signal_connect_object (player->priv->mmplayer,
+				 "notify::preroll-latency",
+				 G_CALLBACK (preroll_latency_changed_cb),
+				 player, 0);
 
 	g_signal_connect_object (player->priv->mmplayer,
 				 "error",
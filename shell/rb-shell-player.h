@@ -121,6 +121,10 @@ gboolean		rb_shell_player_set_playing_time(RBShellPlayer *player,
 gboolean		rb_shell_player_seek		(RBShellPlayer *player,
 							 gint32 offset,
 							 GError **error);
+guint			rb_shell_player_add_elapsed_subscription (RBShellPlayer *player,
+							 guint interval);
+void			rb_shell_player_remove_elapsed_subscription (RBShellPlayer *player,
+							 guint id);
 long			rb_shell_player_get_playing_song_duration (RBShellPlayer *player);
 
 gboolean		rb_shell_player_get_playing	(RBShellPlayer *player,
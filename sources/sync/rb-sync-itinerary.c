@@ -0,0 +1,634 @@
+/*
+ *  Copyright (C) 2010 Jonathan Matthew <jonathan@d14n.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * The itinerary is made up of the tracks in each enabled sync group (all
+ * music, a playlist, a podcast feed, ..).  The tracks in each group are
+ * kept between updates so toggling one group doesn't involve looking at
+ * the others again, and the track uuid for each entry is kept until the
+ * entry changes.
+ *
+ * This doesn't know anything about the device or the shell, so the
+ * playlists to consider are passed in when building the itinerary.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "rb-sync-itinerary.h"
+#include "rb-util.h"
+#include "rb-debug.h"
+
+#include "rhythmdb-query-model.h"
+#include "rb-podcast-manager.h"
+#include "rb-podcast-entry-types.h"
+
+struct _RBSyncItinerary
+{
+	RhythmDB *db;
+
+	/* we don't own a reference on this */
+	RBSyncSettings *sync_settings;
+
+	/* RhythmDBEntry -> track uuid, dropped when the entry changes */
+	GHashTable *fingerprints;
+
+	/* group key -> (track uuid -> RhythmDBEntry) for each enabled sync group */
+	GHashTable *groups;
+
+	/* playlist source -> PlaylistWatch for each synced playlist */
+	GHashTable *playlist_watches;
+
+	gulong entry_added_id;
+	gulong entry_deleted_id;
+	gulong entry_changed_id;
+};
+
+static gboolean
+entry_is_undownloaded_podcast (RhythmDBEntry *entry)
+{
+	if (rhythmdb_entry_get_entry_type (entry) == RHYTHMDB_ENTRY_TYPE_PODCAST_POST) {
+		return (!rb_podcast_manager_entry_downloaded (entry));
+	}
+
+	return FALSE;
+}
+
+guint64
+rb_sync_track_map_get_size (GHashTable *entries)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	guint64 sum = 0;
+
+	g_hash_table_iter_init (&iter, entries);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		RhythmDBEntry *entry = (RhythmDBEntry *)value;
+		sum += rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
+	}
+
+	return sum;
+}
+
+char *
+rb_sync_state_make_track_uuid  (RhythmDBEntry *entry)
+{
+	/* This function is for hashing the two databases for syncing. */
+	GString *str = g_string_new ("");
+	char *result;
+
+	/*
+	 * possible improvements here:
+	 * - use musicbrainz track ID if known (maybe not a great idea?)
+	 * - maybe don't include genre, since there's no canonical genre for anything
+	 */
+
+	g_string_printf (str, "%s%s%s%s%lu%lu",
+			 rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_TITLE),
+			 rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_ARTIST),
+			 rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_GENRE),
+			 rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_ALBUM),
+			 rhythmdb_entry_get_ulong  (entry, RHYTHMDB_PROP_TRACK_NUMBER),
+			 rhythmdb_entry_get_ulong  (entry, RHYTHMDB_PROP_DISC_NUMBER));
+
+	/* not sure why we md5 this.  how does it help? */
+	result = g_compute_checksum_for_string (G_CHECKSUM_MD5, str->str, str->len);
+
+	g_string_free (str, TRUE);
+
+	return result;
+}
+
+static const char *
+get_track_uuid (RBSyncItinerary *itinerary, RhythmDBEntry *entry)
+{
+	char *uuid;
+
+	uuid = g_hash_table_lookup (itinerary->fingerprints, entry);
+	if (uuid == NULL) {
+		uuid = rb_sync_state_make_track_uuid (entry);
+		g_hash_table_insert (itinerary->fingerprints, entry, uuid);
+	}
+	return uuid;
+}
+
+GHashTable *
+rb_sync_track_map_new (void)
+{
+	return g_hash_table_new_full (g_str_hash,
+				      g_str_equal,
+				      g_free,
+				      (GDestroyNotify)rhythmdb_entry_unref);
+}
+
+void
+rb_sync_track_map_merge (GHashTable *target, GHashTable *tracks)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	/* the target doesn't own its keys or values */
+	g_hash_table_iter_init (&iter, tracks);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_hash_table_insert (target, key, value);
+	}
+}
+
+static GHashTable *
+tracks_from_query_model (RBSyncItinerary *itinerary, GtkTreeModel *query_model)
+{
+	GHashTable *tracks;
+	GtkTreeIter iter;
+
+	tracks = rb_sync_track_map_new ();
+	if (gtk_tree_model_get_iter_first (query_model, &iter) == FALSE)
+		return tracks;
+
+	do {
+		RhythmDBEntry *entry;
+
+		entry = rhythmdb_query_model_iter_to_entry (RHYTHMDB_QUERY_MODEL (query_model), &iter);
+		if (!entry_is_undownloaded_podcast (entry)) {
+			g_hash_table_insert (tracks,
+					     g_strdup (get_track_uuid (itinerary, entry)),
+					     entry);
+		} else {
+			rhythmdb_entry_unref (entry);
+		}
+	} while (gtk_tree_model_iter_next (query_model, &iter));
+
+	return tracks;
+}
+
+static GHashTable *
+tracks_of_type (RBSyncItinerary *itinerary, gconstpointer entry_type)
+{
+	GtkTreeModel *query_model;
+	GHashTable *tracks;
+
+	query_model = GTK_TREE_MODEL (rhythmdb_query_model_new_empty (itinerary->db));
+	rhythmdb_do_full_query (itinerary->db, RHYTHMDB_QUERY_RESULTS (query_model),
+				RHYTHMDB_QUERY_PROP_EQUALS,
+				RHYTHMDB_PROP_TYPE, entry_type,
+				RHYTHMDB_QUERY_END);
+
+	tracks = tracks_from_query_model (itinerary, query_model);
+	g_object_unref (query_model);
+	return tracks;
+}
+
+static GHashTable *
+tracks_in_feed (RBSyncItinerary *itinerary, gconstpointer feed)
+{
+	GtkTreeModel *query_model;
+	GHashTable *tracks;
+
+	query_model = GTK_TREE_MODEL (rhythmdb_query_model_new_empty (itinerary->db));
+	rhythmdb_do_full_query (itinerary->db, RHYTHMDB_QUERY_RESULTS (query_model),
+				RHYTHMDB_QUERY_PROP_EQUALS,
+				RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_PODCAST_POST,
+				RHYTHMDB_QUERY_PROP_EQUALS,
+				RHYTHMDB_PROP_SUBTITLE, feed,
+				RHYTHMDB_QUERY_END);
+
+	/* TODO: exclude undownloaded episodes, sort by post date, set limit, optionally exclude things with play count > 0
+	 * RHYTHMDB_QUERY_PROP_NOT_EQUAL, RHYTHMDB_PROP_MOUNTPOINT, NULL,	(will this work?)
+	 * RHYTHMDB_QUERY_PROP_NOT_EQUAL, RHYTHMDB_PROP_STATUS, RHYTHMDB_PODCAST_STATUS_ERROR,
+	 *
+	 * RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_PLAYCOUNT, 0
+	 */
+
+	tracks = tracks_from_query_model (itinerary, query_model);
+	g_object_unref (query_model);
+	return tracks;
+}
+
+static GHashTable *
+reuse_group (RBSyncItinerary *itinerary, GHashTable *groups, const char *key)
+{
+	gpointer orig_key;
+	gpointer tracks;
+
+	if (g_hash_table_lookup_extended (itinerary->groups, key, &orig_key, &tracks) == FALSE)
+		return NULL;
+
+	g_hash_table_steal (itinerary->groups, key);
+	g_hash_table_insert (groups, orig_key, tracks);
+	return tracks;
+}
+
+static char *
+group_key (const char *category, const char *name)
+{
+	if (name != NULL) {
+		return g_strdup_printf ("%s:%s", category, name);
+	} else {
+		return g_strdup (category);
+	}
+}
+
+/* playlist names aren't unique, so playlist groups are keyed by the source */
+static char *
+playlist_group_key (GObject *playlist)
+{
+	return g_strdup_printf ("%s:%p", SYNC_CATEGORY_MUSIC, playlist);
+}
+
+/* takes ownership of the key */
+static void
+itinerary_add_group (RBSyncItinerary *itinerary,
+		     GHashTable *groups,
+		     GHashTable *tracks_map,
+		     char *key,
+		     GHashTable *(*build) (RBSyncItinerary *, gconstpointer),
+		     gconstpointer build_data)
+{
+	GHashTable *tracks;
+
+	/* the itinerary points into the group's tracks, so a group that's
+	 * already part of it must never be replaced.
+	 */
+	if (g_hash_table_lookup (groups, key) != NULL) {
+		rb_debug ("sync group %s is already in the itinerary", key);
+		g_free (key);
+		return;
+	}
+
+	tracks = reuse_group (itinerary, groups, key);
+	if (tracks == NULL) {
+		rb_debug ("finding tracks for sync group %s", key);
+		tracks = build (itinerary, build_data);
+		g_hash_table_insert (groups, key, tracks);
+	} else {
+		rb_debug ("reusing tracks for sync group %s", key);
+		g_free (key);
+	}
+
+	rb_sync_track_map_merge (tracks_map, tracks);
+}
+
+/*
+ * Tracks can be added to or removed from a playlist without anything
+ * happening to the entries themselves (static playlists), or as a side
+ * effect of changes we don't otherwise care about (ratings or play counts
+ * for auto playlists), so we watch the playlist's query model and drop
+ * the group whenever its contents change.  Auto playlists replace their
+ * query model when the query changes, so we watch for that too.
+ */
+typedef struct {
+	RBSyncItinerary *itinerary;
+	GObject *playlist;
+	GtkTreeModel *query_model;
+	char *key;
+} PlaylistWatch;
+
+static void
+invalidate_playlist_group (PlaylistWatch *watch)
+{
+	if (g_hash_table_remove (watch->itinerary->groups, watch->key)) {
+		rb_debug ("contents of sync group %s changed", watch->key);
+	}
+}
+
+static void
+playlist_row_inserted_cb (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, PlaylistWatch *watch)
+{
+	invalidate_playlist_group (watch);
+}
+
+static void
+playlist_row_deleted_cb (GtkTreeModel *model, GtkTreePath *path, PlaylistWatch *watch)
+{
+	invalidate_playlist_group (watch);
+}
+
+static void
+playlist_query_model_changed_cb (GObject *playlist, GParamSpec *pspec, PlaylistWatch *watch)
+{
+	invalidate_playlist_group (watch);
+}
+
+static PlaylistWatch *
+playlist_watch_new (RBSyncItinerary *itinerary, GObject *playlist, GtkTreeModel *query_model, const char *key)
+{
+	PlaylistWatch *watch;
+
+	watch = g_new0 (PlaylistWatch, 1);
+	watch->itinerary = itinerary;
+	watch->playlist = g_object_ref (playlist);
+	watch->query_model = g_object_ref (query_model);
+	watch->key = g_strdup (key);
+
+	g_signal_connect (watch->query_model, "row-inserted", G_CALLBACK (playlist_row_inserted_cb), watch);
+	g_signal_connect (watch->query_model, "row-deleted", G_CALLBACK (playlist_row_deleted_cb), watch);
+	g_signal_connect (watch->playlist, "notify::query-model", G_CALLBACK (playlist_query_model_changed_cb), watch);
+	return watch;
+}
+
+static void
+playlist_watch_free (PlaylistWatch *watch)
+{
+	g_signal_handlers_disconnect_by_data (watch->query_model, watch);
+	g_signal_handlers_disconnect_by_data (watch->playlist, watch);
+	g_object_unref (watch->query_model);
+	g_object_unref (watch->playlist);
+	g_free (watch->key);
+	g_free (watch);
+}
+
+static void
+watch_playlist (RBSyncItinerary *itinerary, GHashTable *watches, GObject *playlist)
+{
+	PlaylistWatch *watch;
+	GtkTreeModel *query_model;
+	char *key;
+
+	key = playlist_group_key (playlist);
+	g_object_get (playlist, "base-query-model", &query_model, NULL);
+
+	/* keep the existing watch if it's still looking at the right things */
+	watch = g_hash_table_lookup (itinerary->playlist_watches, playlist);
+	if (watch != NULL && watch->query_model == query_model) {
+		g_hash_table_steal (itinerary->playlist_watches, playlist);
+	} else {
+		watch = playlist_watch_new (itinerary, playlist, query_model, key);
+	}
+	g_hash_table_insert (watches, playlist, watch);
+
+	g_object_unref (query_model);
+	g_free (key);
+}
+
+static GHashTable *
+build_playlist_group (RBSyncItinerary *itinerary, gconstpointer playlist)
+{
+	GtkTreeModel *query_model;
+	GHashTable *tracks;
+
+	g_object_get ((GObject *) playlist, "base-query-model", &query_model, NULL);
+	tracks = tracks_from_query_model (itinerary, query_model);
+	g_object_unref (query_model);
+	return tracks;
+}
+
+static void
+itinerary_insert_some_playlists (RBSyncItinerary *itinerary,
+				 GHashTable *groups,
+				 GHashTable *watches,
+				 GHashTable *tracks_map,
+				 GList *playlists)
+{
+	GList *list_iter;
+
+	for (list_iter = playlists; list_iter; list_iter = list_iter->next) {
+		gchar *name;
+
+		g_object_get (list_iter->data, "name", &name, NULL);
+
+		/* See if we should sync it */
+		if (rb_sync_settings_sync_group (itinerary->sync_settings, SYNC_CATEGORY_MUSIC, name)) {
+			rb_debug ("adding entries from playlist %s to itinerary", name);
+			itinerary_add_group (itinerary, groups, tracks_map,
+					     playlist_group_key (list_iter->data),
+					     build_playlist_group, list_iter->data);
+			watch_playlist (itinerary, watches, list_iter->data);
+		} else {
+			rb_debug ("not adding playlist %s to itinerary", name);
+		}
+
+		g_free (name);
+	}
+}
+
+static void
+itinerary_insert_some_podcasts (RBSyncItinerary *itinerary,
+				GHashTable *groups,
+				GHashTable *tracks_map)
+{
+	GList *podcasts;
+	GList *i;
+
+	podcasts = rb_sync_settings_get_enabled_groups (itinerary->sync_settings, SYNC_CATEGORY_PODCAST);
+	for (i = podcasts; i != NULL; i = i->next) {
+		rb_debug ("adding entries from podcast %s to itinerary", (char *)i->data);
+		itinerary_add_group (itinerary, groups, tracks_map,
+				     group_key (SYNC_CATEGORY_PODCAST, i->data),
+				     tracks_in_feed, i->data);
+	}
+	rb_list_deep_free (podcasts);
+}
+
+/**
+ * rb_sync_itinerary_build:
+ * @itinerary: the #RBSyncItinerary
+ * @playlists: the playlist sources that may be synced
+ * @music_size: returns the size of the music in the itinerary
+ * @podcast_size: returns the size of the podcasts in the itinerary
+ *
+ * Finds the tracks to be synced, mapping track uuids to entries.
+ * The returned hash doesn't own its keys or values; they belong to the
+ * sync groups, which are kept until the next call or until
+ * rb_sync_itinerary_forget is called.
+ *
+ * Return value: track uuid -> #RhythmDBEntry for each track to sync
+ */
+GHashTable *
+rb_sync_itinerary_build (RBSyncItinerary *itinerary,
+			 GList *playlists,
+			 guint64 *music_size,
+			 guint64 *podcast_size)
+{
+	GHashTable *tracks_map;
+	GHashTable *groups;
+	GHashTable *watches;
+
+	rb_debug ("building itinerary hash");
+
+	tracks_map = g_hash_table_new (g_str_hash, g_str_equal);
+	groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_destroy);
+	watches = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) playlist_watch_free);
+
+	if (rb_sync_settings_sync_category (itinerary->sync_settings, SYNC_CATEGORY_MUSIC) ||
+	    rb_sync_settings_sync_group (itinerary->sync_settings, SYNC_CATEGORY_MUSIC, SYNC_GROUP_ALL_MUSIC)) {
+		rb_debug ("adding all music to the itinerary");
+		itinerary_add_group (itinerary, groups, tracks_map,
+				     group_key (SYNC_CATEGORY_MUSIC, NULL),
+				     tracks_of_type,
+				     RHYTHMDB_ENTRY_TYPE_SONG);
+	} else if (rb_sync_settings_has_enabled_groups (itinerary->sync_settings, SYNC_CATEGORY_MUSIC)) {
+		rb_debug ("adding selected playlists to the itinerary");
+		itinerary_insert_some_playlists (itinerary, groups, watches, tracks_map, playlists);
+	}
+
+	*music_size = rb_sync_track_map_get_size (tracks_map);
+
+	if (rb_sync_settings_sync_category (itinerary->sync_settings, SYNC_CATEGORY_PODCAST)) {
+		rb_debug ("adding all podcasts to the itinerary");
+		/* TODO: when we get #episodes/not-if-played settings, use
+		 * equivalent of insert_some_podcasts, iterating through all feeds
+		 * (use a query for all entries of type PODCAST_FEED to find them)
+		 */
+		itinerary_add_group (itinerary, groups, tracks_map,
+				     group_key (SYNC_CATEGORY_PODCAST, NULL),
+				     tracks_of_type,
+				     RHYTHMDB_ENTRY_TYPE_PODCAST_POST);
+	} else if (rb_sync_settings_has_enabled_groups (itinerary->sync_settings, SYNC_CATEGORY_PODCAST)) {
+		rb_debug ("adding selected podcasts to the itinerary");
+		itinerary_insert_some_podcasts (itinerary, groups, tracks_map);
+	}
+
+	*podcast_size = rb_sync_track_map_get_size (tracks_map) - *music_size;
+
+	/* anything left over belongs to groups that are no longer enabled */
+	g_hash_table_destroy (itinerary->groups);
+	itinerary->groups = groups;
+	g_hash_table_destroy (itinerary->playlist_watches);
+	itinerary->playlist_watches = watches;
+
+	rb_debug ("finished building itinerary hash; has %d entries", g_hash_table_size (tracks_map));
+	return tracks_map;
+}
+
+/**
+ * rb_sync_itinerary_forget:
+ * @itinerary: the #RBSyncItinerary
+ *
+ * Drops the tracks found for each sync group, so the next itinerary
+ * is built from scratch.
+ */
+void
+rb_sync_itinerary_forget (RBSyncItinerary *itinerary)
+{
+	g_hash_table_remove_all (itinerary->groups);
+}
+
+static void
+db_entry_added_cb (RhythmDB *db, RhythmDBEntry *entry, RBSyncItinerary *itinerary)
+{
+	RhythmDBEntryType *entry_type = rhythmdb_entry_get_entry_type (entry);
+
+	if (entry_type == RHYTHMDB_ENTRY_TYPE_SONG || entry_type == RHYTHMDB_ENTRY_TYPE_PODCAST_POST)
+		g_hash_table_remove_all (itinerary->groups);
+}
+
+static void
+db_entry_deleted_cb (RhythmDB *db, RhythmDBEntry *entry, RBSyncItinerary *itinerary)
+{
+	g_hash_table_remove (itinerary->fingerprints, entry);
+	db_entry_added_cb (db, entry, itinerary);
+}
+
+static void
+db_entry_changed_cb (RhythmDB *db, RhythmDBEntry *entry, GPtrArray *changes, RBSyncItinerary *itinerary)
+{
+	guint i;
+
+	for (i = 0; i < changes->len; i++) {
+		RhythmDBEntryChange *change = g_ptr_array_index (changes, i);
+
+		switch (change->prop) {
+		case RHYTHMDB_PROP_TITLE:
+		case RHYTHMDB_PROP_ARTIST:
+		case RHYTHMDB_PROP_GENRE:
+		case RHYTHMDB_PROP_ALBUM:
+		case RHYTHMDB_PROP_TRACK_NUMBER:
+		case RHYTHMDB_PROP_DISC_NUMBER:
+			g_hash_table_remove (itinerary->fingerprints, entry);
+			g_hash_table_remove_all (itinerary->groups);
+			return;
+
+		case RHYTHMDB_PROP_TYPE:
+		case RHYTHMDB_PROP_STATUS:
+		case RHYTHMDB_PROP_MOUNTPOINT:
+			/* changes which podcast posts can be synced */
+			g_hash_table_remove_all (itinerary->groups);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * rb_sync_itinerary_new:
+ * @db: the #RhythmDB instance
+ * @settings: the #RBSyncSettings to build itineraries for
+ *
+ * Creates a new sync itinerary builder.  The settings must outlive it.
+ *
+ * Return value: the new #RBSyncItinerary
+ */
+RBSyncItinerary *
+rb_sync_itinerary_new (RhythmDB *db, RBSyncSettings *settings)
+{
+	RBSyncItinerary *itinerary;
+
+	itinerary = g_new0 (RBSyncItinerary, 1);
+	itinerary->db = g_object_ref (db);
+	itinerary->sync_settings = settings;
+
+	itinerary->fingerprints = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+	itinerary->groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_destroy);
+	itinerary->playlist_watches = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) playlist_watch_free);
+
+	itinerary->entry_added_id = g_signal_connect (db,
+						      "entry-added",
+						      G_CALLBACK (db_entry_added_cb),
+						      itinerary);
+	itinerary->entry_deleted_id = g_signal_connect (db,
+							"entry-deleted",
+							G_CALLBACK (db_entry_deleted_cb),
+							itinerary);
+	itinerary->entry_changed_id = g_signal_connect (db,
+							"entry-changed",
+							G_CALLBACK (db_entry_changed_cb),
+							itinerary);
+	return itinerary;
+}
+
+/**
+ * rb_sync_itinerary_free:
+ * @itinerary: the #RBSyncItinerary
+ *
+ * Frees the itinerary builder, along with any tracks found for sync groups
+ * and its references on the synced playlists.
+ */
+void
+rb_sync_itinerary_free (RBSyncItinerary *itinerary)
+{
+	g_signal_handler_disconnect (itinerary->db, itinerary->entry_added_id);
+	g_signal_handler_disconnect (itinerary->db, itinerary->entry_deleted_id);
+	g_signal_handler_disconnect (itinerary->db, itinerary->entry_changed_id);
+
+	g_hash_table_destroy (itinerary->groups);
+	g_hash_table_destroy (itinerary->playlist_watches);
+	g_hash_table_destroy (itinerary->fingerprints);
+	g_object_unref (itinerary->db);
+	g_free (itinerary);
+}
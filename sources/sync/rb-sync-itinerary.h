@@ -0,0 +1,58 @@
+/*
+ *  Copyright (C) 2010 Jonathan Matthew  <jonathan@d14n.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#ifndef __RB_SYNC_ITINERARY_H
+#define __RB_SYNC_ITINERARY_H
+
+#include <glib-object.h>
+
+#include "rb-sync-settings.h"
+
+#include "rhythmdb.h"
+
+G_BEGIN_DECLS
+
+typedef struct _RBSyncItinerary RBSyncItinerary;
+
+char *			rb_sync_state_make_track_uuid (RhythmDBEntry *entry);
+
+GHashTable *		rb_sync_track_map_new (void);
+void			rb_sync_track_map_merge (GHashTable *target, GHashTable *tracks);
+guint64			rb_sync_track_map_get_size (GHashTable *tracks);
+
+RBSyncItinerary *	rb_sync_itinerary_new (RhythmDB *db, RBSyncSettings *settings);
+void			rb_sync_itinerary_free (RBSyncItinerary *itinerary);
+
+GHashTable *		rb_sync_itinerary_build (RBSyncItinerary *itinerary,
+						 GList *playlists,
+						 guint64 *music_size,
+						 guint64 *podcast_size);
+void			rb_sync_itinerary_forget (RBSyncItinerary *itinerary);
+
+G_END_DECLS
+
+#endif /* __RB_SYNC_ITINERARY_H */
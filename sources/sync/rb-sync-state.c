@@ -27,13 +27,13 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "rb-sync-state.h"
+#include "rb-sync-itinerary.h"
 #include "rb-util.h"
 #include "rb-debug.h"
 
-#include "rhythmdb-query-model.h"
-#include "rb-podcast-manager.h"
-#include "rb-podcast-entry-types.h"
 #include "rb-playlist-manager.h"
 #include "rb-shell.h"
 
@@ -42,6 +42,15 @@ struct _RBSyncStatePrivate
 	/* we don't own a reference on these */
 	RBMediaPlayerSource *source;
 	RBSyncSettings *sync_settings;
+
+	RhythmDB *db;
+
+	/* the tracks in each enabled sync group */
+	RBSyncItinerary *itinerary;
+
+	/* track uuid -> RhythmDBEntry for the tracks on the device */
+	GHashTable *device_music;
+	GHashTable *device_podcasts;
 };
 
 enum {
@@ -59,74 +68,6 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 G_DEFINE_TYPE (RBSyncState, rb_sync_state, G_TYPE_OBJECT)
 
-static gboolean
-entry_is_undownloaded_podcast (RhythmDBEntry *entry)
-{
-	if (rhythmdb_entry_get_entry_type (entry) == RHYTHMDB_ENTRY_TYPE_PODCAST_POST) {
-		return (!rb_podcast_manager_entry_downloaded (entry));
-	}
-
-	return FALSE;
-}
-
-static guint64
-_sum_entry_size (GHashTable *entries)
-{
-	GHashTableIter iter;
-	gpointer key, value;
-	guint64 sum = 0;
-
-	g_hash_table_iter_init (&iter, entries);
-	while (g_hash_table_iter_next (&iter, &key, &value)) {
-		RhythmDBEntry *entry = (RhythmDBEntry *)value;
-		sum += rhythmdb_entry_get_uint64 (entry, RHYTHMDB_PROP_FILE_SIZE);
-	}
-
-	return sum;
-}
-
-static void
-_g_hash_table_transfer_all (GHashTable *target, GHashTable *source)
-{
-	GHashTableIter iter;
-	gpointer key, value;
-
-	g_hash_table_iter_init (&iter, source);
-	while (g_hash_table_iter_next (&iter, &key, &value)) {
-		g_hash_table_insert (target, key, value);
-		g_hash_table_iter_steal (&iter);
-	}
-}
-
-char *
-rb_sync_state_make_track_uuid  (RhythmDBEntry *entry)
-{
-	/* This function is for hashing the two databases for syncing. */
-	GString *str = g_string_new ("");
-	char *result;
-
-	/*
-	 * possible improvements here:
-	 * - use musicbrainz track ID if known (maybe not a great idea?)
-	 * - maybe don't include genre, since there's no canonical genre for anything
-	 */
-
-	g_string_printf (str, "%s%s%s%s%lu%lu",
-			 rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_TITLE),
-			 rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_ARTIST),
-			 rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_GENRE),
-			 rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_ALBUM),
-			 rhythmdb_entry_get_ulong  (entry, RHYTHMDB_PROP_TRACK_NUMBER),
-			 rhythmdb_entry_get_ulong  (entry, RHYTHMDB_PROP_DISC_NUMBER));
-
-	/* not sure why we md5 this.  how does it help? */
-	result = g_compute_checksum_for_string (G_CHECKSUM_MD5, str->str, str->len);
-
-	g_string_free (str, TRUE);
-
-	return result;
-}
-
 static void
 free_sync_lists (RBSyncState *state)
 {
@@ -165,48 +106,10 @@ build_sync_list_cb (char *uuid, RhythmDBEntry *entry, BuildSyncListData *data)
 	data->result = g_list_prepend (data->result, rhythmdb_entry_ref (entry));
 }
 
-
-static gboolean
-hash_table_insert_from_tree_model_cb (GtkTreeModel *query_model,
-				      GtkTreePath  *path,
-				      GtkTreeIter  *iter,
-				      GHashTable   *target)
-{
-	RhythmDBEntry *entry;
-
-	entry = rhythmdb_query_model_iter_to_entry (RHYTHMDB_QUERY_MODEL (query_model), iter);
-	if (!entry_is_undownloaded_podcast (entry)) {
-		g_hash_table_insert (target,
-				     rb_sync_state_make_track_uuid (entry),
-				     rhythmdb_entry_ref (entry));
-	}
-
-	return FALSE;
-}
-
-static void
-itinerary_insert_all_of_type (RhythmDB *db,
-			      RhythmDBEntryType *entry_type,
-			      GHashTable *target)
-{
-	GtkTreeModel *query_model;
-
-	query_model = GTK_TREE_MODEL (rhythmdb_query_model_new_empty (db));
-	rhythmdb_do_full_query (db, RHYTHMDB_QUERY_RESULTS (query_model),
-				RHYTHMDB_QUERY_PROP_EQUALS,
-				RHYTHMDB_PROP_TYPE, entry_type,
-				RHYTHMDB_QUERY_END);
-
-	gtk_tree_model_foreach (query_model,
-				(GtkTreeModelForeachFunc) hash_table_insert_from_tree_model_cb,
-				target);
-}
-
-static void
-itinerary_insert_some_playlists (RBSyncState *state,
-				 GHashTable *target)
+static GHashTable *
+build_sync_itinerary (RBSyncState *state)
 {
-	GList *list_iter;
+	GHashTable *itinerary;
 	GList *playlists;
 	RBPlaylistManager *playlist_manager;
 	RBShell *shell;
@@ -217,155 +120,71 @@ itinerary_insert_some_playlists (RBSyncState *state,
 	g_object_unref (playlist_manager);
 	g_object_unref (shell);
 
-	for (list_iter = playlists; list_iter; list_iter = list_iter->next) {
-		gchar *name;
-
-		g_object_get (list_iter->data, "name", &name, NULL);
-
-		/* See if we should sync it */
-		if (rb_sync_settings_sync_group (state->priv->sync_settings, SYNC_CATEGORY_MUSIC, name)) {
-			GtkTreeModel *query_model;
-
-			rb_debug ("adding entries from playlist %s to itinerary", name);
-			g_object_get (RB_SOURCE (list_iter->data), "base-query-model", &query_model, NULL);
-			gtk_tree_model_foreach (query_model,
-						(GtkTreeModelForeachFunc) hash_table_insert_from_tree_model_cb,
-						target);
-			g_object_unref (query_model);
-		} else {
-			rb_debug ("not adding playlist %s to itinerary", name);
-		}
-
-		g_free (name);
-	}
-
+	itinerary = rb_sync_itinerary_build (state->priv->itinerary,
+					     playlists,
+					     &state->sync_music_size,
+					     &state->sync_podcast_size);
 	g_list_free (playlists);
-}
-
-static void
-itinerary_insert_some_podcasts (RBSyncState *state,
-				RhythmDB *db,
-				GHashTable *target)
-{
-	GList *podcasts;
-	GList *i;
-
-	podcasts = rb_sync_settings_get_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_PODCAST);
-	for (i = podcasts; i != NULL; i = i->next) {
-		GtkTreeModel *query_model;
-		rb_debug ("adding entries from podcast %s to itinerary", (char *)i->data);
-		query_model = GTK_TREE_MODEL (rhythmdb_query_model_new_empty (db));
-		rhythmdb_do_full_query (db, RHYTHMDB_QUERY_RESULTS (query_model),
-					RHYTHMDB_QUERY_PROP_EQUALS,
-					RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_PODCAST_POST,
-					RHYTHMDB_QUERY_PROP_EQUALS,
-					RHYTHMDB_PROP_SUBTITLE, i->data,
-					RHYTHMDB_QUERY_END);
-
-		/* TODO: exclude undownloaded episodes, sort by post date, set limit, optionally exclude things with play count > 0
-		 * RHYTHMDB_QUERY_PROP_NOT_EQUAL, RHYTHMDB_PROP_MOUNTPOINT, NULL,	(will this work?)
-		 * RHYTHMDB_QUERY_PROP_NOT_EQUAL, RHYTHMDB_PROP_STATUS, RHYTHMDB_PODCAST_STATUS_ERROR,
-		 *
-		 * RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_PLAYCOUNT, 0
-		 */
-
-		gtk_tree_model_foreach (query_model,
-					(GtkTreeModelForeachFunc) hash_table_insert_from_tree_model_cb,
-					target);
-		g_object_unref (query_model);
-	}
-}
-
-static GHashTable *
-build_sync_itinerary (RBSyncState *state)
-{
-	RBShell *shell;
-	RhythmDB *db;
-	GHashTable *itinerary;
-
-	rb_debug ("building itinerary hash");
-
-	g_object_get (state->priv->source, "shell", &shell, NULL);
-	g_object_get (shell, "db", &db, NULL);
-
-	itinerary = g_hash_table_new_full (g_str_hash,
-					   g_str_equal,
-					   g_free,
-					   (GDestroyNotify)rhythmdb_entry_unref);
-
-	if (rb_sync_settings_sync_category (state->priv->sync_settings, SYNC_CATEGORY_MUSIC) ||
-	    rb_sync_settings_sync_group (state->priv->sync_settings, SYNC_CATEGORY_MUSIC, SYNC_GROUP_ALL_MUSIC)) {
-		rb_debug ("adding all music to the itinerary");
-		itinerary_insert_all_of_type (db, RHYTHMDB_ENTRY_TYPE_SONG, itinerary);
-	} else if (rb_sync_settings_has_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_MUSIC)) {
-		rb_debug ("adding selected playlists to the itinerary");
-		itinerary_insert_some_playlists (state, itinerary);
-	}
-
-	state->sync_music_size = _sum_entry_size (itinerary);
-
-	if (rb_sync_settings_sync_category (state->priv->sync_settings, SYNC_CATEGORY_PODCAST)) {
-		rb_debug ("adding all podcasts to the itinerary");
-		/* TODO: when we get #episodes/not-if-played settings, use
-		 * equivalent of insert_some_podcasts, iterating through all feeds
-		 * (use a query for all entries of type PODCAST_FEED to find them)
-		 */
-		itinerary_insert_all_of_type (db, RHYTHMDB_ENTRY_TYPE_PODCAST_POST, itinerary);
-	} else if (rb_sync_settings_has_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_PODCAST)) {
-		rb_debug ("adding selected podcasts to the itinerary");
-		itinerary_insert_some_podcasts (state, db, itinerary);
-	}
-
-	state->sync_podcast_size = _sum_entry_size (itinerary) - state->sync_music_size;
-
-	g_object_unref (shell);
-	g_object_unref (db);
-
-	rb_debug ("finished building itinerary hash; has %d entries", g_hash_table_size (itinerary));
 	return itinerary;
 }
 
+/* the returned hash doesn't own its keys or values; they belong to the cached device contents */
 static GHashTable *
 build_device_state (RBSyncState *state)
 {
 	GHashTable *device;
-	GHashTable *entries;
 
 	rb_debug ("building device contents hash");
 
-	device = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)rhythmdb_entry_unref);
-
-	rb_debug ("getting music entries from device");
-	entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) rhythmdb_entry_unref);
+	device = g_hash_table_new (g_str_hash, g_str_equal);
 
-	rb_media_player_source_get_entries (state->priv->source, SYNC_CATEGORY_MUSIC, entries);
-	/*klass->impl_get_entries (source, SYNC_CATEGORY_MUSIC, entries);*/
-	state->total_music_size = _sum_entry_size (entries);
+	if (state->priv->device_music == NULL) {
+		rb_debug ("getting music entries from device");
+		state->priv->device_music = rb_sync_track_map_new ();
+		rb_media_player_source_get_entries (state->priv->source, SYNC_CATEGORY_MUSIC, state->priv->device_music);
+		/*klass->impl_get_entries (source, SYNC_CATEGORY_MUSIC, entries);*/
+		state->total_music_size = rb_sync_track_map_get_size (state->priv->device_music);
+		rb_debug ("done getting music entries from device");
+	}
 	if (rb_sync_settings_sync_category (state->priv->sync_settings, SYNC_CATEGORY_MUSIC) ||
 	    rb_sync_settings_has_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_MUSIC)) {
-		_g_hash_table_transfer_all (device, entries);
+		rb_sync_track_map_merge (device, state->priv->device_music);
+	}
+
+	if (state->priv->device_podcasts == NULL) {
+		rb_debug ("getting podcast entries from device");
+		state->priv->device_podcasts = rb_sync_track_map_new ();
+		rb_media_player_source_get_entries (state->priv->source, SYNC_CATEGORY_PODCAST, state->priv->device_podcasts);
+		/*klass->impl_get_entries (source, SYNC_CATEGORY_PODCAST, entries);*/
+		state->total_podcast_size = rb_sync_track_map_get_size (state->priv->device_podcasts);
+		rb_debug ("done getting podcast entries from device");
 	}
-	g_hash_table_destroy (entries);
-	rb_debug ("done getting music entries from device");
-
-	rb_debug ("getting podcast entries from device");
-	entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) rhythmdb_entry_unref);
-	rb_media_player_source_get_entries (state->priv->source, SYNC_CATEGORY_PODCAST, entries);
-	/*klass->impl_get_entries (source, SYNC_CATEGORY_PODCAST, entries);*/
-	state->total_podcast_size = _sum_entry_size (entries);
 	if (rb_sync_settings_sync_category (state->priv->sync_settings, SYNC_CATEGORY_PODCAST) ||
 	    rb_sync_settings_has_enabled_groups (state->priv->sync_settings, SYNC_CATEGORY_PODCAST)) {
-		_g_hash_table_transfer_all (device, entries);
+		rb_sync_track_map_merge (device, state->priv->device_podcasts);
 	}
-	g_hash_table_destroy (entries);
-	rb_debug ("done getting podcast entries from device");
 
 	rb_debug ("done building device contents hash; has %d entries", g_hash_table_size (device));
 	return device;
 }
 
-void
-rb_sync_state_update (RBSyncState *state)
+static void
+clear_cached_state (RBSyncState *state)
+{
+	if (state->priv->itinerary != NULL)
+		rb_sync_itinerary_forget (state->priv->itinerary);
+	if (state->priv->device_music != NULL) {
+		g_hash_table_destroy (state->priv->device_music);
+		state->priv->device_music = NULL;
+	}
+	if (state->priv->device_podcasts != NULL) {
+		g_hash_table_destroy (state->priv->device_podcasts);
+		state->priv->device_podcasts = NULL;
+	}
+}
+
+static void
+update_sync_lists (RBSyncState *state)
 {
 	GHashTable *device;
 	GHashTable *itinerary;
@@ -385,6 +204,8 @@ rb_sync_state_update (RBSyncState *state)
 	rb_debug ("building list of files to transfer to device");
 	data.target = device;
 	data.result = NULL;
+	data.bytes = 0;
+	data.duration = 0;
 	g_hash_table_foreach (itinerary, (GHFunc)build_sync_list_cb, &data);
 	state->sync_to_add = data.result;
 	state->sync_add_size = data.bytes;
@@ -397,6 +218,8 @@ rb_sync_state_update (RBSyncState *state)
 	rb_debug ("building list of files to remove from device");
 	data.target = itinerary;
 	data.result = NULL;
+	data.bytes = 0;
+	data.duration = 0;
 	g_hash_table_foreach (device, (GHFunc)build_sync_list_cb, &data);
 	state->sync_to_remove = data.result;
 	state->sync_remove_size = data.bytes;
@@ -432,11 +255,27 @@ rb_sync_state_update (RBSyncState *state)
 	g_signal_emit (state, signals[UPDATED], 0);
 }
 
+/**
+ * rb_sync_state_update:
+ * @state: the #RBSyncState
+ *
+ * Rebuilds the sync state from the current contents of the library,
+ * the selected playlists and podcast feeds, and the device.  Changes
+ * to the sync settings are picked up automatically, reusing what is
+ * already known about each sync group and the device contents.
+ */
+void
+rb_sync_state_update (RBSyncState *state)
+{
+	clear_cached_state (state);
+	update_sync_lists (state);
+}
+
 static void
 sync_settings_updated (RBSyncSettings *settings, RBSyncState *state)
 {
 	rb_debug ("sync settings updated, updating state");
-	rb_sync_state_update (state);
+	update_sync_lists (state);
 }
 
 
@@ -462,6 +301,13 @@ static void
 impl_constructed (GObject *object)
 {
 	RBSyncState *state = RB_SYNC_STATE (object);
+	RBShell *shell;
+
+	g_object_get (state->priv->source, "shell", &shell, NULL);
+	g_object_get (shell, "db", &state->priv->db, NULL);
+	g_object_unref (shell);
+
+	state->priv->itinerary = rb_sync_itinerary_new (state->priv->db, state->priv->sync_settings);
 
 	rb_sync_state_update (state);
 
@@ -507,12 +353,32 @@ impl_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *ps
 	}
 }
 
+static void
+impl_dispose (GObject *object)
+{
+	RBSyncState *state = RB_SYNC_STATE (object);
+
+	/* drops our references on the playlists and their query models */
+	if (state->priv->itinerary != NULL) {
+		rb_sync_itinerary_free (state->priv->itinerary);
+		state->priv->itinerary = NULL;
+	}
+
+	if (state->priv->db != NULL) {
+		g_object_unref (state->priv->db);
+		state->priv->db = NULL;
+	}
+
+	G_OBJECT_CLASS (rb_sync_state_parent_class)->dispose (object);
+}
+
 static void
 impl_finalize (GObject *object)
 {
 	RBSyncState *state = RB_SYNC_STATE (object);
 
 	free_sync_lists (state);
+	clear_cached_state (state);
 
 	G_OBJECT_CLASS (rb_sync_state_parent_class)->finalize (object);
 }
@@ -522,6 +388,7 @@ rb_sync_state_class_init (RBSyncStateClass *klass)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+	object_class->dispose = impl_dispose;
 	object_class->finalize = impl_finalize;
 	object_class->constructed = impl_constructed;
 	object_class->set_property = impl_set_property;
@@ -32,6 +32,7 @@
 
 #include "rb-media-player-source.h"
 #include "rb-sync-settings.h"
+#include "rb-sync-itinerary.h"
 
 #include "rhythmdb.h"
 
@@ -78,8 +79,6 @@ struct _RBSyncStateClass
 	void (*updated) (RBSyncState *state);
 };
 
-char *		rb_sync_state_make_track_uuid (RhythmDBEntry *entry);
-
 GType		rb_sync_state_get_type (void);
 
 RBSyncState *	rb_sync_state_new (RBMediaPlayerSource *source, RBSyncSettings *settings);
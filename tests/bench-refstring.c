@@ -0,0 +1,154 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+/*
+ * Interns strings from a number of threads at once, the way the load,
+ * query and metadata threads do, and reports the throughput and how often
+ * threads had to wait for each other.
+ *
+ * usage: bench-refstring [max threads] [operations per thread]
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <stdlib.h>
+
+#include "rb-refstring.h"
+
+/* roughly the number of distinct strings in a medium sized library */
+#define N_STRINGS	20000
+
+static char **strings;
+static guint operations;
+
+static gpointer
+intern_thread (gpointer data)
+{
+	guint offset = GPOINTER_TO_UINT (data);
+	RBRefString *held[16] = {0,};
+	guint i;
+
+	for (i = 0; i < operations; i++) {
+		const char *str = strings[(offset + i * 7) % N_STRINGS];
+		RBRefString *ref;
+
+		/* mostly lookups of strings that already exist, as when loading
+		 * entries, with some strings being created and freed again.
+		 */
+		if (i % 4 == 0) {
+			ref = rb_refstring_find (str);
+			rb_refstring_unref (ref);
+		} else {
+			ref = rb_refstring_new (str);
+			rb_refstring_unref (held[i % G_N_ELEMENTS (held)]);
+			held[i % G_N_ELEMENTS (held)] = ref;
+		}
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (held); i++) {
+		rb_refstring_unref (held[i]);
+	}
+	return NULL;
+}
+
+static void
+run (guint n_threads)
+{
+	GThread **threads;
+	GTimer *timer;
+	guint contention;
+	double elapsed;
+	guint i;
+
+	threads = g_new0 (GThread *, n_threads);
+	contention = rb_refstring_system_get_contention ();
+	timer = g_timer_new ();
+
+	for (i = 0; i < n_threads; i++) {
+		threads[i] = g_thread_new ("intern", intern_thread, GUINT_TO_POINTER (i * (N_STRINGS / n_threads)));
+	}
+	for (i = 0; i < n_threads; i++) {
+		g_thread_join (threads[i]);
+	}
+
+	elapsed = g_timer_elapsed (timer, NULL);
+	contention = rb_refstring_system_get_contention () - contention;
+	g_print ("%3u threads: %.3fs, %.0f operations/s, %u contended (%.3f%%)\n",
+		 n_threads,
+		 elapsed,
+		 (n_threads * (double) operations) / elapsed,
+		 contention,
+		 (contention * 100.0) / (n_threads * (double) operations));
+
+	g_timer_destroy (timer);
+	g_free (threads);
+}
+
+int
+main (int argc, char **argv)
+{
+	RBRefString **common;
+	guint max_threads;
+	guint n;
+	guint i;
+
+	max_threads = (argc > 1) ? strtoul (argv[1], NULL, 10) : 0;
+	if (max_threads == 0)
+		max_threads = g_get_num_processors ();
+	operations = (argc > 2) ? strtoul (argv[2], NULL, 10) : 0;
+	if (operations == 0)
+		operations = 1000000;
+
+	rb_refstring_system_init ();
+
+	strings = g_new0 (char *, N_STRINGS + 1);
+	for (i = 0; i < N_STRINGS; i++) {
+		strings[i] = g_strdup_printf ("file:///home/user/Music/Artist %u/Album %u/%02u - Track.ogg",
+					      i / 200, i / 12, i % 12);
+	}
+
+	/* keep half of the strings alive throughout, like entries in the database */
+	common = g_new0 (RBRefString *, N_STRINGS / 2);
+	for (i = 0; i < N_STRINGS / 2; i++) {
+		common[i] = rb_refstring_new (strings[i * 2]);
+	}
+
+	for (n = 1; n <= max_threads; n *= 2) {
+		run (n);
+		if (n < max_threads && n * 2 > max_threads)
+			run (max_threads);
+	}
+
+	for (i = 0; i < N_STRINGS / 2; i++) {
+		rb_refstring_unref (common[i]);
+	}
+	g_free (common);
+	g_strfreev (strings);
+
+	rb_refstring_system_shutdown ();
+	return 0;
+}
@@ -30,7 +30,9 @@
 #include "config.h"
 
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <locale.h>
 
 #include "rb-debug.h"
@@ -83,11 +85,64 @@ static void wait_for_signal (void)
 }
 
 
+static void
+delete_all_entries (RhythmDB *db)
+{
+	rhythmdb_entry_delete_by_type (db, RHYTHMDB_ENTRY_TYPE_SONG);
+	rhythmdb_entry_delete_by_type (db, rhythmdb_entry_type_get_by_name (db, "iradio"));
+	rhythmdb_entry_delete_by_type (db, RHYTHMDB_ENTRY_TYPE_PODCAST_FEED);
+	rhythmdb_entry_delete_by_type (db, RHYTHMDB_ENTRY_TYPE_PODCAST_POST);
+}
+
+static void
+load_once (RhythmDB *db)
+{
+	set_waiting_signal (G_OBJECT (db), "load-complete");
+	rhythmdb_load (db);
+	wait_for_signal ();
+}
+
+/* returns the total time spent loading */
+static double
+time_loads (RhythmDB *db, gboolean use_snapshot, guint threads, int count)
+{
+	GTimer *timer;
+	double total = 0.0;
+	int i;
+
+	g_object_set (G_OBJECT (db),
+		      "use-snapshot", use_snapshot,
+		      "load-threads", threads,
+		      NULL);
+
+	timer = g_timer_new ();
+	for (i = 0; i < count; i++) {
+		g_timer_start (timer);
+		load_once (db);
+		total += g_timer_elapsed (timer, NULL);
+
+		delete_all_entries (db);
+	}
+	g_timer_destroy (timer);
+
+	return total;
+}
+
 int 
 main (int argc, char **argv)
 {
 	RhythmDB *db;
 	char *name;
+	char *tmpdir;
+	char *copy;
+	char *snapshot;
+	char *contents;
+	gsize length;
+	GError *error = NULL;
+	double xml_time = 0.0;
+	double parallel_time = 0.0;
+	double snapshot_time = 0.0;
+	guint threads = 0;
 	int i;
 
 	if (argc < 2) {
@@ -97,6 +152,28 @@ main (int argc, char **argv)
 		name = g_strdup (argv[1]);
 	}
 
+	/* number of threads for parallel XML loading, 0 for one per processor */
+	if (argc > 2)
+		threads = strtoul (argv[2], NULL, 10);
+	if (threads == 0)
+		threads = g_get_num_processors ();
+
+	/* work on a copy, as saving the database rewrites it */
+	tmpdir = g_dir_make_tmp ("bench-rhythmdb-load-XXXXXX", &error);
+	if (tmpdir == NULL ||
+	    g_file_get_contents (name, &contents, &length, &error) == FALSE) {
+		g_printerr ("unable to copy %s: %s\n", name, error->message);
+		return 1;
+	}
+	copy = g_build_filename (tmpdir, "rhythmdb.xml", NULL);
+	snapshot = g_strconcat (copy, ".snapshot", NULL);
+	if (g_file_set_contents (copy, contents, length, &error) == FALSE) {
+		g_printerr ("unable to copy %s: %s\n", name, error->message);
+		return 1;
+	}
+	g_free (contents);
+	g_free (name);
+
 	rb_profile_start ("load test");
 
 	rb_threads_init ();
@@ -107,24 +184,22 @@ main (int argc, char **argv)
 	rb_file_helpers_init (TRUE);
 
 	db = rhythmdb_tree_new ("test");
-	g_object_set (G_OBJECT (db), "name", name, NULL);
-	g_free (name);
+	g_object_set (G_OBJECT (db), "name", copy, "use-snapshot", FALSE, NULL);
+
+	/* load from the XML file and save it again to write the snapshot */
+	load_once (db);
+	rhythmdb_save (db);
+	delete_all_entries (db);
+	if (g_file_test (snapshot, G_FILE_TEST_EXISTS) == FALSE) {
+		g_printerr ("no snapshot was written\n");
+	}
 
 	for (i = 1; i <= 10; i++) {
-		int j;
-		rb_profile_start ("10 rhythmdb loads");
-		for (j = 1; j <= 10; j++) {
-			set_waiting_signal (G_OBJECT (db), "load-complete");
-			rhythmdb_load (db);
-			wait_for_signal ();
-
-			rhythmdb_entry_delete_by_type (db, RHYTHMDB_ENTRY_TYPE_SONG);
-			rhythmdb_entry_delete_by_type (db, rhythmdb_entry_type_get_by_name (db, "iradio"));
-			rhythmdb_entry_delete_by_type (db, RHYTHMDB_ENTRY_TYPE_PODCAST_FEED);
-			rhythmdb_entry_delete_by_type (db, RHYTHMDB_ENTRY_TYPE_PODCAST_POST);
-		}
-		rb_profile_end ("10 rhythmdb loads");
-		g_print ("completed %d loads\n", i * 10);
+		xml_time += time_loads (db, FALSE, 1, 10);
+		parallel_time += time_loads (db, FALSE, threads, 10);
+		snapshot_time += time_loads (db, TRUE, 1, 10);
+		g_print ("completed %d loads: xml %.3fs, xml with %u threads %.3fs, snapshot %.3fs per load\n",
+			 i * 10, xml_time / (i * 10), threads, parallel_time / (i * 10), snapshot_time / (i * 10));
 	}
 
 	rhythmdb_shutdown (db);
@@ -134,6 +209,13 @@ main (int argc, char **argv)
 	rb_file_helpers_shutdown ();
         rb_refstring_system_shutdown ();
 
+	g_unlink (snapshot);
+	g_unlink (copy);
+	g_rmdir (tmpdir);
+	g_free (snapshot);
+	g_free (copy);
+	g_free (tmpdir);
+
 	rb_profile_end ("load test");
 	return 0;
 }
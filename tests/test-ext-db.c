@@ -0,0 +1,300 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include <check.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <locale.h>
+#include "test-utils.h"
+#include "rb-ext-db.h"
+#include "rb-file-helpers.h"
+#include "rb-util.h"
+#include "rb-debug.h"
+
+#define TEST_STORE_NAME		"test-ext-db"
+#define TEST_SIZE		64
+
+typedef struct {
+	GMainLoop *loop;
+	char *filename;
+	int width;
+	int height;
+} RequestData;
+
+/* same conversions as the album art store in the shell, minus the checks */
+static GValue *
+load_cb (RBExtDB *store, GValue *value, gpointer data)
+{
+	GString *str;
+	GdkPixbufLoader *loader;
+	GValue *v;
+
+	if (G_VALUE_HOLDS (value, G_TYPE_GSTRING) == FALSE)
+		return NULL;
+
+	str = g_value_get_boxed (value);
+	loader = gdk_pixbuf_loader_new ();
+	gdk_pixbuf_loader_write (loader, (const guchar *)str->str, str->len, NULL);
+	gdk_pixbuf_loader_close (loader, NULL);
+
+	v = g_new0 (GValue, 1);
+	g_value_init (v, GDK_TYPE_PIXBUF);
+	g_value_set_object (v, gdk_pixbuf_loader_get_pixbuf (loader));
+	g_object_unref (loader);
+	return v;
+}
+
+static GValue *
+store_cb (RBExtDB *store, GValue *value, gpointer data)
+{
+	char *buf;
+	gsize buf_size;
+	GValue *v;
+
+	if (G_VALUE_HOLDS (value, GDK_TYPE_PIXBUF) == FALSE)
+		return NULL;
+
+	if (gdk_pixbuf_save_to_buffer (GDK_PIXBUF (g_value_get_object (value)), &buf, &buf_size, "png", NULL, NULL) == FALSE)
+		return NULL;
+
+	v = g_new0 (GValue, 1);
+	g_value_init (v, G_TYPE_GSTRING);
+	g_value_take_boxed (v, g_string_new_len (buf, buf_size));
+	g_free (buf);
+	return v;
+}
+
+static void
+added_cb (RBExtDB *store, RBExtDBKey *key, const char *filename, GValue *value, GMainLoop *loop)
+{
+	g_main_loop_quit (loop);
+}
+
+static void
+store_image (RBExtDB *store, int width, int height)
+{
+	RBExtDBKey *key;
+	GdkPixbuf *pixbuf;
+	GMainLoop *loop;
+	GValue v = G_VALUE_INIT;
+	gulong id;
+
+	pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+	gdk_pixbuf_fill (pixbuf, 0x336699ff);
+	g_value_init (&v, GDK_TYPE_PIXBUF);
+	g_value_take_object (&v, pixbuf);
+
+	loop = g_main_loop_new (NULL, FALSE);
+	id = g_signal_connect (store, "added", G_CALLBACK (added_cb), loop);
+
+	key = rb_ext_db_key_create_storage ("album", "sized");
+	rb_ext_db_store (store, key, RB_EXT_DB_SOURCE_USER, &v);
+	g_main_loop_run (loop);
+
+	g_signal_handler_disconnect (store, id);
+	g_main_loop_unref (loop);
+	rb_ext_db_key_free (key);
+	g_value_unset (&v);
+}
+
+static void
+request_cb (RBExtDBKey *key, RBExtDBKey *store_key, const char *filename, GValue *data, RequestData *rdata)
+{
+	GdkPixbuf *pixbuf;
+
+	g_free (rdata->filename);
+	rdata->filename = g_strdup (filename);
+	if (data != NULL && G_VALUE_HOLDS (data, GDK_TYPE_PIXBUF)) {
+		pixbuf = GDK_PIXBUF (g_value_get_object (data));
+		rdata->width = gdk_pixbuf_get_width (pixbuf);
+		rdata->height = gdk_pixbuf_get_height (pixbuf);
+	}
+	g_main_loop_quit (rdata->loop);
+}
+
+static void
+request_image (RBExtDB *store, RequestData *rdata)
+{
+	RBExtDBKey *key;
+
+	rdata->width = 0;
+	rdata->height = 0;
+
+	key = rb_ext_db_key_create_lookup ("album", "sized");
+	rb_ext_db_request_sized (store, key, TEST_SIZE, (RBExtDBRequestCallback) request_cb, rdata, NULL);
+	g_main_loop_run (rdata->loop);
+	rb_ext_db_key_free (key);
+}
+
+static char *
+get_sized_filename (const char *filename)
+{
+	char *storedir;
+	char *sizedir;
+	char *path;
+
+	storedir = g_build_filename (rb_user_cache_dir (), TEST_STORE_NAME, NULL);
+	fail_unless (g_str_has_prefix (filename, storedir), "stored file isn't in the store directory");
+
+	sizedir = g_strdup_printf ("%d", TEST_SIZE);
+	path = g_build_filename (storedir, "sized", sizedir, filename + strlen (storedir) + 1, NULL);
+	g_free (sizedir);
+	g_free (storedir);
+	return path;
+}
+
+static void
+check_sized_file (const char *sized_filename, int width, int height)
+{
+	GdkPixbuf *pixbuf;
+
+	pixbuf = gdk_pixbuf_new_from_file (sized_filename, NULL);
+	fail_unless (pixbuf != NULL, "scaled copy wasn't written");
+	fail_unless (gdk_pixbuf_get_width (pixbuf) == width &&
+		     gdk_pixbuf_get_height (pixbuf) == height,
+		     "scaled copy is %dx%d, expected %dx%d",
+		     gdk_pixbuf_get_width (pixbuf), gdk_pixbuf_get_height (pixbuf),
+		     width, height);
+	g_object_unref (pixbuf);
+}
+
+START_TEST (test_ext_db_sized_copy)
+{
+	RBExtDB *store;
+	RequestData rdata;
+	char *sized_filename;
+
+	store = rb_ext_db_new (TEST_STORE_NAME);
+	g_signal_connect (store, "load", G_CALLBACK (load_cb), NULL);
+	g_signal_connect (store, "store", G_CALLBACK (store_cb), NULL);
+
+	rdata.loop = g_main_loop_new (NULL, FALSE);
+	rdata.filename = NULL;
+
+	/* the first sized request scales the original and keeps a copy */
+	store_image (store, 256, 256);
+	request_image (store, &rdata);
+	fail_unless (rdata.filename != NULL, "stored image wasn't found");
+	fail_unless (rdata.width == TEST_SIZE && rdata.height == TEST_SIZE,
+		     "scaled image is %dx%d", rdata.width, rdata.height);
+
+	sized_filename = get_sized_filename (rdata.filename);
+	check_sized_file (sized_filename, TEST_SIZE, TEST_SIZE);
+
+	/* replacing the original, well within a second of the scaled copy
+	 * being written, must not leave the old copy in use.
+	 */
+	store_image (store, 256, 128);
+	fail_unless (g_file_test (sized_filename, G_FILE_TEST_EXISTS) == FALSE,
+		     "scaled copy wasn't removed when the original was replaced");
+	request_image (store, &rdata);
+	fail_unless (rdata.width == TEST_SIZE && rdata.height == TEST_SIZE / 2,
+		     "scaled image is %dx%d after replacing the original", rdata.width, rdata.height);
+	check_sized_file (sized_filename, TEST_SIZE, TEST_SIZE / 2);
+
+	g_free (sized_filename);
+	g_free (rdata.filename);
+	g_main_loop_unref (rdata.loop);
+	g_object_unref (store);
+}
+END_TEST
+
+static void
+remove_tree (const char *path)
+{
+	GDir *dir;
+	const char *name;
+	char *child;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir != NULL) {
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			child = g_build_filename (path, name, NULL);
+			remove_tree (child);
+			g_free (child);
+		}
+		g_dir_close (dir);
+		g_rmdir (path);
+	} else {
+		g_unlink (path);
+	}
+}
+
+static Suite *
+rb_ext_db_suite (void)
+{
+	Suite *s = suite_create ("rb-ext-db");
+	TCase *tc_chain = tcase_create ("rb-ext-db-core");
+
+	suite_add_tcase (s, tc_chain);
+
+	tcase_add_test (tc_chain, test_ext_db_sized_copy);
+
+	return s;
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+	SRunner *sr;
+	Suite *s;
+	char *cache_dir;
+
+	/* keep the store out of the real cache directory */
+	cache_dir = g_dir_make_tmp ("rb-test-ext-db-XXXXXX", NULL);
+	g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+
+	rb_profile_start ("rb-ext-db test suite");
+	rb_threads_init ();
+	setlocale (LC_ALL, NULL);
+	rb_debug_init (TRUE);
+	rb_file_helpers_init (TRUE);
+
+	/* setup tests */
+	s = rb_ext_db_suite ();
+	sr = srunner_create (s);
+
+	init_setup (sr, argc, argv);
+	init_once (FALSE);
+
+	srunner_run_all (sr, CK_NORMAL);
+	ret = srunner_ntests_failed (sr);
+	srunner_free (sr);
+
+	rb_file_helpers_shutdown ();
+
+	remove_tree (cache_dir);
+	g_free (cache_dir);
+
+	rb_profile_end ("rb-ext-db test suite");
+	return ret;
+}
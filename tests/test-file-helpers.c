@@ -28,6 +28,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <unistd.h>
 
 #include <check.h>
 #include <gtk/gtk.h>
@@ -100,6 +101,105 @@ START_TEST (test_rb_check_dir_has_space)
 }
 END_TEST
 
+typedef struct {
+	GHashTable *seen;
+	GMainLoop *loop;
+	int duplicates;
+} RecurseData;
+
+static gboolean
+recurse_cb (GFile *file, GFileInfo *info, RecurseData *data)
+{
+	char *name;
+
+	name = g_file_get_basename (file);
+	if (g_hash_table_contains (data->seen, name)) {
+		rb_debug ("saw %s twice", name);
+		data->duplicates++;
+		g_free (name);
+	} else {
+		g_hash_table_add (data->seen, name);
+	}
+	return TRUE;
+}
+
+static void
+recurse_done (RecurseData *data)
+{
+	g_main_loop_quit (data->loop);
+}
+
+START_TEST (test_rb_uri_handle_recursively_async)
+{
+	RecurseData data;
+	char *root;
+	char *path;
+	char *uri;
+	int d, f;
+
+	init_once (TRUE);
+
+	root = g_dir_make_tmp ("rb-recurse-XXXXXX", NULL);
+	fail_unless (root != NULL);
+
+	/* more directories than are enumerated at once, each with some files */
+	for (d = 0; d < 10; d++) {
+		path = g_strdup_printf ("%s/dir%d/sub%d", root, d, d);
+		g_mkdir_with_parents (path, 0755);
+		g_free (path);
+
+		for (f = 0; f < 5; f++) {
+			path = g_strdup_printf ("%s/dir%d/sub%d/file%d-%d.ogg", root, d, d, d, f);
+			g_file_set_contents (path, "", 0, NULL);
+			g_free (path);
+		}
+	}
+
+	/* a symlink back to the top of the tree, and a hard link to a file */
+	path = g_strdup_printf ("%s/dir0/sub0/loop", root);
+	fail_unless (symlink (root, path) == 0);
+	g_free (path);
+	{
+		char *target = g_strdup_printf ("%s/dir1/hard.ogg", root);
+		g_file_set_contents (target, "", 0, NULL);
+		path = g_strdup_printf ("%s/dir2/hard.ogg", root);
+		fail_unless (link (target, path) == 0);
+		g_free (target);
+		g_free (path);
+	}
+
+	data.seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	data.loop = g_main_loop_new (NULL, FALSE);
+	data.duplicates = 0;
+
+	uri = g_filename_to_uri (root, NULL, NULL);
+	rb_uri_handle_recursively_async (uri, NULL, (RBUriRecurseFunc) recurse_cb, &data, (GDestroyNotify) recurse_done);
+	g_main_loop_run (data.loop);
+
+	/* the loop and the hard link are only seen as the files they point to */
+	fail_unless (data.duplicates == 0);
+	for (d = 0; d < 10; d++) {
+		for (f = 0; f < 5; f++) {
+			char *name = g_strdup_printf ("file%d-%d.ogg", d, f);
+			fail_unless (g_hash_table_contains (data.seen, name), "missed %s", name);
+			g_free (name);
+		}
+	}
+	fail_unless (g_hash_table_contains (data.seen, "hard.ogg"));
+	fail_unless (g_hash_table_contains (data.seen, "loop"));
+	fail_unless (g_hash_table_size (data.seen) == 10 + 10 + 10 * 5 + 2);
+
+	g_main_loop_unref (data.loop);
+	g_hash_table_destroy (data.seen);
+	g_free (uri);
+
+	path = g_strdup_printf ("rm -rf '%s'", root);
+	g_spawn_command_line_sync (path, NULL, NULL, NULL, NULL);
+	g_free (path);
+	g_free (root);
+}
+END_TEST
+
 static Suite *
 rb_file_helpers_suite ()
 {
@@ -110,6 +210,7 @@ rb_file_helpers_suite ()
 
 	tcase_add_test (tc_chain, test_rb_uri_get_short_path_name);
 	tcase_add_test (tc_chain, test_rb_check_dir_has_space);
+	tcase_add_test (tc_chain, test_rb_uri_handle_recursively_async);
 
 	return s;
 }
@@ -0,0 +1,274 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <check.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <locale.h>
+#include "test-utils.h"
+#include "rb-metadata.h"
+#include "rb-file-helpers.h"
+#include "rb-util.h"
+#include "rb-debug.h"
+
+#define TEST_HELPERS		3
+#define TEST_THREADS		4
+#define TEST_LOADS		100
+
+typedef struct {
+	const char *uri;
+	gint loads;
+	gint failures;
+} LoadData;
+
+/* writes a short silent WAV file */
+static char *
+write_test_file (const char *dir)
+{
+	const guint32 data_size = 16000;
+	guchar header[44];
+	char *filename;
+	char *data;
+	char *uri;
+
+	memcpy (header, "RIFF", 4);
+	header[4] = (36 + data_size) & 0xff;
+	header[5] = ((36 + data_size) >> 8) & 0xff;
+	header[6] = ((36 + data_size) >> 16) & 0xff;
+	header[7] = 0;
+	memcpy (header + 8, "WAVEfmt ", 8);
+	header[16] = 16; header[17] = 0; header[18] = 0; header[19] = 0;
+	header[20] = 1; header[21] = 0;				/* PCM */
+	header[22] = 1; header[23] = 0;				/* mono */
+	header[24] = 0x40; header[25] = 0x1f; header[26] = 0; header[27] = 0;	/* 8000 Hz */
+	header[28] = 0x80; header[29] = 0x3e; header[30] = 0; header[31] = 0;	/* 16000 bytes/s */
+	header[32] = 2; header[33] = 0;				/* block align */
+	header[34] = 16; header[35] = 0;			/* bits per sample */
+	memcpy (header + 36, "data", 4);
+	header[40] = data_size & 0xff;
+	header[41] = (data_size >> 8) & 0xff;
+	header[42] = 0;
+	header[43] = 0;
+
+	data = g_malloc0 (sizeof (header) + data_size);
+	memcpy (data, header, sizeof (header));
+	filename = g_build_filename (dir, "test.wav", NULL);
+	fail_unless (g_file_set_contents (filename, data, sizeof (header) + data_size, NULL), "couldn't write test file");
+	g_free (data);
+
+	uri = g_filename_to_uri (filename, NULL, NULL);
+	g_free (filename);
+	return uri;
+}
+
+/* finds the running metadata helpers started by this process */
+static GArray *
+find_helpers (void)
+{
+	GArray *pids;
+	GDir *dir;
+	const char *name;
+
+	pids = g_array_new (FALSE, FALSE, sizeof (GPid));
+	dir = g_dir_open ("/proc", 0, NULL);
+	if (dir == NULL)
+		return pids;
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		char *path;
+		char *stat;
+		char *comm_end;
+		char state;
+		int ppid;
+
+		if (g_ascii_isdigit (name[0]) == FALSE)
+			continue;
+
+		path = g_build_filename ("/proc", name, "stat", NULL);
+		if (g_file_get_contents (path, &stat, NULL, NULL)) {
+			/* pid (comm) state ppid ... */
+			comm_end = strrchr (stat, ')');
+			if (comm_end != NULL &&
+			    strstr (stat, "(rhythmbox-meta") != NULL &&
+			    sscanf (comm_end + 2, "%c %d", &state, &ppid) == 2 &&
+			    ppid == getpid () &&
+			    state != 'Z') {
+				GPid pid = atoi (name);
+				g_array_append_val (pids, pid);
+			}
+			g_free (stat);
+		}
+		g_free (path);
+	}
+	g_dir_close (dir);
+	return pids;
+}
+
+static gpointer
+load_thread (LoadData *data)
+{
+	int i;
+
+	for (i = 0; i < TEST_LOADS; i++) {
+		RBMetaData *md;
+		GError *error = NULL;
+
+		md = rb_metadata_new ();
+		rb_metadata_load (md, data->uri, &error);
+		if (error != NULL) {
+			rb_debug ("metadata load failed: %s", error->message);
+			g_atomic_int_inc (&data->failures);
+			g_clear_error (&error);
+		}
+		g_object_unref (md);
+		g_atomic_int_inc (&data->loads);
+	}
+	return NULL;
+}
+
+START_TEST (test_metadata_helper_pool)
+{
+	GThread *threads[TEST_THREADS];
+	LoadData data = {0,};
+	RBMetaData *md;
+	GError *error = NULL;
+	GArray *helpers;
+	char *dir;
+	char *uri;
+	char *filename;
+	int max_seen = 0;
+	int waited;
+	int i;
+
+	dir = g_dir_make_tmp ("rb-test-metadata-XXXXXX", NULL);
+	uri = write_test_file (dir);
+	data.uri = uri;
+
+	rb_metadata_set_max_helpers (TEST_HELPERS);
+
+	for (i = 0; i < TEST_THREADS; i++) {
+		threads[i] = g_thread_new ("metadata-test", (GThreadFunc) load_thread, &data);
+	}
+
+	/* wait until more than one helper is running, so loads are
+	 * actually happening at once, then kill one of them.
+	 */
+	helpers = NULL;
+	for (waited = 0; waited < 1000; waited++) {
+		if (helpers != NULL)
+			g_array_free (helpers, TRUE);
+		helpers = find_helpers ();
+		max_seen = MAX (max_seen, helpers->len);
+		if (helpers->len > 1 || g_atomic_int_get (&data.loads) == TEST_THREADS * TEST_LOADS)
+			break;
+		g_usleep (10 * 1000);
+	}
+	fail_unless (helpers->len > 1, "metadata loads didn't run on several helpers");
+
+	rb_debug ("killing metadata helper %d", g_array_index (helpers, GPid, 0));
+	kill (g_array_index (helpers, GPid, 0), SIGKILL);
+	g_array_free (helpers, TRUE);
+
+	while (g_atomic_int_get (&data.loads) < TEST_THREADS * TEST_LOADS) {
+		helpers = find_helpers ();
+		max_seen = MAX (max_seen, helpers->len);
+		g_array_free (helpers, TRUE);
+		g_usleep (10 * 1000);
+	}
+	for (i = 0; i < TEST_THREADS; i++) {
+		g_thread_join (threads[i]);
+	}
+
+	fail_unless (max_seen <= TEST_HELPERS, "too many metadata helpers were running");
+
+	/* only the request running on the killed helper can fail */
+	fail_unless (data.failures <= 1, "killing one helper broke loads on others");
+
+	/* and the pool still works afterwards */
+	md = rb_metadata_new ();
+	rb_metadata_load (md, uri, &error);
+	fail_unless (error == NULL, "metadata load failed after a helper was killed");
+	fail_unless (rb_metadata_has_audio (md), "test file has no audio");
+	g_object_unref (md);
+
+	filename = g_filename_from_uri (uri, NULL, NULL);
+	g_unlink (filename);
+	g_rmdir (dir);
+	g_free (filename);
+	g_free (uri);
+	g_free (dir);
+}
+END_TEST
+
+static Suite *
+rb_metadata_suite (void)
+{
+	Suite *s = suite_create ("rb-metadata");
+	TCase *tc_chain = tcase_create ("rb-metadata-core");
+
+	suite_add_tcase (s, tc_chain);
+	tcase_set_timeout (tc_chain, 60);
+
+	tcase_add_test (tc_chain, test_metadata_helper_pool);
+
+	return s;
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+	SRunner *sr;
+	Suite *s;
+
+	rb_threads_init ();
+	setlocale (LC_ALL, NULL);
+	rb_debug_init (TRUE);
+	rb_file_helpers_init (TRUE);
+
+	/* setup tests */
+	s = rb_metadata_suite ();
+	sr = srunner_create (s);
+
+	init_setup (sr, argc, argv);
+	init_once (FALSE);
+
+	srunner_run_all (sr, CK_NORMAL);
+	ret = srunner_ntests_failed (sr);
+	srunner_free (sr);
+
+	rb_file_helpers_shutdown ();
+
+	return ret;
+}
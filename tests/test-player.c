@@ -0,0 +1,203 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include <check.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+#include <locale.h>
+#include "test-utils.h"
+#include "rb-player.h"
+#include "rb-file-helpers.h"
+#include "rb-util.h"
+#include "rb-debug.h"
+
+/* writes a short silent wav file, returning its filename */
+static char *
+write_test_wav (const char *dir)
+{
+	const guint32 rate = 44100;
+	const guint16 channels = 2;
+	const guint16 bits = 16;
+	const guint32 data_size = rate * channels * (bits / 8) / 2;
+	guint8 header[44];
+	guint8 *contents;
+	guint32 v32;
+	guint16 v16;
+	char *filename;
+
+	memcpy (header, "RIFF", 4);
+	v32 = GUINT32_TO_LE (36 + data_size);
+	memcpy (header + 4, &v32, 4);
+	memcpy (header + 8, "WAVEfmt ", 8);
+	v32 = GUINT32_TO_LE (16);
+	memcpy (header + 16, &v32, 4);
+	v16 = GUINT16_TO_LE (1);		/* PCM */
+	memcpy (header + 20, &v16, 2);
+	v16 = GUINT16_TO_LE (channels);
+	memcpy (header + 22, &v16, 2);
+	v32 = GUINT32_TO_LE (rate);
+	memcpy (header + 24, &v32, 4);
+	v32 = GUINT32_TO_LE (rate * channels * (bits / 8));
+	memcpy (header + 28, &v32, 4);
+	v16 = GUINT16_TO_LE (channels * (bits / 8));
+	memcpy (header + 32, &v16, 2);
+	v16 = GUINT16_TO_LE (bits);
+	memcpy (header + 34, &v16, 2);
+	memcpy (header + 36, "data", 4);
+	v32 = GUINT32_TO_LE (data_size);
+	memcpy (header + 40, &v32, 4);
+
+	contents = g_malloc0 (sizeof (header) + data_size);
+	memcpy (contents, header, sizeof (header));
+
+	filename = g_build_filename (dir, "silence.wav", NULL);
+	fail_unless (g_file_set_contents (filename, (char *) contents, sizeof (header) + data_size, NULL),
+		     "failed to write test file");
+
+	g_free (contents);
+	return filename;
+}
+
+static void
+preroll_latency_notify_cb (GObject *player, GParamSpec *pspec, GMainLoop *loop)
+{
+	g_main_loop_quit (loop);
+}
+
+static gboolean
+preroll_timeout_cb (GMainLoop *loop)
+{
+	g_main_loop_quit (loop);
+	return FALSE;
+}
+
+START_TEST (test_player_preroll_latency)
+{
+	RBPlayer *player;
+	GMainLoop *loop;
+	GError *error = NULL;
+	gint64 latency = 0;
+	gint64 average = 0;
+	gint64 max = 0;
+	char *dir;
+	char *filename;
+	char *uri;
+	guint timeout_id;
+
+	if (gst_registry_check_feature_version (gst_registry_get (), "wavparse", 1, 0, 0) == FALSE) {
+		rb_debug ("wavparse not available, can't test prerolling");
+		return;
+	}
+
+	dir = g_dir_make_tmp ("rb-test-player-XXXXXX", NULL);
+	fail_unless (dir != NULL, "failed to create temporary directory");
+	filename = write_test_wav (dir);
+	uri = g_filename_to_uri (filename, NULL, NULL);
+
+	player = rb_player_new (TRUE, &error);
+	fail_unless (player != NULL, "failed to create player");
+
+	loop = g_main_loop_new (NULL, FALSE);
+	g_signal_connect (player, "notify::preroll-latency", G_CALLBACK (preroll_latency_notify_cb), loop);
+	timeout_id = g_timeout_add_seconds (10, (GSourceFunc) preroll_timeout_cb, loop);
+
+	/* opening a stream starts prerolling it, and the latency is
+	 * recorded when that finishes.
+	 */
+	fail_unless (rb_player_open (player, uri, NULL, NULL, &error), "failed to open stream");
+	g_main_loop_run (loop);
+
+	fail_unless (g_source_remove (timeout_id), "preroll latency wasn't notified");
+	g_object_get (player,
+		      "preroll-latency", &latency,
+		      "preroll-latency-average", &average,
+		      "preroll-latency-max", &max,
+		      NULL);
+	fail_unless (latency > 0, "preroll latency wasn't recorded");
+	fail_unless (average == latency, "average preroll latency is wrong after one stream");
+	fail_unless (max == latency, "maximum preroll latency is wrong after one stream");
+
+	rb_player_close (player, NULL, NULL);
+	g_object_unref (player);
+	g_main_loop_unref (loop);
+
+	g_unlink (filename);
+	g_rmdir (dir);
+	g_free (filename);
+	g_free (uri);
+	g_free (dir);
+}
+END_TEST
+
+static Suite *
+rb_player_suite (void)
+{
+	Suite *s = suite_create ("rb-player");
+	TCase *tc_chain = tcase_create ("rb-player-core");
+
+	suite_add_tcase (s, tc_chain);
+
+	tcase_add_test (tc_chain, test_player_preroll_latency);
+
+	return s;
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+	SRunner *sr;
+	Suite *s;
+
+	rb_profile_start ("rb-player test suite");
+	rb_threads_init ();
+	setlocale (LC_ALL, NULL);
+	rb_debug_init (TRUE);
+	rb_file_helpers_init (TRUE);
+	gst_init (&argc, &argv);
+
+	/* setup tests */
+	s = rb_player_suite ();
+	sr = srunner_create (s);
+
+	init_setup (sr, argc, argv);
+	init_once (FALSE);
+
+	srunner_run_all (sr, CK_NORMAL);
+	ret = srunner_ntests_failed (sr);
+	srunner_free (sr);
+
+	rb_file_helpers_shutdown ();
+
+	rb_profile_end ("rb-player test suite");
+	return ret;
+}
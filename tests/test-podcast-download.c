@@ -0,0 +1,656 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <check.h>
+#include <gtk/gtk.h>
+#include <locale.h>
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+
+#include "test-utils.h"
+#include "rb-podcast-downloader.h"
+#include "rb-podcast-parse.h"
+#include "rb-util.h"
+#include "rb-debug.h"
+
+#define BODY_SIZE		(256 * 1024)
+#define SLOW_CHUNK_SIZE		(8 * 1024)
+#define TEST_TIMEOUT		20
+
+/* a local http server standing in for podcast hosts */
+static SoupServer *server;
+static guint server_port;
+static char *body;
+
+/* requests the server has seen */
+static int in_flight;
+static int max_in_flight;
+static GHashTable *host_in_flight;
+static int max_host_in_flight;
+static goffset last_range_start;
+static int get_count;
+
+/* the podcast feed the server provides */
+#define FEED_ETAG		"\"feed-1\""
+#define FEED_LAST_MODIFIED	"Wed, 01 Jan 2020 00:00:00 GMT"
+static const char *feed_body;
+static gboolean feed_validators;
+static int feed_get_count;
+static int feed_not_modified_count;
+
+static const char feed_body_1[] =
+	"<?xml version=\"1.0\"?>\n"
+	"<rss version=\"2.0\"><channel><title>Test feed</title>\n"
+	"<item><title>Episode 1</title>"
+	"<enclosure url=\"http://127.0.0.1/episode-1.mp3\" length=\"262144\" type=\"audio/mpeg\"/></item>\n"
+	"</channel></rss>\n";
+
+static const char feed_body_2[] =
+	"<?xml version=\"1.0\"?>\n"
+	"<rss version=\"2.0\"><channel><title>Test feed</title>\n"
+	"<item><title>Episode 2</title>"
+	"<enclosure url=\"http://127.0.0.1/episode-2.mp3\" length=\"262144\" type=\"audio/mpeg\"/></item>\n"
+	"<item><title>Episode 1</title>"
+	"<enclosure url=\"http://127.0.0.1/episode-1.mp3\" length=\"262144\" type=\"audio/mpeg\"/></item>\n"
+	"</channel></rss>\n";
+
+/* downloads */
+static GMainLoop *loop;
+static char *dest_dir;
+static int downloads_pending;
+
+typedef struct {
+	char *dest_path;
+	gboolean done;
+	GError *error;
+	guint64 downloaded;
+	gboolean progress;
+} TestDownload;
+
+typedef struct {
+	SoupMessage *msg;
+	char *host;
+	goffset offset;
+} PendingResponse;
+
+static void
+update_in_flight (const char *host, int delta)
+{
+	int count;
+
+	in_flight += delta;
+	max_in_flight = MAX (max_in_flight, in_flight);
+
+	count = GPOINTER_TO_INT (g_hash_table_lookup (host_in_flight, host)) + delta;
+	g_hash_table_insert (host_in_flight, g_strdup (host), GINT_TO_POINTER (count));
+	max_host_in_flight = MAX (max_host_in_flight, count);
+}
+
+static gboolean
+delayed_response_cb (PendingResponse *pending)
+{
+	update_in_flight (pending->host, -1);
+	soup_server_unpause_message (server, pending->msg);
+
+	g_object_unref (pending->msg);
+	g_free (pending->host);
+	g_free (pending);
+	return FALSE;
+}
+
+static gboolean
+slow_chunk_cb (PendingResponse *pending)
+{
+	gsize len;
+
+	len = MIN (SLOW_CHUNK_SIZE, BODY_SIZE - pending->offset);
+	soup_message_body_append (pending->msg->response_body, SOUP_MEMORY_STATIC, body + pending->offset, len);
+	pending->offset += len;
+	if (pending->offset == BODY_SIZE)
+		soup_message_body_complete (pending->msg->response_body);
+	soup_server_unpause_message (server, pending->msg);
+
+	if (pending->offset < BODY_SIZE)
+		return TRUE;
+
+	g_object_unref (pending->msg);
+	g_free (pending->host);
+	g_free (pending);
+	return FALSE;
+}
+
+static void
+server_cb (SoupServer *srv, SoupMessage *msg, const char *path, GHashTable *query, SoupClientContext *client, gpointer data)
+{
+	SoupRange *ranges;
+	int n_ranges;
+	goffset start = 0;
+	goffset end = BODY_SIZE - 1;
+	PendingResponse *pending;
+
+	if (msg->method != SOUP_METHOD_GET && msg->method != SOUP_METHOD_HEAD) {
+		soup_message_set_status (msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	soup_message_headers_replace (msg->response_headers, "ETag", "\"episode\"");
+
+	if (strcmp (path, "/slow.mp3") == 0 && msg->method == SOUP_METHOD_GET) {
+		get_count++;
+		soup_message_set_status (msg, SOUP_STATUS_OK);
+		soup_message_headers_set_encoding (msg->response_headers, SOUP_ENCODING_CHUNKED);
+		soup_message_headers_set_content_type (msg->response_headers, "audio/mpeg", NULL);
+
+		pending = g_new0 (PendingResponse, 1);
+		pending->msg = g_object_ref (msg);
+		soup_server_pause_message (srv, msg);
+		g_timeout_add (50, (GSourceFunc) slow_chunk_cb, pending);
+		return;
+	}
+
+	if (soup_message_headers_get_ranges (msg->request_headers, BODY_SIZE, &ranges, &n_ranges)) {
+		start = ranges[0].start;
+		end = ranges[0].end;
+		soup_message_headers_free_ranges (msg->request_headers, ranges);
+
+		soup_message_set_status (msg, SOUP_STATUS_PARTIAL_CONTENT);
+		soup_message_headers_set_content_range (msg->response_headers, start, end, BODY_SIZE);
+	} else {
+		soup_message_set_status (msg, SOUP_STATUS_OK);
+	}
+	soup_message_set_response (msg, "audio/mpeg", SOUP_MEMORY_STATIC, body + start, end - start + 1);
+
+	if (msg->method == SOUP_METHOD_HEAD)
+		return;
+
+	get_count++;
+	last_range_start = start;
+
+	/* hold each response for a while so concurrent downloads overlap */
+	pending = g_new0 (PendingResponse, 1);
+	pending->msg = g_object_ref (msg);
+	pending->host = g_strdup (soup_message_get_uri (msg)->host);
+	update_in_flight (pending->host, 1);
+	soup_server_pause_message (srv, msg);
+	g_timeout_add (200, (GSourceFunc) delayed_response_cb, pending);
+}
+
+static void
+feed_server_cb (SoupServer *srv, SoupMessage *msg, const char *path, GHashTable *query, SoupClientContext *client, gpointer data)
+{
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status (msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	feed_get_count++;
+	if (feed_validators) {
+		soup_message_headers_replace (msg->response_headers, "ETag", FEED_ETAG);
+		soup_message_headers_replace (msg->response_headers, "Last-Modified", FEED_LAST_MODIFIED);
+		if (g_strcmp0 (soup_message_headers_get_one (msg->request_headers, "If-None-Match"), FEED_ETAG) == 0) {
+			feed_not_modified_count++;
+			soup_message_set_status (msg, SOUP_STATUS_NOT_MODIFIED);
+			return;
+		}
+	}
+
+	soup_message_set_status (msg, SOUP_STATUS_OK);
+	soup_message_set_response (msg, "application/rss+xml", SOUP_MEMORY_STATIC, feed_body, strlen (feed_body));
+}
+
+static GFile *
+destination_cb (RBPodcastDownload *download, GFileInfo *info, TestDownload *td, GError **error)
+{
+	return g_file_new_for_path (td->dest_path);
+}
+
+static void
+progress_cb (RBPodcastDownload *download, guint64 downloaded, guint64 total, TestDownload *td)
+{
+	td->progress = TRUE;
+}
+
+static void
+done_cb (RBPodcastDownload *download, guint64 downloaded, guint64 total, const GError *error, TestDownload *td)
+{
+	td->done = TRUE;
+	td->downloaded = downloaded;
+	if (error != NULL)
+		td->error = g_error_copy (error);
+
+	if (--downloads_pending == 0)
+		g_main_loop_quit (loop);
+}
+
+static gboolean
+timeout_cb (gpointer data)
+{
+	g_main_loop_quit (loop);
+	return FALSE;
+}
+
+static TestDownload *
+add_download (RBPodcastDownloader *downloader, const char *host, const char *path, const char *name, RBPodcastDownload **download)
+{
+	TestDownload *td;
+	RBPodcastDownload *d;
+	char *uri;
+
+	td = g_new0 (TestDownload, 1);
+	td->dest_path = g_build_filename (dest_dir, name, NULL);
+
+	uri = g_strdup_printf ("http://%s:%u%s", host, server_port, path);
+	d = rb_podcast_downloader_add (downloader,
+				       uri,
+				       (RBPodcastDownloadDestinationFunc) destination_cb,
+				       (RBPodcastDownloadProgressFunc) progress_cb,
+				       (RBPodcastDownloadDoneFunc) done_cb,
+				       td,
+				       NULL);
+	g_free (uri);
+
+	if (download != NULL)
+		*download = d;
+	downloads_pending++;
+	return td;
+}
+
+static void
+wait_for_downloads (void)
+{
+	guint timeout_id;
+
+	timeout_id = g_timeout_add_seconds (TEST_TIMEOUT, timeout_cb, NULL);
+	g_main_loop_run (loop);
+	g_source_remove (timeout_id);
+
+	fail_unless (downloads_pending == 0, "downloads didn't finish in time");
+}
+
+static void
+check_download (TestDownload *td)
+{
+	char *contents;
+	gsize length;
+
+	fail_unless (td->done, "download wasn't completed");
+	fail_unless (td->error == NULL, "download failed: %s", td->error ? td->error->message : "");
+	fail_unless (g_file_get_contents (td->dest_path, &contents, &length, NULL), "couldn't read downloaded file");
+	fail_unless (length == BODY_SIZE, "downloaded file has the wrong size (%" G_GSIZE_FORMAT ")", length);
+	fail_unless (memcmp (contents, body, BODY_SIZE) == 0, "downloaded file has the wrong contents");
+	g_free (contents);
+}
+
+static void
+free_download (TestDownload *td)
+{
+	g_unlink (td->dest_path);
+	g_free (td->dest_path);
+	g_clear_error (&td->error);
+	g_free (td);
+}
+
+static void
+setup (void)
+{
+	int i;
+
+	body = g_malloc (BODY_SIZE);
+	for (i = 0; i < BODY_SIZE; i++) {
+		body[i] = (i * 31 + i / 997) & 0xff;
+	}
+
+	server = soup_server_new (SOUP_SERVER_PORT, 0, NULL);
+	fail_unless (server != NULL, "couldn't start http server");
+	server_port = soup_server_get_port (server);
+	soup_server_add_handler (server, NULL, server_cb, NULL, NULL);
+	soup_server_add_handler (server, "/feed.rss", feed_server_cb, NULL, NULL);
+	soup_server_run_async (server);
+
+	host_in_flight = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	in_flight = 0;
+	max_in_flight = 0;
+	max_host_in_flight = 0;
+	last_range_start = -1;
+	get_count = 0;
+
+	feed_body = feed_body_1;
+	feed_validators = TRUE;
+	feed_get_count = 0;
+	feed_not_modified_count = 0;
+
+	loop = g_main_loop_new (NULL, FALSE);
+	downloads_pending = 0;
+	dest_dir = g_dir_make_tmp ("rb-test-podcast-download-XXXXXX", NULL);
+	fail_unless (dest_dir != NULL, "couldn't create temporary directory");
+}
+
+static void
+teardown (void)
+{
+	soup_server_disconnect (server);
+	g_object_unref (server);
+	g_hash_table_destroy (host_in_flight);
+	g_main_loop_unref (loop);
+	g_rmdir (dest_dir);
+	g_free (dest_dir);
+	g_free (body);
+}
+
+START_TEST (test_download_limit)
+{
+	RBPodcastDownloader *downloader;
+	TestDownload *td[5];
+	int i;
+
+	downloader = rb_podcast_downloader_new ();
+	g_object_set (downloader, "max-downloads", 2, "max-downloads-per-host", 2, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS (td); i++) {
+		char *name = g_strdup_printf ("episode-%d.mp3", i);
+		td[i] = add_download (downloader, "127.0.0.1", "/episode.mp3", name, NULL);
+		g_free (name);
+	}
+	wait_for_downloads ();
+
+	fail_unless (max_in_flight == 2, "expected 2 concurrent downloads, got %d", max_in_flight);
+	for (i = 0; i < G_N_ELEMENTS (td); i++) {
+		check_download (td[i]);
+		fail_unless (td[i]->downloaded == BODY_SIZE, "wrong size reported for download");
+		free_download (td[i]);
+	}
+
+	g_object_unref (downloader);
+}
+END_TEST
+
+START_TEST (test_download_host_limit)
+{
+	RBPodcastDownloader *downloader;
+	TestDownload *td[4];
+	int i;
+
+	downloader = rb_podcast_downloader_new ();
+	g_object_set (downloader, "max-downloads", 4, "max-downloads-per-host", 1, NULL);
+
+	/* two hostnames for the same server, so two hosts as far as the downloader knows */
+	for (i = 0; i < G_N_ELEMENTS (td); i++) {
+		char *name = g_strdup_printf ("episode-%d.mp3", i);
+		td[i] = add_download (downloader, (i % 2) ? "localhost" : "127.0.0.1", "/episode.mp3", name, NULL);
+		g_free (name);
+	}
+	wait_for_downloads ();
+
+	fail_unless (max_host_in_flight == 1, "expected 1 concurrent download per host, got %d", max_host_in_flight);
+	fail_unless (max_in_flight == 2, "expected 2 concurrent downloads, got %d", max_in_flight);
+	for (i = 0; i < G_N_ELEMENTS (td); i++) {
+		check_download (td[i]);
+		free_download (td[i]);
+	}
+
+	g_object_unref (downloader);
+}
+END_TEST
+
+START_TEST (test_download_resume)
+{
+	RBPodcastDownloader *downloader;
+	TestDownload *td;
+	char *path;
+
+	downloader = rb_podcast_downloader_new ();
+
+	/* a partial file left behind by an interrupted download */
+	path = g_build_filename (dest_dir, "episode.mp3", NULL);
+	fail_unless (g_file_set_contents (path, body, BODY_SIZE / 2, NULL), "couldn't create partial file");
+	g_free (path);
+
+	td = add_download (downloader, "127.0.0.1", "/episode.mp3", "episode.mp3", NULL);
+	wait_for_downloads ();
+
+	fail_unless (last_range_start == BODY_SIZE / 2,
+		     "expected download to resume from %d, got %" G_GINT64_FORMAT, BODY_SIZE / 2, (gint64) last_range_start);
+	check_download (td);
+	free_download (td);
+
+	/* downloading it again shouldn't transfer anything */
+	get_count = 0;
+	td = add_download (downloader, "127.0.0.1", "/episode.mp3", "episode.mp3", NULL);
+	wait_for_downloads ();
+
+	fail_unless (get_count == 0, "complete file was downloaded again");
+	check_download (td);
+	free_download (td);
+
+	g_object_unref (downloader);
+}
+END_TEST
+
+START_TEST (test_download_cancel_queued)
+{
+	RBPodcastDownloader *downloader;
+	RBPodcastDownload *download;
+	TestDownload *first;
+	TestDownload *queued;
+
+	downloader = rb_podcast_downloader_new ();
+	g_object_set (downloader, "max-downloads", 1, NULL);
+
+	first = add_download (downloader, "127.0.0.1", "/episode.mp3", "first.mp3", NULL);
+	queued = add_download (downloader, "127.0.0.1", "/episode.mp3", "queued.mp3", &download);
+
+	rb_podcast_downloader_cancel (downloader, download);
+	fail_unless (queued->done, "cancelled download wasn't completed");
+	fail_unless (g_error_matches (queued->error, G_IO_ERROR, G_IO_ERROR_CANCELLED),
+		     "cancelled download didn't report cancellation");
+
+	wait_for_downloads ();
+	check_download (first);
+	fail_unless (get_count == 1, "cancelled download was started");
+	fail_unless (g_file_test (queued->dest_path, G_FILE_TEST_EXISTS) == FALSE, "cancelled download created a file");
+
+	free_download (first);
+	free_download (queued);
+	g_object_unref (downloader);
+}
+END_TEST
+
+static void
+rate_notify_cb (RBPodcastDownloader *downloader, GParamSpec *pspec, guint64 *max_rate)
+{
+	*max_rate = MAX (*max_rate, rb_podcast_downloader_get_rate (downloader));
+}
+
+START_TEST (test_download_rate)
+{
+	RBPodcastDownloader *downloader;
+	TestDownload *td;
+	guint64 max_rate = 0;
+
+	downloader = rb_podcast_downloader_new ();
+	g_signal_connect (downloader, "notify::download-rate", G_CALLBACK (rate_notify_cb), &max_rate);
+
+	/* takes a couple of seconds, so the rate is sampled while it's running */
+	td = add_download (downloader, "127.0.0.1", "/slow.mp3", "slow.mp3", NULL);
+	wait_for_downloads ();
+
+	check_download (td);
+	fail_unless (td->progress, "no progress was reported");
+	fail_unless (max_rate > 0, "no download rate was reported");
+	fail_unless (max_rate <= BODY_SIZE, "download rate is too high (%" G_GUINT64_FORMAT ")", max_rate);
+	fail_unless (rb_podcast_downloader_get_rate (downloader) == 0, "download rate not reset when idle");
+	free_download (td);
+
+	g_object_unref (downloader);
+}
+END_TEST
+
+typedef struct {
+	RBPodcastChannel *channel;
+	char *url;
+	gboolean result;
+	GError *error;
+} FeedLoad;
+
+static gboolean
+feed_loaded_cb (gpointer data)
+{
+	g_main_loop_quit (loop);
+	return FALSE;
+}
+
+static gpointer
+load_feed_thread (FeedLoad *load)
+{
+	load->result = rb_podcast_parse_load_feed (load->channel, load->url, TRUE, &load->error);
+	g_idle_add (feed_loaded_cb, NULL);
+	return NULL;
+}
+
+/* loads the feed the way the podcast manager does, passing in the
+ * validators from the previous load, if any.  the feed is fetched
+ * synchronously, so it has to be done on another thread while the
+ * server runs here.
+ */
+static RBPodcastChannel *
+load_feed (RBPodcastChannel *previous)
+{
+	FeedLoad load;
+	GThread *thread;
+
+	load.channel = g_new0 (RBPodcastChannel, 1);
+	load.url = g_strdup_printf ("http://127.0.0.1:%u/feed.rss", server_port);
+	load.error = NULL;
+	if (previous != NULL) {
+		load.channel->etag = g_strdup (previous->etag);
+		load.channel->last_modified = g_strdup (previous->last_modified);
+		load.channel->checksum = g_strdup (previous->checksum);
+	}
+
+	thread = g_thread_new ("load-feed", (GThreadFunc) load_feed_thread, &load);
+	g_main_loop_run (loop);
+	g_thread_join (thread);
+
+	fail_unless (load.result, "loading the feed failed: %s", load.error ? load.error->message : "");
+	g_free (load.url);
+	return load.channel;
+}
+
+START_TEST (test_feed_conditional)
+{
+	RBPodcastChannel *first;
+	RBPodcastChannel *channel;
+	RBPodcastChannel *next;
+
+	/* the first load fetches and parses the feed */
+	first = load_feed (NULL);
+	fail_unless (first->unchanged == FALSE, "new feed was considered unchanged");
+	fail_unless (g_list_length (first->posts) == 1, "expected 1 post, got %u", g_list_length (first->posts));
+	fail_unless (g_strcmp0 (first->etag, FEED_ETAG) == 0, "etag wasn't recorded");
+	fail_unless (g_strcmp0 (first->last_modified, FEED_LAST_MODIFIED) == 0, "last modified time wasn't recorded");
+	fail_unless (first->checksum != NULL, "checksum wasn't recorded");
+
+	/* loading it again with the validators gets a 304 */
+	channel = load_feed (first);
+	fail_unless (feed_not_modified_count == 1, "conditional request wasn't made");
+	fail_unless (channel->unchanged, "not modified feed wasn't considered unchanged");
+	fail_unless (channel->posts == NULL, "not modified feed has posts");
+	fail_unless (g_strcmp0 (channel->etag, FEED_ETAG) == 0, "etag was lost after a 304 response");
+	fail_unless (g_strcmp0 (channel->checksum, first->checksum) == 0, "checksum was lost after a 304 response");
+	rb_podcast_parse_channel_free (channel);
+
+	/* a server ignoring the validators sends the whole feed again,
+	 * which is skipped because its contents are the same.
+	 */
+	feed_validators = FALSE;
+	channel = load_feed (first);
+	fail_unless (feed_get_count == 3, "expected 3 requests, got %d", feed_get_count);
+	fail_unless (channel->unchanged, "feed with the same contents wasn't considered unchanged");
+	fail_unless (channel->posts == NULL, "unchanged feed has posts");
+	fail_unless (channel->etag == NULL, "etag the server no longer sends was kept");
+	fail_unless (channel->last_modified == NULL, "last modified time the server no longer sends was kept");
+
+	/* and parsed when its contents change */
+	feed_body = feed_body_2;
+	next = load_feed (channel);
+	fail_unless (next->unchanged == FALSE, "changed feed was considered unchanged");
+	fail_unless (g_list_length (next->posts) == 2, "expected 2 posts, got %u", g_list_length (next->posts));
+	fail_unless (g_strcmp0 (next->checksum, first->checksum) != 0, "checksum wasn't updated");
+
+	rb_podcast_parse_channel_free (next);
+	rb_podcast_parse_channel_free (channel);
+	rb_podcast_parse_channel_free (first);
+}
+END_TEST
+
+static Suite *
+rb_podcast_download_suite (void)
+{
+	Suite *s = suite_create ("rb-podcast-download");
+	TCase *tc_chain = tcase_create ("rb-podcast-download-core");
+
+	suite_add_tcase (s, tc_chain);
+	tcase_add_checked_fixture (tc_chain, setup, teardown);
+	tcase_set_timeout (tc_chain, TEST_TIMEOUT * 2);
+
+	tcase_add_test (tc_chain, test_download_limit);
+	tcase_add_test (tc_chain, test_download_host_limit);
+	tcase_add_test (tc_chain, test_download_resume);
+	tcase_add_test (tc_chain, test_download_cancel_queued);
+	tcase_add_test (tc_chain, test_download_rate);
+	tcase_add_test (tc_chain, test_feed_conditional);
+
+	return s;
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+	SRunner *sr;
+	Suite *s;
+
+	rb_threads_init ();
+	setlocale (LC_ALL, NULL);
+	rb_debug_init (TRUE);
+
+	/* setup tests */
+	s = rb_podcast_download_suite ();
+	sr = srunner_create (s);
+
+	init_setup (sr, argc, argv);
+	init_once (FALSE);
+
+	srunner_run_all (sr, CK_NORMAL);
+	ret = srunner_ntests_failed (sr);
+	srunner_free (sr);
+
+	return ret;
+}
@@ -29,6 +29,7 @@
 
 #include <string.h>
 #include <glib-object.h>
+#include <glib/gstdio.h>
 
 #include <check.h>
 #include "test-utils.h"
@@ -82,6 +83,81 @@ START_TEST (test_rb_string_value_map)
 }
 END_TEST
 
+START_TEST (test_rb_trace)
+{
+	char *dir;
+	char *filename;
+	char *counters_filename;
+	char *contents;
+	char *dump;
+	RBTraceCounter *counter;
+
+	rb_trace_counter_set ("test.b", 5);
+	rb_trace_counter_add ("test.b", -2);
+	rb_trace_counter_add ("test.a", 1);
+	fail_unless (rb_trace_counter_get ("test.b") == 3, "counter has wrong value");
+	fail_unless (rb_trace_counter_get ("test.missing") == 0, "missing counter should be 0");
+
+	/* handles update the same counter as the name-based functions */
+	counter = rb_trace_counter_lookup ("test.c");
+	fail_unless (rb_trace_counter_lookup ("test.c") == counter, "counter lookup returned a different handle");
+	rb_trace_counter_add_value (counter, 4);
+	rb_trace_counter_add ("test.c", 3);
+	rb_trace_counter_add_value (counter, -5);
+	fail_unless (rb_trace_counter_get ("test.c") == 2, "counter has wrong value after updates through its handle");
+	/* values don't fit in 32 bits */
+	rb_trace_counter_set_value (counter, G_GINT64_CONSTANT (1) << 40);
+	rb_trace_counter_add_value (counter, G_GINT64_CONSTANT (1) << 33);
+	fail_unless (rb_trace_counter_get ("test.c") == (G_GINT64_CONSTANT (1) << 40) + (G_GINT64_CONSTANT (1) << 33),
+		     "counter value was truncated");
+	rb_trace_counter_set_value (counter, 7);
+	fail_unless (rb_trace_counter_get ("test.c") == 7, "counter has wrong value after being set through its handle");
+
+	dump = rb_trace_dump_counters ();
+	fail_unless (strstr (dump, "test.a 1\ntest.b 3\ntest.c 7\n") != NULL, "counter dump is wrong: %s", dump);
+	g_free (dump);
+
+	/* spans aren't recorded until a trace file is set */
+	fail_unless (rb_trace_enabled () == FALSE, "tracing should be disabled");
+	rb_trace_begin ("test", "unrecorded");
+	rb_trace_end ("test", "unrecorded");
+
+	dir = g_dir_make_tmp ("rb-trace-XXXXXX", NULL);
+	fail_unless (dir != NULL, "couldn't create temporary directory");
+	filename = g_build_filename (dir, "trace.json", NULL);
+	counters_filename = g_strdup_printf ("%s.counters", filename);
+
+	rb_trace_init (filename);
+	fail_unless (rb_trace_enabled (), "tracing should be enabled");
+	rb_trace_begin ("test", "span \"quoted\"");
+	rb_trace_instant ("test", "instant");
+	rb_trace_end ("test", "span");
+	rb_trace_shutdown ();
+	fail_unless (rb_trace_enabled () == FALSE, "tracing should be disabled after shutdown");
+
+	fail_unless (g_file_get_contents (filename, &contents, NULL, NULL), "trace wasn't written");
+	fail_unless (g_str_has_prefix (contents, "{\"traceEvents\":["), "trace doesn't look like a trace: %s", contents);
+	fail_unless (strstr (contents, "{\"name\":\"span \\\"quoted\\\"\",\"cat\":\"test\",\"ph\":\"B\"") != NULL,
+		     "span begin missing or badly escaped: %s", contents);
+	fail_unless (strstr (contents, "\"ph\":\"E\"") != NULL, "span end missing: %s", contents);
+	fail_unless (strstr (contents, "\"name\":\"instant\",\"cat\":\"test\",\"ph\":\"i\"") != NULL,
+		     "instant event missing: %s", contents);
+	fail_unless (strstr (contents, "unrecorded") == NULL, "event recorded while tracing was disabled");
+	g_free (contents);
+
+	fail_unless (g_file_get_contents (counters_filename, &contents, NULL, NULL), "counters weren't written");
+	fail_unless (strstr (contents, "test.b 3\n") != NULL, "counters file is wrong: %s", contents);
+	g_free (contents);
+
+	g_unlink (filename);
+	g_unlink (counters_filename);
+	g_rmdir (dir);
+	g_free (counters_filename);
+	g_free (filename);
+	g_free (dir);
+}
+END_TEST
+
 static Suite *
 rb_file_helpers_suite ()
 {
@@ -91,6 +167,7 @@ rb_file_helpers_suite ()
 	suite_add_tcase (s, tc_chain);
 
 	tcase_add_test (tc_chain, test_rb_string_value_map);
+	tcase_add_test (tc_chain, test_rb_trace);
 
 	return s;
 }
@@ -27,6 +27,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <check.h>
 #include <gtk/gtk.h>
 #include <locale.h>
@@ -664,6 +666,174 @@ START_TEST (test_rhythmdb_property_model_empty_strings)
 }
 END_TEST
 
+/* tests property models built while the query populating the query model runs */
+START_TEST (test_rhythmdb_property_model_bulk)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBPropertyModel *propmodel;
+	RhythmDBEntry *a, *b, *c, *d;
+	GtkTreeIter iter;
+	char *artist;
+
+	start_test_case ();
+
+	/* setup */
+	set_waiting_signal (G_OBJECT (db), "entry_added");
+	a = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///a.ogg");
+	b = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///b.ogg");
+	c = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///c.ogg");
+	d = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///d.ogg");
+	set_entry_string (db, a, RHYTHMDB_PROP_ARTIST, "y");
+	set_entry_string (db, b, RHYTHMDB_PROP_ARTIST, "x");
+	set_entry_string (db, c, RHYTHMDB_PROP_ARTIST, "z");
+	set_entry_string (db, d, RHYTHMDB_PROP_ARTIST, "x");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	end_step ();
+
+	/* attach the property model while the query is running */
+	model = rhythmdb_query_model_new_empty (db);
+	rhythmdb_do_full_query_async (db, RHYTHMDB_QUERY_RESULTS (model),
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_END);
+	fail_unless (rhythmdb_query_model_query_running (model));
+
+	propmodel = rhythmdb_property_model_new (db, RHYTHMDB_PROP_ARTIST);
+	set_waiting_signal (G_OBJECT (model), "complete");
+	g_object_set (propmodel, "query-model", model, NULL);
+	wait_for_signal ();
+	fail_if (rhythmdb_query_model_query_running (model));
+
+	/* the values should all be there, in order */
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (propmodel), NULL) == 4);
+	fail_unless (_get_property_count (propmodel, "x") == 2);
+	fail_unless (_get_property_count (propmodel, "y") == 1);
+	fail_unless (_get_property_count (propmodel, "z") == 1);
+
+	fail_unless (gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (propmodel), &iter, NULL, 1));
+	gtk_tree_model_get (GTK_TREE_MODEL (propmodel), &iter, RHYTHMDB_PROPERTY_MODEL_COLUMN_TITLE, &artist, -1);
+	fail_unless (strcmp (artist, "x") == 0);
+	g_free (artist);
+	fail_unless (gtk_tree_model_iter_next (GTK_TREE_MODEL (propmodel), &iter));
+	gtk_tree_model_get (GTK_TREE_MODEL (propmodel), &iter, RHYTHMDB_PROPERTY_MODEL_COLUMN_TITLE, &artist, -1);
+	fail_unless (strcmp (artist, "y") == 0);
+	g_free (artist);
+	fail_unless (gtk_tree_model_iter_next (GTK_TREE_MODEL (propmodel), &iter));
+	gtk_tree_model_get (GTK_TREE_MODEL (propmodel), &iter, RHYTHMDB_PROPERTY_MODEL_COLUMN_TITLE, &artist, -1);
+	fail_unless (strcmp (artist, "z") == 0);
+	g_free (artist);
+
+	end_step ();
+
+	/* changes after the query is complete are applied directly */
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_string (db, a, RHYTHMDB_PROP_ARTIST, "w");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+	fail_unless (_get_property_count (propmodel, "w") == 1);
+	fail_unless (_get_property_count (propmodel, "y") == 0);
+
+	end_step ();
+
+	rhythmdb_entry_delete (db, a);
+	rhythmdb_entry_delete (db, b);
+	rhythmdb_entry_delete (db, c);
+	rhythmdb_entry_delete (db, d);
+	rhythmdb_commit (db);
+
+	end_test_case ();
+
+	g_object_unref (model);
+	g_object_unref (propmodel);
+}
+END_TEST
+
+static void
+_count_row_inserted (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, GArray *inserted)
+{
+	int index = gtk_tree_path_get_indices (path)[0];
+	g_array_append_val (inserted, index);
+}
+
+static void
+_count_row_changed (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, int *changed)
+{
+	(*changed)++;
+}
+
+/* tests property models attached to query models that are already complete */
+START_TEST (test_rhythmdb_property_model_bulk_complete)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBPropertyModel *propmodel;
+	RhythmDBEntry *a, *b, *c, *d;
+	GArray *inserted;
+	int changed = 0;
+
+	start_test_case ();
+
+	/* setup */
+	set_waiting_signal (G_OBJECT (db), "entry_added");
+	a = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///a.ogg");
+	b = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///b.ogg");
+	c = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///c.ogg");
+	d = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///d.ogg");
+	set_entry_string (db, a, RHYTHMDB_PROP_ARTIST, "y");
+	set_entry_string (db, b, RHYTHMDB_PROP_ARTIST, "x");
+	set_entry_string (db, c, RHYTHMDB_PROP_ARTIST, "z");
+	set_entry_string (db, d, RHYTHMDB_PROP_ARTIST, "x");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	model = rhythmdb_query_model_new_empty (db);
+	rhythmdb_do_full_query (db, RHYTHMDB_QUERY_RESULTS (model),
+				RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				RHYTHMDB_QUERY_END);
+	fail_if (rhythmdb_query_model_query_running (model));
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 4);
+
+	end_step ();
+
+	/* attaching should publish the values once, in order, rather than
+	 * inserting and updating rows for each entry.
+	 */
+	propmodel = rhythmdb_property_model_new (db, RHYTHMDB_PROP_ARTIST);
+	inserted = g_array_new (FALSE, FALSE, sizeof (int));
+	g_signal_connect (propmodel, "row-inserted", G_CALLBACK (_count_row_inserted), inserted);
+	g_signal_connect (propmodel, "row-changed", G_CALLBACK (_count_row_changed), &changed);
+	g_object_set (propmodel, "query-model", model, NULL);
+
+	fail_unless (inserted->len == 3, "%u rows inserted", inserted->len);
+	fail_unless (g_array_index (inserted, int, 0) == 1 &&
+		     g_array_index (inserted, int, 1) == 2 &&
+		     g_array_index (inserted, int, 2) == 3,
+		     "rows weren't inserted in order");
+	fail_unless (changed == 0, "%d rows changed while attaching", changed);
+
+	fail_unless (_get_property_count (propmodel, "x") == 2);
+	fail_unless (_get_property_count (propmodel, "y") == 1);
+	fail_unless (_get_property_count (propmodel, "z") == 1);
+
+	g_signal_handlers_disconnect_by_func (propmodel, G_CALLBACK (_count_row_inserted), inserted);
+	g_signal_handlers_disconnect_by_func (propmodel, G_CALLBACK (_count_row_changed), &changed);
+	g_array_free (inserted, TRUE);
+
+	end_step ();
+
+	rhythmdb_entry_delete (db, a);
+	rhythmdb_entry_delete (db, b);
+	rhythmdb_entry_delete (db, c);
+	rhythmdb_entry_delete (db, d);
+	rhythmdb_commit (db);
+
+	end_test_case ();
+
+	g_object_unref (model);
+	g_object_unref (propmodel);
+}
+END_TEST
+
 static Suite *
 rhythmdb_property_model_suite (void)
 {
@@ -681,6 +851,8 @@ rhythmdb_property_model_suite (void)
 	tcase_add_test (tc_chain, test_rhythmdb_property_model_query);
 	tcase_add_test (tc_chain, test_rhythmdb_property_model_query_chain);
 	tcase_add_test (tc_chain, test_rhythmdb_property_model_sorting);
+	tcase_add_test (tc_chain, test_rhythmdb_property_model_bulk);
+	tcase_add_test (tc_chain, test_rhythmdb_property_model_bulk_complete);
 
 	/* tests for breakable bug fixes */
 /*	tcase_add_test (tc_bugs, test_hidden_chain_filter);*/
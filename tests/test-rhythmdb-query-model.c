@@ -30,8 +30,10 @@
 #include <check.h>
 #include <gtk/gtk.h>
 #include <locale.h>
+#include <string.h>
 #include "test-utils.h"
 #include "rhythmdb-query-model.h"
+#include "rb-podcast-entry-types.h"
 
 #include "rb-debug.h"
 #include "rb-file-helpers.h"
@@ -216,6 +218,827 @@ START_TEST (test_rhythmdb_db_queries)
 }
 END_TEST
 
+/* evaluates a preprocessed query the way the backend did before queries
+ * were compiled, to check the compiled programs against.
+ */
+static gboolean reference_evaluate_query (RhythmDB *db, GPtrArray *query, RhythmDBEntry *entry);
+
+static int
+reference_compare_values (RhythmDB *db, RhythmDBQueryData *data, RhythmDBEntry *entry)
+{
+	switch (rhythmdb_get_property_type (db, data->propid)) {
+	case G_TYPE_STRING:
+		return g_strcmp0 (rhythmdb_entry_get_string (entry, data->propid), g_value_get_string (data->val));
+	case G_TYPE_ULONG:
+	{
+		gulong a = rhythmdb_entry_get_ulong (entry, data->propid);
+		gulong b = g_value_get_ulong (data->val);
+		return (a < b) ? -1 : (a > b);
+	}
+	case G_TYPE_BOOLEAN:
+		return rhythmdb_entry_get_boolean (entry, data->propid) - g_value_get_boolean (data->val);
+	case G_TYPE_UINT64:
+	{
+		guint64 a = rhythmdb_entry_get_uint64 (entry, data->propid);
+		guint64 b = g_value_get_uint64 (data->val);
+		return (a < b) ? -1 : (a > b);
+	}
+	case G_TYPE_DOUBLE:
+	{
+		gdouble a = rhythmdb_entry_get_double (entry, data->propid);
+		gdouble b = g_value_get_double (data->val);
+		return (a < b) ? -1 : (a > b);
+	}
+	case G_TYPE_OBJECT:
+	{
+		gpointer a = rhythmdb_entry_get_object (entry, data->propid);
+		gpointer b = g_value_get_object (data->val);
+		return (a < b) ? -1 : (a > b);
+	}
+	default:
+		g_assert_not_reached ();
+		return 0;
+	}
+}
+
+static gboolean
+reference_evaluate_term (RhythmDB *db, RhythmDBQueryData *data, RhythmDBEntry *entry)
+{
+	switch (data->type) {
+	case RHYTHMDB_QUERY_SUBQUERY:
+		return reference_evaluate_query (db, data->subquery, entry);
+	case RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN:
+	case RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN:
+	{
+		GTimeVal now;
+		gboolean within;
+
+		g_get_current_time (&now);
+		within = (rhythmdb_entry_get_ulong (entry, data->propid) >= (now.tv_sec - g_value_get_ulong (data->val)));
+		return within == (data->type == RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN);
+	}
+	case RHYTHMDB_QUERY_PROP_PREFIX:
+		return g_str_has_prefix (rhythmdb_entry_get_string (entry, data->propid), g_value_get_string (data->val));
+	case RHYTHMDB_QUERY_PROP_SUFFIX:
+		return g_str_has_suffix (rhythmdb_entry_get_string (entry, data->propid), g_value_get_string (data->val));
+	case RHYTHMDB_QUERY_PROP_LIKE:
+	case RHYTHMDB_QUERY_PROP_NOT_LIKE:
+	{
+		gboolean like = (data->type == RHYTHMDB_QUERY_PROP_LIKE);
+
+		if (data->propid == RHYTHMDB_PROP_KEYWORD) {
+			RBRefString *keyword;
+			gboolean has = FALSE;
+
+			keyword = rb_refstring_find (g_value_get_string (data->val));
+			if (keyword != NULL) {
+				has = rhythmdb_entry_keyword_has (db, entry, keyword);
+				rb_refstring_unref (keyword);
+			}
+			return has == like;
+		} else if (data->propid == RHYTHMDB_PROP_SEARCH_MATCH) {
+			const RhythmDBPropType props[] = {
+				RHYTHMDB_PROP_TITLE_FOLDED,
+				RHYTHMDB_PROP_ALBUM_FOLDED,
+				RHYTHMDB_PROP_ARTIST_FOLDED,
+				RHYTHMDB_PROP_COMPOSER_FOLDED,
+				RHYTHMDB_PROP_GENRE_FOLDED
+			};
+			gchar **words;
+			int i;
+
+			for (words = g_value_get_boxed (data->val); *words != NULL; words++) {
+				gboolean found = FALSE;
+
+				for (i = 0; i < G_N_ELEMENTS (props) && !found; i++) {
+					const char *str = rhythmdb_entry_get_string (entry, props[i]);
+					found = (str != NULL && strstr (str, *words) != NULL);
+				}
+				if (!found)
+					return !like;
+			}
+			return like;
+		} else if (rhythmdb_get_property_type (db, data->propid) == G_TYPE_STRING) {
+			const char *str = rhythmdb_entry_get_string (entry, data->propid);
+
+			if (str == NULL)
+				return FALSE;
+			return (strstr (str, g_value_get_string (data->val)) != NULL) == like;
+		}
+		return reference_compare_values (db, data, entry) == 0;
+	}
+	case RHYTHMDB_QUERY_PROP_EQUALS:
+		return reference_compare_values (db, data, entry) == 0;
+	case RHYTHMDB_QUERY_PROP_NOT_EQUAL:
+		return reference_compare_values (db, data, entry) != 0;
+	case RHYTHMDB_QUERY_PROP_GREATER:
+		return reference_compare_values (db, data, entry) >= 0;
+	case RHYTHMDB_QUERY_PROP_LESS:
+		return reference_compare_values (db, data, entry) <= 0;
+	default:
+		g_assert_not_reached ();
+		return FALSE;
+	}
+}
+
+static gboolean
+reference_evaluate_query (RhythmDB *db, GPtrArray *query, RhythmDBEntry *entry)
+{
+	gboolean match = TRUE;
+	guint i;
+
+	for (i = 0; i < query->len; i++) {
+		RhythmDBQueryData *data = g_ptr_array_index (query, i);
+
+		if (data->type == RHYTHMDB_QUERY_DISJUNCTION) {
+			if (match)
+				return TRUE;
+			match = TRUE;
+		} else if (match) {
+			match = reference_evaluate_term (db, data, entry);
+		}
+	}
+	return match;
+}
+
+/* checks that the query matches the same entries when it's compiled, both
+ * evaluated directly and when run by the backend, as it does when
+ * evaluated term by term.
+ */
+static void
+check_compiled_query (GPtrArray *entries, RhythmDBQuery *query, const char *what)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBQuery *processed;
+	GtkTreeIter iter;
+	guint i;
+
+	processed = rhythmdb_query_copy (query);
+	rhythmdb_query_preprocess (db, processed);
+
+	model = rhythmdb_query_model_new_empty (db);
+	rhythmdb_do_full_query_parsed (db, RHYTHMDB_QUERY_RESULTS (model), query);
+
+	for (i = 0; i < entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+		gboolean expected;
+
+		expected = reference_evaluate_query (db, processed, entry);
+		fail_unless (rhythmdb_evaluate_query (db, processed, entry) == expected, what);
+		fail_unless (rhythmdb_query_model_entry_to_iter (model, entry, &iter) == expected, what);
+	}
+
+	g_object_unref (model);
+	rhythmdb_query_free (processed);
+}
+
+START_TEST (test_rhythmdb_compiled_queries)
+{
+	RhythmDBQuery *query;
+	RhythmDBQuery *subquery;
+	GPtrArray *entries;
+	RBRefString *keyword;
+	GTimeVal now;
+	guint i;
+
+	start_test_case ();
+
+	g_get_current_time (&now);
+	keyword = rb_refstring_new ("compiled-test");
+	entries = g_ptr_array_new ();
+	for (i = 0; i < 60; i++) {
+		RhythmDBEntry *entry;
+		char *str;
+
+		str = g_strdup_printf ("file:///compiled/%02u.ogg", i);
+		entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, str);
+		g_free (str);
+		fail_unless (entry != NULL, "failed to create entry");
+
+		str = g_strdup_printf ("Artist %u", i % 4);
+		set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, str);
+		g_free (str);
+		str = g_strdup_printf ("Album %u", i % 6);
+		set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM, str);
+		g_free (str);
+		if (i % 5 != 0) {
+			str = g_strdup_printf ("Song %u", i % 7);
+			set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, str);
+			g_free (str);
+		}
+		set_entry_string (db, entry, RHYTHMDB_PROP_GENRE, (i % 3) ? "Rock" : "Jazz");
+		set_entry_ulong (db, entry, RHYTHMDB_PROP_TRACK_NUMBER, i % 10);
+		set_entry_ulong (db, entry, RHYTHMDB_PROP_PLAY_COUNT, i % 4);
+
+		/* keep played times well clear of the criteria below */
+		set_entry_ulong (db, entry, RHYTHMDB_PROP_LAST_PLAYED, now.tv_sec - (i % 5) * 1000 - 500);
+
+		if (i % 4 == 1)
+			rhythmdb_entry_keyword_add (db, entry, keyword);
+
+		g_ptr_array_add (entries, entry);
+	}
+	rhythmdb_commit (db);
+
+	/* disjunctions */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_ARTIST, "Artist 1",
+				      RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_TRACK_NUMBER, 4,
+				      RHYTHMDB_QUERY_DISJUNCTION,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Jazz",
+				      RHYTHMDB_QUERY_DISJUNCTION,
+				      RHYTHMDB_QUERY_PROP_GREATER, RHYTHMDB_PROP_PLAY_COUNT, 3,
+				      RHYTHMDB_QUERY_END);
+	check_compiled_query (entries, query, "disjunction evaluated differently");
+	rhythmdb_query_free (query);
+
+	end_step ();
+
+	/* subqueries, with their own disjunctions */
+	subquery = rhythmdb_query_parse (db,
+					 RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_ALBUM, "Album 2",
+					 RHYTHMDB_QUERY_DISJUNCTION,
+					 RHYTHMDB_QUERY_PROP_PREFIX, RHYTHMDB_PROP_TITLE, "Song 3",
+					 RHYTHMDB_QUERY_END);
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_NOT_EQUAL, RHYTHMDB_PROP_ARTIST, "Artist 0",
+				      RHYTHMDB_QUERY_SUBQUERY, subquery,
+				      RHYTHMDB_QUERY_DISJUNCTION,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TRACK_NUMBER, 9,
+				      RHYTHMDB_QUERY_END);
+	check_compiled_query (entries, query, "subquery evaluated differently");
+	rhythmdb_query_free (query);
+	rhythmdb_query_free (subquery);
+
+	end_step ();
+
+	/* NOT_LIKE, including entries with no title */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_NOT_LIKE, RHYTHMDB_PROP_TITLE_FOLDED, "song 2",
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_ALBUM_FOLDED, "album",
+				      RHYTHMDB_QUERY_END);
+	check_compiled_query (entries, query, "NOT_LIKE evaluated differently");
+	rhythmdb_query_free (query);
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_NOT_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "rock artist 3",
+				      RHYTHMDB_QUERY_END);
+	check_compiled_query (entries, query, "negated search evaluated differently");
+	rhythmdb_query_free (query);
+
+	end_step ();
+
+	/* keywords */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_KEYWORD, "compiled-test",
+				      RHYTHMDB_QUERY_DISJUNCTION,
+				      RHYTHMDB_QUERY_PROP_NOT_LIKE, RHYTHMDB_PROP_KEYWORD, "compiled-test",
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_GENRE, "Jazz",
+				      RHYTHMDB_QUERY_END);
+	check_compiled_query (entries, query, "keyword query evaluated differently");
+	rhythmdb_query_free (query);
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_KEYWORD, "no-such-keyword",
+				      RHYTHMDB_QUERY_END);
+	check_compiled_query (entries, query, "unknown keyword evaluated differently");
+	rhythmdb_query_free (query);
+
+	end_step ();
+
+	/* time-relative criteria */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_CURRENT_TIME_WITHIN, RHYTHMDB_PROP_LAST_PLAYED, 2000,
+				      RHYTHMDB_QUERY_DISJUNCTION,
+				      RHYTHMDB_QUERY_PROP_CURRENT_TIME_NOT_WITHIN, RHYTHMDB_PROP_LAST_PLAYED, 4000,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_ARTIST, "Artist 2",
+				      RHYTHMDB_QUERY_END);
+	check_compiled_query (entries, query, "time-relative query evaluated differently");
+	rhythmdb_query_free (query);
+
+	end_step ();
+
+	for (i = 0; i < entries->len; i++) {
+		rhythmdb_entry_delete (db, g_ptr_array_index (entries, i));
+	}
+	rhythmdb_commit (db);
+	g_ptr_array_free (entries, TRUE);
+	rb_refstring_unref (keyword);
+
+	end_test_case ();
+}
+END_TEST
+
+/* entries for the sort order tests, with plenty of ties and empty values */
+#define SORT_TEST_ENTRIES	200
+
+static void
+set_entry_double (RhythmDB *db, RhythmDBEntry *entry, RhythmDBPropType prop, gdouble value)
+{
+	GValue v = {0,};
+
+	g_value_init (&v, G_TYPE_DOUBLE);
+	g_value_set_double (&v, value);
+	rhythmdb_entry_set (db, entry, prop, &v);
+	g_value_unset (&v);
+}
+
+static RhythmDBEntry *
+add_sort_test_entry (guint i)
+{
+	RhythmDBEntry *entry;
+	char *str;
+
+	/* spread the locations so insertion order isn't location order */
+	str = g_strdup_printf ("file:///sort/%03u.ogg", (i * 37) % SORT_TEST_ENTRIES);
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, str);
+	g_free (str);
+	fail_unless (entry != NULL, "failed to create entry");
+
+	/* leave every fifth value unset, and make every fifth one empty */
+	if (i % 5 != 0) {
+		str = (i % 5 == 1) ? g_strdup ("") : g_strdup_printf ("Title %u", i % 3);
+		set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, str);
+		g_free (str);
+	}
+	if (i % 5 != 2) {
+		str = (i % 5 == 3) ? g_strdup ("") : g_strdup_printf ("Artist %u", i % 2);
+		set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, str);
+		g_free (str);
+	}
+	if (i % 11 == 0)
+		set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST_SORTNAME, "Artist 0");
+	if (i % 5 != 4) {
+		str = (i % 5 == 0) ? g_strdup ("") : g_strdup_printf ("Album %u", i % 4);
+		set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM, str);
+		g_free (str);
+	}
+	if (i % 13 == 0)
+		set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM_SORTNAME, "Album 1");
+	if (i % 3 != 0)
+		set_entry_string (db, entry, RHYTHMDB_PROP_COMPOSER, (i % 3 == 1) ? "" : "Composer");
+	if (i % 4 != 0)
+		set_entry_string (db, entry, RHYTHMDB_PROP_GENRE, (i % 4 == 1) ? "" : "Genre");
+	if (i % 6 == 0)
+		set_entry_string (db, entry, RHYTHMDB_PROP_COMMENT, "comment");
+	if (i % 9 == 0)
+		set_entry_string (db, entry, RHYTHMDB_PROP_MEDIA_TYPE, "audio/x-flac");
+	else
+		set_entry_ulong (db, entry, RHYTHMDB_PROP_BITRATE, (i % 4) * 64);
+
+	/* disc 0 sorts as disc 1 */
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_DISC_NUMBER, i % 3);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_TRACK_NUMBER, i % 4);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_PLAY_COUNT, i % 3);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_DATE, (i % 3) ? year_to_julian (1990 + (i % 2)) : 0);
+	set_entry_double (db, entry, RHYTHMDB_PROP_RATING, (i % 6) * 0.5);
+
+	return entry;
+}
+
+struct SortTestData
+{
+	GCompareDataFunc func;
+	gpointer data;
+};
+
+static gint
+sort_test_compare (gconstpointer a, gconstpointer b, gpointer data)
+{
+	struct SortTestData *sort = data;
+	return sort->func (*(RhythmDBEntry **) a, *(RhythmDBEntry **) b, sort->data);
+}
+
+/* checks that re-sorting a model (which uses sort keys where it can) gives
+ * the same order as sorting the entries with the sort function itself.
+ * Entries the sort function considers equal may appear in either order.
+ */
+static void
+check_sort_order (GPtrArray *entries, GCompareDataFunc sort_func, gpointer sort_data, gboolean reverse, const char *what)
+{
+	RhythmDBQueryModel *model;
+	GPtrArray *expected;
+	GtkTreeIter iter;
+	struct SortTestData sort;
+	guint i;
+
+	model = rhythmdb_query_model_new_empty (db);
+	for (i = 0; i < entries->len; i++) {
+		rhythmdb_query_model_add_entry (model, g_ptr_array_index (entries, i), -1);
+	}
+	rhythmdb_query_model_set_sort_order (model, sort_func, sort_data, NULL, reverse);
+
+	expected = g_ptr_array_new ();
+	for (i = 0; i < entries->len; i++) {
+		g_ptr_array_add (expected, g_ptr_array_index (entries, i));
+	}
+	sort.func = sort_func;
+	sort.data = sort_data;
+	g_ptr_array_sort_with_data (expected, sort_test_compare, &sort);
+
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == (int) entries->len, what);
+	fail_unless (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter), what);
+	for (i = 0; i < expected->len; i++) {
+		RhythmDBEntry *entry;
+		RhythmDBEntry *expected_entry;
+
+		entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+		expected_entry = g_ptr_array_index (expected, reverse ? expected->len - i - 1 : i);
+		fail_unless (sort_func (entry, expected_entry, sort_data) == 0, what);
+		rhythmdb_entry_unref (entry);
+
+		fail_unless (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter) == (i + 1 < expected->len), what);
+	}
+
+	g_ptr_array_free (expected, TRUE);
+	g_object_unref (model);
+}
+
+START_TEST (test_rhythmdb_sort_keys)
+{
+	GPtrArray *entries;
+	guint i;
+
+	start_test_case ();
+
+	entries = g_ptr_array_new ();
+	for (i = 0; i < SORT_TEST_ENTRIES; i++) {
+		g_ptr_array_add (entries, add_sort_test_entry (i));
+	}
+	rhythmdb_commit (db);
+
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_location_sort_func, NULL, FALSE, "location sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_title_sort_func, NULL, FALSE, "title sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_album_sort_func, NULL, FALSE, "album sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_artist_sort_func, NULL, FALSE, "artist sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_composer_sort_func, NULL, FALSE, "composer sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_genre_sort_func, NULL, FALSE, "genre sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_track_sort_func, NULL, FALSE, "track sort order differs");
+	end_step ();
+
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_double_ceiling_sort_func,
+			  GINT_TO_POINTER (RHYTHMDB_PROP_RATING), FALSE, "rating sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_ulong_sort_func,
+			  GINT_TO_POINTER (RHYTHMDB_PROP_PLAY_COUNT), FALSE, "play count sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_bitrate_sort_func, NULL, FALSE, "bitrate sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_date_sort_func, NULL, FALSE, "date sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_string_sort_func,
+			  GINT_TO_POINTER (RHYTHMDB_PROP_COMMENT), FALSE, "string sort order differs");
+	end_step ();
+
+	/* reversed */
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_artist_sort_func, NULL, TRUE, "reversed artist sort order differs");
+	check_sort_order (entries, (GCompareDataFunc) rhythmdb_query_model_double_ceiling_sort_func,
+			  GINT_TO_POINTER (RHYTHMDB_PROP_RATING), TRUE, "reversed rating sort order differs");
+	end_step ();
+
+	for (i = 0; i < entries->len; i++) {
+		rhythmdb_entry_delete (db, g_ptr_array_index (entries, i));
+	}
+	rhythmdb_commit (db);
+	g_ptr_array_free (entries, TRUE);
+
+	end_test_case ();
+}
+END_TEST
+
+static void
+count_reorders_cb (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer new_order, guint *count)
+{
+	(*count)++;
+}
+
+START_TEST (test_rhythmdb_bulk_reorder)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBQuery *query;
+	RhythmDBEntry *entries[48];
+	GtkTreeIter iter;
+	guint reorders = 0;
+	gulong prev_track;
+	int count;
+	int i;
+
+	start_test_case ();
+
+	/* the model holds the first 40 entries, in track number order */
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		char *location;
+
+		location = g_strdup_printf ("file:///bulk/%02d.ogg", i);
+		entries[i] = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, location);
+		g_free (location);
+		fail_unless (entries[i] != NULL, "failed to create entry");
+
+		set_entry_string (db, entries[i], RHYTHMDB_PROP_ARTIST, (i < 40) ? "Bulk" : "Other");
+		set_entry_ulong (db, entries[i], RHYTHMDB_PROP_TRACK_NUMBER, i + 1);
+	}
+	rhythmdb_commit (db);
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_ARTIST, "Bulk",
+				      RHYTHMDB_QUERY_END);
+	model = rhythmdb_query_model_new (db, query,
+					  (GCompareDataFunc) rhythmdb_query_model_ulong_sort_func,
+					  GINT_TO_POINTER (RHYTHMDB_PROP_TRACK_NUMBER), NULL, FALSE);
+	rhythmdb_do_full_query_parsed (db, RHYTHMDB_QUERY_RESULTS (model), query);
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == 40, "query returned wrong entries");
+
+	end_step ();
+
+	/* in one commit, reverse the order of the entries, move some out of
+	 * the model and some into it.  far more than
+	 * RHYTHMDB_QUERY_MODEL_BULK_REORDER_MIN entries stay in the model, so
+	 * it should be re-sorted in one go.
+	 */
+	g_signal_connect (model, "rows-reordered", G_CALLBACK (count_reorders_cb), &reorders);
+	set_waiting_signal (G_OBJECT (db), "entries-changed");
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		set_entry_ulong (db, entries[i], RHYTHMDB_PROP_TRACK_NUMBER, 100 - i);
+		if (i % 10 == 3)
+			set_entry_string (db, entries[i], RHYTHMDB_PROP_ARTIST, "Other");
+		else if (i >= 44)
+			set_entry_string (db, entries[i], RHYTHMDB_PROP_ARTIST, "Bulk");
+	}
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	fail_unless (reorders == 1, "model wasn't re-sorted in one step");
+
+	/* check membership, then check the order */
+	count = 0;
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		gboolean expected = (i < 40 || i >= 44) && (i % 10 != 3);
+
+		fail_unless (rhythmdb_query_model_entry_to_iter (model, entries[i], &iter) == expected,
+			     "model membership is wrong after changes");
+		if (expected)
+			count++;
+	}
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == count, "model has extra entries");
+
+	prev_track = 0;
+	fail_unless (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (model), &iter), "model is empty");
+	do {
+		RhythmDBEntry *entry;
+		gulong track;
+
+		entry = rhythmdb_query_model_iter_to_entry (model, &iter);
+		track = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_TRACK_NUMBER);
+		fail_unless (track > prev_track, "model is not sorted after changes");
+		prev_track = track;
+		rhythmdb_entry_unref (entry);
+	} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (model), &iter));
+
+	end_step ();
+
+	g_object_unref (model);
+	rhythmdb_query_free (query);
+	for (i = 0; i < G_N_ELEMENTS (entries); i++) {
+		rhythmdb_entry_delete (db, entries[i]);
+	}
+	rhythmdb_commit (db);
+
+	end_test_case ();
+}
+END_TEST
+
+START_TEST (test_rhythmdb_search_index)
+{
+	RhythmDBEntry *entry = NULL;
+	RhythmDBQuery *query;
+
+	start_test_case ();
+
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///search.ogg");
+	fail_unless (entry != NULL, "failed to create entry");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, "Nine Inch Nails");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM, "Pretty Hate Machine");
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, "Terrible Lie");
+	rhythmdb_commit (db);
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "terrible inch",
+				      RHYTHMDB_QUERY_END);
+	test_query_eval (db, query, entry, TRUE, "indexed search query evaluated incorrectly");
+	rhythmdb_query_free (query);
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "terrible machines",
+				      RHYTHMDB_QUERY_END);
+	test_query_eval (db, query, entry, FALSE, "indexed search query matched a missing word");
+	rhythmdb_query_free (query);
+
+	/* words too short to use the index */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "li ni",
+				      RHYTHMDB_QUERY_END);
+	test_query_eval (db, query, entry, TRUE, "short search query evaluated incorrectly");
+	rhythmdb_query_free (query);
+
+	end_step ();
+
+	/* the index should follow changes to the entry */
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, "Sin");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "terrible",
+				      RHYTHMDB_QUERY_END);
+	test_query_eval (db, query, entry, FALSE, "search query matched an old title");
+	rhythmdb_query_free (query);
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "sin hate",
+				      RHYTHMDB_QUERY_END);
+	test_query_eval (db, query, entry, TRUE, "search query didn't match a new title");
+	rhythmdb_query_free (query);
+
+	end_step ();
+
+	/* an entry using the same string for two fields should still be
+	 * found through the one that doesn't change.
+	 */
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, "Weezer");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM, "Weezer");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM, "Pinkerton");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "weezer",
+				      RHYTHMDB_QUERY_END);
+	test_query_eval (db, query, entry, TRUE, "search query didn't match an artist also used as the old album");
+	rhythmdb_query_free (query);
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_LIKE, RHYTHMDB_PROP_SEARCH_MATCH, "pinkerton",
+				      RHYTHMDB_QUERY_END);
+	test_query_eval (db, query, entry, TRUE, "search query didn't match a new album");
+	rhythmdb_query_free (query);
+
+	end_step ();
+
+	rhythmdb_entry_delete (db, entry);
+	rhythmdb_commit (db);
+
+	end_test_case ();
+}
+END_TEST
+
+/* checks that a query for podcast posts, which the backend answers from
+ * its feed index, finds the same posts as evaluating the query against
+ * every post, and nothing else.
+ */
+static void
+check_feed_query (GPtrArray *posts, RhythmDBQuery *query, const char *what)
+{
+	RhythmDBQueryModel *model;
+	RhythmDBQuery *processed;
+	GtkTreeIter iter;
+	int expected_count = 0;
+	guint i;
+
+	processed = rhythmdb_query_copy (query);
+	rhythmdb_query_preprocess (db, processed);
+
+	model = rhythmdb_query_model_new_empty (db);
+	rhythmdb_do_full_query_parsed (db, RHYTHMDB_QUERY_RESULTS (model), query);
+
+	for (i = 0; i < posts->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (posts, i);
+		gboolean expected;
+
+		expected = reference_evaluate_query (db, processed, entry);
+		fail_unless (rhythmdb_query_model_entry_to_iter (model, entry, &iter) == expected, what);
+		if (expected)
+			expected_count++;
+	}
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == expected_count, what);
+
+	g_object_unref (model);
+	rhythmdb_query_free (processed);
+}
+
+static void
+check_feed_queries (GPtrArray *posts, const char *what)
+{
+	RhythmDBQuery *query;
+	RhythmDBQuery *subquery;
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_PODCAST_POST,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_SUBTITLE, "http://feeds.example.com/1",
+				      RHYTHMDB_QUERY_END);
+	check_feed_query (posts, query, what);
+	rhythmdb_query_free (query);
+
+	/* the posts in any of several feeds, as the podcast source shows them */
+	subquery = rhythmdb_query_parse (db,
+					 RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_SUBTITLE, "http://feeds.example.com/0",
+					 RHYTHMDB_QUERY_DISJUNCTION,
+					 RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_SUBTITLE, "http://feeds.example.com/2",
+					 RHYTHMDB_QUERY_END);
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_PODCAST_POST,
+				      RHYTHMDB_QUERY_SUBQUERY, subquery,
+				      RHYTHMDB_QUERY_END);
+	check_feed_query (posts, query, what);
+	rhythmdb_query_free (query);
+	rhythmdb_query_free (subquery);
+
+	/* other criteria still apply to the posts in the feed */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_PODCAST_POST,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_SUBTITLE, "http://feeds.example.com/2",
+				      RHYTHMDB_QUERY_PROP_LESS, RHYTHMDB_PROP_TRACK_NUMBER, 6,
+				      RHYTHMDB_QUERY_END);
+	check_feed_query (posts, query, what);
+	rhythmdb_query_free (query);
+
+	/* a feed with no posts */
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_PODCAST_POST,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_SUBTITLE, "http://feeds.example.com/none",
+				      RHYTHMDB_QUERY_END);
+	check_feed_query (posts, query, what);
+	rhythmdb_query_free (query);
+}
+
+START_TEST (test_rhythmdb_feed_index)
+{
+	RhythmDBEntry *entry;
+	GPtrArray *posts;
+	guint i;
+
+	start_test_case ();
+
+	/* posts spread over three feeds, and a song that isn't in any */
+	posts = g_ptr_array_new ();
+	for (i = 0; i < 12; i++) {
+		char *str;
+
+		str = g_strdup_printf ("http://feeds.example.com/post-%02u.mp3", i);
+		entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_PODCAST_POST, str);
+		g_free (str);
+		fail_unless (entry != NULL, "failed to create entry");
+
+		str = g_strdup_printf ("http://feeds.example.com/%u", i % 3);
+		set_entry_string (db, entry, RHYTHMDB_PROP_SUBTITLE, str);
+		g_free (str);
+		set_entry_ulong (db, entry, RHYTHMDB_PROP_TRACK_NUMBER, i);
+		g_ptr_array_add (posts, entry);
+	}
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, "file:///feed-index.ogg");
+	fail_unless (entry != NULL, "failed to create entry");
+	g_ptr_array_add (posts, entry);
+	rhythmdb_commit (db);
+
+	check_feed_queries (posts, "feed query results differ after adding posts");
+
+	end_step ();
+
+	/* move a post from feed 1 to feed 2 */
+	entry = g_ptr_array_index (posts, 4);
+	set_waiting_signal (G_OBJECT (db), "entry-changed");
+	set_entry_string (db, entry, RHYTHMDB_PROP_SUBTITLE, "http://feeds.example.com/2");
+	rhythmdb_commit (db);
+	wait_for_signal ();
+
+	check_feed_queries (posts, "feed query results differ after moving a post");
+
+	end_step ();
+
+	/* delete the moved post and one of those left in feed 1 */
+	for (i = 0; i < 2; i++) {
+		entry = g_ptr_array_index (posts, i == 0 ? 4 : 1);
+		g_ptr_array_remove (posts, entry);
+		rhythmdb_entry_delete (db, entry);
+	}
+	rhythmdb_commit (db);
+
+	check_feed_queries (posts, "feed query results differ after deleting posts");
+
+	end_step ();
+
+	for (i = 0; i < posts->len; i++) {
+		rhythmdb_entry_delete (db, g_ptr_array_index (posts, i));
+	}
+	rhythmdb_commit (db);
+	g_ptr_array_free (posts, TRUE);
+
+	end_test_case ();
+}
+END_TEST
+
 /* this tests that chained query models, where the base shows hidden entries
  * forwards visibility changes correctly. This is basically what static playlists do */
 START_TEST (test_hidden_chain_filter)
@@ -300,6 +1123,11 @@ rhythmdb_query_model_suite (void)
 
 	/* test core functionality */
 	tcase_add_test (tc_chain, test_rhythmdb_db_queries);
+	tcase_add_test (tc_chain, test_rhythmdb_compiled_queries);
+	tcase_add_test (tc_chain, test_rhythmdb_search_index);
+	tcase_add_test (tc_chain, test_rhythmdb_feed_index);
+	tcase_add_test (tc_chain, test_rhythmdb_sort_keys);
+	tcase_add_test (tc_chain, test_rhythmdb_bulk_reorder);
 
 	/* tests for breakable bug fixes */
 	tcase_add_test (tc_bugs, test_hidden_chain_filter);
@@ -31,6 +31,7 @@
 #include <gtk/gtk.h>
 #include <string.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 
 #include "test-utils.h"
 
@@ -508,6 +509,629 @@ START_TEST (test_rhythmdb_commit_change_merging)
 }
 END_TEST
 
+/* properties written to the database file, compared after reloading it */
+static const RhythmDBPropType stored_props[] = {
+	RHYTHMDB_PROP_LOCATION,
+	RHYTHMDB_PROP_TITLE,
+	RHYTHMDB_PROP_GENRE,
+	RHYTHMDB_PROP_ARTIST,
+	RHYTHMDB_PROP_ALBUM,
+	RHYTHMDB_PROP_ALBUM_ARTIST,
+	RHYTHMDB_PROP_COMPOSER,
+	RHYTHMDB_PROP_COMMENT,
+	RHYTHMDB_PROP_ARTIST_SORTNAME,
+	RHYTHMDB_PROP_MUSICBRAINZ_TRACKID,
+	RHYTHMDB_PROP_MEDIA_TYPE,
+	RHYTHMDB_PROP_TRACK_NUMBER,
+	RHYTHMDB_PROP_DISC_NUMBER,
+	RHYTHMDB_PROP_DURATION,
+	RHYTHMDB_PROP_FILE_SIZE,
+	RHYTHMDB_PROP_MTIME,
+	RHYTHMDB_PROP_FIRST_SEEN,
+	RHYTHMDB_PROP_LAST_SEEN,
+	RHYTHMDB_PROP_RATING,
+	RHYTHMDB_PROP_PLAY_COUNT,
+	RHYTHMDB_PROP_LAST_PLAYED,
+	RHYTHMDB_PROP_BITRATE,
+	RHYTHMDB_PROP_DATE,
+	RHYTHMDB_PROP_BPM,
+	RHYTHMDB_PROP_HIDDEN
+};
+
+static void
+set_entry_double (RhythmDBEntry *entry, RhythmDBPropType prop, double value)
+{
+	GValue v = {0,};
+
+	g_value_init (&v, G_TYPE_DOUBLE);
+	g_value_set_double (&v, value);
+	rhythmdb_entry_set (db, entry, prop, &v);
+	g_value_unset (&v);
+}
+
+static RhythmDBEntry *
+add_test_entry (guint i)
+{
+	RhythmDBEntry *entry;
+	RBRefString *keyword;
+	GValue v = {0,};
+	char *str;
+
+	str = g_strdup_printf ("file:///music/artist%%20%u/track%%20%02u.ogg", i / 10, i % 10);
+	entry = rhythmdb_entry_new (db, (i % 7 == 6) ? RHYTHMDB_ENTRY_TYPE_IGNORE : RHYTHMDB_ENTRY_TYPE_SONG, str);
+	fail_unless (entry != NULL, "failed to create entry %s", str);
+	g_free (str);
+
+	/* leave some strings unset or empty, and use some characters
+	 * that have to be escaped in the XML file.
+	 */
+	str = g_strdup_printf ("Track <%u> & \"friends\"", i);
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, (i % 5 == 4) ? "" : str);
+	g_free (str);
+	str = g_strdup_printf ("Artist %u", i / 10);
+	set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, str);
+	g_free (str);
+	str = g_strdup_printf ("Album %u", i / 4);
+	set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM, str);
+	g_free (str);
+	set_entry_string (db, entry, RHYTHMDB_PROP_GENRE, (i % 2) ? "Rock" : "J\xc3\xa4zz");
+	if (i % 3 == 0) {
+		set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM_ARTIST, "Various");
+		set_entry_string (db, entry, RHYTHMDB_PROP_COMPOSER, "Someone");
+		set_entry_string (db, entry, RHYTHMDB_PROP_COMMENT, "line one\nline two");
+		set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST_SORTNAME, "Artist, The");
+		set_entry_string (db, entry, RHYTHMDB_PROP_MUSICBRAINZ_TRACKID, "5b11f4ce-a62d-471e-81fc-a69a8278c7da");
+	}
+	set_entry_string (db, entry, RHYTHMDB_PROP_MEDIA_TYPE, "audio/x-vorbis");
+
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_TRACK_NUMBER, i % 10 + 1);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_DISC_NUMBER, i % 2);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_DURATION, 120 + i);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_MTIME, 1000000000 + i);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_FIRST_SEEN, 1100000000 + i);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_LAST_SEEN, 1200000000 + i);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_PLAY_COUNT, i % 4);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_LAST_PLAYED, (i % 4) ? 1300000000 + i : 0);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_BITRATE, 128 + (i % 3) * 64);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_DATE, (i % 2) ? 730000 + i : 0);
+	set_entry_double (entry, RHYTHMDB_PROP_RATING, (i % 6) * 1.0);
+	set_entry_double (entry, RHYTHMDB_PROP_BPM, (i % 2) ? 120.5 : 0.0);
+
+	g_value_init (&v, G_TYPE_UINT64);
+	g_value_set_uint64 (&v, G_GUINT64_CONSTANT (5000000000) + i);
+	rhythmdb_entry_set (db, entry, RHYTHMDB_PROP_FILE_SIZE, &v);
+	g_value_unset (&v);
+
+	if (i % 4 == 1) {
+		keyword = rb_refstring_new ("favourite");
+		rhythmdb_entry_keyword_add (db, entry, keyword);
+		rb_refstring_unref (keyword);
+	}
+
+	return entry;
+}
+
+static int
+compare_refstrings (RBRefString *a, RBRefString *b)
+{
+	return strcmp (rb_refstring_get (a), rb_refstring_get (b));
+}
+
+static char *
+describe_entry (RhythmDBEntry *entry)
+{
+	GString *str;
+	GList *keywords;
+	GList *l;
+	guint i;
+
+	str = g_string_new (rhythmdb_entry_type_get_name (rhythmdb_entry_get_entry_type (entry)));
+	for (i = 0; i < G_N_ELEMENTS (stored_props); i++) {
+		GValue v = {0,};
+		char *contents;
+
+		g_value_init (&v, rhythmdb_get_property_type (db, stored_props[i]));
+		rhythmdb_entry_get (db, entry, stored_props[i], &v);
+		contents = g_strdup_value_contents (&v);
+		g_string_append_printf (str, " %s=%s",
+					(const char *) rhythmdb_nice_elt_name_from_propid (db, stored_props[i]),
+					contents);
+		g_free (contents);
+		g_value_unset (&v);
+	}
+
+	keywords = g_list_sort (rhythmdb_entry_keywords_get (db, entry), (GCompareFunc) compare_refstrings);
+	for (l = keywords; l != NULL; l = l->next) {
+		g_string_append_printf (str, " keyword=%s", rb_refstring_get (l->data));
+		rb_refstring_unref (l->data);
+	}
+	g_list_free (keywords);
+
+	return g_string_free (str, FALSE);
+}
+
+static void
+collect_entry (RhythmDBEntry *entry, GPtrArray *entries)
+{
+	g_ptr_array_add (entries, rhythmdb_entry_ref (entry));
+}
+
+static int
+compare_entry_ids (RhythmDBEntry **a, RhythmDBEntry **b)
+{
+	gulong ida = rhythmdb_entry_get_ulong (*a, RHYTHMDB_PROP_ENTRY_ID);
+	gulong idb = rhythmdb_entry_get_ulong (*b, RHYTHMDB_PROP_ENTRY_ID);
+
+	return (ida < idb) ? -1 : (ida > idb);
+}
+
+static int
+compare_descriptions (const char **a, const char **b)
+{
+	return strcmp (*a, *b);
+}
+
+/* Describes every entry in the database, in the order they were added,
+ * or sorted by type and location if @sorted is TRUE.
+ */
+static GPtrArray *
+describe_entries (gboolean sorted)
+{
+	GPtrArray *entries;
+	GPtrArray *descriptions;
+	guint i;
+
+	entries = g_ptr_array_new ();
+	rhythmdb_entry_foreach (db, (RhythmDBEntryForeachFunc) collect_entry, entries);
+	g_ptr_array_sort (entries, (GCompareFunc) compare_entry_ids);
+
+	descriptions = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+		g_ptr_array_add (descriptions, describe_entry (entry));
+		rhythmdb_entry_unref (entry);
+	}
+	g_ptr_array_free (entries, TRUE);
+
+	if (sorted)
+		g_ptr_array_sort (descriptions, (GCompareFunc) compare_descriptions);
+	return descriptions;
+}
+
+static void
+check_descriptions (GPtrArray *expected, GPtrArray *actual, const char *what)
+{
+	guint i;
+
+	fail_unless (expected->len == actual->len,
+		     "%s: expected %u entries, got %u", what, expected->len, actual->len);
+	for (i = 0; i < expected->len; i++) {
+		fail_unless (strcmp (g_ptr_array_index (expected, i), g_ptr_array_index (actual, i)) == 0,
+			     "%s: entry %u differs:\nexpected %s\ngot      %s",
+			     what, i,
+			     (const char *) g_ptr_array_index (expected, i),
+			     (const char *) g_ptr_array_index (actual, i));
+	}
+}
+
+static guint saves_started;
+static guint saves_completed;
+
+static void
+save_complete_cb (RhythmDB *db, gpointer data)
+{
+	saves_completed++;
+}
+
+/* Saves the database, in full or by appending to the journal,
+ * and waits for all saves so far to finish.
+ */
+static void
+save_database (gboolean full)
+{
+	saves_started++;
+	if (full)
+		rhythmdb_save (db);
+	else
+		rhythmdb_save_async (db);
+
+	while (saves_completed < saves_started)
+		gtk_main_iteration ();
+}
+
+/* Points the database at a new file in a temporary directory
+ * and loads it, so the database can be saved.
+ */
+static char *
+use_temporary_database (void)
+{
+	char *dir;
+	char *name;
+
+	dir = g_dir_make_tmp ("test-rhythmdb-XXXXXX", NULL);
+	fail_unless (dir != NULL, "couldn't create temporary directory");
+
+	name = g_build_filename (dir, "rhythmdb.xml", NULL);
+	g_object_set (G_OBJECT (db), "name", name, NULL);
+	g_free (name);
+
+	saves_started = 0;
+	saves_completed = 0;
+	g_signal_connect (G_OBJECT (db), "save-complete", G_CALLBACK (save_complete_cb), NULL);
+
+	set_waiting_signal (G_OBJECT (db), "load-complete");
+	rhythmdb_load (db);
+	wait_for_signal ();
+
+	return dir;
+}
+
+static void
+remove_temporary_database (char *dir)
+{
+	const char *name;
+	GDir *d;
+
+	d = g_dir_open (dir, 0, NULL);
+	while ((name = g_dir_read_name (d)) != NULL) {
+		char *path = g_build_filename (dir, name, NULL);
+		g_unlink (path);
+		g_free (path);
+	}
+	g_dir_close (d);
+	g_rmdir (dir);
+	g_free (dir);
+}
+
+static char *
+database_file_path (const char *suffix)
+{
+	char *name;
+	char *path;
+
+	g_object_get (G_OBJECT (db), "name", &name, NULL);
+	path = g_strconcat (name, suffix, NULL);
+	g_free (name);
+	return path;
+}
+
+/* Throws away all the entries in the database and loads it again.
+ * There can only be one database instance in a process, so this is
+ * as close to restarting as the tests can get.
+ */
+static void
+reload_database (gboolean use_snapshot)
+{
+	g_object_set (G_OBJECT (db), "use-snapshot", use_snapshot, NULL);
+
+	rhythmdb_entry_delete_by_type (db, RHYTHMDB_ENTRY_TYPE_SONG);
+	rhythmdb_entry_delete_by_type (db, RHYTHMDB_ENTRY_TYPE_IGNORE);
+	rhythmdb_commit (db);
+	fail_unless (rhythmdb_entry_count (db) == 0, "entries left after deleting everything");
+
+	set_waiting_signal (G_OBJECT (db), "load-complete");
+	rhythmdb_load (db);
+	wait_for_signal ();
+}
+
+START_TEST (test_rhythmdb_save_load_round_trip)
+{
+	GPtrArray *expected;
+	GPtrArray *actual;
+	char *snapshot;
+	char *dir;
+	guint i;
+
+	dir = use_temporary_database ();
+
+	for (i = 0; i < 50; i++)
+		add_test_entry (i);
+	rhythmdb_commit (db);
+	save_database (TRUE);
+
+	snapshot = database_file_path (".snapshot");
+	fail_unless (g_file_test (snapshot, G_FILE_TEST_EXISTS), "snapshot wasn't written");
+	g_free (snapshot);
+
+	expected = describe_entries (TRUE);
+	fail_unless (expected->len == 50, "wrong number of entries before saving");
+
+	/* from the snapshot */
+	reload_database (TRUE);
+	actual = describe_entries (TRUE);
+	check_descriptions (expected, actual, "snapshot");
+	g_ptr_array_free (actual, TRUE);
+
+	/* from the XML file */
+	reload_database (FALSE);
+	actual = describe_entries (TRUE);
+	check_descriptions (expected, actual, "XML");
+	g_ptr_array_free (actual, TRUE);
+
+	g_ptr_array_free (expected, TRUE);
+	remove_temporary_database (dir);
+}
+END_TEST
+
+static RhythmDBEntry *
+lookup_test_entry (guint i)
+{
+	RhythmDBEntry *entry;
+	char *location;
+
+	location = g_strdup_printf ("file:///music/artist%%20%u/track%%20%02u.ogg", i / 10, i % 10);
+	entry = rhythmdb_entry_lookup_by_location (db, location);
+	fail_unless (entry != NULL, "couldn't find entry %s", location);
+	g_free (location);
+	return entry;
+}
+
+static void
+load_error_cb (RhythmDB *db, const char *uri, const char *msg, gpointer data)
+{
+	fail ("error loading the database: %s", msg);
+}
+
+START_TEST (test_rhythmdb_journal_replay)
+{
+	GPtrArray *expected;
+	GPtrArray *actual;
+	RhythmDBEntry *entry;
+	char *journal;
+	char *dir;
+	guint i;
+
+	dir = use_temporary_database ();
+	for (i = 0; i < 20; i++)
+		add_test_entry (i);
+	rhythmdb_commit (db);
+	save_database (TRUE);
+
+	journal = database_file_path (".journal");
+	fail_unless (g_file_test (journal, G_FILE_TEST_EXISTS) == FALSE, "full save left a journal behind");
+
+	/* change, rename, delete and add entries */
+	entry = lookup_test_entry (1);
+	set_entry_ulong (db, entry, RHYTHMDB_PROP_PLAY_COUNT, 9);
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, "Changed");
+	entry = lookup_test_entry (2);
+	set_entry_string (db, entry, RHYTHMDB_PROP_LOCATION, "file:///music/moved.ogg");
+	rhythmdb_entry_delete (db, lookup_test_entry (3));
+	add_test_entry (30);
+	rhythmdb_commit (db);
+	save_database (FALSE);
+
+	fail_unless (g_file_test (journal, G_FILE_TEST_EXISTS), "changes weren't written to the journal");
+	expected = describe_entries (TRUE);
+
+	reload_database (TRUE);
+	actual = describe_entries (TRUE);
+	check_descriptions (expected, actual, "snapshot and journal");
+	g_ptr_array_free (actual, TRUE);
+
+	reload_database (FALSE);
+	actual = describe_entries (TRUE);
+	check_descriptions (expected, actual, "XML and journal");
+	g_ptr_array_free (actual, TRUE);
+
+	g_ptr_array_free (expected, TRUE);
+	g_free (journal);
+	remove_temporary_database (dir);
+}
+END_TEST
+
+START_TEST (test_rhythmdb_journal_compaction)
+{
+	GPtrArray *expected;
+	GPtrArray *actual;
+	char *journal;
+	char *dir;
+	guint i;
+
+	dir = use_temporary_database ();
+	for (i = 0; i < 20; i++)
+		add_test_entry (i);
+	rhythmdb_commit (db);
+	save_database (TRUE);
+
+	set_entry_ulong (db, lookup_test_entry (4), RHYTHMDB_PROP_PLAY_COUNT, 12);
+	rhythmdb_entry_delete (db, lookup_test_entry (5));
+	rhythmdb_commit (db);
+	save_database (FALSE);
+
+	journal = database_file_path (".journal");
+	fail_unless (g_file_test (journal, G_FILE_TEST_EXISTS), "changes weren't written to the journal");
+
+	/* a full save includes the journalled changes and removes the journal */
+	set_entry_ulong (db, lookup_test_entry (6), RHYTHMDB_PROP_PLAY_COUNT, 3);
+	rhythmdb_commit (db);
+	save_database (TRUE);
+	fail_unless (g_file_test (journal, G_FILE_TEST_EXISTS) == FALSE, "journal wasn't removed by a full save");
+
+	expected = describe_entries (TRUE);
+	reload_database (FALSE);
+	actual = describe_entries (TRUE);
+	check_descriptions (expected, actual, "compacted");
+	g_ptr_array_free (actual, TRUE);
+
+	/* the journal starts again after compaction */
+	set_entry_ulong (db, lookup_test_entry (7), RHYTHMDB_PROP_PLAY_COUNT, 4);
+	rhythmdb_commit (db);
+	save_database (FALSE);
+	fail_unless (g_file_test (journal, G_FILE_TEST_EXISTS), "journal wasn't started again after compaction");
+
+	g_ptr_array_free (expected, TRUE);
+	g_free (journal);
+	remove_temporary_database (dir);
+}
+END_TEST
+
+START_TEST (test_rhythmdb_journal_truncated)
+{
+	GPtrArray *expected;
+	GPtrArray *actual;
+	char *journal;
+	char *contents;
+	gsize first_length;
+	gsize length;
+	char *dir;
+	guint i;
+
+	dir = use_temporary_database ();
+	for (i = 0; i < 20; i++)
+		add_test_entry (i);
+	rhythmdb_commit (db);
+	save_database (TRUE);
+
+	set_entry_ulong (db, lookup_test_entry (8), RHYTHMDB_PROP_PLAY_COUNT, 20);
+	rhythmdb_commit (db);
+	save_database (FALSE);
+
+	journal = database_file_path (".journal");
+	fail_unless (g_file_get_contents (journal, &contents, &first_length, NULL), "couldn't read the journal");
+	g_free (contents);
+	expected = describe_entries (TRUE);
+
+	/* cut the second record in half, as if we'd crashed while writing it */
+	set_entry_string (db, lookup_test_entry (9), RHYTHMDB_PROP_TITLE, "Never saved");
+	rhythmdb_commit (db);
+	save_database (FALSE);
+
+	fail_unless (g_file_get_contents (journal, &contents, &length, NULL), "couldn't read the journal");
+	fail_unless (length > first_length, "second change wasn't written to the journal");
+	fail_unless (g_file_set_contents (journal, contents, first_length + (length - first_length) / 2, NULL),
+		     "couldn't truncate the journal");
+	g_free (contents);
+
+	g_signal_connect (G_OBJECT (db), "load-error", G_CALLBACK (load_error_cb), NULL);
+	reload_database (FALSE);
+	actual = describe_entries (TRUE);
+	check_descriptions (expected, actual, "truncated journal");
+	g_ptr_array_free (actual, TRUE);
+
+	g_ptr_array_free (expected, TRUE);
+	g_free (journal);
+	remove_temporary_database (dir);
+}
+END_TEST
+
+/* records for entry types that aren't registered, such as those belonging
+ * to disabled plugins, have to survive until the next full save.
+ */
+START_TEST (test_rhythmdb_journal_unknown_type)
+{
+	static const char records[] =
+		"  <entry type=\"test-unregistered\">\n"
+		"    <title>Original</title>\n"
+		"    <location>file:///unregistered/1</location>\n"
+		"  </entry>\n"
+		"  <entry type=\"test-unregistered\" update=\"true\">\n"
+		"    <location>file:///unregistered/1</location>\n"
+		"    <title>Updated</title>\n"
+		"  </entry>\n"
+		"  <entry type=\"test-unregistered\">\n"
+		"    <title>Deleted</title>\n"
+		"    <location>file:///unregistered/2</location>\n"
+		"  </entry>\n"
+		"  <deleted>file:///unregistered/2</deleted>\n";
+	GPtrArray *expected;
+	GPtrArray *actual;
+	char *journal;
+	char *xml;
+	char *contents;
+	char *dir;
+	guint i;
+	FILE *f;
+
+	dir = use_temporary_database ();
+	for (i = 0; i < 10; i++)
+		add_test_entry (i);
+	rhythmdb_commit (db);
+	save_database (TRUE);
+
+	set_entry_ulong (db, lookup_test_entry (1), RHYTHMDB_PROP_PLAY_COUNT, 5);
+	rhythmdb_commit (db);
+	save_database (FALSE);
+	expected = describe_entries (TRUE);
+
+	journal = database_file_path (".journal");
+	f = fopen (journal, "a");
+	fail_unless (f != NULL, "couldn't open the journal");
+	fail_unless (fwrite (records, 1, sizeof (records) - 1, f) == sizeof (records) - 1, "couldn't append to the journal");
+	fclose (f);
+
+	/* the known entries are unaffected */
+	g_signal_connect (G_OBJECT (db), "load-error", G_CALLBACK (load_error_cb), NULL);
+	reload_database (FALSE);
+	actual = describe_entries (TRUE);
+	check_descriptions (expected, actual, "journal with unknown entry types");
+	g_ptr_array_free (actual, TRUE);
+
+	/* and the unknown entries are written out by a full save */
+	save_database (TRUE);
+	fail_unless (g_file_test (journal, G_FILE_TEST_EXISTS) == FALSE, "journal wasn't removed by a full save");
+
+	xml = database_file_path ("");
+	fail_unless (g_file_get_contents (xml, &contents, NULL, NULL), "couldn't read the database");
+	fail_unless (strstr (contents, "file:///unregistered/1") != NULL, "unknown entry from the journal was lost");
+	fail_unless (strstr (contents, "<title>Updated</title>") != NULL, "update to unknown entry was lost");
+	fail_unless (strstr (contents, "<title>Original</title>") == NULL, "update to unknown entry wasn't applied");
+	fail_unless (strstr (contents, "file:///unregistered/2") == NULL, "deleted unknown entry was saved");
+	g_free (contents);
+
+	g_ptr_array_free (expected, TRUE);
+	g_free (journal);
+	g_free (xml);
+	remove_temporary_database (dir);
+}
+END_TEST
+
+START_TEST (test_rhythmdb_parallel_load)
+{
+	GPtrArray *serial;
+	GPtrArray *parallel;
+	GStatBuf buf;
+	char *name;
+	char *dir;
+	guint i;
+
+	dir = use_temporary_database ();
+
+	/* files smaller than 512KiB are always loaded serially */
+	for (i = 0; i < 1500; i++)
+		add_test_entry (i);
+	rhythmdb_commit (db);
+	save_database (TRUE);
+
+	g_object_get (G_OBJECT (db), "name", &name, NULL);
+	fail_unless (g_stat (name, &buf) == 0, "database wasn't saved");
+	fail_unless (buf.st_size >= 512 * 1024, "test database is too small to be loaded in parallel");
+	g_free (name);
+
+	g_object_set (G_OBJECT (db), "load-threads", 1, NULL);
+	reload_database (FALSE);
+	serial = describe_entries (FALSE);
+	fail_unless (serial->len == 1500, "wrong number of entries loaded serially");
+
+	/* entries must be added in the same order, not just end up the same */
+	g_object_set (G_OBJECT (db), "load-threads", 4, NULL);
+	reload_database (FALSE);
+	parallel = describe_entries (FALSE);
+	check_descriptions (serial, parallel, "parallel load");
+	g_ptr_array_free (parallel, TRUE);
+
+	/* an uneven split */
+	g_object_set (G_OBJECT (db), "load-threads", 7, NULL);
+	reload_database (FALSE);
+	parallel = describe_entries (FALSE);
+	check_descriptions (serial, parallel, "parallel load with 7 threads");
+	g_ptr_array_free (parallel, TRUE);
+
+	g_ptr_array_free (serial, TRUE);
+	remove_temporary_database (dir);
+}
+END_TEST
+
 static Suite *
 rhythmdb_suite (void)
 {
@@ -533,6 +1157,12 @@ rhythmdb_suite (void)
 	tcase_add_test (tc_chain, test_rhythmdb_deserialisation2);
 	tcase_add_test (tc_chain, test_rhythmdb_deserialisation3);
 	/*tcase_add_test (tc_chain, test_rhythmdb_serialisation);*/
+	tcase_add_test (tc_chain, test_rhythmdb_save_load_round_trip);
+	tcase_add_test (tc_chain, test_rhythmdb_journal_replay);
+	tcase_add_test (tc_chain, test_rhythmdb_journal_compaction);
+	tcase_add_test (tc_chain, test_rhythmdb_journal_truncated);
+	tcase_add_test (tc_chain, test_rhythmdb_journal_unknown_type);
+	tcase_add_test (tc_chain, test_rhythmdb_parallel_load);
 
 	/* tests for breakable bug fixes */
 	tcase_add_test (tc_chain, test_rhythmdb_podcast_upgrade);
@@ -0,0 +1,162 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Rhythmbox authors hereby grant permission for non-GPL compatible
+ *  GStreamer plugins to be used and distributed together with GStreamer
+ *  and Rhythmbox. This permission is above and beyond the permissions granted
+ *  by the GPL license by which Rhythmbox is covered. If you modify this code
+ *  you may extend this exception to your version of the code, but you are not
+ *  obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301  USA.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include <check.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <locale.h>
+#include "test-utils.h"
+#include "rb-sync-itinerary.h"
+#include "rb-sync-settings.h"
+#include "rb-file-helpers.h"
+#include "rb-util.h"
+#include "rb-debug.h"
+
+/* finds the uuid an entry has in the itinerary */
+static char *
+itinerary_uuid (RBSyncItinerary *itinerary, RhythmDBEntry *entry)
+{
+	GHashTable *tracks;
+	GHashTableIter iter;
+	gpointer uuid, value;
+	char *result = NULL;
+	guint64 music_size;
+	guint64 podcast_size;
+
+	tracks = rb_sync_itinerary_build (itinerary, NULL, &music_size, &podcast_size);
+	g_hash_table_iter_init (&iter, tracks);
+	while (g_hash_table_iter_next (&iter, &uuid, &value)) {
+		if (value == entry) {
+			fail_unless (result == NULL, "entry is in the itinerary more than once");
+			result = g_strdup (uuid);
+		}
+	}
+	g_hash_table_destroy (tracks);
+	return result;
+}
+
+START_TEST (test_sync_itinerary_retitle)
+{
+	RBSyncItinerary *itinerary;
+	RBSyncSettings *settings;
+	RhythmDBEntry *entry;
+	char *dir;
+	char *keyfile;
+	char *uuid;
+	char *new_uuid;
+	char *expected;
+
+	dir = g_dir_make_tmp ("rb-test-sync-XXXXXX", NULL);
+	keyfile = g_build_filename (dir, "sync.conf", NULL);
+	settings = rb_sync_settings_new (keyfile);
+	rb_sync_settings_set_category (settings, SYNC_CATEGORY_MUSIC, TRUE);
+
+	entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_SONG, "file:///sync.ogg");
+	fail_unless (entry != NULL, "failed to create entry");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, "Nine Inch Nails");
+	set_entry_string (db, entry, RHYTHMDB_PROP_ALBUM, "Pretty Hate Machine");
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, "Terrible Lie");
+	rhythmdb_commit (db);
+
+	itinerary = rb_sync_itinerary_new (db, settings);
+
+	uuid = itinerary_uuid (itinerary, entry);
+	fail_unless (uuid != NULL, "entry isn't in the itinerary");
+	expected = rb_sync_state_make_track_uuid (entry);
+	fail_unless (strcmp (uuid, expected) == 0, "entry has the wrong uuid in the itinerary");
+	g_free (expected);
+
+	/* the uuid is derived from the title, so retitling the entry must change it */
+	set_entry_string (db, entry, RHYTHMDB_PROP_TITLE, "Head Like A Hole");
+	rhythmdb_commit (db);
+
+	new_uuid = itinerary_uuid (itinerary, entry);
+	fail_unless (new_uuid != NULL, "retitled entry isn't in the itinerary");
+	fail_unless (strcmp (uuid, new_uuid) != 0, "retitled entry kept its old uuid");
+	expected = rb_sync_state_make_track_uuid (entry);
+	fail_unless (strcmp (new_uuid, expected) == 0, "retitled entry has the wrong uuid in the itinerary");
+	g_free (expected);
+
+	g_free (new_uuid);
+	g_free (uuid);
+	rb_sync_itinerary_free (itinerary);
+	g_object_unref (settings);
+
+	g_unlink (keyfile);
+	g_rmdir (dir);
+	g_free (keyfile);
+	g_free (dir);
+}
+END_TEST
+
+static Suite *
+rb_sync_suite (void)
+{
+	Suite *s = suite_create ("rb-sync");
+	TCase *tc_chain = tcase_create ("rb-sync-itinerary");
+
+	suite_add_tcase (s, tc_chain);
+	tcase_add_checked_fixture (tc_chain, test_rhythmdb_setup, test_rhythmdb_shutdown);
+
+	tcase_add_test (tc_chain, test_sync_itinerary_retitle);
+
+	return s;
+}
+
+int
+main (int argc, char **argv)
+{
+	int ret;
+	SRunner *sr;
+	Suite *s;
+
+	rb_threads_init ();
+	setlocale (LC_ALL, NULL);
+	rb_debug_init (TRUE);
+	rb_refstring_system_init ();
+	rb_file_helpers_init (TRUE);
+
+	/* setup tests */
+	s = rb_sync_suite ();
+	sr = srunner_create (s);
+
+	init_setup (sr, argc, argv);
+	init_once (FALSE);
+
+	srunner_run_all (sr, CK_NORMAL);
+	ret = srunner_ntests_failed (sr);
+	srunner_free (sr);
+
+	rb_file_helpers_shutdown ();
+	rb_refstring_system_shutdown ();
+
+	return ret;
+}
@@ -10,6 +10,7 @@
 #include "rhythmdb-tree.h"
 
 #include "rb-query-creator.h"
+#include "rb-library-browser.h"
 
 #include "test-utils.h"
 
@@ -282,11 +283,144 @@ START_TEST (test_query_creator_load_sort_artist_dec)
 }
 END_TEST
 
+/* checks that the browser's output model holds exactly the entries with
+ * the given genre (if any) and artist, going by their current values.
+ */
+static void
+check_browser_output (RBLibraryBrowser *browser, GPtrArray *entries, const char *genre, const char *artist, const char *what)
+{
+	RhythmDBQueryModel *model;
+	GtkTreeIter iter;
+	int expected_count = 0;
+	guint i;
+
+	g_object_get (browser, "output-model", &model, NULL);
+	fail_unless (model != NULL, what);
+
+	for (i = 0; i < entries->len; i++) {
+		RhythmDBEntry *entry = g_ptr_array_index (entries, i);
+		gboolean expected;
+
+		expected = (strcmp (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_ARTIST), artist) == 0) &&
+			   (genre == NULL || strcmp (rhythmdb_entry_get_string (entry, RHYTHMDB_PROP_GENRE), genre) == 0);
+		fail_unless (rhythmdb_query_model_entry_to_iter (model, entry, &iter) == expected, what);
+		if (expected)
+			expected_count++;
+	}
+	fail_unless (gtk_tree_model_iter_n_children (GTK_TREE_MODEL (model), NULL) == expected_count, what);
+
+	g_object_unref (model);
+}
+
+static void
+set_browser_selection (RBLibraryBrowser *browser, RhythmDBPropType prop, const char *value)
+{
+	GList *selection;
+
+	selection = g_list_prepend (NULL, (gpointer) value);
+	rb_library_browser_set_selection (browser, prop, selection);
+	g_list_free (selection);
+}
+
+/* swaps the artists of some of the rock entries; run from an idle handler
+ * added just after the browser's rebuild handler, so the worker thread is
+ * filtering while the entries change.
+ */
+static gboolean
+retag_entries_idle (GPtrArray *entries)
+{
+	guint i;
+
+	for (i = 0; i < entries->len; i++) {
+		if (i % 6 == 0)
+			set_entry_string (db, g_ptr_array_index (entries, i), RHYTHMDB_PROP_ARTIST, "Artist 2");
+		else if (i % 6 == 2)
+			set_entry_string (db, g_ptr_array_index (entries, i), RHYTHMDB_PROP_ARTIST, "Artist 0");
+	}
+	rhythmdb_commit (db);
+	return FALSE;
+}
+
+START_TEST (test_library_browser_filter)
+{
+	RBLibraryBrowser *browser;
+	RhythmDBQueryModel *model;
+	RhythmDBQuery *query;
+	GPtrArray *entries;
+	guint i;
+
+	start_test_case ();
+
+	entries = g_ptr_array_new ();
+	for (i = 0; i < 3000; i++) {
+		RhythmDBEntry *entry;
+		char *str;
+
+		str = g_strdup_printf ("file:///browser/%04u.ogg", i);
+		entry = rhythmdb_entry_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE, str);
+		g_free (str);
+		fail_unless (entry != NULL, "failed to create entry");
+
+		str = g_strdup_printf ("Artist %u", i % 3);
+		set_entry_string (db, entry, RHYTHMDB_PROP_ARTIST, str);
+		g_free (str);
+		set_entry_string (db, entry, RHYTHMDB_PROP_GENRE, (i % 2) ? "Jazz" : "Rock");
+		g_ptr_array_add (entries, entry);
+	}
+	rhythmdb_commit (db);
+
+	query = rhythmdb_query_parse (db,
+				      RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, RHYTHMDB_ENTRY_TYPE_IGNORE,
+				      RHYTHMDB_QUERY_END);
+	model = rhythmdb_query_model_new_empty (db);
+	rhythmdb_do_full_query_parsed (db, RHYTHMDB_QUERY_RESULTS (model), query);
+	rhythmdb_query_free (query);
+
+	browser = rb_library_browser_new (db, RHYTHMDB_ENTRY_TYPE_IGNORE);
+	g_object_ref_sink (browser);
+	rb_library_browser_set_model (browser, model, FALSE);
+
+	end_step ();
+
+	/* one selection, then another above it */
+	set_waiting_signal (G_OBJECT (browser), "notify::output-model");
+	set_browser_selection (browser, RHYTHMDB_PROP_ARTIST, "Artist 1");
+	wait_for_signal ();
+	end_step ();
+	check_browser_output (browser, entries, NULL, "Artist 1", "browser output wrong for an artist selection");
+
+	set_waiting_signal (G_OBJECT (browser), "notify::output-model");
+	set_browser_selection (browser, RHYTHMDB_PROP_GENRE, "Rock");
+	wait_for_signal ();
+	end_step ();
+	check_browser_output (browser, entries, "Rock", "Artist 1", "browser output wrong for genre and artist selections");
+
+	/* entries changing while the worker thread filters them */
+	set_waiting_signal (G_OBJECT (browser), "notify::output-model");
+	set_browser_selection (browser, RHYTHMDB_PROP_ARTIST, "Artist 2");
+	g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, (GSourceFunc) retag_entries_idle, entries, NULL);
+	wait_for_signal ();
+	end_step ();
+	check_browser_output (browser, entries, "Rock", "Artist 2", "browser output wrong after entries changed during filtering");
+
+	g_object_unref (browser);
+	g_object_unref (model);
+	for (i = 0; i < entries->len; i++) {
+		rhythmdb_entry_delete (db, g_ptr_array_index (entries, i));
+	}
+	rhythmdb_commit (db);
+	g_ptr_array_free (entries, TRUE);
+
+	end_test_case ();
+}
+END_TEST
+
 static Suite *
 rb_query_creator_suite (void)
 {
 	Suite *s = suite_create ("RBQueryCreator");
 	TCase *tc_qls = tcase_create ("query_load-save");
+	TCase *tc_browser = tcase_create ("library-browser");
 
 	/* test loading and retrieving various queries,
 	 * ensuring the result is identical to the original
@@ -305,6 +439,11 @@ rb_query_creator_suite (void)
 	tcase_add_test (tc_qls, test_query_creator_load_limit_gb);
 	tcase_add_test (tc_qls, test_query_creator_load_sort_artist_dec);
 
+	/* test filtering through the library browser */
+	suite_add_tcase (s, tc_browser);
+	tcase_add_checked_fixture (tc_browser, test_rhythmdb_setup, test_rhythmdb_shutdown);
+	tcase_add_test (tc_browser, test_library_browser_filter);
+
 	return s;
 }
 	
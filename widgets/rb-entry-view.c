@@ -110,6 +110,12 @@ struct RBEntryViewColumnSortData
 /* GObject data item used to associate cell renderers with property IDs */
 #define CELL_PROPID_ITEM "rb-cell-propid"
 
+/* number of formatted strings to keep for each property; well over what
+ * fits on screen, so scrolling back and forth over a page or two doesn't
+ * format anything again.
+ */
+#define RENDER_CACHE_SIZE	2048
+
 static void rb_entry_view_class_init (RBEntryViewClass *klass);
 static void rb_entry_view_init (RBEntryView *view);
 static void rb_entry_view_constructed (GObject *object);
@@ -129,6 +135,7 @@ static void rb_entry_view_get_property (GObject *object,
 static void rb_entry_view_selection_changed_cb (GtkTreeSelection *selection,
 				               RBEntryView *view);
 static void rb_entry_view_grab_focus (GtkWidget *widget);
+static void rb_entry_view_unmap (GtkWidget *widget);
 static void rb_entry_view_row_activated_cb (GtkTreeView *treeview,
 			                   GtkTreePath *path,
 			                   GtkTreeViewColumn *column,
@@ -145,6 +152,12 @@ static void rb_entry_view_rows_reordered_cb (GtkTreeModel *model,
 					     GtkTreeIter *iter,
 					     gint *order,
 					     RBEntryView *view);
+static void rb_entry_view_entry_prop_changed_cb (RhythmDBQueryModel *model,
+						 RhythmDBEntry *entry,
+						 RhythmDBPropType prop,
+						 const GValue *old,
+						 const GValue *new_value,
+						 RBEntryView *view);
 static void rb_entry_view_sync_columns_visible (RBEntryView *view);
 static void rb_entry_view_rated_cb (RBCellRendererRating *cellrating,
 				   const char *path,
@@ -203,6 +216,11 @@ struct RBEntryViewPrivate
 
 	GHashTable *propid_column_map;
 	GHashTable *column_sort_data_map;
+
+	/* formatted text for columns that need it, one table
+	 * per property mapping entries to strings.
+	 */
+	GHashTable *render_cache;
 };
 
 
@@ -278,6 +296,7 @@ rb_entry_view_class_init (RBEntryViewClass *klass)
 	object_class->get_property = rb_entry_view_get_property;
 
 	widget_class->grab_focus = rb_entry_view_grab_focus;
+	widget_class->unmap = rb_entry_view_unmap;
 
 	/**
 	 * RBEntryView:db:
@@ -515,6 +534,7 @@ rb_entry_view_init (RBEntryView *view)
 	view->priv->column_sort_data_map = g_hash_table_new_full (NULL, NULL, NULL, g_free);
 	view->priv->column_key_map = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 	view->priv->type_ahead_propid = RHYTHMDB_PROP_TITLE;
+	view->priv->render_cache = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_hash_table_destroy);
 }
 
 static void
@@ -557,6 +577,8 @@ rb_entry_view_dispose (GObject *object)
 		view->priv->model = NULL;
 	}
 
+	g_hash_table_remove_all (view->priv->render_cache);
+
 	G_OBJECT_CLASS (rb_entry_view_parent_class)->dispose (object);
 }
 
@@ -577,6 +599,7 @@ rb_entry_view_finalize (GObject *object)
 			      rb_entry_view_sort_data_finalize, NULL);
 	g_hash_table_destroy (view->priv->column_sort_data_map);
 	g_hash_table_destroy (view->priv->column_key_map);
+	g_hash_table_destroy (view->priv->render_cache);
 
 	g_free (view->priv->sorting_column_name);
 	g_strfreev (view->priv->visible_columns);
@@ -632,10 +655,14 @@ rb_entry_view_set_model_internal (RBEntryView        *view,
 		g_signal_handlers_disconnect_by_func (view->priv->model,
 						      G_CALLBACK (rb_entry_view_rows_reordered_cb),
 						      view);
+		g_signal_handlers_disconnect_by_func (view->priv->model,
+						      G_CALLBACK (rb_entry_view_entry_prop_changed_cb),
+						      view);
 		g_object_unref (view->priv->model);
 	}
 
 	gtk_tree_selection_unselect_all (view->priv->selection);
+	g_hash_table_remove_all (view->priv->render_cache);
 
 	view->priv->model = model;
 	if (view->priv->model != NULL) {
@@ -655,6 +682,11 @@ rb_entry_view_set_model_internal (RBEntryView        *view,
 					 G_CALLBACK (rb_entry_view_rows_reordered_cb),
 					 view,
 					 0);
+		g_signal_connect_object (view->priv->model,
+					 "entry-prop-changed",
+					 G_CALLBACK (rb_entry_view_entry_prop_changed_cb),
+					 view,
+					 0);
 
 		if (view->priv->sorting_column != NULL) {
 			rb_entry_view_resort_model (view);
@@ -812,10 +844,13 @@ rb_entry_view_set_model (RBEntryView *view,
 	g_object_set (view, "model", model, NULL);
 }
 
+typedef char *(*RBEntryViewFormatFunc) (RhythmDBEntry *entry, RhythmDBPropType propid);
+
 /* Sweet name, eh? */
 struct RBEntryViewCellDataFuncData {
 	RBEntryView *view;
 	RhythmDBPropType propid;
+	RBEntryViewFormatFunc format;
 };
 
 static void
@@ -875,176 +910,147 @@ rb_entry_view_rating_cell_data_func (GtkTreeViewColumn *column,
 	rhythmdb_entry_unref (entry);
 }
 
-static void
-rb_entry_view_bpm_cell_data_func (GtkTreeViewColumn *column,
-				   GtkCellRenderer *renderer,
-				   GtkTreeModel *tree_model,
-				   GtkTreeIter *iter,
-				   struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_bpm (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
-	char *str;
 	gdouble val;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
-
-	val = rhythmdb_entry_get_double (entry, data->propid);
+	val = rhythmdb_entry_get_double (entry, propid);
 
 	if (val > 0.001)
-		str = g_strdup_printf ("%.2f", val);
+		return g_strdup_printf ("%.2f", val);
 	else
-		str = g_strdup ("");
-
-	g_object_set (renderer, "text", str, NULL);
-	g_free (str);
-	rhythmdb_entry_unref (entry);
+		return g_strdup ("");
 }
 
-static void
-rb_entry_view_long_cell_data_func (GtkTreeViewColumn *column,
-				   GtkCellRenderer *renderer,
-				   GtkTreeModel *tree_model,
-				   GtkTreeIter *iter,
-				   struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_long (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
-	char *str;
 	gulong val;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
-
-	val = rhythmdb_entry_get_ulong (entry, data->propid);
+	val = rhythmdb_entry_get_ulong (entry, propid);
 
 	if (val > 0)
-		str = g_strdup_printf ("%lu", val);
+		return g_strdup_printf ("%lu", val);
 	else
-		str = g_strdup ("");
-
-	g_object_set (renderer, "text", str, NULL);
-	g_free (str);
-	rhythmdb_entry_unref (entry);
+		return g_strdup ("");
 }
 
-static void
-rb_entry_view_play_count_cell_data_func (GtkTreeViewColumn *column,
-					 GtkCellRenderer *renderer,
-					 GtkTreeModel *tree_model,
-					 GtkTreeIter * iter,
-					 struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_play_count (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
 	gulong i;
-	char *str;
-
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
 
-	i = rhythmdb_entry_get_ulong (entry, data->propid);
+	i = rhythmdb_entry_get_ulong (entry, propid);
 	if (i == 0)
-		str = _("Never");
+		return g_strdup (_("Never"));
 	else
-		str = g_strdup_printf ("%ld", i);
-
-	g_object_set (renderer, "text", str, NULL);
-	if (i != 0)
-		g_free (str);
-
-	rhythmdb_entry_unref (entry);
+		return g_strdup_printf ("%ld", i);
 }
 
-static void
-rb_entry_view_duration_cell_data_func (GtkTreeViewColumn *column,
-				       GtkCellRenderer *renderer,
-				       GtkTreeModel *tree_model,
-				       GtkTreeIter *iter,
-				       struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_duration (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
-	gulong duration;
-	char *str;
-
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
-	duration = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION);
-
-	str = rb_make_duration_string (duration);
-	g_object_set (renderer, "text", str, NULL);
-	g_free (str);
-	rhythmdb_entry_unref (entry);
+	return rb_make_duration_string (rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DURATION));
 }
 
-static void
-rb_entry_view_year_cell_data_func (GtkTreeViewColumn *column,
-				   GtkCellRenderer *renderer,
-				   GtkTreeModel *tree_model,
-				   GtkTreeIter *iter,
-				   struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_year (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
 	char str[255];
 	int julian;
 	GDate *date;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
 	julian = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_DATE);
 
 	if (julian > 0) {
 		date = g_date_new_julian (julian);
 		g_date_strftime (str, sizeof (str), "%Y", date);
-		g_object_set (renderer, "text", str, NULL);
 		g_date_free (date);
+		return g_strdup (str);
 	} else {
-		g_object_set (renderer, "text", _("Unknown"), NULL);
+		return g_strdup (_("Unknown"));
 	}
-
-	rhythmdb_entry_unref (entry);
 }
 
-static void
-rb_entry_view_quality_cell_data_func (GtkTreeViewColumn *column,
-				      GtkCellRenderer *renderer,
-				      GtkTreeModel *tree_model,
-				      GtkTreeIter *iter,
-				      struct RBEntryViewCellDataFuncData *data)
+static char *
+rb_entry_view_format_quality (RhythmDBEntry *entry, RhythmDBPropType propid)
 {
-	RhythmDBEntry *entry;
 	gulong bitrate;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
 	bitrate = rhythmdb_entry_get_ulong (entry, RHYTHMDB_PROP_BITRATE);
 
 	if (rhythmdb_entry_is_lossless (entry)) {
-		g_object_set (renderer, "text", _("Lossless"), NULL);
+		return g_strdup (_("Lossless"));
 	} else if (bitrate == 0) {
-		g_object_set (renderer, "text", _("Unknown"), NULL);
+		return g_strdup (_("Unknown"));
 	} else {
-		char *s;
-	       
-		s = g_strdup_printf (_("%lu kbps"), bitrate);
-		g_object_set (renderer, "text", s, NULL);
-		g_free (s);
+		return g_strdup_printf (_("%lu kbps"), bitrate);
 	}
+}
 
-	rhythmdb_entry_unref (entry);
+static char *
+rb_entry_view_format_location (RhythmDBEntry *entry, RhythmDBPropType propid)
+{
+	return g_uri_unescape_string (rhythmdb_entry_get_string (entry, propid), NULL);
 }
 
 static void
-rb_entry_view_location_cell_data_func (GtkTreeViewColumn *column,
-				       GtkCellRenderer *renderer,
-				       GtkTreeModel *tree_model,
-				       GtkTreeIter *iter,
-				       struct RBEntryViewCellDataFuncData *data)
+rb_entry_view_forget_entry_cb (gpointer propid,
+			       GHashTable *cache,
+			       RhythmDBEntry *entry)
+{
+	g_hash_table_remove (cache, entry);
+}
+
+static void
+rb_entry_view_render_cache_remove (RBEntryView *view,
+				   RhythmDBPropType propid,
+				   RhythmDBEntry *entry)
+{
+	GHashTable *cache;
+
+	cache = g_hash_table_lookup (view->priv->render_cache, GINT_TO_POINTER (propid));
+	if (cache != NULL) {
+		g_hash_table_remove (cache, entry);
+	}
+}
+
+static void
+rb_entry_view_cached_cell_data_func (GtkTreeViewColumn *column,
+				     GtkCellRenderer *renderer,
+				     GtkTreeModel *tree_model,
+				     GtkTreeIter *iter,
+				     struct RBEntryViewCellDataFuncData *data)
 {
+	RBEntryView *view = data->view;
 	RhythmDBEntry *entry;
-	const char *location;
+	GHashTable *cache;
 	char *str;
 
-	entry = rhythmdb_query_model_iter_to_entry (data->view->priv->model, iter);
+	entry = rhythmdb_query_model_iter_to_entry (view->priv->model, iter);
 
-	location = rhythmdb_entry_get_string (entry, data->propid);
-	str = g_uri_unescape_string (location, NULL);
+	cache = g_hash_table_lookup (view->priv->render_cache, GINT_TO_POINTER (data->propid));
+	if (cache == NULL) {
+		cache = g_hash_table_new_full (NULL, NULL, (GDestroyNotify) rhythmdb_entry_unref, g_free);
+		g_hash_table_insert (view->priv->render_cache, GINT_TO_POINTER (data->propid), cache);
+	}
 
-	g_object_set (renderer, "text", str, NULL);
-	g_free (str);
+	/* formatting the text is most of the cost of drawing these cells,
+	 * so it's only done again when the property changes.
+	 */
+	str = g_hash_table_lookup (cache, entry);
+	if (str == NULL) {
+		/* when the cache is full, start again with whatever is drawn next */
+		if (g_hash_table_size (cache) >= RENDER_CACHE_SIZE) {
+			g_hash_table_remove_all (cache);
+		}
 
+		str = data->format (entry, data->propid);
+		g_hash_table_insert (cache, rhythmdb_entry_ref (entry), str);
+	}
+
+	g_object_set (renderer, "text", str, NULL);
 	rhythmdb_entry_unref (entry);
 }
 
@@ -1428,7 +1434,8 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_TRACK_NUMBER:
 		propid = RHYTHMDB_PROP_TRACK_NUMBER;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_long_cell_data_func;
+		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_cached_cell_data_func;
+		cell_data->format = rb_entry_view_format_long;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_track_sort_func;
 		title = _("Track");
 		key = "Track";
@@ -1498,7 +1505,8 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_DURATION:
 		propid = RHYTHMDB_PROP_DURATION;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_duration_cell_data_func;
+		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_cached_cell_data_func;
+		cell_data->format = rb_entry_view_format_duration;
 		sort_propid = cell_data->propid;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_ulong_sort_func;
 		title = _("Time");
@@ -1510,7 +1518,8 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_YEAR:
 		propid = RHYTHMDB_PROP_DATE;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_year_cell_data_func;
+		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_cached_cell_data_func;
+		cell_data->format = rb_entry_view_format_year;
 		sort_propid = cell_data->propid;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_date_sort_func;
 		title = _("Year");
@@ -1522,7 +1531,8 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_QUALITY:
 		propid = RHYTHMDB_PROP_BITRATE;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_quality_cell_data_func;
+		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_cached_cell_data_func;
+		cell_data->format = rb_entry_view_format_quality;
 		sort_propid = cell_data->propid;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_bitrate_sort_func;
 		title = _("Quality");
@@ -1558,7 +1568,8 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_PLAY_COUNT:
 		propid = RHYTHMDB_PROP_PLAY_COUNT;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_play_count_cell_data_func;
+		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_cached_cell_data_func;
+		cell_data->format = rb_entry_view_format_play_count;
 		sort_propid = cell_data->propid;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_ulong_sort_func;
 		title = _("Play Count");
@@ -1604,7 +1615,8 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_LOCATION:
 		propid = RHYTHMDB_PROP_LOCATION;
 		cell_data->propid = RHYTHMDB_PROP_LOCATION;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_location_cell_data_func;
+		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_cached_cell_data_func;
+		cell_data->format = rb_entry_view_format_location;
 		sort_propid = RHYTHMDB_PROP_LOCATION;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_location_sort_func;
 		title = _("Location");
@@ -1614,7 +1626,8 @@ rb_entry_view_append_column (RBEntryView *view,
 	case RB_ENTRY_VIEW_COL_BPM:
 		propid = RHYTHMDB_PROP_BPM;
 		cell_data->propid = propid;
-		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_bpm_cell_data_func;
+		cell_data_func = (GtkTreeCellDataFunc) rb_entry_view_cached_cell_data_func;
+		cell_data->format = rb_entry_view_format_bpm;
 		sort_func = (GCompareDataFunc) rhythmdb_query_model_double_ceiling_sort_func;
 		title = _("BPM");
 		key = "BPM";
@@ -2156,10 +2169,29 @@ rb_entry_view_row_inserted_cb (GtkTreeModel *model,
 	RhythmDBEntry *entry = rhythmdb_query_model_tree_path_to_entry (RHYTHMDB_QUERY_MODEL (model), path);
 
 	rb_debug ("row added");
+
+	/* the entry may have changed while it wasn't in the model */
+	g_hash_table_foreach (view->priv->render_cache, (GHFunc) rb_entry_view_forget_entry_cb, entry);
+
 	g_signal_emit (G_OBJECT (view), rb_entry_view_signals[ENTRY_ADDED], 0, entry);
 	rhythmdb_entry_unref (entry);
 }
 
+static void
+rb_entry_view_entry_prop_changed_cb (RhythmDBQueryModel *model,
+				     RhythmDBEntry *entry,
+				     RhythmDBPropType prop,
+				     const GValue *old,
+				     const GValue *new_value,
+				     RBEntryView *view)
+{
+	rb_entry_view_render_cache_remove (view, prop, entry);
+
+	/* the quality column also depends on the media type */
+	if (prop == RHYTHMDB_PROP_MEDIA_TYPE)
+		rb_entry_view_render_cache_remove (view, RHYTHMDB_PROP_BITRATE, entry);
+}
+
 static void
 rb_entry_view_row_deleted_cb (GtkTreeModel *model,
 			      GtkTreePath *path,
@@ -2168,6 +2200,7 @@ rb_entry_view_row_deleted_cb (GtkTreeModel *model,
 	RhythmDBEntry *entry = rhythmdb_query_model_tree_path_to_entry (RHYTHMDB_QUERY_MODEL (model), path);
 
 	rb_debug ("row deleted");
+	g_hash_table_foreach (view->priv->render_cache, (GHFunc) rb_entry_view_forget_entry_cb, entry);
 	g_signal_emit (G_OBJECT (view), rb_entry_view_signals[ENTRY_DELETED], 0, entry);
 	rhythmdb_entry_unref (entry);
 }
@@ -2487,6 +2520,19 @@ rb_entry_view_grab_focus (GtkWidget *widget)
 	gtk_widget_grab_focus (GTK_WIDGET (view->priv->treeview));
 }
 
+static void
+rb_entry_view_unmap (GtkWidget *widget)
+{
+	RBEntryView *view = RB_ENTRY_VIEW (widget);
+
+	/* the cache only needs to cover what's been drawn since the
+	 * view was last shown, so don't hold on to it while hidden.
+	 */
+	g_hash_table_remove_all (view->priv->render_cache);
+
+	GTK_WIDGET_CLASS (rb_entry_view_parent_class)->unmap (widget);
+}
+
 static gboolean
 rb_entry_view_emit_row_changed (RBEntryView *view,
 				RhythmDBEntry *entry)
@@ -81,6 +81,8 @@ static void rb_header_get_preferred_width (GtkWidget *widget,
 					   int *minimum_size,
 					   int *natural_size);
 static void rb_header_size_allocate (GtkWidget *widget, GtkAllocation *allocation);
+static void rb_header_map (GtkWidget *widget);
+static void rb_header_unmap (GtkWidget *widget);
 static void rb_header_update_elapsed (RBHeader *header);
 static void apply_slider_position (RBHeader *header);
 static gboolean slider_press_callback (GtkWidget *widget, GdkEventButton *event, RBHeader *header);
@@ -129,6 +131,7 @@ struct RBHeaderPrivate
 	gboolean slider_drag_moved;
 	guint slider_moved_timeout;
 	long latest_set_time;
+	guint elapsed_subscription;
 
 	GtkWidget *timebutton;
 	GtkWidget *timelabel;
@@ -165,9 +168,15 @@ enum
 /* unicode graphic characters, encoded in UTF-8 */
 static const char const *UNICODE_MIDDLE_DOT = "\xC2\xB7";
 
+/* how often to update the elapsed time and position slider while visible (ms) */
+#define ELAPSED_UPDATE_INTERVAL	200
+
 #define SCROLL_UP_SEEK_OFFSET	5
 #define SCROLL_DOWN_SEEK_OFFSET -5
 
+/* largest size the album art is shown at, in the image's tooltip */
+#define ART_REQUEST_SIZE	256
+
 G_DEFINE_TYPE (RBHeader, rb_header, GTK_TYPE_GRID)
 
 static void
@@ -186,6 +195,8 @@ rb_header_class_init (RBHeaderClass *klass)
 	widget_class->get_request_mode = rb_header_get_request_mode;
 	widget_class->get_preferred_width = rb_header_get_preferred_width;
 	widget_class->size_allocate = rb_header_size_allocate;
+	widget_class->map = rb_header_map;
+	widget_class->unmap = rb_header_unmap;
 	/* GtkGrid's get_preferred_height_for_width does all we need here */
 
 	/**
@@ -443,6 +454,11 @@ rb_header_dispose (GObject *object)
 	}
 
 	if (header->priv->shell_player != NULL) {
+		if (header->priv->elapsed_subscription != 0) {
+			rb_shell_player_remove_elapsed_subscription (header->priv->shell_player,
+								     header->priv->elapsed_subscription);
+			header->priv->elapsed_subscription = 0;
+		}
 		g_object_unref (header->priv->shell_player);
 		header->priv->shell_player = NULL;
 	}
@@ -542,11 +558,12 @@ rb_header_playing_song_changed_cb (RBShellPlayer *player, RhythmDBEntry *entry,
 		    rhythmdb_entry_matches_ext_db_key (header->priv->db, entry, header->priv->art_key) == FALSE) {
 			rb_fading_image_start (RB_FADING_IMAGE (header->priv->image), 2000);
 			key = rhythmdb_entry_create_ext_db_key (entry, RHYTHMDB_PROP_ALBUM);
-			rb_ext_db_request (header->priv->art_store,
-					   key,
-					   (RBExtDBRequestCallback) art_cb,
-					   g_object_ref (header),
-					   g_object_unref);
+			rb_ext_db_request_sized (header->priv->art_store,
+						 key,
+						 ART_REQUEST_SIZE,
+						 (RBExtDBRequestCallback) art_cb,
+						 g_object_ref (header),
+						 g_object_unref);
 			rb_ext_db_key_free (key);
 		} else {
 			rb_debug ("existing art matches new entry");
@@ -707,6 +724,35 @@ rb_header_size_allocate (GtkWidget *widget, GtkAllocation *allocation)
 	}
 }
 
+static void
+rb_header_map (GtkWidget *widget)
+{
+	RBHeader *header = RB_HEADER (widget);
+
+	GTK_WIDGET_CLASS (rb_header_parent_class)->map (widget);
+
+	/* only ask for frequent position updates while they can be seen */
+	if (header->priv->elapsed_subscription == 0) {
+		header->priv->elapsed_subscription =
+			rb_shell_player_add_elapsed_subscription (header->priv->shell_player,
+								  ELAPSED_UPDATE_INTERVAL);
+	}
+}
+
+static void
+rb_header_unmap (GtkWidget *widget)
+{
+	RBHeader *header = RB_HEADER (widget);
+
+	if (header->priv->elapsed_subscription != 0) {
+		rb_shell_player_remove_elapsed_subscription (header->priv->shell_player,
+							     header->priv->elapsed_subscription);
+		header->priv->elapsed_subscription = 0;
+	}
+
+	GTK_WIDGET_CLASS (rb_header_parent_class)->unmap (widget);
+}
+
 static void
 rb_header_set_property (GObject *object,
 			guint prop_id,
@@ -38,6 +38,7 @@
 #include "rb-library-browser.h"
 #include "rhythmdb-property-model.h"
 #include "rhythmdb-query-model.h"
+#include "rhythmdb-private.h"
 #include "rb-property-view.h"
 #include "rb-debug.h"
 #include "rb-util.h"
@@ -67,6 +68,7 @@ static void update_browser_views_visibility (RBLibraryBrowser *widget);
 typedef struct _RBLibraryBrowserRebuildData RBLibraryBrowserRebuildData;
 
 static void destroy_idle_rebuild_model (RBLibraryBrowserRebuildData *data);
+static void cancel_rebuild (RBLibraryBrowser *widget);
 
 G_DEFINE_TYPE (RBLibraryBrowser, rb_library_browser, GTK_TYPE_BOX)
 #define RB_LIBRARY_BROWSER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), RB_TYPE_LIBRARY_BROWSER, RBLibraryBrowserPrivate))
@@ -89,12 +91,16 @@ G_DEFINE_TYPE (RBLibraryBrowser, rb_library_browser, GTK_TYPE_BOX)
  * When the selection in any of the property views changes, or when
  * #rb_library_browser_reset or #rb_library_browser_set_selection are
  * called to manipulate the selection, the query chain is rebuilt
- * asynchronously to update the property views.
+ * asynchronously to update the property views.  The entries for all
+ * the rebuilt views are filtered in a single pass on a worker thread,
+ * and the new query models are only put in place once that finishes,
+ * so a selection change that arrives in the meantime just restarts it.
  */
 
 struct _RBLibraryBrowserRebuildData
 {
 	RBLibraryBrowser *widget;
+	RBPropertyView *blocked_view;
 	int rebuild_prop_index;
 	int rebuild_idle_id;
 };
@@ -113,6 +119,8 @@ typedef struct
 	GHashTable *selections;
 
 	RBLibraryBrowserRebuildData *rebuild_data;
+	GCancellable *rebuild_cancel;
+	int rebuild_task_index;
 } RBLibraryBrowserPrivate;
 
 enum
@@ -284,6 +292,8 @@ rb_library_browser_dispose (GObject *object)
 		priv->rebuild_data = NULL;
 		g_source_remove (id);
 	}
+
+	cancel_rebuild (RB_LIBRARY_BROWSER (object));
 	
 	if (priv->db != NULL) {
 		g_object_unref (priv->db);
@@ -717,13 +727,324 @@ rebuild_child_model (RBLibraryBrowser *widget,
 	g_object_unref (base_model);
 }
 
+typedef struct {
+	RhythmDB *db;
+	RhythmDBQueryModel *base_model;
+	int rebuild_prop_index;
+
+	/* entries in the base model when the rebuild started, and those
+	 * added to it or changed since then, which the worker thread may
+	 * have missed or filtered using their old values.
+	 */
+	GPtrArray *entries;
+	GHashTable *late_entries;
+	gulong row_inserted_id;
+	gulong entry_changed_id;
+
+	/* for each property view with a selection, the query for its child model,
+	 * a preprocessed copy of it compiled for the worker thread to evaluate,
+	 * and the entries that match it and the selections of all views above it.
+	 */
+	RhythmDBQuery *queries[G_N_ELEMENTS (browser_properties)];
+	RhythmDBQuery *filters[G_N_ELEMENTS (browser_properties)];
+	RhythmDBQueryProgram *programs[G_N_ELEMENTS (browser_properties)];
+	GPtrArray *results[G_N_ELEMENTS (browser_properties)];
+} RBLibraryBrowserFilterData;
+
+static void
+filter_data_free (RBLibraryBrowserFilterData *data)
+{
+	int i;
+
+	g_signal_handler_disconnect (data->base_model, data->row_inserted_id);
+	g_signal_handler_disconnect (data->base_model, data->entry_changed_id);
+	g_object_unref (data->base_model);
+	g_object_unref (data->db);
+
+	for (i = 0; i < num_browser_properties; i++) {
+		if (data->queries[i] != NULL)
+			rhythmdb_query_free (data->queries[i]);
+		if (data->programs[i] != NULL)
+			rhythmdb_query_program_free (data->programs[i]);
+		if (data->filters[i] != NULL)
+			rhythmdb_query_free (data->filters[i]);
+		if (data->results[i] != NULL)
+			g_ptr_array_free (data->results[i], TRUE);
+	}
+
+	g_ptr_array_free (data->entries, TRUE);
+	g_hash_table_destroy (data->late_entries);
+	g_free (data);
+}
+
+static void
+filter_entry (RBLibraryBrowserFilterData *data, RhythmDBEntry *entry)
+{
+	int i;
+
+	/* each view's child model is a subset of the one above it, so
+	 * once the entry fails to match one selection we're done with it.
+	 */
+	for (i = data->rebuild_prop_index; i < num_browser_properties; i++) {
+		if (data->programs[i] == NULL)
+			continue;
+
+		if (rhythmdb_query_program_run (data->programs[i], entry) == FALSE)
+			break;
+
+		g_ptr_array_add (data->results[i], entry);
+	}
+}
+
+static void
+filter_base_row_inserted_cb (GtkTreeModel *model,
+			     GtkTreePath *path,
+			     GtkTreeIter *iter,
+			     RBLibraryBrowserFilterData *data)
+{
+	g_hash_table_add (data->late_entries,
+			  rhythmdb_query_model_iter_to_entry (RHYTHMDB_QUERY_MODEL (model), iter));
+}
+
+static void
+filter_base_entry_changed_cb (RhythmDBQueryModel *model,
+			      RhythmDBEntry *entry,
+			      RhythmDBPropType prop,
+			      const GValue *old,
+			      const GValue *new_value,
+			      RBLibraryBrowserFilterData *data)
+{
+	g_hash_table_add (data->late_entries, rhythmdb_entry_ref (entry));
+}
+
+/* drops entries that have to be filtered again from the worker thread's results */
+static void
+filter_remove_late_entries (RBLibraryBrowserFilterData *data, GPtrArray *results)
+{
+	guint i, j;
+
+	for (i = 0, j = 0; i < results->len; i++) {
+		gpointer entry = g_ptr_array_index (results, i);
+
+		if (g_hash_table_contains (data->late_entries, entry) == FALSE)
+			g_ptr_array_index (results, j++) = entry;
+	}
+	g_ptr_array_set_size (results, j);
+}
+
+static void
+filter_entries_thread (GTask *task,
+		       gpointer source_object,
+		       gpointer task_data,
+		       GCancellable *cancellable)
+{
+	RBLibraryBrowserFilterData *data = task_data;
+	guint i;
+
+	for (i = 0; i < data->entries->len; i++) {
+		if ((i % 1000) == 0 && g_task_return_error_if_cancelled (task))
+			return;
+
+		filter_entry (data, g_ptr_array_index (data->entries, i));
+	}
+
+	g_task_return_boolean (task, TRUE);
+}
+
+static void
+publish_child_models (RBLibraryBrowser *widget,
+		      RBLibraryBrowserFilterData *data)
+{
+	RBLibraryBrowserPrivate *priv = RB_LIBRARY_BROWSER_GET_PRIVATE (widget);
+	RhythmDBPropertyModel *prop_model;
+	RhythmDBQueryModel *base_model, *child_model;
+	RBPropertyView *view;
+	GHashTableIter iter;
+	gpointer entry;
+	int p;
+
+	/* entries added or changed since the rebuild started are filtered
+	 * again here, using their current values.
+	 */
+	if (g_hash_table_size (data->late_entries) > 0) {
+		for (p = data->rebuild_prop_index; p < num_browser_properties; p++) {
+			if (data->results[p] != NULL)
+				filter_remove_late_entries (data, data->results[p]);
+		}
+
+		g_hash_table_iter_init (&iter, data->late_entries);
+		while (g_hash_table_iter_next (&iter, &entry, NULL)) {
+			filter_entry (data, entry);
+		}
+	}
+
+	base_model = g_object_ref (data->base_model);
+	for (p = data->rebuild_prop_index; p < num_browser_properties; p++) {
+		if (data->queries[p] != NULL) {
+			rb_debug ("rebuilding child model for browser %d with %d entries", p, data->results[p]->len);
+			child_model = rhythmdb_query_model_new_empty (priv->db);
+			rhythmdb_query_model_chain (child_model, base_model, FALSE);
+			rhythmdb_query_results_set_query (RHYTHMDB_QUERY_RESULTS (child_model), data->queries[p]);
+		} else {
+			rb_debug ("no selection for browser %d - reusing parent model", p);
+			child_model = g_object_ref (base_model);
+		}
+
+		if (p < num_browser_properties-1) {
+			view = g_hash_table_lookup (priv->property_views, (gpointer)browser_properties[p+1].type);
+			ignore_selection_changes (widget, view, TRUE);
+
+			prop_model = rb_property_view_get_model (view);
+			g_object_set (prop_model, "query-model", child_model, NULL);
+		}
+
+		if (data->queries[p] != NULL) {
+			/* the results are checked against the base model, which drops
+			 * anything removed from it since the rebuild started.  the next
+			 * child model isn't chained to this one yet, so the rows don't
+			 * get filtered again on the way down.
+			 */
+			rhythmdb_query_results_add_results (RHYTHMDB_QUERY_RESULTS (child_model), data->results[p]);
+			data->results[p] = NULL;
+			rhythmdb_query_results_query_complete (RHYTHMDB_QUERY_RESULTS (child_model));
+		}
+
+		g_object_unref (base_model);
+		base_model = child_model;
+	}
+
+	if (priv->output_model != NULL) {
+		g_object_unref (priv->output_model);
+	}
+	priv->output_model = base_model;
+	g_object_notify (G_OBJECT (widget), "output-model");
+
+	for (p = num_browser_properties-1; p > data->rebuild_prop_index; p--) {
+		restore_selection (widget, p, FALSE);
+	}
+}
+
+static void
+filter_entries_done_cb (GObject *source_object,
+			GAsyncResult *result,
+			gpointer user_data)
+{
+	RBLibraryBrowser *widget = RB_LIBRARY_BROWSER (source_object);
+	RBLibraryBrowserPrivate *priv = RB_LIBRARY_BROWSER_GET_PRIVATE (widget);
+	RBLibraryBrowserFilterData *data;
+	GError *error = NULL;
+
+	/* the task data is freed here rather than when the task is, as
+	 * that could happen on the worker thread.
+	 */
+	data = g_task_get_task_data (G_TASK (result));
+	if (g_task_propagate_boolean (G_TASK (result), &error)) {
+		g_clear_object (&priv->rebuild_cancel);
+		publish_child_models (widget, data);
+	} else {
+		rb_debug ("rebuild for browser %d cancelled", data->rebuild_prop_index);
+		g_clear_error (&error);
+	}
+
+	filter_data_free (data);
+}
+
+static void
+cancel_rebuild (RBLibraryBrowser *widget)
+{
+	RBLibraryBrowserPrivate *priv = RB_LIBRARY_BROWSER_GET_PRIVATE (widget);
+
+	if (priv->rebuild_cancel != NULL) {
+		rb_debug ("cancelling rebuild for browser %d", priv->rebuild_task_index);
+		g_cancellable_cancel (priv->rebuild_cancel);
+		g_clear_object (&priv->rebuild_cancel);
+	}
+}
+
+static void
+start_rebuild (RBLibraryBrowser *widget,
+	       gint property_index)
+{
+	RBLibraryBrowserPrivate *priv = RB_LIBRARY_BROWSER_GET_PRIVATE (widget);
+	RBLibraryBrowserFilterData *data;
+	RhythmDBPropertyModel *prop_model;
+	RBPropertyView *view;
+	GtkTreeIter iter;
+	GTask *task;
+	GList *selections;
+	int p;
+
+	g_assert (property_index >= 0);
+	g_assert (property_index < num_browser_properties);
+
+	cancel_rebuild (widget);
+
+	data = g_new0 (RBLibraryBrowserFilterData, 1);
+	data->db = g_object_ref (priv->db);
+	data->rebuild_prop_index = property_index;
+
+	view = g_hash_table_lookup (priv->property_views, (gpointer)browser_properties[property_index].type);
+	prop_model = rb_property_view_get_model (view);
+	g_object_get (prop_model, "query-model", &data->base_model, NULL);
+
+	for (p = property_index; p < num_browser_properties; p++) {
+		selections = g_hash_table_lookup (priv->selections, (gpointer)browser_properties[p].type);
+		if (selections == NULL)
+			continue;
+
+		/* we need the entry type query criteria to allow the
+		 * backend to optimise the query.
+		 */
+		data->queries[p] = rhythmdb_query_parse (priv->db,
+							 RHYTHMDB_QUERY_PROP_EQUALS, RHYTHMDB_PROP_TYPE, priv->entry_type,
+							 RHYTHMDB_QUERY_END);
+		rhythmdb_query_append_prop_multiple (priv->db,
+						     data->queries[p],
+						     browser_properties[p].type,
+						     selections);
+
+		data->filters[p] = rhythmdb_query_copy (data->queries[p]);
+		rhythmdb_query_preprocess (priv->db, data->filters[p]);
+		data->programs[p] = rhythmdb_query_program_compile (priv->db, data->filters[p]);
+		data->results[p] = g_ptr_array_new ();
+	}
+
+	data->entries = g_ptr_array_new_with_free_func ((GDestroyNotify) rhythmdb_entry_unref);
+	if (gtk_tree_model_get_iter_first (GTK_TREE_MODEL (data->base_model), &iter)) {
+		do {
+			g_ptr_array_add (data->entries,
+					 rhythmdb_query_model_iter_to_entry (data->base_model, &iter));
+		} while (gtk_tree_model_iter_next (GTK_TREE_MODEL (data->base_model), &iter));
+	}
+
+	data->late_entries = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						    (GDestroyNotify) rhythmdb_entry_unref, NULL);
+	data->row_inserted_id = g_signal_connect (data->base_model,
+						  "row-inserted",
+						  G_CALLBACK (filter_base_row_inserted_cb),
+						  data);
+	data->entry_changed_id = g_signal_connect (data->base_model,
+						   "entry-prop-changed",
+						   G_CALLBACK (filter_base_entry_changed_cb),
+						   data);
+
+	rb_debug ("filtering %d entries for browsers from %d", data->entries->len, property_index);
+	priv->rebuild_cancel = g_cancellable_new ();
+	priv->rebuild_task_index = property_index;
+
+	task = g_task_new (widget, priv->rebuild_cancel, filter_entries_done_cb, NULL);
+	g_task_set_task_data (task, data, NULL);
+	g_task_run_in_thread (task, filter_entries_thread);
+	g_object_unref (task);
+}
+
 static gboolean
 idle_rebuild_model (RBLibraryBrowserRebuildData *data)
 {
 	RBLibraryBrowserPrivate *priv = RB_LIBRARY_BROWSER_GET_PRIVATE (data->widget);
 
 	priv->rebuild_data = NULL;
-	rebuild_child_model (data->widget, data->rebuild_prop_index, FALSE);
+	start_rebuild (data->widget, data->rebuild_prop_index);
 	return FALSE;
 }
 
@@ -731,13 +1052,9 @@ static void
 destroy_idle_rebuild_model (RBLibraryBrowserRebuildData *data)
 {
 	RBLibraryBrowserPrivate *priv = RB_LIBRARY_BROWSER_GET_PRIVATE (data->widget);
-	RBPropertyView *view;
-	RhythmDBPropType prop_type;
-	
-	prop_type = browser_properties[data->rebuild_prop_index].type;
-	view = g_hash_table_lookup (priv->property_views, (gpointer)prop_type);
-	if (view != NULL) {
-		ignore_selection_changes (data->widget, view, FALSE);
+
+	if (data->blocked_view != NULL) {
+		ignore_selection_changes (data->widget, data->blocked_view, FALSE);
 	}
 
 	priv->rebuild_data = NULL;
@@ -775,6 +1092,14 @@ rb_library_browser_set_selection (RBLibraryBrowser *widget,
 		g_hash_table_remove (priv->selections, (gpointer)type);
 
 	rebuild_index = prop_to_index (type);
+	if (priv->rebuild_cancel != NULL) {
+		/* the running rebuild was given the old selection, so
+		 * start again from wherever it or this one starts.
+		 */
+		rebuild_index = MIN (rebuild_index, priv->rebuild_task_index);
+		cancel_rebuild (widget);
+	}
+
 	if (priv->rebuild_data != NULL) {
 		rebuild_data = priv->rebuild_data;
 		if (rebuild_data->rebuild_prop_index <= rebuild_index) {
@@ -794,6 +1119,7 @@ rb_library_browser_set_selection (RBLibraryBrowser *widget,
 
 	rebuild_data = g_new0 (RBLibraryBrowserRebuildData, 1);
 	rebuild_data->widget = g_object_ref (widget);
+	rebuild_data->blocked_view = view;
 	rebuild_data->rebuild_prop_index = rebuild_index;
 	rebuild_data->rebuild_idle_id =
 		g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
@@ -862,6 +1188,8 @@ rb_library_browser_set_model (RBLibraryBrowser *widget,
 	RBPropertyView *view;
 	RhythmDBPropertyModel *prop_model;
 
+	cancel_rebuild (widget);
+
 	if (priv->input_model != NULL) {
 		g_object_unref (priv->input_model);
 	}